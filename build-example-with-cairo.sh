@@ -27,6 +27,16 @@ mkdir -p gen/bin
 
 # ----
 
+echo "Building gen/bin/iconvg-to-atlas-with-cairo"
+
+${CC:-gcc} -O3 -Wall -std=c99 \
+    -DICONVG_CONFIG__ENABLE_CAIRO_BACKEND \
+    example/iconvg-to-atlas/iconvg-to-atlas.c \
+    -lcairo -lm -lpng -pthread \
+    -o gen/bin/iconvg-to-atlas-with-cairo
+
+# ----
+
 echo "Building gen/bin/iconvg-to-png-with-cairo"
 
 ${CC:-gcc} -O3 -Wall -std=c99 \
@@ -42,5 +52,15 @@ echo "Building gen/bin/iconvg-viewer-with-cairo"
 ${CC:-gcc} -O3 -Wall -std=c99 \
     -DICONVG_CONFIG__ENABLE_CAIRO_BACKEND \
     example/iconvg-viewer/iconvg-viewer.c \
-    -lcairo -lm -lxcb -lxcb-image \
+    -lcairo -lm -lpthread -lxcb -lxcb-image -lxcb-shm \
     -o gen/bin/iconvg-viewer-with-cairo
+
+# ----
+
+echo "Building gen/bin/iconvg-trace-with-cairo"
+
+${CC:-gcc} -O3 -Wall -std=c99 \
+    -DICONVG_CONFIG__ENABLE_CAIRO_BACKEND \
+    example/iconvg-trace/iconvg-trace.c \
+    -lcairo -lm \
+    -o gen/bin/iconvg-trace-with-cairo
@@ -36,6 +36,20 @@ mkdir -p gen/bin
 
 # ----
 
+echo "Building gen/bin/iconvg-to-atlas-with-skia"
+
+${CC:-gcc} -O3 -Wall -std=c99 \
+    -DICONVG_CONFIG__ENABLE_SKIA_BACKEND \
+    -I $SKIA_LIB_DIR/../.. \
+    example/iconvg-to-atlas/iconvg-to-atlas.c \
+    $SKIA_LIB_DIR/libskia.* \
+    -lm -lpng -pthread \
+    -o gen/bin/iconvg-to-atlas-with-skia \
+    -Wl,-rpath \
+    -Wl,$SKIA_LIB_DIR
+
+# ----
+
 echo "Building gen/bin/iconvg-to-png-with-skia"
 
 ${CC:-gcc} -O3 -Wall -std=c99 \
@@ -57,7 +71,21 @@ ${CC:-gcc} -O3 -Wall -std=c99 \
     -I $SKIA_LIB_DIR/../.. \
     example/iconvg-viewer/iconvg-viewer.c \
     $SKIA_LIB_DIR/libskia.* \
-    -lm -lxcb -lxcb-image \
+    -lm -lpthread -lxcb -lxcb-image -lxcb-shm \
     -o gen/bin/iconvg-viewer-with-skia \
     -Wl,-rpath \
     -Wl,$SKIA_LIB_DIR
+
+# ----
+
+echo "Building gen/bin/iconvg-trace-with-skia"
+
+${CC:-gcc} -O3 -Wall -std=c99 \
+    -DICONVG_CONFIG__ENABLE_SKIA_BACKEND \
+    -I $SKIA_LIB_DIR/../.. \
+    example/iconvg-trace/iconvg-trace.c \
+    $SKIA_LIB_DIR/libskia.* \
+    -lm \
+    -o gen/bin/iconvg-trace-with-skia \
+    -Wl,-rpath \
+    -Wl,$SKIA_LIB_DIR
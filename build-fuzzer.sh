@@ -0,0 +1,77 @@
+#!/bin/bash -eu
+# Copyright 2021 The IconVG Authors.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    https://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# ----------------
+
+# This builds:
+#   - gen/bin/iconvg-fuzzer-replay, which runs the fuzz target over the files
+#     (or directories) given as arguments, e.g. "gen/bin/iconvg-fuzzer-replay
+#     test/data". It is an ordinary program, not linked with a fuzzing engine.
+#   - gen/fuzz/iconvg_fuzzer_seed_corpus.zip, the test/data/*.ivg and
+#     fuzz/data/*.ivg files.
+#   - gen/bin/iconvg-fuzzer, a libFuzzer binary, if $LIB_FUZZING_ENGINE is set
+#     (as it is by OSS-Fuzz) or if $CC is clang.
+#
+# Within OSS-Fuzz, set $OUT to also copy the fuzzer and seed corpus there.
+
+if [ ! -e iconvg-root-directory.txt ]; then
+  echo "$0 should be run from the IconVG root directory."
+  exit 1
+fi
+
+mkdir -p gen/bin gen/fuzz
+
+# ----
+
+echo "Building gen/bin/iconvg-fuzzer-replay"
+
+${CC:-gcc} -O3 -Wall -std=c99 \
+    -DICONVG_CONFIG__FUZZLIB_MAIN \
+    fuzz/c/iconvg_fuzzer.c \
+    -lm \
+    -o gen/bin/iconvg-fuzzer-replay
+
+# ----
+
+echo "Building gen/fuzz/iconvg_fuzzer_seed_corpus.zip"
+
+rm -f gen/fuzz/iconvg_fuzzer_seed_corpus.zip
+zip --quiet --junk-paths gen/fuzz/iconvg_fuzzer_seed_corpus.zip \
+    test/data/*.ivg fuzz/data/*.ivg
+
+# ----
+
+if [[ -z ${LIB_FUZZING_ENGINE:-} && ${CC:-gcc} == *clang* ]]; then
+  LIB_FUZZING_ENGINE=-fsanitize=fuzzer
+  CFLAGS="${CFLAGS:--O1 -g -fsanitize=address,undefined}"
+fi
+
+if [[ -n ${LIB_FUZZING_ENGINE:-} ]]; then
+  echo "Building gen/bin/iconvg-fuzzer"
+
+  ${CC} ${CFLAGS:-} -std=c99 \
+      -c fuzz/c/iconvg_fuzzer.c \
+      -o gen/fuzz/iconvg_fuzzer.o
+  ${CXX:-${CC}} ${CXXFLAGS:-${CFLAGS:-}} \
+      gen/fuzz/iconvg_fuzzer.o \
+      ${LIB_FUZZING_ENGINE} \
+      -lm \
+      -o gen/bin/iconvg-fuzzer
+
+  if [[ -n ${OUT:-} ]]; then
+    cp gen/bin/iconvg-fuzzer $OUT/iconvg_fuzzer
+    cp gen/fuzz/iconvg_fuzzer_seed_corpus.zip $OUT/
+  fi
+fi
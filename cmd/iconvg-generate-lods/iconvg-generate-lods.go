@@ -0,0 +1,93 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----------------
+
+// iconvg-generate-lods adds simplified Level of Detail variants to IconVG
+// byte-code, for rendering at small pixel heights.
+//
+// Usage: iconvg-generate-lods -heights=24,48 in.ivg > out.ivg
+//     in.ivg may be omitted, in which case stdin is read.
+//
+// The -heights flag gives the boundaries, in pixels, between LOD bands. The
+// -tolerance flag gives how far, in pixels, simplified geometry may deviate
+// from the original.
+package main
+
+import (
+	"flag"
+	"fmt"
+	"io"
+	"os"
+	"strconv"
+	"strings"
+
+	"github.com/google/iconvg/src/go/lowlevel"
+)
+
+var (
+	heightsFlag   = flag.String("heights", "16,32,64", "comma-separated LOD band boundaries, in pixels")
+	toleranceFlag = flag.Float64("tolerance", lowlevel.DefaultLODTolerance, "maximum deviation, in pixels")
+)
+
+func main() {
+	if err := main1(); err != nil {
+		os.Stderr.WriteString(err.Error() + "\n")
+		os.Exit(1)
+	}
+}
+
+func main1() error {
+	flag.Parse()
+	cmd := "iconvg-generate-lods"
+	if len(os.Args) > 0 {
+		cmd = os.Args[0]
+	}
+
+	opts := &lowlevel.GenerateLODsOptions{
+		Tolerance: float32(*toleranceFlag),
+	}
+	for _, s := range strings.Split(*heightsFlag, ",") {
+		h, err := strconv.ParseFloat(strings.TrimSpace(s), 32)
+		if err != nil {
+			return fmt.Errorf("%s: invalid -heights: %v", cmd, err)
+		}
+		opts.BandHeights = append(opts.BandHeights, float32(h))
+	}
+
+	data := []byte(nil)
+	in := os.Stdin
+	if flag.NArg() > 1 {
+		return fmt.Errorf("Usage: %s -heights=24,48 in.ivg > out.ivg\n"+
+			"    in.ivg may be omitted, in which case stdin is read.", cmd)
+	} else if flag.NArg() == 1 {
+		if f, err := os.Open(flag.Arg(0)); err != nil {
+			return err
+		} else {
+			defer f.Close()
+			in = f
+		}
+	}
+	data, err := io.ReadAll(in)
+	if err != nil {
+		return err
+	}
+
+	generated, err := lowlevel.GenerateLODs(data, opts)
+	if err != nil {
+		return err
+	}
+	_, err = os.Stdout.Write(generated)
+	return err
+}
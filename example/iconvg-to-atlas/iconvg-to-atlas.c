@@ -0,0 +1,790 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----------------
+
+// iconvg-to-atlas rasterizes many IconVG files into one texture atlas (a PNG
+// image) and writes a JSON index of where each icon is in that atlas.
+//
+// See the top-level build-example-etc.sh scripts for build parameters.
+//
+// Usage: iconvg-to-atlas [flags] list.txt atlas.png atlas.json
+//
+// Each non-empty line of list.txt that does not start with '#' is "WxH name"
+// or "S name", where W, H and S are pixel sizes and name is an .ivg filename
+// (which may contain spaces). The same file may be listed multiple times, at
+// different sizes.
+//
+// Flags:
+//   -padding=N  pixels of transparent padding around each icon (default 1)
+//   -threads=N  number of rasterizing threads (default: the number of CPUs)
+//   -width=N    atlas width in pixels (default 4096)
+//
+// Icons are packed with a skyline bottom-left packer, tallest first. Each
+// thread re-uses one backend surface, sized for the largest icon, for every
+// icon it rasterizes.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <png.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// IconVG ships as a "single file C library" or "header file library" as per
+// https://github.com/nothings/stb/blob/master/docs/stb_howto.txt
+//
+// To use that single file as a "foo.c"-like implementation, instead of a
+// "foo.h"-like header, #define ICONVG_IMPLEMENTATION before #include'ing or
+// compiling it.
+#define ICONVG_IMPLEMENTATION
+#include "../../release/c/iconvg-unsupported-snapshot.c"
+
+// SRC_BUFFER_ARRAY_SIZE is the largest size (in bytes) for .ivg files
+// supported by this program. Each thread has its own buffer.
+//
+// This is 1 MiB (1024 * 1024 = 1048576 bytes) by default, but can be
+// configured by compiling with -DSRC_BUFFER_ARRAY_SIZE=etc.
+#ifndef SRC_BUFFER_ARRAY_SIZE
+#define SRC_BUFFER_ARRAY_SIZE 1048576
+#endif
+
+// MAX_DIMENSION bounds the atlas and icon widths and heights. An 0x7FFF =
+// 32767 pixel bound is somewhat arbitrary, but it simplifies any overflow
+// concerns about (width * height * bytes_per_pixel).
+#define MAX_DIMENSION 0x7FFF
+
+#define MAX_THREADS 256
+
+typedef struct {
+  char* name;
+  uint32_t width;
+  uint32_t height;
+  uint32_t x;
+  uint32_t y;
+} icon;
+
+typedef struct {
+  uint8_t* data;
+  size_t stride;
+  size_t height;
+  iconvg_canvas canvas;
+  void* extra0;
+  void* extra1;
+} worker_surface;
+
+icon* g_icons = NULL;
+size_t g_num_icons = 0;
+
+uint8_t* g_atlas = NULL;
+uint32_t g_atlas_width = 4096;
+uint32_t g_atlas_height = 0;
+uint32_t g_padding = 1;
+
+pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+size_t g_next_icon = 0;
+bool g_failed = false;
+
+// ----
+
+#if defined(ICONVG_CONFIG__ENABLE_CAIRO_BACKEND)
+
+#include <cairo/cairo.h>
+
+const char*  //
+initialize_worker_surface(worker_surface* ws, uint32_t width, uint32_t height) {
+  cairo_surface_t* cs =
+      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, (int)width, (int)height);
+  cairo_t* cr = cairo_create(cs);
+  if (cairo_status(cr) != CAIRO_STATUS_SUCCESS) {
+    cairo_destroy(cr);
+    cairo_surface_destroy(cs);
+    return "main: could not create cairo_t";
+  }
+
+  *ws = ((worker_surface){0});
+  ws->canvas = iconvg_make_cairo_canvas(cr);
+  ws->extra0 = cs;
+  ws->extra1 = cr;
+  return NULL;
+}
+
+void  //
+clear_worker_surface(worker_surface* ws) {
+  cairo_t* cr = (cairo_t*)(ws->extra1);
+  cairo_save(cr);
+  cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+  cairo_paint(cr);
+  cairo_restore(cr);
+}
+
+void  //
+flush_worker_surface(worker_surface* ws) {
+  cairo_surface_t* cs = (cairo_surface_t*)(ws->extra0);
+  cairo_surface_flush(cs);
+  ws->data = cairo_image_surface_get_data(cs);
+  ws->stride = (size_t)(cairo_image_surface_get_stride(cs));
+}
+
+void  //
+finalize_worker_surface(worker_surface* ws) {
+  if (ws->extra1) {
+    cairo_destroy((cairo_t*)(ws->extra1));
+    ws->extra1 = NULL;
+  }
+  if (ws->extra0) {
+    cairo_surface_destroy((cairo_surface_t*)(ws->extra0));
+    ws->extra0 = NULL;
+  }
+}
+
+#elif defined(ICONVG_CONFIG__ENABLE_SKIA_BACKEND)
+
+#include "include/c/sk_imageinfo.h"
+#include "include/c/sk_surface.h"
+
+const char*  //
+initialize_worker_surface(worker_surface* ws, uint32_t width, uint32_t height) {
+  uint8_t* data = (uint8_t*)(malloc(4 * ((size_t)width) * ((size_t)height)));
+  if (!data) {
+    return "main: could not allocate worker surface data";
+  }
+
+  sk_imageinfo_t* si =
+      sk_imageinfo_new((int)width, (int)height, BGRA_8888_SK_COLORTYPE,
+                       PREMUL_SK_ALPHATYPE, NULL);
+  if (!si) {
+    free(data);
+    return "main: could not create sk_imageinfo_t";
+  }
+  sk_surface_t* ss = sk_surface_new_raster_direct(si, data, 4 * width, NULL);
+  sk_imageinfo_delete(si);
+  if (!ss) {
+    free(data);
+    return "main: could not create sk_surface_t";
+  }
+  sk_canvas_t* sc = sk_surface_get_canvas(ss);
+  if (!sc) {
+    sk_surface_unref(ss);
+    free(data);
+    return "main: could not create sk_canvas_t";
+  }
+
+  *ws = ((worker_surface){0});
+  ws->data = data;
+  ws->stride = 4 * ((size_t)width);
+  ws->height = height;
+  ws->canvas = iconvg_make_skia_canvas(sc);
+  ws->extra0 = ss;
+  return NULL;
+}
+
+void  //
+clear_worker_surface(worker_surface* ws) {
+  memset(ws->data, 0, ws->stride * ws->height);
+}
+
+void  //
+flush_worker_surface(worker_surface* ws) {}
+
+void  //
+finalize_worker_surface(worker_surface* ws) {
+  if (ws->extra0) {
+    sk_surface_unref((sk_surface_t*)(ws->extra0));
+    ws->extra0 = NULL;
+  }
+  if (ws->data) {
+    free(ws->data);
+    ws->data = NULL;
+  }
+}
+
+#else  //  ICONVG_CONFIG__ETC
+
+const char*  //
+initialize_worker_surface(worker_surface* ws, uint32_t width, uint32_t height) {
+  *ws = ((worker_surface){0});
+  ws->canvas = iconvg_make_broken_canvas("main: no IconVG backend configured");
+  return NULL;
+}
+
+void  //
+clear_worker_surface(worker_surface* ws) {}
+
+void  //
+flush_worker_surface(worker_surface* ws) {}
+
+void  //
+finalize_worker_surface(worker_surface* ws) {}
+
+#endif  //  ICONVG_CONFIG__ETC
+
+// ----
+
+bool  //
+read_file(size_t* dst_num_bytes_read,
+          uint8_t* dst_buffer_ptr,
+          size_t dst_buffer_len,
+          FILE* src_file,
+          const char* src_filename) {
+  if (!dst_num_bytes_read || !src_file || !src_filename) {
+    return false;
+  }
+  *dst_num_bytes_read = 0;
+  uint8_t placeholder[1];
+  uint8_t* ptr = dst_buffer_ptr;
+  size_t len = dst_buffer_len;
+  while (true) {
+    if (!len) {
+      // We have read all that dst can hold. Check that we have read the full
+      // file by trying to read one more byte, which should fail with EOF.
+      ptr = placeholder;
+      len = 1;
+    }
+    size_t n = fread(ptr, 1, len, src_file);
+    if (ptr != placeholder) {
+      ptr += n;
+      len -= n;
+      *dst_num_bytes_read += n;
+    } else if (n) {
+      fprintf(stderr, "main: %s file size (in bytes) is too large\n",
+              src_filename);
+      return false;
+    }
+    if (feof(src_file)) {
+      break;
+    }
+    int err = ferror(src_file);
+    if (!err) {
+      continue;
+    } else if (err == EINTR) {
+      clearerr(src_file);
+      continue;
+    }
+    fprintf(stderr, "main: could not read %s: %s\n", src_filename,
+            strerror(err));
+    return false;
+  }
+  return true;
+}
+
+// ----
+
+bool  //
+read_icon_list(const char* filename) {
+  FILE* f = fopen(filename, "r");
+  if (!f) {
+    fprintf(stderr, "main: could not open %s: %s\n", filename,
+            strerror(errno));
+    return false;
+  }
+  size_t cap = 0;
+  char line[4096];
+  for (int line_number = 1; fgets(line, sizeof(line), f); line_number++) {
+    size_t n = strlen(line);
+    while ((n > 0) && ((line[n - 1] == '\n') || (line[n - 1] == '\r'))) {
+      line[--n] = '\0';
+    }
+    if ((n == 0) || (line[0] == '#')) {
+      continue;
+    }
+
+    unsigned int w = 0;
+    unsigned int h = 0;
+    int name_offset = 0;
+    if (sscanf(line, "%ux%u %n", &w, &h, &name_offset) == 2) {
+      // No-op.
+    } else if (sscanf(line, "%u %n", &w, &name_offset) == 1) {
+      h = w;
+    } else {
+      name_offset = 0;
+    }
+    if ((name_offset == 0) || (line[name_offset] == '\0') || (w == 0) ||
+        (h == 0) || (w > MAX_DIMENSION) || (h > MAX_DIMENSION)) {
+      fprintf(stderr, "main: %s:%d: invalid line\n", filename, line_number);
+      fclose(f);
+      return false;
+    }
+
+    if (g_num_icons == cap) {
+      cap = cap ? (2 * cap) : 256;
+      icon* new_icons = (icon*)(realloc(g_icons, cap * sizeof(icon)));
+      if (!new_icons) {
+        fprintf(stderr, "main: out of memory\n");
+        fclose(f);
+        return false;
+      }
+      g_icons = new_icons;
+    }
+    icon* ic = &g_icons[g_num_icons++];
+    *ic = ((icon){0});
+    ic->name = strdup(&line[name_offset]);
+    ic->width = w;
+    ic->height = h;
+    if (!ic->name) {
+      fprintf(stderr, "main: out of memory\n");
+      fclose(f);
+      return false;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// ----
+
+// skyline_node is a horizontal segment of the packed region's top edge.
+typedef struct {
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+} skyline_node;
+
+int  //
+compare_icons_by_height(const void* p, const void* q) {
+  const icon* a = *((const icon* const*)p);
+  const icon* b = *((const icon* const*)q);
+  if (a->height != b->height) {
+    return (a->height > b->height) ? -1 : +1;
+  } else if (a->width != b->width) {
+    return (a->width > b->width) ? -1 : +1;
+  }
+  return (a < b) ? -1 : +1;
+}
+
+// pack sets each icon's x and y, and sets g_atlas_height. Each icon occupies
+// (width + padding) by (height + padding) pixels, and the atlas has an extra
+// padding-pixel margin at its top and left.
+bool  //
+pack() {
+  icon** order = (icon**)(malloc(g_num_icons * sizeof(icon*)));
+  skyline_node* nodes =
+      (skyline_node*)(malloc((g_num_icons + 1) * sizeof(skyline_node)));
+  if (!order || !nodes) {
+    fprintf(stderr, "main: out of memory\n");
+    free(order);
+    free(nodes);
+    return false;
+  }
+  for (size_t i = 0; i < g_num_icons; i++) {
+    order[i] = &g_icons[i];
+  }
+  qsort(order, g_num_icons, sizeof(icon*), &compare_icons_by_height);
+
+  size_t num_nodes = 1;
+  nodes[0].x = g_padding;
+  nodes[0].y = g_padding;
+  nodes[0].width = g_atlas_width - g_padding;
+  uint64_t max_y = g_padding;
+
+  for (size_t i = 0; i < g_num_icons; i++) {
+    icon* ic = order[i];
+    uint32_t w = ic->width + g_padding;
+    uint32_t h = ic->height + g_padding;
+
+    // Find the lowest position (breaking ties by the narrowest top node) at
+    // which the icon rests on the skyline.
+    size_t best_index = SIZE_MAX;
+    uint32_t best_y = UINT32_MAX;
+    uint32_t best_width = UINT32_MAX;
+    for (size_t j = 0; j < num_nodes; j++) {
+      if ((g_atlas_width - nodes[j].x) < w) {
+        break;
+      }
+      uint32_t y = 0;
+      uint32_t remaining = w;
+      for (size_t k = j; remaining > 0; k++) {
+        if (y < nodes[k].y) {
+          y = nodes[k].y;
+        }
+        remaining -= (remaining < nodes[k].width) ? remaining : nodes[k].width;
+      }
+      if ((y < best_y) || ((y == best_y) && (nodes[j].width < best_width))) {
+        best_index = j;
+        best_y = y;
+        best_width = nodes[j].width;
+      }
+    }
+    if (best_index == SIZE_MAX) {
+      fprintf(stderr, "main: %s is wider than the atlas\n", ic->name);
+      free(order);
+      free(nodes);
+      return false;
+    }
+    ic->x = nodes[best_index].x;
+    ic->y = best_y;
+    if (max_y < (((uint64_t)best_y) + h)) {
+      max_y = ((uint64_t)best_y) + h;
+    }
+    if (max_y > MAX_DIMENSION) {
+      fprintf(stderr, "main: atlas is too tall; try a larger -width\n");
+      free(order);
+      free(nodes);
+      return false;
+    }
+
+    // Insert the icon's top edge as a new node, then shrink or remove the
+    // nodes that it covers.
+    memmove(&nodes[best_index + 1], &nodes[best_index],
+            (num_nodes - best_index) * sizeof(skyline_node));
+    num_nodes++;
+    nodes[best_index].x = ic->x;
+    nodes[best_index].y = best_y + h;
+    nodes[best_index].width = w;
+    uint32_t right = ic->x + w;
+    size_t j = best_index + 1;
+    while ((j < num_nodes) && (nodes[j].x < right)) {
+      uint32_t node_right = nodes[j].x + nodes[j].width;
+      if (node_right <= right) {
+        memmove(&nodes[j], &nodes[j + 1],
+                (num_nodes - j - 1) * sizeof(skyline_node));
+        num_nodes--;
+      } else {
+        nodes[j].width = node_right - right;
+        nodes[j].x = right;
+        break;
+      }
+    }
+
+    // Merge neighboring nodes at the same height.
+    for (j = 0; (j + 1) < num_nodes;) {
+      if (nodes[j].y == nodes[j + 1].y) {
+        nodes[j].width += nodes[j + 1].width;
+        memmove(&nodes[j + 1], &nodes[j + 2],
+                (num_nodes - j - 2) * sizeof(skyline_node));
+        num_nodes--;
+      } else {
+        j++;
+      }
+    }
+  }
+
+  g_atlas_height = (uint32_t)max_y;
+  free(order);
+  free(nodes);
+  return true;
+}
+
+// ----
+
+void*  //
+rasterize(void* arg) {
+  worker_surface* ws = (worker_surface*)arg;
+  uint8_t* src_ptr = (uint8_t*)(malloc(SRC_BUFFER_ARRAY_SIZE));
+  if (!src_ptr) {
+    fprintf(stderr, "main: out of memory\n");
+    pthread_mutex_lock(&g_mutex);
+    g_failed = true;
+    pthread_mutex_unlock(&g_mutex);
+    return NULL;
+  }
+
+  while (true) {
+    pthread_mutex_lock(&g_mutex);
+    size_t i = g_next_icon;
+    bool done = g_failed || (i >= g_num_icons);
+    g_next_icon++;
+    pthread_mutex_unlock(&g_mutex);
+    if (done) {
+      break;
+    }
+    icon* ic = &g_icons[i];
+
+    size_t src_len = 0;
+    FILE* f = fopen(ic->name, "r");
+    if (!f) {
+      fprintf(stderr, "main: could not open %s: %s\n", ic->name,
+              strerror(errno));
+      goto fail;
+    }
+    bool ok = read_file(&src_len, src_ptr, SRC_BUFFER_ARRAY_SIZE, f, ic->name);
+    fclose(f);
+    if (!ok) {
+      goto fail;
+    }
+
+    clear_worker_surface(ws);
+    const char* err_msg = iconvg_decode(
+        &ws->canvas, iconvg_make_rectangle_f32(0, 0, ic->width, ic->height),
+        src_ptr, src_len, NULL);
+    if (err_msg) {
+      fprintf(stderr, "main: could not decode %s\n%s\n", ic->name, err_msg);
+      goto fail;
+    }
+    flush_worker_surface(ws);
+
+    // Each icon has its own region of the atlas, so no locking is needed.
+    for (uint32_t y = 0; y < ic->height; y++) {
+      memcpy(g_atlas + (4 * ((((size_t)(ic->y + y)) * g_atlas_width) + ic->x)),
+             ws->data + (y * ws->stride), 4 * ((size_t)(ic->width)));
+    }
+  }
+
+  free(src_ptr);
+  return NULL;
+
+fail:
+  pthread_mutex_lock(&g_mutex);
+  g_failed = true;
+  pthread_mutex_unlock(&g_mutex);
+  free(src_ptr);
+  return NULL;
+}
+
+// ----
+
+const char*  //
+write_png(FILE* f) {
+  const char* ret = NULL;
+  png_structp png = NULL;
+  png_infop info = NULL;
+  png_byte** rows = NULL;
+
+  {
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png) {
+      ret = "main: png_create_write_struct failed";
+      goto exit;
+    } else if (setjmp(png_jmpbuf(png))) {
+      ret = "main: libpng failed";
+      goto exit;
+    }
+
+    info = png_create_info_struct(png);
+    if (!info) {
+      ret = "main: png_create_info_struct failed";
+      goto exit;
+    }
+
+    rows = malloc(g_atlas_height * sizeof(png_byte*));
+    if (!rows) {
+      ret = "main: out of memory";
+      goto exit;
+    }
+    for (uint32_t i = 0; i < g_atlas_height; i++) {
+      const size_t bytes_per_pixel = 4;
+      rows[i] = g_atlas + (i * bytes_per_pixel * g_atlas_width);
+    }
+    png_init_io(png, f);
+    png_set_IHDR(png, info, g_atlas_width, g_atlas_height, 8,
+                 PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_set_rows(png, info, rows);
+    png_write_png(png, info, PNG_TRANSFORM_BGR, NULL);
+  }
+
+exit:
+  if (rows) {
+    free(rows);
+  }
+  if (png) {
+    png_destroy_write_struct(&png, &info);
+  }
+  return ret;
+}
+
+void  //
+write_json_string(FILE* f, const char* s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)(*s);
+    if ((c == '"') || (c == '\\')) {
+      fprintf(f, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(f, "\\u%04X", c);
+    } else {
+      fputc(c, f);
+    }
+  }
+  fputc('"', f);
+}
+
+// write_json writes the icons, in list.txt order. The u and v texture
+// coordinates are normalized to the atlas size.
+void  //
+write_json(FILE* f) {
+  fprintf(f, "{\n  \"width\": %u,\n  \"height\": %u,\n  \"icons\": [",
+          g_atlas_width, g_atlas_height);
+  for (size_t i = 0; i < g_num_icons; i++) {
+    const icon* ic = &g_icons[i];
+    fprintf(f, "%s\n    {\"name\": ", i ? "," : "");
+    write_json_string(f, ic->name);
+    fprintf(f,
+            ", \"x\": %u, \"y\": %u, \"w\": %u, \"h\": %u, "
+            "\"u0\": %.9g, \"v0\": %.9g, \"u1\": %.9g, \"v1\": %.9g}",
+            ic->x, ic->y, ic->width, ic->height,
+            ((double)(ic->x)) / g_atlas_width,
+            ((double)(ic->y)) / g_atlas_height,
+            ((double)(ic->x + ic->width)) / g_atlas_width,
+            ((double)(ic->y + ic->height)) / g_atlas_height);
+  }
+  fprintf(f, "\n  ]\n}\n");
+}
+
+// ----
+
+bool  //
+parse_flag(const char* arg, const char* name, uint32_t* dst) {
+  size_t n = strlen(name);
+  if (strncmp(arg, name, n) || (arg[n] != '=')) {
+    return false;
+  }
+  char* end = NULL;
+  unsigned long x = strtoul(arg + n + 1, &end, 10);
+  if ((end == (arg + n + 1)) || *end || (x > MAX_DIMENSION)) {
+    return false;
+  }
+  *dst = (uint32_t)x;
+  return true;
+}
+
+int  //
+main(int argc, char** argv) {
+  uint32_t num_threads = 0;
+  {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = (n > 0) ? ((n < MAX_THREADS) ? ((uint32_t)n) : MAX_THREADS)
+                          : 1;
+  }
+
+  int i = 1;
+  for (; (i < argc) && (argv[i][0] == '-'); i++) {
+    if (!parse_flag(argv[i], "-padding", &g_padding) &&
+        !parse_flag(argv[i], "-threads", &num_threads) &&
+        !parse_flag(argv[i], "-width", &g_atlas_width)) {
+      break;
+    }
+  }
+  if (((argc - i) != 3) || (num_threads == 0) ||
+      (num_threads > MAX_THREADS) || (g_atlas_width <= g_padding)) {
+    fprintf(stderr,
+            "Usage: %s [-padding=N] [-threads=N] [-width=N] list.txt "
+            "atlas.png atlas.json\n",
+            argv[0]);
+    return 1;
+  }
+  const char* list_filename = argv[i + 0];
+  const char* png_filename = argv[i + 1];
+  const char* json_filename = argv[i + 2];
+
+  if (!read_icon_list(list_filename) || !pack()) {
+    return 1;
+  }
+
+  // Allocate the (zero-initialized, transparent black) atlas.
+  g_atlas = (uint8_t*)(calloc(4 * ((size_t)g_atlas_width),
+                              g_atlas_height ? g_atlas_height : 1));
+  if (!g_atlas) {
+    fprintf(stderr, "main: could not allocate the atlas\n");
+    return 1;
+  }
+
+  // Rasterize concurrently, with one worker surface per thread.
+  {
+    uint32_t max_width = 1;
+    uint32_t max_height = 1;
+    for (size_t j = 0; j < g_num_icons; j++) {
+      if (max_width < g_icons[j].width) {
+        max_width = g_icons[j].width;
+      }
+      if (max_height < g_icons[j].height) {
+        max_height = g_icons[j].height;
+      }
+    }
+    if (num_threads > g_num_icons) {
+      num_threads = g_num_icons ? ((uint32_t)g_num_icons) : 1;
+    }
+
+    worker_surface surfaces[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    uint32_t num_started = 0;
+    for (; num_started < num_threads; num_started++) {
+      const char* err_msg = initialize_worker_surface(
+          &surfaces[num_started], max_width, max_height);
+      if (err_msg) {
+        fprintf(stderr, "main: could not initialize a worker surface\n%s\n",
+                err_msg);
+        g_failed = true;
+        break;
+      } else if (pthread_create(&threads[num_started], NULL, &rasterize,
+                                &surfaces[num_started])) {
+        fprintf(stderr, "main: could not create a thread\n");
+        finalize_worker_surface(&surfaces[num_started]);
+        g_failed = true;
+        break;
+      }
+    }
+    for (uint32_t j = 0; j < num_started; j++) {
+      pthread_join(threads[j], NULL);
+      finalize_worker_surface(&surfaces[j]);
+    }
+    if (g_failed) {
+      return 1;
+    }
+  }
+
+  // Convert from premultiplied alpha to non-premultiplied alpha.
+  // CAIRO_FORMAT_ARGB32 uses the former, as does Skia with
+  // PREMUL_SK_ALPHATYPE. libpng uses the latter.
+  {
+    const size_t n = ((size_t)g_atlas_width) * ((size_t)g_atlas_height);
+    for (size_t j = 0; j < n; j++) {
+      uint8_t* rgba = g_atlas + (4 * j);
+      if ((rgba[3] != 0x00) && (rgba[3] != 0xFF)) {
+        uint32_t a = rgba[3];
+        rgba[0] = (uint8_t)((rgba[0] * ((uint32_t)0xFF)) / a);
+        rgba[1] = (uint8_t)((rgba[1] * ((uint32_t)0xFF)) / a);
+        rgba[2] = (uint8_t)((rgba[2] * ((uint32_t)0xFF)) / a);
+      }
+    }
+  }
+
+  // Write the PNG and JSON files.
+  {
+    FILE* f = fopen(png_filename, "wb");
+    if (!f) {
+      fprintf(stderr, "main: could not open %s: %s\n", png_filename,
+              strerror(errno));
+      return 1;
+    }
+    const char* err_msg = write_png(f);
+    if (fclose(f) && !err_msg) {
+      err_msg = "main: could not close the PNG file";
+    }
+    if (err_msg) {
+      fprintf(stderr, "main: could not write %s\n%s\n", png_filename, err_msg);
+      return 1;
+    }
+  }
+  {
+    FILE* f = fopen(json_filename, "w");
+    if (!f) {
+      fprintf(stderr, "main: could not open %s: %s\n", json_filename,
+              strerror(errno));
+      return 1;
+    }
+    write_json(f);
+    if (fclose(f)) {
+      fprintf(stderr, "main: could not write %s\n", json_filename);
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -16,10 +16,27 @@
 
 // iconvg-to-png converts from IconVG to PNG (written to stdout).
 //
-// Usage: iconvg-to-png input.ivg > output.png
+// Usage: iconvg-to-png [flags] input.ivg > output.png
 //     If input.ivg is omitted, it reads from stdin.
+//
+// Flags:
+//   -debug         log the IconVG canvas calls to stderr
+//   -filter=NAME   PNG row filter: none, sub, up, avg, paeth or all (default:
+//                  libpng's choice)
+//   -format=NAME   output format: png (default), pam, qoi or raw
+//   -level=N       PNG (zlib) compression level, 0 (fastest) to 9 (smallest)
+//
+// The pam, qoi and raw output formats are uncompressed (or, for QOI, cheaply
+// compressed), for intermediate pipeline steps where deflate would dominate
+// the run time. pam is a Netpbm PAM file with TUPLTYPE RGB_ALPHA. qoi is "The
+// Quite OK Image Format" (https://qoiformat.org/). Both are non-premultiplied
+// RGBA, like PNG. raw is alpha-premultiplied RGBA after a 16-byte header: the
+// 8 bytes "PRGBA32\n" and then the width and height as little-endian uint32
+// values. The rows are tightly packed, so that a memory-mapped raw file's
+// pixels can be used directly.
 
 #include <errno.h>
+#include <inttypes.h>
 #include <png.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -47,6 +64,11 @@
 
 uint8_t g_src_buffer_array[SRC_BUFFER_ARRAY_SIZE];
 
+// g_png_compression_level and g_png_filters are set by the -level and -filter
+// flags. Negative values mean to use libpng's defaults.
+int g_png_compression_level = -1;
+int g_png_filters = -1;
+
 typedef struct {
   uint8_t* data;
   uint32_t width;
@@ -294,8 +316,14 @@ write_png_to_stdout(pixel_buffer* pb) {
     png_set_IHDR(png, info, pb->width, pb->height, 8, PNG_COLOR_TYPE_RGBA,
                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
                  PNG_FILTER_TYPE_DEFAULT);
+    if (g_png_compression_level >= 0) {
+      png_set_compression_level(png, g_png_compression_level);
+    }
+    if (g_png_filters >= 0) {
+      png_set_filter(png, PNG_FILTER_TYPE_BASE, g_png_filters);
+    }
     png_set_rows(png, info, rows);
-    png_write_png(png, info, PNG_TRANSFORM_BGR, NULL);
+    png_write_png(png, info, PNG_TRANSFORM_IDENTITY, NULL);
   }
 
 exit:
@@ -308,38 +336,238 @@ exit:
   return ret;
 }
 
+const char*  //
+write_pam_to_stdout(pixel_buffer* pb) {
+  if (!pb || (pb->width > 0x7FFF) || (pb->height > 0x7FFF)) {
+    return "main: invalid write_pam_to_stdout argument";
+  }
+  size_t n = 4 * ((size_t)pb->width) * ((size_t)pb->height);
+  if ((printf("P7\nWIDTH %" PRIu32 "\nHEIGHT %" PRIu32
+              "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+              pb->width, pb->height) < 0) ||
+      (fwrite(pb->data, 1, n, stdout) != n)) {
+    return "main: could not write to stdout";
+  }
+  return NULL;
+}
+
+const char*  //
+write_raw_to_stdout(pixel_buffer* pb) {
+  if (!pb || (pb->width > 0x7FFF) || (pb->height > 0x7FFF)) {
+    return "main: invalid write_raw_to_stdout argument";
+  }
+  uint8_t header[16] = {'P', 'R', 'G', 'B', 'A', '3', '2', '\n'};
+  for (int i = 0; i < 4; i++) {
+    header[8 + i] = (uint8_t)(pb->width >> (8 * i));
+    header[12 + i] = (uint8_t)(pb->height >> (8 * i));
+  }
+  size_t n = 4 * ((size_t)pb->width) * ((size_t)pb->height);
+  if ((fwrite(header, 1, 16, stdout) != 16) ||
+      (fwrite(pb->data, 1, n, stdout) != n)) {
+    return "main: could not write to stdout";
+  }
+  return NULL;
+}
+
+// write_qoi_to_stdout encodes pb as per the QOI specification
+// (https://qoiformat.org/qoi-specification.pdf).
+const char*  //
+write_qoi_to_stdout(pixel_buffer* pb) {
+  if (!pb || (pb->width > 0x7FFF) || (pb->height > 0x7FFF)) {
+    return "main: invalid write_qoi_to_stdout argument";
+  }
+  size_t num_pixels = ((size_t)pb->width) * ((size_t)pb->height);
+  // The worst case is 5 bytes per pixel (QOI_OP_RGBA), plus a 14-byte header
+  // and an 8-byte end marker.
+  uint8_t* buf = malloc(14 + (5 * num_pixels) + 8);
+  if (!buf) {
+    return "main: could not allocate QOI buffer";
+  }
+  uint8_t* p = buf;
+  *p++ = 'q';
+  *p++ = 'o';
+  *p++ = 'i';
+  *p++ = 'f';
+  for (int i = 3; i >= 0; i--) {
+    *p++ = (uint8_t)(pb->width >> (8 * i));
+  }
+  for (int i = 3; i >= 0; i--) {
+    *p++ = (uint8_t)(pb->height >> (8 * i));
+  }
+  *p++ = 4;  // Channels: RGBA.
+  *p++ = 0;  // Colorspace: sRGB with linear alpha.
+
+  uint8_t index[64][4] = {{0}};
+  uint8_t prev[4] = {0x00, 0x00, 0x00, 0xFF};
+  uint32_t run = 0;
+  const uint8_t* px = pb->data;
+  for (size_t i = 0; i < num_pixels; i++, px += 4) {
+    if (!memcmp(px, prev, 4)) {
+      run++;
+      if ((run == 62) || ((i + 1) == num_pixels)) {
+        *p++ = (uint8_t)(0xC0 | (run - 1));  // QOI_OP_RUN.
+        run = 0;
+      }
+      continue;
+    } else if (run > 0) {
+      *p++ = (uint8_t)(0xC0 | (run - 1));  // QOI_OP_RUN.
+      run = 0;
+    }
+
+    uint32_t h = ((px[0] * 3) + (px[1] * 5) + (px[2] * 7) + (px[3] * 11)) % 64;
+    if (!memcmp(px, index[h], 4)) {
+      *p++ = (uint8_t)h;  // QOI_OP_INDEX.
+    } else {
+      memcpy(index[h], px, 4);
+      if (px[3] == prev[3]) {
+        int32_t dr = (int8_t)(px[0] - prev[0]);
+        int32_t dg = (int8_t)(px[1] - prev[1]);
+        int32_t db = (int8_t)(px[2] - prev[2]);
+        int32_t dr_dg = dr - dg;
+        int32_t db_dg = db - dg;
+        if ((-2 <= dr) && (dr <= 1) && (-2 <= dg) && (dg <= 1) &&
+            (-2 <= db) && (db <= 1)) {
+          // QOI_OP_DIFF.
+          *p++ = (uint8_t)(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+        } else if ((-32 <= dg) && (dg <= 31) && (-8 <= dr_dg) &&
+                   (dr_dg <= 7) && (-8 <= db_dg) && (db_dg <= 7)) {
+          // QOI_OP_LUMA.
+          *p++ = (uint8_t)(0x80 | (dg + 32));
+          *p++ = (uint8_t)(((dr_dg + 8) << 4) | (db_dg + 8));
+        } else {
+          *p++ = 0xFE;  // QOI_OP_RGB.
+          *p++ = px[0];
+          *p++ = px[1];
+          *p++ = px[2];
+        }
+      } else {
+        *p++ = 0xFF;  // QOI_OP_RGBA.
+        *p++ = px[0];
+        *p++ = px[1];
+        *p++ = px[2];
+        *p++ = px[3];
+      }
+    }
+    memcpy(prev, px, 4);
+  }
+  static const uint8_t end_marker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  memcpy(p, end_marker, 8);
+  p += 8;
+
+  size_t n = (size_t)(p - buf);
+  bool ok = fwrite(buf, 1, n, stdout) == n;
+  free(buf);
+  return ok ? NULL : "main: could not write to stdout";
+}
+
 // ----
 
+bool  //
+parse_uint32_flag(const char* arg,
+                  const char* name,
+                  uint32_t* dst,
+                  uint32_t max_value) {
+  size_t n = strlen(name);
+  if (strncmp(arg, name, n) || (arg[n] != '=')) {
+    return false;
+  }
+  char* end = NULL;
+  unsigned long x = strtoul(arg + n + 1, &end, 10);
+  if ((end == (arg + n + 1)) || *end || (x > max_value)) {
+    return false;
+  }
+  *dst = (uint32_t)x;
+  return true;
+}
+
+bool  //
+parse_string_flag(const char* arg, const char* name, const char** dst) {
+  size_t n = strlen(name);
+  if (strncmp(arg, name, n) || (arg[n] != '=')) {
+    return false;
+  }
+  *dst = arg + n + 1;
+  return true;
+}
+
 int  //
 main(int argc, char** argv) {
+  // Parse the flags.
+  bool debug = false;
+  const char* filter = NULL;
+  const char* format = "png";
+  uint32_t level = 0xFFFFFFFF;
+  int i = 1;
+  for (; (i < argc) && (argv[i][0] == '-'); i++) {
+    if (!strcmp(argv[i], "-debug")) {
+      debug = true;
+    } else if (!parse_string_flag(argv[i], "-filter", &filter) &&
+               !parse_string_flag(argv[i], "-format", &format) &&
+               !parse_uint32_flag(argv[i], "-level", &level, 9)) {
+      break;
+    }
+  }
+  bool bad_flag = false;
+  int png_filters = -1;
+  if (!filter) {
+    // No-op.
+  } else if (!strcmp(filter, "none")) {
+    png_filters = PNG_FILTER_NONE;
+  } else if (!strcmp(filter, "sub")) {
+    png_filters = PNG_FILTER_SUB;
+  } else if (!strcmp(filter, "up")) {
+    png_filters = PNG_FILTER_UP;
+  } else if (!strcmp(filter, "avg")) {
+    png_filters = PNG_FILTER_AVG;
+  } else if (!strcmp(filter, "paeth")) {
+    png_filters = PNG_FILTER_PAETH;
+  } else if (!strcmp(filter, "all")) {
+    png_filters = PNG_ALL_FILTERS;
+  } else {
+    bad_flag = true;
+  }
+  const char* (*write_to_stdout)(pixel_buffer * pb) = NULL;
+  if (!strcmp(format, "png")) {
+    write_to_stdout = &write_png_to_stdout;
+  } else if (!strcmp(format, "pam")) {
+    write_to_stdout = &write_pam_to_stdout;
+  } else if (!strcmp(format, "qoi")) {
+    write_to_stdout = &write_qoi_to_stdout;
+  } else if (!strcmp(format, "raw")) {
+    write_to_stdout = &write_raw_to_stdout;
+  } else {
+    bad_flag = true;
+  }
+  if (bad_flag || ((argc - i) > 1)) {
+    fprintf(stderr,
+            "Usage: %s [-debug] [-filter=NAME] [-format=NAME] [-level=N] "
+            "input.ivg > output.png\n"
+            "    If input.ivg is omitted, it reads from stdin.\n",
+            argv[0]);
+    return 1;
+  }
+  g_png_compression_level = (level <= 9) ? ((int)level) : -1;
+  g_png_filters = png_filters;
+
   // Read the input bytes.
   const char* input_filename = NULL;
   uint8_t* src_ptr = &g_src_buffer_array[0];
   size_t src_len = 0;
   {
     FILE* in = NULL;
-    switch (argc) {
-      case 1:
-        input_filename = "<stdin>";
-        in = stdin;
-        break;
-      case 2:
-        input_filename = argv[1];
-        in = fopen(input_filename, "r");
-        if (!in) {
-          fprintf(stderr, "main: could not open %s: %s\n", input_filename,
-                  strerror(errno));
-          return 1;
-        }
-        // No need to explicitly close in later. The program exits (and releases
-        // all file descriptors) when main returns.
-        break;
-      default:
-        fprintf(stderr,
-                "Usage: %s input.ivg > output.png\n"
-                "    If input.ivg is omitted, it reads from stdin.\n",
-                argv[0]);
+    if (i == argc) {
+      input_filename = "<stdin>";
+      in = stdin;
+    } else {
+      input_filename = argv[i];
+      in = fopen(input_filename, "r");
+      if (!in) {
+        fprintf(stderr, "main: could not open %s: %s\n", input_filename,
+                strerror(errno));
         return 1;
+      }
+      // No need to explicitly close in later. The program exits (and releases
+      // all file descriptors) when main returns.
     }
     if (!read_file(&src_len, &g_src_buffer_array[0], SRC_BUFFER_ARRAY_SIZE, in,
                    input_filename)) {
@@ -391,7 +619,7 @@ main(int argc, char** argv) {
     iconvg_canvas debug_canvas = iconvg_make_debug_canvas(
         stderr,
         "debug: ", iconvg_canvas__does_nothing(&pb.canvas) ? NULL : &pb.canvas);
-    if (true) {  // TODO: parse a -debug command line arg.
+    if (debug) {
       c = &debug_canvas;
     }
     const char* err_msg = iconvg_decode(
@@ -413,30 +641,34 @@ main(int argc, char** argv) {
     }
   }
 
-  // Convert from premultiplied alpha to non-premultiplied alpha.
-  // CAIRO_FORMAT_ARGB32 uses the former, as does Skia with
-  // PREMUL_SK_ALPHATYPE. libpng uses the latter.
+  // Convert (in place) from premultiplied BGRA to non-premultiplied RGBA (or,
+  // for the raw output format, premultiplied RGBA). CAIRO_FORMAT_ARGB32 uses
+  // the former (on little-endian systems), as does Skia with
+  // BGRA_8888_SK_COLORTYPE and PREMUL_SK_ALPHATYPE. libpng uses the latter.
   {
-    for (uint32_t y = 0; y < pb.height; y++) {
-      const size_t bytes_per_pixel = 4;
-      uint8_t* row = pb.data + (y * bytes_per_pixel * pb.width);
-      for (uint32_t x = 0; x < pb.width; x++) {
-        uint8_t* rgba = row + (x * bytes_per_pixel);
-        if ((rgba[3] != 0x00) && (rgba[3] != 0xFF)) {
-          uint32_t a = rgba[3];
-          rgba[0] = (uint8_t)((rgba[0] * ((uint32_t)0xFF)) / a);
-          rgba[1] = (uint8_t)((rgba[1] * ((uint32_t)0xFF)) / a);
-          rgba[2] = (uint8_t)((rgba[2] * ((uint32_t)0xFF)) / a);
-        }
-      }
+    const size_t stride = 4 * ((size_t)pb.width);
+    const size_t len = stride * pb.height;
+    const iconvg_pixel_format dst_format =
+        (write_to_stdout == &write_raw_to_stdout)
+            ? ICONVG_PIXEL_FORMAT__RGBA_PREMUL
+            : ICONVG_PIXEL_FORMAT__RGBA_NONPREMUL;
+    const char* err_msg = iconvg_convert_pixels(
+        pb.data, len, stride, dst_format,                         //
+        pb.data, len, stride, ICONVG_PIXEL_FORMAT__BGRA_PREMUL,  //
+        pb.width, pb.height);
+    if (err_msg) {
+      fprintf(stderr, "main: could not convert the pixel buffer\n%s\n",
+              err_msg);
+      return 1;
     }
   }
 
-  // Write the PNG to stdout.
+  // Write the image to stdout.
   {
-    const char* err_msg = write_png_to_stdout(&pb);
+    const char* err_msg = (*write_to_stdout)(&pb);
     if (err_msg) {
-      fprintf(stderr, "main: could not write the PNG to stdout\n%s\n", err_msg);
+      fprintf(stderr, "main: could not write the %s to stdout\n%s\n", format,
+              err_msg);
       return 1;
     }
   }
@@ -0,0 +1,290 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----------------
+
+// iconvg-trace records and replays canvas call traces, for benchmarking a
+// backend (such as Cairo or Skia) without also measuring the IconVG decoder.
+//
+// Usage: iconvg-trace record input.ivg > output.trace
+//        iconvg-trace replay input.trace [iterations]
+//     If input.etc is omitted, it reads from stdin. The record subcommand
+//     decodes at 256x256 pixels. The replay subcommand paints the trace
+//     (repeatedly, 1 iteration by default) onto a 256x256 pixel buffer and
+//     prints timing to stderr.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// IconVG ships as a "single file C library" or "header file library" as per
+// https://github.com/nothings/stb/blob/master/docs/stb_howto.txt
+//
+// To use that single file as a "foo.c"-like implementation, instead of a
+// "foo.h"-like header, #define ICONVG_IMPLEMENTATION before #include'ing or
+// compiling it.
+#define ICONVG_IMPLEMENTATION
+#include "../../release/c/iconvg-unsupported-snapshot.c"
+
+// SRC_BUFFER_ARRAY_SIZE is the largest size (in bytes) for .ivg or trace files
+// supported by this program.
+//
+// This is 64 MiB (64 * 1024 * 1024 = 67108864 bytes) by default, but can be
+// configured by compiling with -DSRC_BUFFER_ARRAY_SIZE=etc.
+#ifndef SRC_BUFFER_ARRAY_SIZE
+#define SRC_BUFFER_ARRAY_SIZE 67108864
+#endif
+
+uint8_t g_src_buffer_array[SRC_BUFFER_ARRAY_SIZE];
+
+#define PIXEL_WIDTH 256
+#define PIXEL_HEIGHT 256
+
+// ----
+
+#if defined(ICONVG_CONFIG__ENABLE_CAIRO_BACKEND)
+
+#include <cairo/cairo.h>
+
+cairo_surface_t* g_cairo_surface = NULL;
+cairo_t* g_cairo = NULL;
+
+const char*  //
+initialize_canvas(iconvg_canvas* c) {
+  g_cairo_surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                               PIXEL_WIDTH, PIXEL_HEIGHT);
+  g_cairo = cairo_create(g_cairo_surface);
+  *c = iconvg_make_cairo_canvas(g_cairo);
+  return NULL;
+}
+
+void  //
+finalize_canvas() {
+  cairo_surface_flush(g_cairo_surface);
+  cairo_destroy(g_cairo);
+  cairo_surface_destroy(g_cairo_surface);
+}
+
+#elif defined(ICONVG_CONFIG__ENABLE_SKIA_BACKEND)
+
+#include "include/c/sk_imageinfo.h"
+#include "include/c/sk_surface.h"
+
+uint8_t g_skia_pixels[4 * PIXEL_WIDTH * PIXEL_HEIGHT];
+sk_surface_t* g_skia_surface = NULL;
+
+const char*  //
+initialize_canvas(iconvg_canvas* c) {
+  sk_imageinfo_t* si =
+      sk_imageinfo_new(PIXEL_WIDTH, PIXEL_HEIGHT, BGRA_8888_SK_COLORTYPE,
+                       PREMUL_SK_ALPHATYPE, NULL);
+  if (!si) {
+    return "main: could not create sk_imageinfo_t";
+  }
+  g_skia_surface = sk_surface_new_raster_direct(si, &g_skia_pixels[0],
+                                                4 * PIXEL_WIDTH, NULL);
+  sk_imageinfo_delete(si);
+  if (!g_skia_surface) {
+    return "main: could not create sk_surface_t";
+  }
+  sk_canvas_t* sc = sk_surface_get_canvas(g_skia_surface);
+  if (!sc) {
+    return "main: could not create sk_canvas_t";
+  }
+  *c = iconvg_make_skia_canvas(sc);
+  return NULL;
+}
+
+void  //
+finalize_canvas() {
+  sk_surface_unref(g_skia_surface);
+}
+
+#else  //  ICONVG_CONFIG__ETC
+
+// With no backend configured, replaying measures only the replay overhead.
+
+const char*  //
+initialize_canvas(iconvg_canvas* c) {
+  *c = iconvg_make_broken_canvas(NULL);
+  return NULL;
+}
+
+void  //
+finalize_canvas() {}
+
+#endif  //  ICONVG_CONFIG__ETC
+
+// ----
+
+bool  //
+read_file(size_t* dst_num_bytes_read,
+          uint8_t* dst_buffer_ptr,
+          size_t dst_buffer_len,
+          FILE* src_file,
+          const char* src_filename) {
+  if (!dst_num_bytes_read || !src_file || !src_filename) {
+    return false;
+  }
+  *dst_num_bytes_read = 0;
+  uint8_t placeholder[1];
+  uint8_t* ptr = dst_buffer_ptr;
+  size_t len = dst_buffer_len;
+  while (true) {
+    if (!len) {
+      // We have read all that dst can hold. Check that we have read the full
+      // file by trying to read one more byte, which should fail with EOF.
+      ptr = placeholder;
+      len = 1;
+    }
+    size_t n = fread(ptr, 1, len, src_file);
+    if (ptr != placeholder) {
+      ptr += n;
+      len -= n;
+      *dst_num_bytes_read += n;
+    } else if (n) {
+      fprintf(stderr, "main: %s file size (in bytes) is too large\n",
+              src_filename);
+      return false;
+    }
+    if (feof(src_file)) {
+      break;
+    }
+    int err = ferror(src_file);
+    if (!err) {
+      continue;
+    } else if (err == EINTR) {
+      clearerr(src_file);
+      continue;
+    }
+    fprintf(stderr, "main: could not read %s: %s\n", src_filename,
+            strerror(err));
+    return false;
+  }
+  return true;
+}
+
+// ----
+
+int  //
+record(const char* input_filename, const uint8_t* src_ptr, size_t src_len) {
+  iconvg_growable_buffer trace = {0};
+  trace.grow = &iconvg_growable_buffer__realloc_grow;
+  iconvg_canvas c = iconvg_make_trace_canvas(&trace, NULL);
+  const char* err_msg = iconvg_decode(
+      &c, iconvg_make_rectangle_f32(0, 0, PIXEL_WIDTH, PIXEL_HEIGHT), src_ptr,
+      src_len, NULL);
+  if (err_msg) {
+    fprintf(stderr, "main: could not decode %s\n%s\n", input_filename,
+            err_msg);
+    free(trace.ptr);
+    return 1;
+  }
+  if (fwrite(trace.ptr, 1, trace.len, stdout) != trace.len) {
+    fprintf(stderr, "main: could not write the trace to stdout\n");
+    free(trace.ptr);
+    return 1;
+  }
+  free(trace.ptr);
+  return 0;
+}
+
+int  //
+replay(const char* input_filename,
+       const uint8_t* src_ptr,
+       size_t src_len,
+       long iterations) {
+  iconvg_canvas c = {0};
+  {
+    const char* err_msg = initialize_canvas(&c);
+    if (err_msg) {
+      fprintf(stderr, "main: could not initialize the canvas\n%s\n", err_msg);
+      return 1;
+    }
+  }
+
+  clock_t start = clock();
+  for (long i = 0; i < iterations; i++) {
+    const char* err_msg = iconvg_replay_trace(&c, src_ptr, src_len);
+    if (err_msg) {
+      fprintf(stderr, "main: could not replay %s\n%s\n", input_filename,
+              err_msg);
+      finalize_canvas();
+      return 1;
+    }
+  }
+  double seconds = ((double)(clock() - start)) / CLOCKS_PER_SEC;
+  finalize_canvas();
+
+  fprintf(stderr, "%ld iterations in %.3f s: %.3f microseconds each\n",
+          iterations, seconds, (seconds * 1e6) / ((double)iterations));
+  return 0;
+}
+
+// ----
+
+int  //
+main(int argc, char** argv) {
+  const char* subcommand = (argc > 1) ? argv[1] : "";
+  bool is_record = !strcmp(subcommand, "record");
+  bool is_replay = !strcmp(subcommand, "replay");
+  long iterations = 1;
+  if (is_replay && (argc == 4)) {
+    iterations = strtol(argv[3], NULL, 10);
+  }
+  if ((!is_record && !is_replay) || (argc > (is_replay ? 4 : 3)) ||
+      (iterations <= 0)) {
+    fprintf(stderr,
+            "Usage: %s record input.ivg > output.trace\n"
+            "       %s replay input.trace [iterations]\n"
+            "    If input.etc is omitted, it reads from stdin.\n",
+            argv[0], argv[0]);
+    return 1;
+  }
+
+  // Read the input bytes.
+  const char* input_filename = NULL;
+  uint8_t* src_ptr = &g_src_buffer_array[0];
+  size_t src_len = 0;
+  {
+    FILE* in = NULL;
+    if (argc < 3) {
+      input_filename = "<stdin>";
+      in = stdin;
+    } else {
+      input_filename = argv[2];
+      in = fopen(input_filename, "r");
+      if (!in) {
+        fprintf(stderr, "main: could not open %s: %s\n", input_filename,
+                strerror(errno));
+        return 1;
+      }
+      // No need to explicitly close in later. The program exits (and releases
+      // all file descriptors) when main returns.
+    }
+    if (!read_file(&src_len, &g_src_buffer_array[0], SRC_BUFFER_ARRAY_SIZE, in,
+                   input_filename)) {
+      return 1;
+    }
+  }
+
+  if (is_record) {
+    return record(input_filename, src_ptr, src_len);
+  }
+  return replay(input_filename, src_ptr, src_len, iterations);
+}
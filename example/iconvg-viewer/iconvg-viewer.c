@@ -30,6 +30,14 @@
 // The , and . keys cycle through background checkerboard colors.
 //
 // The Escape key quits.
+//
+// Rendering happens on a separate thread, so that the GUI stays responsive.
+// Pending re-renders are coalesced: resizing the window renders only at the
+// latest size. The previous and next files are loaded in the background.
+//
+// On Linux, if the X server supports the MIT-SHM extension (and is local), the
+// pixels are rendered directly into memory shared with the X server, instead
+// of being copied through the X socket.
 
 #include <errno.h>
 #include <stdbool.h>
@@ -55,8 +63,12 @@
 #ifndef SRC_BUFFER_ARRAY_SIZE
 #define SRC_BUFFER_ARRAY_SIZE 1048576
 #endif
-uint8_t g_src_buffer_array[SRC_BUFFER_ARRAY_SIZE];
-size_t g_src_len = 0;
+
+// NUM_LOADED_FILES is how many .ivg files are held in memory at once: the one
+// being viewed and its previous and next neighbors, prefetched in the
+// background so that cycling through the files does not wait on file I/O.
+#define NUM_LOADED_FILES 3
+uint8_t g_src_buffer_arrays[NUM_LOADED_FILES][SRC_BUFFER_ARRAY_SIZE];
 
 // g_background_colors' 6 elements are two checkerboard colors: [R0, G0, B0,
 // R1, G1, B1].
@@ -77,6 +89,13 @@ typedef struct {
   void* extra1;
 } pixel_buffer;
 
+// Each backend's initialize_pixel_buffer renders into the given data, which
+// holds (4 * width * height) bytes, if it is non-NULL. Otherwise, the backend
+// allocates its own memory.
+//
+// A pixel_buffer can be re-used for multiple frames (of the same dimensions).
+// Each frame starts with clear_pixel_buffer, which draws the background.
+
 // ----
 
 #if defined(ICONVG_CONFIG__ENABLE_CAIRO_BACKEND)
@@ -84,14 +103,21 @@ typedef struct {
 #include <cairo/cairo.h>
 
 const char*  //
-initialize_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
+initialize_pixel_buffer(pixel_buffer* pb,
+                        uint8_t* data,
+                        uint32_t width,
+                        uint32_t height) {
   if (!pb) {
     return "main: NULL pixel_buffer";
   } else if ((width > 0x7FFF) || (height > 0x7FFF)) {
     return "main: dimensions are too large";
   }
   cairo_surface_t* cs =
-      cairo_image_surface_create(CAIRO_FORMAT_ARGB32, (int)width, (int)height);
+      data ? cairo_image_surface_create_for_data(
+                 data, CAIRO_FORMAT_ARGB32, (int)width, (int)height,
+                 (int)(4 * width))
+           : cairo_image_surface_create(CAIRO_FORMAT_ARGB32, (int)width,
+                                        (int)height);
   cairo_status_t cs_status = cairo_surface_status(cs);
   if (cs_status != CAIRO_STATUS_SUCCESS) {
     cairo_surface_destroy(cs);
@@ -105,9 +131,29 @@ initialize_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
     return cairo_status_to_string(cr_status);
   }
 
+  *pb = ((pixel_buffer){0});
+  pb->data = cairo_image_surface_get_data(cs);
+  pb->width = width;
+  pb->height = height;
+  pb->canvas = iconvg_make_cairo_canvas(cr);
+  pb->extra0 = cs;
+  pb->extra1 = cr;
+  return NULL;
+}
+
+const char*  //
+clear_pixel_buffer(pixel_buffer* pb) {
+  if (!pb) {
+    return "main: NULL pixel_buffer";
+  }
+  cairo_t* cr = (cairo_t*)(pb->extra1);
+  if (!cr) {
+    return "main: NULL cairo_t";
+  }
+
   // Draw the checkerboard background.
-  for (uint32_t y = 0; y < height; y += 64) {
-    for (uint32_t x = 0; x < width; x += 64) {
+  for (uint32_t y = 0; y < pb->height; y += 64) {
+    for (uint32_t x = 0; x < pb->width; x += 64) {
       uint32_t xor = ((x ^ y) >> 6) & 1;
       uint32_t base = 3 * xor;
       cairo_set_source_rgb(
@@ -119,16 +165,11 @@ initialize_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
       cairo_fill(cr);
     }
   }
-
-  *pb = ((pixel_buffer){0});
-  pb->canvas = iconvg_make_cairo_canvas(cr);
-  pb->extra0 = cs;
-  pb->extra1 = cr;
   return NULL;
 }
 
 const char*  //
-flush_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
+flush_pixel_buffer(pixel_buffer* pb) {
   if (!pb) {
     return "main: NULL pixel_buffer";
   }
@@ -137,9 +178,6 @@ flush_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
     return "main: NULL cairo_surface_t";
   }
   cairo_surface_flush(cs);
-  pb->data = cairo_image_surface_get_data(cs);
-  pb->width = width;
-  pb->height = height;
   return NULL;
 }
 
@@ -165,38 +203,67 @@ finalize_pixel_buffer(pixel_buffer* pb) {
 #include "include/c/sk_surface.h"
 
 const char*  //
-initialize_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
+initialize_pixel_buffer(pixel_buffer* pb,
+                        uint8_t* data,
+                        uint32_t width,
+                        uint32_t height) {
   if (!pb) {
     return "main: NULL pixel_buffer";
   } else if ((width > 0x7FFF) || (height > 0x7FFF)) {
     return "main: dimensions are too large";
   }
 
-  uint8_t* data = (uint8_t*)(malloc(4 * width * height));
+  uint8_t* owned = NULL;
   if (!data) {
-    return "main: could not allocate pixel buffer data";
+    owned = (uint8_t*)(malloc(4 * width * height));
+    if (!owned) {
+      return "main: could not allocate pixel buffer data";
+    }
+    data = owned;
   }
 
   sk_imageinfo_t* si =
       sk_imageinfo_new((int)width, (int)height, BGRA_8888_SK_COLORTYPE,
                        PREMUL_SK_ALPHATYPE, NULL);
   if (!si) {
-    free(data);
+    free(owned);
     return "main: could not create sk_imageinfo_t";
   }
   sk_surface_t* ss = sk_surface_new_raster_direct(si, data, 4 * width, NULL);
   sk_imageinfo_delete(si);
   if (!ss) {
-    free(data);
+    free(owned);
     return "main: could not create sk_surface_t";
   }
   sk_canvas_t* sc = sk_surface_get_canvas(ss);
   if (!sc) {
     sk_surface_unref(ss);
-    free(data);
+    free(owned);
     return "main: could not create sk_canvas_t";
   }
 
+  *pb = ((pixel_buffer){0});
+  pb->data = data;
+  pb->width = width;
+  pb->height = height;
+  pb->canvas = iconvg_make_skia_canvas(sc);
+  pb->extra0 = ss;
+  pb->extra1 = owned;
+  return NULL;
+}
+
+const char*  //
+clear_pixel_buffer(pixel_buffer* pb) {
+  if (!pb) {
+    return "main: NULL pixel_buffer";
+  } else if (!pb->extra0) {
+    return "main: NULL sk_surface_t";
+  }
+  sk_canvas_t* sc = sk_surface_get_canvas((sk_surface_t*)(pb->extra0));
+  if (!sc) {
+    return "main: could not get sk_canvas_t";
+  }
+
   // Draw the checkerboard background.
   sk_color_t background_colors[2];
   background_colors[0] = sk_color_set_argb(
@@ -211,8 +278,8 @@ initialize_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
       ((uint8_t)(0xFF * g_background_colors[g_background_color_index][5])));
   sk_paint_t* sp = sk_paint_new();
   sk_paint_set_xfermode_mode(sp, SRC_SK_XFERMODE_MODE);
-  for (uint32_t y = 0; y < height; y += 64) {
-    for (uint32_t x = 0; x < width; x += 64) {
+  for (uint32_t y = 0; y < pb->height; y += 64) {
+    for (uint32_t x = 0; x < pb->width; x += 64) {
       uint32_t xor = ((x ^ y) >> 6) & 1;
       sk_rect_t rect;
       rect.left = x;
@@ -224,18 +291,11 @@ initialize_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
     }
   }
   sk_paint_delete(sp);
-
-  *pb = ((pixel_buffer){0});
-  pb->data = data;
-  pb->width = width;
-  pb->height = height;
-  pb->canvas = iconvg_make_skia_canvas(sc);
-  pb->extra0 = ss;
   return NULL;
 }
 
 const char*  //
-flush_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
+flush_pixel_buffer(pixel_buffer* pb) {
   if (!pb) {
     return "main: NULL pixel_buffer";
   }
@@ -251,27 +311,38 @@ finalize_pixel_buffer(pixel_buffer* pb) {
     sk_surface_unref((sk_surface_t*)(pb->extra0));
     pb->extra0 = NULL;
   }
-  if (pb->data) {
-    free(pb->data);
-    pb->data = NULL;
+  if (pb->extra1) {
+    free(pb->extra1);
+    pb->extra1 = NULL;
   }
+  pb->data = NULL;
   return NULL;
 }
 
 #else  //  ICONVG_CONFIG__ETC
 
 const char*  //
-initialize_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
+initialize_pixel_buffer(pixel_buffer* pb,
+                        uint8_t* data,
+                        uint32_t width,
+                        uint32_t height) {
   if (!pb) {
     return "main: NULL pixel_buffer";
   }
   *pb = ((pixel_buffer){0});
+  pb->width = width;
+  pb->height = height;
   pb->canvas = iconvg_make_broken_canvas("main: no IconVG backend configured");
   return NULL;
 }
 
 const char*  //
-flush_pixel_buffer(pixel_buffer* pb, uint32_t width, uint32_t height) {
+clear_pixel_buffer(pixel_buffer* pb) {
+  return NULL;
+}
+
+const char*  //
+flush_pixel_buffer(pixel_buffer* pb) {
   return "main: no IconVG backend configured";
 }
 
@@ -329,52 +400,112 @@ read_file(size_t* dst_num_bytes_read,
   return true;
 }
 
-bool  //
-load(const char* filename) {
+// loaded_file is an .ivg file's contents (and its pre-decoded ViewBox) held
+// in one of the g_src_buffer_arrays. Files are identified by their index into
+// the command line arguments.
+typedef struct {
+  int arg;  // Zero means that the slot is empty.
+  bool ok;
+  const char* filename;
+  uint8_t* src_ptr;
+  size_t src_len;
+  iconvg_rectangle_f32 viewbox;
+} loaded_file;
+
+loaded_file g_loaded_files[NUM_LOADED_FILES] = {0};
+
+// arg_distance is how many Space or BackSpace key presses separate the two
+// command line arguments i and j, out of num_args (cycling around).
+int  //
+arg_distance(int i, int j, int num_args) {
+  int d = (i < j) ? (j - i) : (i - j);
+  return (d < (num_args - d)) ? d : (num_args - d);
+}
+
+// load returns the loaded_file for the arg'th command line argument, reading
+// the file if it is not already loaded. If it has to evict another file, it
+// picks the one furthest from current_arg, which is the one being viewed (or
+// about to be viewed).
+loaded_file*  //
+load(int arg, const char* filename, int current_arg, int num_args) {
   if (!filename) {
-    return false;
+    return NULL;
+  }
+  loaded_file* lf = NULL;
+  int lf_distance = -1;
+  for (int i = 0; i < NUM_LOADED_FILES; i++) {
+    loaded_file* o = &g_loaded_files[i];
+    if (o->arg == arg) {
+      return o;
+    }
+    int d = o->arg ? arg_distance(o->arg, current_arg, num_args) : num_args;
+    if (lf_distance < d) {
+      lf = o;
+      lf_distance = d;
+    }
   }
+
+  *lf = ((loaded_file){0});
+  lf->arg = arg;
+  lf->filename = filename;
+  lf->src_ptr = &g_src_buffer_arrays[lf - &g_loaded_files[0]][0];
   FILE* f = fopen(filename, "r");
   if (f == NULL) {
     printf("%s: main: could not open file\n", filename);
-    return false;
+    return lf;
   }
-  g_src_len = 0;
-  bool ret = read_file(&g_src_len, &g_src_buffer_array[0],
-                       SRC_BUFFER_ARRAY_SIZE, f, filename);
+  bool ok = read_file(&lf->src_len, lf->src_ptr, SRC_BUFFER_ARRAY_SIZE, f,
+                      filename);
   fclose(f);
-  return ret;
+  if (!ok) {
+    return lf;
+  }
+
+  // Decode the IconVG viewbox.
+  const char* err_msg =
+      iconvg_decode_viewbox(&lf->viewbox, lf->src_ptr, lf->src_len);
+  if (err_msg) {
+    printf("%s: iconvg_decode_viewbox: %s\n", filename, err_msg);
+    return lf;
+  }
+  lf->ok = true;
+  return lf;
 }
 
 // ----
 
+// g_pixel_buffer is re-used from one render call to the next, as long as the
+// window dimensions, and the OS-provided memory that it renders into (which
+// may be NULL), are unchanged.
+pixel_buffer g_pixel_buffer = {0};
+uint8_t* g_pixel_buffer_os_data = NULL;
+bool g_pixel_buffer_valid = false;
+
 bool  //
 render(void* ctx,
        uint32_t window_width,
        uint32_t window_height,
-       const char* filename,
+       const loaded_file* lf,
+       uint8_t* (*acquire_pixel_data)(void* ctx,
+                                      uint32_t width,
+                                      uint32_t height),
        const char* (*upload_pixel_buffer)(void* ctx, pixel_buffer* pb)) {
-  if (!filename) {
+  if (!lf || !lf->ok) {
     return false;
   }
-  uint8_t const* src_ptr = &g_src_buffer_array[0];
-  const size_t src_len = g_src_len;
+  const char* filename = lf->filename;
+  uint8_t const* src_ptr = lf->src_ptr;
+  const size_t src_len = lf->src_len;
 
-  // Decode the IconVG viewbox.
+  // Fit the IconVG viewbox to the window.
   double vw = 0.0;
   double vh = 0.0;
   iconvg_rectangle_f32 dst_rect = {0};
   {
-    iconvg_rectangle_f32 viewbox = {0};
-    const char* err_msg = iconvg_decode_viewbox(&viewbox, src_ptr, src_len);
-    if (err_msg) {
-      printf("%s: iconvg_decode_viewbox: %s\n", filename, err_msg);
-      return false;
-    }
     int32_t dr_width = 0;
     int32_t dr_height = 0;
-    vw = iconvg_rectangle_f32__width_f64(&viewbox);
-    vh = iconvg_rectangle_f32__height_f64(&viewbox);
+    vw = iconvg_rectangle_f32__width_f64(&lf->viewbox);
+    vh = iconvg_rectangle_f32__height_f64(&lf->viewbox);
     if ((vw <= 0) || (vh <= 0)) {
       dr_width = 1;
       dr_height = 1;
@@ -404,21 +535,45 @@ render(void* ctx,
                                          min_y + dr_height);  //
   }
 
-  // Initialize the pixel buffer.
-  pixel_buffer pb = {0};
+  // Initialize (or re-use) the pixel buffer, rendering into OS-provided
+  // memory if available (acquire_pixel_data may be NULL or return NULL).
+  pixel_buffer* pb = &g_pixel_buffer;
   {
-    const char* err_msg =
-        initialize_pixel_buffer(&pb, window_width, window_height);
+    uint8_t* data =
+        acquire_pixel_data
+            ? (*acquire_pixel_data)(ctx, window_width, window_height)
+            : NULL;
+    if (g_pixel_buffer_valid &&
+        ((pb->width != window_width) || (pb->height != window_height) ||
+         (g_pixel_buffer_os_data != data))) {
+      finalize_pixel_buffer(pb);
+      g_pixel_buffer_valid = false;
+    }
+    if (!g_pixel_buffer_valid) {
+      const char* err_msg =
+          initialize_pixel_buffer(pb, data, window_width, window_height);
+      if (err_msg) {
+        printf("%s: initialize_pixel_buffer: %s\n", filename, err_msg);
+        return false;
+      }
+      g_pixel_buffer_os_data = data;
+      g_pixel_buffer_valid = true;
+    }
+  }
+
+  // Draw the background.
+  {
+    const char* err_msg = clear_pixel_buffer(pb);
     if (err_msg) {
-      printf("%s: initialize_pixel_buffer: %s\n", filename, err_msg);
-      return false;
+      printf("%s: clear_pixel_buffer: %s\n", filename, err_msg);
+      goto clean_up_and_fail;
     }
   }
 
   // Decode the IconVG.
   if ((vw > 0.0) && (vh > 0.0)) {
     const char* err_msg =
-        iconvg_decode(&pb.canvas, dst_rect, src_ptr, src_len, NULL);
+        iconvg_decode(&pb->canvas, dst_rect, src_ptr, src_len, NULL);
     if (err_msg) {
       printf("%s: iconvg_decode: %s\n", filename, err_msg);
       goto clean_up_and_fail;
@@ -427,7 +582,7 @@ render(void* ctx,
 
   // Flush the backend-specific drawing ops to the pixel buffer.
   {
-    const char* err_msg = flush_pixel_buffer(&pb, window_width, window_height);
+    const char* err_msg = flush_pixel_buffer(pb);
     if (err_msg) {
       printf("%s: flush_pixel_buffer: %s\n", filename, err_msg);
       goto clean_up_and_fail;
@@ -436,26 +591,18 @@ render(void* ctx,
 
   // Upload the pixel buffer to the screen, in an OS-specific way.
   {
-    const char* err_msg = (*upload_pixel_buffer)(ctx, &pb);
+    const char* err_msg = (*upload_pixel_buffer)(ctx, pb);
     if (err_msg) {
       printf("%s: upload_pixel_buffer: %s\n", filename, err_msg);
       goto clean_up_and_fail;
     }
   }
 
-  // Finalize the pixel buffer.
-  {
-    const char* err_msg = finalize_pixel_buffer(&pb);
-    if (err_msg) {
-      printf("%s: finalize_pixel_buffer: %s\n", filename, err_msg);
-      return false;
-    }
-  }
-
   printf("%s: ok (%g x %g)\n", filename, vw, vh);
   return true;
 clean_up_and_fail:
-  finalize_pixel_buffer(&pb);
+  finalize_pixel_buffer(pb);
+  g_pixel_buffer_valid = false;
   return false;
 }
 
@@ -464,6 +611,10 @@ clean_up_and_fail:
 #if defined(__linux__)
 #define SUPPORTED_OPERATING_SYSTEM
 
+#include <pthread.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/shm.h>
 #include <xcb/xcb.h>
 #include <xcb/xcb_image.h>
 
@@ -481,6 +632,34 @@ uint32_t g_pixmap_height = 0;
 xcb_keysym_t* g_keysyms = NULL;
 xcb_get_keyboard_mapping_reply_t* g_keyboard_mapping = NULL;
 
+// render_request is what the main (event loop) thread asks the render thread
+// to draw. A request that has not been picked up yet is simply overwritten by
+// a newer one, so that e.g. a burst of resize events while dragging the
+// window's edge leads to a single re-render, at the latest size.
+typedef struct {
+  bool pending;
+  int arg;
+  uint32_t width;
+  uint32_t height;
+  uint32_t background_color_index;
+} render_request;
+
+// g_mutex guards g_request and g_pixmap_etc, which are shared by the main and
+// render threads. g_cond signals that g_request.pending was set.
+pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+render_request g_request = {0};
+
+// g_shm_etc describe the MIT-SHM segment, shared with the X server, that the
+// pixel buffer is rendered into. g_shm_available is false if the X server does
+// not support MIT-SHM (or we could not attach a segment, e.g. the X server is
+// on another machine), in which case upload_pixel_buffer falls back to
+// xcb_image_put.
+bool g_shm_available = false;
+xcb_shm_seg_t g_shm_seg = XCB_NONE;
+uint8_t* g_shm_ptr = NULL;
+size_t g_shm_len = 0;
+
 void  //
 init_keymap(xcb_connection_t* c, const xcb_setup_t* z) {
   xcb_get_keyboard_mapping_cookie_t cookie = xcb_get_keyboard_mapping(
@@ -489,6 +668,33 @@ init_keymap(xcb_connection_t* c, const xcb_setup_t* z) {
   g_keysyms = (xcb_keysym_t*)(g_keyboard_mapping + 1);
 }
 
+void  //
+init_shm(xcb_connection_t* c) {
+  const xcb_query_extension_reply_t* ext =
+      xcb_get_extension_data(c, &xcb_shm_id);
+  if (!ext || !ext->present) {
+    return;
+  }
+  xcb_shm_query_version_reply_t* reply =
+      xcb_shm_query_version_reply(c, xcb_shm_query_version(c), NULL);
+  if (!reply) {
+    return;
+  }
+  free(reply);
+  g_shm_available = true;
+}
+
+void  //
+release_shm(xcb_connection_t* c) {
+  if (g_shm_ptr) {
+    xcb_shm_detach(c, g_shm_seg);
+    shmdt(g_shm_ptr);
+    g_shm_seg = XCB_NONE;
+    g_shm_ptr = NULL;
+    g_shm_len = 0;
+  }
+}
+
 xcb_window_t  //
 make_window(xcb_connection_t* c, xcb_screen_t* s) {
   xcb_window_t w = xcb_generate_id(c);
@@ -513,11 +719,59 @@ typedef struct {
   xcb_screen_t* s;
   xcb_window_t w;
   xcb_gcontext_t g;
+  int argc;
+  char** argv;
 } my_context;
 
-const char*  //
-upload_pixel_buffer(void* ctx_as_void_star, pixel_buffer* pb) {
+// acquire_pixel_data returns the MIT-SHM segment's memory, growing (replacing)
+// the segment if it is smaller than (4 * width * height) bytes. It returns NULL
+// if MIT-SHM is unavailable.
+uint8_t*  //
+acquire_pixel_data(void* ctx_as_void_star, uint32_t width, uint32_t height) {
   my_context* ctx = (my_context*)ctx_as_void_star;
+  if (!g_shm_available || (width == 0) || (height == 0) ||
+      (width > 0x3FFF) || (height > 0x3FFF)) {
+    return NULL;
+  }
+  size_t n = 4 * ((size_t)width) * ((size_t)height);
+  if (n <= g_shm_len) {
+    return g_shm_ptr;
+  }
+  release_shm(ctx->c);
+
+  int id = shmget(IPC_PRIVATE, n, IPC_CREAT | 0600);
+  if (id < 0) {
+    g_shm_available = false;
+    return NULL;
+  }
+  void* ptr = shmat(id, NULL, 0);
+  if (ptr == ((void*)-1)) {
+    shmctl(id, IPC_RMID, NULL);
+    g_shm_available = false;
+    return NULL;
+  }
+  xcb_shm_seg_t seg = xcb_generate_id(ctx->c);
+  xcb_generic_error_t* err =
+      xcb_request_check(ctx->c, xcb_shm_attach_checked(ctx->c, seg, id, 0));
+  // Now that both we and (if err is NULL) the X server have attached to the
+  // segment, mark it for deletion. The kernel frees it after both detach, even
+  // if this program crashes.
+  shmctl(id, IPC_RMID, NULL);
+  if (err) {
+    free(err);
+    shmdt(ptr);
+    g_shm_available = false;
+    return NULL;
+  }
+  g_shm_seg = seg;
+  g_shm_ptr = (uint8_t*)ptr;
+  g_shm_len = n;
+  return g_shm_ptr;
+}
+
+// upload_pixel_buffer_locked requires that g_mutex is held.
+const char*  //
+upload_pixel_buffer_locked(my_context* ctx, pixel_buffer* pb) {
   if ((g_pixmap_width > 0) && (g_pixmap_height > 0)) {
     xcb_free_pixmap(ctx->c, g_pixmap);
     g_pixmap_width = 0;
@@ -529,6 +783,23 @@ upload_pixel_buffer(void* ctx_as_void_star, pixel_buffer* pb) {
     return "main: pixel buffer is too large";
   }
 
+  g_pixmap_width = pb->width;
+  g_pixmap_height = pb->height;
+  xcb_create_pixmap(ctx->c, ctx->s->root_depth, g_pixmap, ctx->w,
+                    g_pixmap_width, g_pixmap_height);
+
+  // If we rendered into the MIT-SHM segment then a single (small) request
+  // suffices, regardless of the pixel buffer's size. We wait for the X server
+  // to process it (with a round trip) before returning, as the next render
+  // will overwrite the segment.
+  if (g_shm_ptr && (pb->data == g_shm_ptr)) {
+    xcb_shm_put_image(ctx->c, g_pixmap, ctx->g, pb->width, pb->height, 0, 0,
+                      pb->width, pb->height, 0, 0, ctx->s->root_depth,
+                      XCB_IMAGE_FORMAT_Z_PIXMAP, 0, g_shm_seg, 0);
+    free(xcb_get_input_focus_reply(ctx->c, xcb_get_input_focus(ctx->c), NULL));
+    return NULL;
+  }
+
   // Calculate max_h, the largest number of rows we can issue in a single
   // xcb_image_put call without exceeding the XCB request length limit. This
   // number depends on pb->width, the width of the pixel buffer.
@@ -548,10 +819,6 @@ upload_pixel_buffer(void* ctx_as_void_star, pixel_buffer* pb) {
     return "main: XCB request length is too short";
   }
 
-  g_pixmap_width = pb->width;
-  g_pixmap_height = pb->height;
-  xcb_create_pixmap(ctx->c, ctx->s->root_depth, g_pixmap, ctx->w,
-                    g_pixmap_width, g_pixmap_height);
   xcb_image_t* image = xcb_image_create_native(
       ctx->c, pb->width, pb->height, XCB_IMAGE_FORMAT_Z_PIXMAP,
       ctx->s->root_depth, NULL, pb->width * pb->height * 4, pb->data);
@@ -574,6 +841,97 @@ upload_pixel_buffer(void* ctx_as_void_star, pixel_buffer* pb) {
   return NULL;
 }
 
+const char*  //
+upload_pixel_buffer(void* ctx_as_void_star, pixel_buffer* pb) {
+  pthread_mutex_lock(&g_mutex);
+  const char* ret =
+      upload_pixel_buffer_locked((my_context*)ctx_as_void_star, pb);
+  pthread_mutex_unlock(&g_mutex);
+  return ret;
+}
+
+// next_arg returns the command line argument that is delta key presses
+// (Space for +1, BackSpace for -1) away from arg, cycling around.
+int  //
+next_arg(int arg, int delta, int argc) {
+  arg += delta;
+  if (arg <= 0) {
+    arg = argc - 1;
+  } else if (arg >= argc) {
+    arg = 1;
+  }
+  return arg;
+}
+
+bool  //
+request_is_pending() {
+  pthread_mutex_lock(&g_mutex);
+  bool ret = g_request.pending;
+  pthread_mutex_unlock(&g_mutex);
+  return ret;
+}
+
+void*  //
+render_thread(void* ctx_as_void_star) {
+  my_context* ctx = (my_context*)ctx_as_void_star;
+  const int num_args = ctx->argc - 1;
+  while (true) {
+    pthread_mutex_lock(&g_mutex);
+    while (!g_request.pending) {
+      pthread_cond_wait(&g_cond, &g_mutex);
+    }
+    render_request req = g_request;
+    g_request.pending = false;
+    pthread_mutex_unlock(&g_mutex);
+
+    g_background_color_index = req.background_color_index;
+    loaded_file* lf = load(req.arg, ctx->argv[req.arg], req.arg, num_args);
+    if (!render(ctx, req.width, req.height, lf, &acquire_pixel_data,
+                &upload_pixel_buffer)) {
+      // Show nothing (the window's background) instead of a stale image.
+      pthread_mutex_lock(&g_mutex);
+      if ((g_pixmap_width > 0) && (g_pixmap_height > 0)) {
+        xcb_free_pixmap(ctx->c, g_pixmap);
+        g_pixmap_width = 0;
+        g_pixmap_height = 0;
+      }
+      pthread_mutex_unlock(&g_mutex);
+    }
+    xcb_clear_area(ctx->c, 1, ctx->w, 0, 0, 0xFFFF, 0xFFFF);
+    xcb_flush(ctx->c);
+
+    // Prefetch the next and previous files, unless there is more (more
+    // urgent) rendering to do.
+    if (num_args > 1) {
+      for (int delta = +1; delta >= -1; delta -= 2) {
+        if (request_is_pending()) {
+          break;
+        }
+        int arg = next_arg(req.arg, delta, ctx->argc);
+        load(arg, ctx->argv[arg], req.arg, num_args);
+      }
+    }
+  }
+  return NULL;
+}
+
+// post_render_request asks the render thread to draw the arg'th file. It
+// replaces any request that the render thread has not picked up yet.
+void  //
+post_render_request(int arg,
+                    uint32_t width,
+                    uint32_t height,
+                    uint32_t background_color_index) {
+  pthread_mutex_lock(&g_mutex);
+  g_request.pending = true;
+  g_request.arg = arg;
+  g_request.width = width;
+  g_request.height = height;
+  g_request.background_color_index = background_color_index;
+  pthread_cond_signal(&g_cond);
+  pthread_mutex_unlock(&g_mutex);
+}
+
 int  //
 main(int argc, char** argv) {
   if (argc <= 1) {
@@ -611,18 +969,30 @@ main(int argc, char** argv) {
   xcb_gcontext_t g = xcb_generate_id(c);
   xcb_create_gc(c, g, w, 0, NULL);
   init_keymap(c, z);
+  init_shm(c);
   xcb_flush(c);
   g_pixmap = xcb_generate_id(c);
 
+  my_context ctx;
+  ctx.c = c;
+  ctx.s = s;
+  ctx.w = w;
+  ctx.g = g;
+  ctx.argc = argc;
+  ctx.argv = argv;
+  pthread_t render_thread_id;
+  if (pthread_create(&render_thread_id, NULL, &render_thread, &ctx)) {
+    printf("main: could not create render thread\n");
+    return 1;
+  }
+
   uint32_t window_width = 0;
   uint32_t window_height = 0;
+  uint32_t background_color_index = 0;
 
   int arg = 1;
-  bool loaded = load(argv[arg]);
-  bool rendered = false;
 
   while (true) {
-    bool reload = false;
     bool rerender = false;
 
     xcb_generic_event_t* event = xcb_wait_for_event(c);
@@ -637,12 +1007,13 @@ main(int argc, char** argv) {
     switch (event->response_type & 0x7F) {
       case XCB_EXPOSE: {
         xcb_expose_event_t* e = (xcb_expose_event_t*)event;
-        if (rendered && (e->count == 0) && (g_pixmap_width > 0) &&
-            (g_pixmap_height > 0)) {
+        pthread_mutex_lock(&g_mutex);
+        if ((e->count == 0) && (g_pixmap_width > 0) && (g_pixmap_height > 0)) {
           xcb_copy_area(c, g_pixmap, w, g, 0, 0, 0, 0, g_pixmap_width,
                         g_pixmap_height);
           xcb_flush(c);
         }
+        pthread_mutex_unlock(&g_mutex);
         break;
       }
 
@@ -662,21 +1033,15 @@ main(int argc, char** argv) {
               if (argc <= 2) {
                 break;
               }
-              arg += (i != XK_BackSpace) ? +1 : -1;
-              if (arg == 0) {
-                arg = argc - 1;
-              } else if (arg == argc) {
-                arg = 1;
-              }
-              reload = true;
+              arg = next_arg(arg, (i != XK_BackSpace) ? +1 : -1, argc);
               rerender = true;
               break;
 
             case ',':
             case '.':
-              g_background_color_index +=
+              background_color_index +=
                   (i == ',') ? (NUM_BACKGROUND_COLORS - 1) : 1;
-              g_background_color_index %= NUM_BACKGROUND_COLORS;
+              background_color_index %= NUM_BACKGROUND_COLORS;
               rerender = true;
               break;
           }
@@ -704,20 +1069,9 @@ main(int argc, char** argv) {
     }
     free(event);
 
-    const char* filename = argv[arg];
-    if (reload) {
-      loaded = load(filename);
-    }
-    if (loaded && rerender && (window_width > 0) && (window_height > 0)) {
-      my_context ctx;
-      ctx.c = c;
-      ctx.s = s;
-      ctx.w = w;
-      ctx.g = g;
-      rendered = render(&ctx, window_width, window_height, filename,
-                        &upload_pixel_buffer);
-      xcb_clear_area(c, 1, w, 0, 0, 0xFFFF, 0xFFFF);
-      xcb_flush(c);
+    if (rerender && (window_width > 0) && (window_height > 0)) {
+      post_render_request(arg, window_width, window_height,
+                          background_color_index);
     }
   }
   return 0;
@@ -0,0 +1,380 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----------------
+
+// iconvg_fuzzer is a fuzz target for iconvg_decode. It is typically run
+// indirectly, by a framework such as libFuzzer, AFL++ or
+// https://github.com/google/oss-fuzz calling LLVMFuzzerTestOneInput.
+//
+// As well as looking for crashes, it checks that decoding does a bounded
+// amount of work per input byte. A counting canvas tallies every callback
+// (including each cubic Bézier that an arc expands to) and the fuzz target
+// fails if the tally exceeds CALLBACKS_PER_BYTE * src_len + CALLBACKS_CONSTANT.
+//
+// The decoder's own loop iterations are not counted separately. Each one
+// consumes at least one byte of src, so they are already bounded by src_len,
+// and canvas callbacks are the only place where one byte can fan out to more
+// work (e.g. an arc becoming multiple cubics).
+//
+// Defining ICONVG_CONFIG__FUZZLIB_MAIN builds a standalone replay driver
+// instead, which runs the fuzz target over the files (or the files in the
+// directories) given as arguments. For example:
+//
+// gcc -DICONVG_CONFIG__FUZZLIB_MAIN fuzz/c/iconvg_fuzzer.c -lm
+// ./a.out test/data
+//
+// See also build-fuzzer.sh in the IconVG root directory.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ICONVG_IMPLEMENTATION
+#include "../../release/c/iconvg-unsupported-snapshot.c"
+
+// Every IconVG opcode consumes at least one byte and produces at most a
+// handful of canvas callbacks. The worst cases are 'z' (which ends a path and
+// a drawing, 2 callbacks for 1 byte, but must follow a 3 byte "start path")
+// and arcs (at most 4 cubic Béziers for 6 bytes, when repeated). 2 callbacks
+// per byte is therefore a generous bound.
+#define CALLBACKS_PER_BYTE 2
+#define CALLBACKS_CONSTANT 16
+
+static const char g_error_too_many_callbacks[] = "fuzz: too many callbacks";
+
+// ----
+
+typedef struct {
+  uint64_t num_callbacks;
+  uint64_t max_callbacks;
+} counter;
+
+static const char*  //
+count(iconvg_canvas* c, uint64_t n) {
+  counter* k = (counter*)(c->context_nonconst_ptr0);
+  k->num_callbacks += n;
+  return (k->num_callbacks > k->max_callbacks) ? g_error_too_many_callbacks
+                                               : NULL;
+}
+
+static const char*  //
+counting_canvas__begin_decode(iconvg_canvas* c, iconvg_rectangle_f32 dst_rect) {
+  return count(c, 1);
+}
+
+static const char*  //
+counting_canvas__end_decode(iconvg_canvas* c,
+                            const char* err_msg,
+                            size_t num_bytes_consumed,
+                            size_t num_bytes_remaining) {
+  const char* z = count(c, 1);
+  return err_msg ? err_msg : z;
+}
+
+static const char*  //
+counting_canvas__begin_drawing(iconvg_canvas* c) {
+  return count(c, 1);
+}
+
+static const char*  //
+counting_canvas__end_drawing(iconvg_canvas* c, const iconvg_paint* p) {
+  // Exercise the paint accessors. They are not counted as callbacks.
+  switch (iconvg_paint__type(p)) {
+    case ICONVG_PAINT_TYPE__FLAT_COLOR:
+      iconvg_paint__flat_color_as_nonpremul_color(p);
+      break;
+    case ICONVG_PAINT_TYPE__LINEAR_GRADIENT:
+    case ICONVG_PAINT_TYPE__RADIAL_GRADIENT: {
+      uint32_t n = iconvg_paint__gradient_number_of_stops(p);
+      for (uint32_t i = 0; i < n; i++) {
+        iconvg_paint__gradient_stop_color_as_nonpremul_color(p, i);
+        iconvg_paint__gradient_stop_offset(p, i);
+      }
+      iconvg_matrix_2x3_f64 m = iconvg_paint__gradient_transformation_matrix(p);
+      iconvg_matrix_2x3_f64__override_second_row(&m);
+      iconvg_matrix_2x3_f64__inverse(&m);
+      break;
+    }
+    default:
+      break;
+  }
+  return count(c, 1);
+}
+
+static const char*  //
+counting_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  return count(c, 1);
+}
+
+static const char*  //
+counting_canvas__end_path(iconvg_canvas* c) {
+  return count(c, 1);
+}
+
+static const char*  //
+counting_canvas__path_line_to(iconvg_canvas* c, float x1, float y1) {
+  return count(c, 1);
+}
+
+static const char*  //
+counting_canvas__path_quad_to(iconvg_canvas* c,
+                              float x1,
+                              float y1,
+                              float x2,
+                              float y2) {
+  return count(c, 1);
+}
+
+static const char*  //
+counting_canvas__path_cube_to(iconvg_canvas* c,
+                              float x1,
+                              float y1,
+                              float x2,
+                              float y2,
+                              float x3,
+                              float y3) {
+  return count(c, 1);
+}
+
+static const char*  //
+counting_canvas__on_metadata_viewbox(iconvg_canvas* c,
+                                     iconvg_rectangle_f32 viewbox) {
+  return count(c, 1);
+}
+
+static const char*  //
+counting_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  return count(c, 1);
+}
+
+static const iconvg_canvas_vtable counting_canvas_vtable = {
+    sizeof(iconvg_canvas_vtable),
+    &counting_canvas__begin_decode,
+    &counting_canvas__end_decode,
+    &counting_canvas__begin_drawing,
+    &counting_canvas__end_drawing,
+    &counting_canvas__begin_path,
+    &counting_canvas__end_path,
+    &counting_canvas__path_line_to,
+    &counting_canvas__path_quad_to,
+    &counting_canvas__path_cube_to,
+    &counting_canvas__on_metadata_viewbox,
+    &counting_canvas__on_metadata_suggested_palette,
+    NULL,
+};
+
+// ----
+
+static const char*  //
+fuzz_one(const uint8_t* src_ptr,
+         size_t src_len,
+         iconvg_rectangle_f32 dst_rect,
+         const iconvg_decode_options* options) {
+  counter k = {0};
+  k.max_callbacks =
+      (CALLBACKS_PER_BYTE * ((uint64_t)src_len)) + CALLBACKS_CONSTANT;
+
+  iconvg_canvas c = {0};
+  c.vtable = &counting_canvas_vtable;
+  c.context_nonconst_ptr0 = &k;
+
+  const char* err_msg = iconvg_decode(&c, dst_rect, src_ptr, src_len, options);
+  if (err_msg == g_error_too_many_callbacks) {
+    return err_msg;
+  }
+  return NULL;
+}
+
+// fuzz_byte returns the i'th byte from the end of src, or zero if src is too
+// short. These bytes parameterize some of the decoding options.
+static uint8_t  //
+fuzz_byte(const uint8_t* src_ptr, size_t src_len, size_t i) {
+  return (i < src_len) ? src_ptr[src_len - 1 - i] : 0;
+}
+
+// fuzz returns NULL if decoding src (with a variety of options) succeeded or
+// failed gracefully, or an error message if decoding made too many canvas
+// callbacks.
+static const char*  //
+fuzz(const uint8_t* src_ptr, size_t src_len) {
+  iconvg_rectangle_f32 viewbox;
+  iconvg_decode_viewbox(&viewbox, src_ptr, src_len);
+
+  // Small, large and degenerate destinations. The height (in pixels) also
+  // affects which Level of Detail drawings are painted.
+  ICONVG_PRIVATE_TRY(fuzz_one(src_ptr, src_len,
+                              iconvg_make_rectangle_f32(0, 0, 48, 48), NULL));
+  ICONVG_PRIVATE_TRY(fuzz_one(
+      src_ptr, src_len, iconvg_make_rectangle_f32(-1e6f, -1e6f, 1e6f, 1e6f),
+      NULL));
+  ICONVG_PRIVATE_TRY(
+      fuzz_one(src_ptr, src_len, iconvg_make_rectangle_f32(0, 0, 0, 0), NULL));
+
+  // A custom palette and an explicit height, derived from the input so that
+  // the fuzzer can explore them.
+  iconvg_palette palette;
+  for (int i = 0; i < 64; i++) {
+    uint8_t u = (uint8_t)(src_len + i);
+    palette.colors[i].rgba[0] = u & 0x7F;
+    palette.colors[i].rgba[1] = u & 0x3F;
+    palette.colors[i].rgba[2] = u & 0x1F;
+    palette.colors[i].rgba[3] = 0x80 | u;
+  }
+  iconvg_decode_options options = iconvg_make_decode_options_ffv1(&palette);
+  options.height_in_pixels = iconvg_make_optional_i64_some(fuzz_byte(
+      src_ptr, src_len, 0));
+  ICONVG_PRIVATE_TRY(fuzz_one(src_ptr, src_len,
+                              iconvg_make_rectangle_f32(0, 0, 64, 64),
+                              &options));
+
+  // A cull rectangle, without and then with a dst_transform, also derived from
+  // the input. For graphics with a drawing index (MID 2), the cull rectangle
+  // decides which drawings are painted.
+  float cull_x = ((float)(fuzz_byte(src_ptr, src_len, 1) & 0x3F)) - 8.0f;
+  float cull_y = ((float)(fuzz_byte(src_ptr, src_len, 2) & 0x3F)) - 8.0f;
+  iconvg_rectangle_f32 cull_rect = iconvg_make_rectangle_f32(
+      cull_x, cull_y,
+      cull_x + ((float)(fuzz_byte(src_ptr, src_len, 3) & 0x3F)),
+      cull_y + ((float)(fuzz_byte(src_ptr, src_len, 4) & 0x3F)));
+  options = iconvg_make_decode_options_ffv1(NULL);
+  options.cull_rect = &cull_rect;
+  ICONVG_PRIVATE_TRY(fuzz_one(src_ptr, src_len,
+                              iconvg_make_rectangle_f32(0, 0, 64, 64),
+                              &options));
+
+  // The transform's linear part is near the identity, so that it is usually
+  // (but not always) invertible.
+  iconvg_matrix_2x3_f64 dst_transform;
+  for (int i = 0; i < 6; i++) {
+    double u = ((double)(fuzz_byte(src_ptr, src_len, 5 + i))) - 128.0;
+    if ((i % 3) == 2) {  // Translation.
+      dst_transform.elems[i / 3][i % 3] = u / 4.0;
+    } else if ((i % 4) == 0) {  // Diagonal.
+      dst_transform.elems[i / 3][i % 3] = 1.0 + (u / 64.0);
+    } else {
+      dst_transform.elems[i / 3][i % 3] = u / 64.0;
+    }
+  }
+  options.dst_transform = &dst_transform;
+  return fuzz_one(src_ptr, src_len, iconvg_make_rectangle_f32(0, 0, 64, 64),
+                  &options);
+}
+
+// ----
+
+int  //
+LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  const char* err_msg = fuzz(data, size);
+  if (err_msg) {
+    fprintf(stderr, "%s\n", err_msg);
+    abort();
+  }
+  return 0;
+}
+
+// ----
+
+#ifdef ICONVG_CONFIG__FUZZLIB_MAIN
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+// SRC_BUFFER_ARRAY_SIZE is the largest input (in bytes) that the replay
+// driver supports.
+//
+// This is 4 MiB (4 * 1024 * 1024 = 4194304 bytes) by default, so that it
+// covers script/gen-stress-corpus.go's output (whose stress-drawings.ivg is
+// just over 1 MiB), but can be configured by compiling with
+// -DSRC_BUFFER_ARRAY_SIZE=etc.
+#ifndef SRC_BUFFER_ARRAY_SIZE
+#define SRC_BUFFER_ARRAY_SIZE 4194304
+#endif
+
+uint8_t g_src_buffer_array[SRC_BUFFER_ARRAY_SIZE];
+
+static int g_num_files_processed;
+
+static bool  //
+replay_file(const char* filename) {
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    fprintf(stderr, "FAIL %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+  size_t n = fread(g_src_buffer_array, 1, SRC_BUFFER_ARRAY_SIZE, f);
+  bool too_long = !feof(f);
+  fclose(f);
+  if (too_long) {
+    fprintf(stderr, "FAIL %s: file too long\n", filename);
+    return false;
+  }
+
+  g_num_files_processed++;
+  const char* err_msg = fuzz(g_src_buffer_array, n);
+  if (err_msg) {
+    fprintf(stderr, "FAIL %s: %s\n", filename, err_msg);
+    return false;
+  }
+  return true;
+}
+
+static bool  //
+replay(const char* filename) {
+  struct stat s;
+  if (stat(filename, &s)) {
+    fprintf(stderr, "FAIL %s: %s\n", filename, strerror(errno));
+    return false;
+  } else if (!S_ISDIR(s.st_mode)) {
+    return replay_file(filename);
+  }
+
+  DIR* d = opendir(filename);
+  if (!d) {
+    fprintf(stderr, "FAIL %s: %s\n", filename, strerror(errno));
+    return false;
+  }
+  bool ok = true;
+  char path[4096];
+  struct dirent* e;
+  while ((e = readdir(d))) {
+    if ((e->d_name[0] == '.') ||
+        (snprintf(path, sizeof(path), "%s/%s", filename, e->d_name) >=
+         (int)sizeof(path))) {
+      continue;
+    } else if (!stat(path, &s) && S_ISREG(s.st_mode)) {
+      ok = replay_file(path) && ok;
+    }
+  }
+  closedir(d);
+  return ok;
+}
+
+int  //
+main(int argc, char** argv) {
+  bool ok = true;
+  for (int i = 1; i < argc; i++) {
+    ok = replay(argv[i]) && ok;
+  }
+  printf("%s: %d files processed\n", ok ? "PASS" : "FAIL",
+         g_num_files_processed);
+  return ok ? 0 : 1;
+}
+
+#endif  // ICONVG_CONFIG__FUZZLIB_MAIN
@@ -2,4 +2,4 @@ module github.com/google/iconvg
 
 go 1.17
 
-require golang.org/x/image v0.0.0-20210504121937-7319ad40d33e // indirect
+require golang.org/x/image v0.0.0-20210504121937-7319ad40d33e
@@ -83,6 +83,7 @@ extern const char iconvg_error_bad_coordinate[];
 extern const char iconvg_error_bad_drawing_opcode[];
 extern const char iconvg_error_bad_magic_identifier[];
 extern const char iconvg_error_bad_metadata[];
+extern const char iconvg_error_bad_metadata_drawing_index[];
 extern const char iconvg_error_bad_metadata_id_order[];
 extern const char iconvg_error_bad_metadata_suggested_palette[];
 extern const char iconvg_error_bad_metadata_viewbox[];
@@ -93,8 +94,19 @@ extern const char iconvg_error_bad_styling_opcode[];
 extern const char iconvg_error_system_failure_out_of_memory[];
 
 extern const char iconvg_error_invalid_backend_not_enabled[];
+extern const char iconvg_error_invalid_batch_argument[];
+extern const char iconvg_error_invalid_buffer_too_small[];
 extern const char iconvg_error_invalid_constructor_argument[];
+extern const char iconvg_error_invalid_damage_argument[];
+extern const char iconvg_error_invalid_dst_transform[];
+extern const char iconvg_error_invalid_encoder_argument[];
+extern const char iconvg_error_invalid_encoder_state[];
+extern const char iconvg_error_invalid_instances_argument[];
+extern const char iconvg_error_invalid_mipmap_argument[];
 extern const char iconvg_error_invalid_paint_type[];
+extern const char iconvg_error_invalid_pixel_argument[];
+extern const char iconvg_error_invalid_raster_cache_argument[];
+extern const char iconvg_error_invalid_trace[];
 extern const char iconvg_error_unsupported_vtable[];
 
 // ----
@@ -173,6 +185,18 @@ typedef struct iconvg_palette_struct {
   iconvg_premul_color colors[64];
 } iconvg_palette;
 
+// iconvg_pixel_format is a 4 bytes per pixel memory layout. BGRA means that
+// the bytes are in B, G, R, A order, which is what Cairo's CAIRO_FORMAT_ARGB32
+// and Skia's BGRA_8888_SK_COLORTYPE are on little-endian systems. RGBA means
+// R, G, B, A order, which is what PNG expects.
+typedef enum iconvg_pixel_format_enum {
+  ICONVG_PIXEL_FORMAT__INVALID = 0,
+  ICONVG_PIXEL_FORMAT__BGRA_PREMUL = 1,
+  ICONVG_PIXEL_FORMAT__BGRA_NONPREMUL = 2,
+  ICONVG_PIXEL_FORMAT__RGBA_PREMUL = 3,
+  ICONVG_PIXEL_FORMAT__RGBA_NONPREMUL = 4,
+} iconvg_pixel_format;
+
 // ----
 
 typedef enum iconvg_paint_type_enum {
@@ -244,6 +268,55 @@ iconvg_matrix_2x3_f64__determinant(iconvg_matrix_2x3_f64* self) {
 
 // ----
 
+// iconvg_paint_snapshot_stop is one gradient stop of an iconvg_paint_snapshot.
+typedef struct iconvg_paint_snapshot_stop_struct {
+  iconvg_premul_color color;
+  float offset;
+} iconvg_paint_snapshot_stop;
+
+// iconvg_paint_snapshot is a self-contained copy of what an iconvg_paint
+// looks like, for canvases that defer their drawing (such as recorders,
+// batchers or tile binners). Unlike an iconvg_paint, it does not hold the
+// decoder's registers, palettes or coordinate transforms.
+//
+// Its fields are ordered so that only a prefix of the struct is meaningful,
+// whose length is returned by iconvg_paint__snapshot. A flat color needs only
+// the fields up to and including gradient_number_of_stops (which is zero). A
+// gradient also needs the transformation matrix and its first
+// gradient_number_of_stops stops. Callers may store just that prefix and later
+// copy it back into an iconvg_paint_snapshot.
+typedef struct iconvg_paint_snapshot_struct {
+  iconvg_paint_type type;
+  iconvg_premul_color flat_color;
+  iconvg_gradient_spread gradient_spread;
+  uint32_t gradient_number_of_stops;
+  // gradient_transformation_matrix has the same meaning as the result of
+  // iconvg_paint__gradient_transformation_matrix.
+  iconvg_matrix_2x3_f64 gradient_transformation_matrix;
+  iconvg_paint_snapshot_stop gradient_stops[63];
+} iconvg_paint_snapshot;
+
+// iconvg_source_position is where, in the IconVG source bytes, a drawing
+// came from.
+typedef struct iconvg_source_position_struct {
+  // drawing_index counts the drawings in the IconVG graphic, starting at
+  // zero. Drawings that are skipped by Level of Detail thresholds still count,
+  // so that the index does not depend on the rasterization size.
+  uint64_t drawing_index;
+
+  // src_begin and src_end are byte offsets, relative to the src_ptr passed
+  // to iconvg_decode. The range covers the styling opcodes that immediately
+  // precede the drawing (after the previous drawing, if any) through to the
+  // drawing's final opcode.
+  //
+  // Register values set before src_begin (including by the metadata) can
+  // still affect what the drawing looks like.
+  size_t src_begin;
+  size_t src_end;
+} iconvg_source_position;
+
+// ----
+
 // iconvg_decode_options holds the optional arguments to iconvg_decode.
 typedef struct iconvg_decode_options_struct {
   // sizeof__iconvg_decode_options should be set to the sizeof this data
@@ -264,6 +337,33 @@ typedef struct iconvg_decode_options_struct {
   // palette, if non-NULL, is the custom palette used for rendering. If NULL,
   // the IconVG file's suggested palette is used instead.
   iconvg_palette* palette;
+
+  // dst_transform, if non-NULL, is an affine transformation applied to every
+  // point after it is mapped from the ViewBox to the dst_rect. Gradients are
+  // transformed to match. This lets a graphic be rotated or skewed without a
+  // backend-specific transform, keeping the backend's identity matrix (and
+  // any faster code paths that come with it).
+  //
+  // begin_decode receives the bounding box of the transformed dst_rect, so
+  // that backends that clip to it do not clip the graphic. Level of Detail
+  // thresholds still use height_in_pixels or the untransformed dst_rect.
+  //
+  // The matrix must be invertible, otherwise decoding fails with
+  // iconvg_error_invalid_dst_transform.
+  const iconvg_matrix_2x3_f64* dst_transform;
+
+  // cull_rect, if non-NULL, is the part of dst coordinate space (after any
+  // dst_transform) that needs painting, such as the dst canvas' clip or a
+  // damaged region. If the IconVG graphic has a drawing index (MID 2) then
+  // drawings whose bounds lie wholly outside of cull_rect are skipped: their
+  // canvas callbacks are not called. They still count towards
+  // iconvg_source_position's drawing_index.
+  //
+  // Without a drawing index, cull_rect has no effect. Either way, every
+  // drawing is still decoded, so that whether decoding succeeds does not
+  // depend on cull_rect. An index that does not match the drawings is
+  // rejected with iconvg_error_bad_metadata_drawing_index.
+  const iconvg_rectangle_f32* cull_rect;
 } iconvg_decode_options;
 
 // iconvg_make_decode_options_ffv1 returns an iconvg_decode_options suitable
@@ -278,6 +378,166 @@ iconvg_make_decode_options_ffv1(iconvg_palette* palette) {
 
 // ----
 
+// iconvg_batch_item is one graphic for iconvg_decode_batch to paint: the
+// src_ptr[0 .. src_len] IconVG-formatted data, painted into dst_rect.
+typedef struct iconvg_batch_item_struct {
+  iconvg_rectangle_f32 dst_rect;
+  const uint8_t* src_ptr;
+  size_t src_len;
+} iconvg_batch_item;
+
+// ----
+
+// ICONVG_MIPMAP_CHAIN_MAX_LEVELS is the maximum number of levels in an
+// iconvg_mipmap_chain, enough for a level 0 up to 0xFFFFFFFF pixels wide.
+#define ICONVG_MIPMAP_CHAIN_MAX_LEVELS 32
+
+// iconvg_mipmap_level is one level of an iconvg_mipmap_chain: a width x height
+// pixel buffer with 4 bytes (premultiplied alpha) per pixel. The order of the
+// 4 channels within a pixel is whatever the render callback produces.
+typedef struct iconvg_mipmap_level_struct {
+  uint8_t* ptr;
+  size_t stride;
+  uint32_t width;
+  uint32_t height;
+
+  // rendered is whether this level was painted by the render callback. If
+  // false, it was downsampled from the previous (larger) level.
+  bool rendered;
+} iconvg_mipmap_level;
+
+// iconvg_mipmap_chain is a sequence of iconvg_mipmap_level values, from the
+// largest (levels[0]) to the smallest (1x1 pixels), each level's width and
+// height being half of the previous level's (rounded down, but at least 1).
+typedef struct iconvg_mipmap_chain_struct {
+  uint32_t num_levels;
+  iconvg_mipmap_level levels[ICONVG_MIPMAP_CHAIN_MAX_LEVELS];
+} iconvg_mipmap_chain;
+
+// iconvg_mipmap_render_func paints the src IconVG-formatted data onto a
+// mipmap level's pixels (which have been zeroed beforehand), typically by
+// calling iconvg_decode with a backend-specific canvas and a dst_rect of
+// {0, 0, level->width, level->height}. options is passed through from
+// iconvg_decode_mipmap_chain.
+typedef const char* (*iconvg_mipmap_render_func)(
+    void* context,
+    const iconvg_mipmap_level* level,
+    const uint8_t* src_ptr,
+    size_t src_len,
+    const iconvg_decode_options* options);
+
+// ----
+
+// iconvg_raster_cache_key identifies a rasterization in an iconvg_raster_cache.
+typedef struct iconvg_raster_cache_key_struct {
+  // src_hash is the iconvg_raster_cache_hash of the IconVG source bytes.
+  uint64_t src_hash;
+
+  // palette_hash is the iconvg_raster_cache_hash of the custom palette, or
+  // zero when rendering with the IconVG source's suggested palette.
+  uint64_t palette_hash;
+
+  // width and height are the rasterization's size in pixels.
+  uint32_t width;
+  uint32_t height;
+
+  // backend is chosen by the caller, to distinguish rasterizations that would
+  // otherwise look the same, such as Cairo's versus Skia's, or BGRA versus
+  // RGBA channel order.
+  uint32_t backend;
+
+  // bytes_per_pixel is either 4 (alpha-premultiplied color, in whatever
+  // channel order the backend uses) or 1 (an 8-bit alpha mask).
+  uint32_t bytes_per_pixel;
+
+  // subpixel_x and subpixel_y are the rasterization's subpixel phase, in
+  // 1/256ths of a pixel (see iconvg_subpixel_placement). Both are zero for
+  // rasterizations that are not subpixel positioned.
+  uint8_t subpixel_x;
+  uint8_t subpixel_y;
+
+  // content_width and content_height are the size, in possibly fractional
+  // pixels, of the destination rectangle that the graphic was rasterized to
+  // (see iconvg_subpixel_placement). Rasterizations whose width and height
+  // are equal can still differ in scale. Both are zero when that rectangle is
+  // the whole {0, 0, width, height} rasterization. They are compared by
+  // their bits, so callers should compute them the same way each time.
+  float content_width;
+  float content_height;
+} iconvg_raster_cache_key;
+
+// iconvg_subpixel_placement is how to rasterize and then blit a graphic whose
+// destination rectangle is at a fractional pixel position, such as an icon
+// placed inline with text. The fractional part is quantized to one of a small
+// number of subpixel phases, so that the rasterization can be cached (keyed
+// by the phase) and re-used for every placement with that phase, as glyph
+// caches do. This avoids both re-rasterizing per placement and the jitter of
+// snapping to whole pixels.
+typedef struct iconvg_subpixel_placement_struct {
+  // dst_x and dst_y are the whole pixel position at which to blit the
+  // rasterization's top-left corner.
+  int32_t dst_x;
+  int32_t dst_y;
+
+  // subpixel_x and subpixel_y are the quantized phase, in 1/256ths of a
+  // pixel, for the iconvg_raster_cache_key fields of the same name.
+  uint8_t subpixel_x;
+  uint8_t subpixel_y;
+
+  // width and height are the rasterization's size in pixels, for the
+  // iconvg_raster_cache_key fields of the same name. They are large enough to
+  // hold dst_rect, which can take one more pixel than the destination
+  // rectangle's (rounded up) size when the phase is non-zero.
+  uint32_t width;
+  uint32_t height;
+
+  // content_width and content_height are the destination rectangle's size,
+  // unrounded, for the iconvg_raster_cache_key fields of the same name. Two
+  // placements can share a phase, width and height but not a content size,
+  // such as 15.5 and 16 pixels wide, and their rasterizations differ.
+  float content_width;
+  float content_height;
+
+  // dst_rect is what to pass to iconvg_decode when rasterizing, relative to
+  // the rasterization's top-left corner. Its offset from (0, 0) is exactly the
+  // quantized phase.
+  iconvg_rectangle_f32 dst_rect;
+} iconvg_subpixel_placement;
+
+// iconvg_raster_cache is a persistent cache of rasterizations, held in
+// ptr[0 .. len]. That memory is typically a file mapped (e.g. by mmap with
+// MAP_SHARED) into multiple processes, so that the cache survives restarts
+// and is shared. The data format is little-endian and independent of the
+// process' pointer size, but may change across library versions (in which
+// case the cache is re-formatted, i.e. emptied, by the writer).
+//
+// The memory is both the cache's storage and its size cap. Older entries are
+// evicted (over-written) to make room for newer ones, in first-in-first-out
+// order.
+//
+// There may be many concurrent readers (iconvg_raster_cache__lookup) but at
+// most one writer (iconvg_raster_cache__open_for_writing and
+// iconvg_raster_cache__insert) at a time. Coordinating writers (e.g. with a
+// file lock) is the caller's responsibility. Readers take no locks. They
+// detect entries that are concurrently being over-written, which are then
+// cache misses.
+typedef struct iconvg_raster_cache_struct {
+  uint8_t* ptr;
+  size_t len;
+} iconvg_raster_cache;
+
+// iconvg_make_raster_cache returns an iconvg_raster_cache that wraps the
+// caller-owned ptr[0 .. len] memory. It does not read or write that memory.
+static inline iconvg_raster_cache  //
+iconvg_make_raster_cache(uint8_t* ptr, size_t len) {
+  iconvg_raster_cache c;
+  c.ptr = ptr;
+  c.len = ptr ? len : 0;
+  return c;
+}
+
+// ----
+
 // iconvg_canvas is conceptually a 'virtual super-class' with e.g. Cairo-backed
 // or Skia-backed 'sub-classes'.
 //
@@ -324,6 +584,15 @@ typedef struct iconvg_canvas_vtable_struct {
   const char* (*on_metadata_suggested_palette)(
       struct iconvg_canvas_struct* c,
       const iconvg_palette* suggested_palette);
+
+  // end_drawing_instances is optional and may be NULL. If non-NULL, it is
+  // like end_drawing but paints the path num_instances times, translated by
+  // (offsets_xy[2*i+0], offsets_xy[2*i+1]) for each i. It is only called by
+  // iconvg_decode_instances.
+  const char* (*end_drawing_instances)(struct iconvg_canvas_struct* c,
+                                       const iconvg_paint* p,
+                                       const float* offsets_xy,
+                                       size_t num_instances);
 } iconvg_canvas_vtable;
 
 typedef struct iconvg_canvas_struct {
@@ -343,6 +612,67 @@ typedef struct iconvg_canvas_struct {
 
 // ----
 
+// iconvg_growable_buffer is a contiguous byte buffer that the IconVG encoder
+// appends to. Bytes ptr[0 .. len] hold data. Bytes ptr[len .. cap] are
+// available for appending to.
+//
+// grow, if non-NULL, is called when more capacity is needed. It should make
+// (cap - len) at least min_additional, possibly by changing ptr, or return an
+// error. If NULL, appending past cap fails with
+// iconvg_error_invalid_buffer_too_small.
+//
+// context is not used by the library, other than being available to grow.
+typedef struct iconvg_growable_buffer_struct {
+  uint8_t* ptr;
+  size_t len;
+  size_t cap;
+  const char* (*grow)(struct iconvg_growable_buffer_struct* self,
+                      size_t min_additional);
+  void* context;
+} iconvg_growable_buffer;
+
+// iconvg_make_growable_buffer returns an iconvg_growable_buffer that wraps the
+// caller-owned ptr[0 .. cap] memory. It never grows.
+static inline iconvg_growable_buffer  //
+iconvg_make_growable_buffer(uint8_t* ptr, size_t cap) {
+  iconvg_growable_buffer b;
+  b.ptr = ptr;
+  b.len = 0;
+  b.cap = ptr ? cap : 0;
+  b.grow = NULL;
+  b.context = NULL;
+  return b;
+}
+
+// ----
+
+// iconvg_encoder writes IconVG-formatted data to an iconvg_growable_buffer.
+// Its methods mirror the iconvg_canvas_vtable callbacks, except that the paint
+// is given at the start of a drawing instead of the end.
+//
+// The fields should be considered private implementation details. Users
+// should not read or write them directly and their semantics may change
+// between minor library releases. Use iconvg_encoder__initialize instead.
+typedef struct iconvg_encoder_struct {
+  iconvg_growable_buffer* private_dst;
+  const char* private_err_msg;
+  uint32_t private_mode;
+  uint32_t private_csel;
+  uint32_t private_nsel;
+  uint32_t private_start_path_adj;
+  size_t private_run_index;
+  float private_curr_x;
+  float private_curr_y;
+  float private_start_x;
+  float private_start_y;
+  float private_refl_x;
+  float private_refl_y;
+  uint64_t private_creg_known_bits;
+  iconvg_premul_color private_creg[64];
+} iconvg_encoder;
+
+// ----
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -385,6 +715,51 @@ iconvg_make_debug_canvas(FILE* f,
                          const char* message_prefix,
                          iconvg_canvas* wrapped);
 
+// iconvg_make_trace_canvas returns an iconvg_canvas that records vtable calls,
+// and their arguments, to dst in a compact binary format before forwarding the
+// call on to the wrapped iconvg_canvas. It is like iconvg_make_debug_canvas
+// but the trace can later be played back, by iconvg_replay_trace, without
+// re-running the IconVG decoder. This helps benchmark a canvas in isolation.
+//
+// dst may be NULL, in which case nothing is recorded. Recording multiple
+// iconvg_decode calls to the same dst is valid. The trace format is not
+// stable across library versions.
+//
+// wrapped may be NULL, in which case the iconvg_canvas vtable calls always
+// return success (a NULL error message) except that end_decode returns its
+// (possibly non-NULL) err_msg argument unchanged. Recording can also fail,
+// e.g. with iconvg_error_invalid_buffer_too_small.
+//
+// If any of the pointer-typed arguments are non-NULL then the caller of this
+// function is responsible for ensuring that the pointers remain valid while
+// the returned iconvg_canvas is in use.
+iconvg_canvas  //
+iconvg_make_trace_canvas(iconvg_growable_buffer* dst, iconvg_canvas* wrapped);
+
+// iconvg_make_paint_sorting_canvas returns an iconvg_canvas that buffers each
+// decode's drawings and then forwards them on to the wrapped iconvg_canvas,
+// re-ordered so that drawings with the same paint are more often adjacent.
+// This reduces how often the wrapped canvas switches paints (e.g. creating
+// Cairo patterns or Skia shaders), which helps busy, many-colored graphics.
+//
+// Only drawings that share no pixels are re-ordered relative to each other.
+// Overlapping drawings keep their relative order, so the painted result is
+// unchanged. Pixels are judged by bounding boxes, presuming that dst
+// coordinate space units are pixels. Drawings are only re-ordered within
+// windows of (up to) 256 consecutive drawings, so that the sorting work per
+// drawing, and the memory used, is bounded. Buffering allocates memory, so
+// decoding can fail with iconvg_error_system_failure_out_of_memory.
+//
+// wrapped may be NULL, in which case the iconvg_canvas vtable calls always
+// return success (a NULL error message) except that end_decode returns its
+// (possibly non-NULL) err_msg argument unchanged.
+//
+// If wrapped is non-NULL then the caller of this function is responsible for
+// ensuring that the pointer remains valid while the returned iconvg_canvas is
+// in use.
+iconvg_canvas  //
+iconvg_make_paint_sorting_canvas(iconvg_canvas* wrapped);
+
 // iconvg_canvas__does_nothing returns whether self is NULL or *self is
 // zero-valued or broken. Other canvas values are presumed to do something.
 // Zero-valued means the result of "iconvg_canvas c = {0}". Broken means the
@@ -455,6 +830,105 @@ iconvg_decode(iconvg_canvas* dst_canvas,
               size_t src_len,
               const iconvg_decode_options* options);
 
+// iconvg_decode_instances is like iconvg_decode but paints the src graphic
+// num_instances times, the i'th copy translated (in dst coordinate space) by
+// (offsets_xy[2*i+0], offsets_xy[2*i+1]) relative to dst_rect. The src is
+// parsed only once. Each of its drawings is painted at every offset before
+// moving on to the next drawing, so overlapping instances can composite
+// differently than separate iconvg_decode calls would.
+//
+// If dst_canvas's vtable has a non-NULL end_drawing_instances then each path
+// is built once and handed over with the whole offsets_xy array. Otherwise,
+// the path is buffered and replayed, translated, once per instance. Either
+// way, begin_decode receives the union of the translated dst_rects.
+//
+// offsets_xy may be NULL only if num_instances is zero.
+//
+// options may be NULL, in which case default values will be used.
+const char*  //
+iconvg_decode_instances(iconvg_canvas* dst_canvas,
+                        iconvg_rectangle_f32 dst_rect,
+                        const uint8_t* src_ptr,
+                        size_t src_len,
+                        const float* offsets_xy,
+                        size_t num_instances,
+                        const iconvg_decode_options* options);
+
+// iconvg_decode_batch paints num_items graphics, like calling iconvg_decode
+// once per item, but within a single begin_decode / end_decode session whose
+// dst_rect is the union of the items' dst_rects. This amortizes a backend's
+// per-decode setup, such as Cairo's or Skia's save, clip and restore.
+//
+// An item whose path coordinates all lie within its dst_rect is painted
+// without a clip of its own. Any other item (including one whose src is not
+// well-formed) is painted by a nested iconvg_decode call, which clips to that
+// item's dst_rect. Finding out which is which costs an extra parse (but no
+// painting) of each item's src.
+//
+// dst_err_msgs may be NULL. If non-NULL, it should have room for num_items
+// elements and dst_err_msgs[i] is set to the i'th item's error (NULL meaning
+// success). A failing item does not stop later items from being painted.
+//
+// It returns the first non-NULL item error, unless end_decode returns an
+// error of its own. end_decode's byte counts are zero and its err_msg argument
+// is NULL unless begin_decode failed, in which case no item is painted.
+//
+// options may be NULL, in which case default values will be used. They apply
+// to every item.
+const char*  //
+iconvg_decode_batch(iconvg_canvas* dst_canvas,
+                    const iconvg_batch_item* items,
+                    size_t num_items,
+                    const char** dst_err_msgs,
+                    const iconvg_decode_options* options);
+
+// iconvg_decode_damage compares two versions of an IconVG graphic, drawing by
+// drawing, and sets *dst_damage to the region of dst_rect whose pixels can
+// differ between them. An editor can then re-paint only that region (with a
+// clip) after an edit, instead of the whole graphic.
+//
+// Drawings are compared by what they look like (their dst-space paths and
+// their resolved colors and gradients), not by their bytes, so that edits to
+// the CREG and NREG registers are accounted for. The damage is the union of
+// the pixel bounding boxes of the drawings that changed, were added or were
+// removed, after skipping the drawings that both versions start and end with.
+// This presumes that dst coordinate space units are pixels.
+//
+// If nothing changed then *dst_damage is set to the all-zero (empty)
+// rectangle. If either version fails to decode then *dst_damage is set to the
+// whole dst_rect (or its bounding box after any dst_transform) and the first
+// error is returned. Comparing allocates memory, so it can also fail with
+// iconvg_error_system_failure_out_of_memory.
+//
+// options may be NULL, in which case default values will be used. They apply
+// to both versions, as they should be the same as when painting them.
+const char*  //
+iconvg_decode_damage(iconvg_rectangle_f32* dst_damage,
+                     iconvg_rectangle_f32 dst_rect,
+                     const uint8_t* old_src_ptr,
+                     size_t old_src_len,
+                     const uint8_t* new_src_ptr,
+                     size_t new_src_len,
+                     const iconvg_decode_options* options);
+
+// iconvg_decode_palette_dependencies sets *dst_mask to the union of
+// iconvg_paint__palette_dependencies over the drawings that iconvg_decode,
+// with the same arguments, would paint. A cache of rendered graphics can then
+// skip invalidating a graphic when none of its bits are among the changed
+// custom palette entries. Finer-grained (per drawing) invalidation can call
+// iconvg_paint__palette_dependencies in a canvas' end_drawing method.
+//
+// Drawings skipped by Level of Detail thresholds do not count, so the mask can
+// depend on dst_rect and options' height_in_pixels.
+//
+// options may be NULL, in which case default values will be used.
+const char*  //
+iconvg_decode_palette_dependencies(uint64_t* dst_mask,
+                                   iconvg_rectangle_f32 dst_rect,
+                                   const uint8_t* src_ptr,
+                                   size_t src_len,
+                                   const iconvg_decode_options* options);
+
 // iconvg_decode_viewbox sets *dst_viewbox to the ViewBox Metadata from the src
 // IconVG-formatted data.
 //
@@ -468,6 +942,250 @@ iconvg_decode_viewbox(iconvg_rectangle_f32* dst_viewbox,
                       const uint8_t* src_ptr,
                       size_t src_len);
 
+// iconvg_replay_trace plays back a trace, recorded by an
+// iconvg_make_trace_canvas canvas, calling dst_canvas's callbacks with the
+// recorded arguments. This skips decoding the IconVG data, so that the
+// dst_canvas's cost can be measured in isolation.
+//
+// The trace may hold multiple begin_decode ... end_decode call sequences. As
+// with iconvg_decode, if a callback returns an error (or the trace is
+// malformed) part-way through a call sequence then that sequence stops and
+// the error becomes the err_msg argument to end_decode, whose
+// num_bytes_etc arguments then count trace bytes instead of IconVG bytes.
+// This function returns the first non-NULL error returned by end_decode (or
+// iconvg_error_invalid_trace), or NULL if there were none.
+//
+// Error messages recorded in the trace are passed to end_decode as the
+// equivalent iconvg_error_etc constant where there is one, so that they can
+// be compared by the == operator. Other (non-library) messages are passed as
+// pointers into src_ptr.
+const char*  //
+iconvg_replay_trace(iconvg_canvas* dst_canvas,
+                    const uint8_t* src_ptr,
+                    size_t src_len);
+
+// iconvg_mipmap_chain_byte_length returns the number of bytes needed to hold
+// every level of a mipmap chain whose level 0 is width x height pixels. It
+// returns zero if width or height is zero or if the total overflows a size_t.
+size_t  //
+iconvg_mipmap_chain_byte_length(uint32_t width, uint32_t height);
+
+// iconvg_decode_mipmap_chain fills in a complete mipmap chain for the src
+// IconVG-formatted data, whose level 0 is width x height pixels. All levels
+// are laid out, tightly packed, in the single dst_ptr buffer, whose dst_len
+// should be at least iconvg_mipmap_chain_byte_length(width, height).
+//
+// Level 0 is painted by the render callback. Each subsequent level is either
+// painted by the render callback or is a 2x2 box-filter downsampling of the
+// previous level. It is re-rendered only when the src's Level of Detail
+// thresholds select a different set of paths at that level's height, since
+// downsampling is much cheaper than rendering but would otherwise blend away
+// paths that are meant to appear (or disappear) at smaller sizes.
+//
+// If options->height_in_pixels has_value then that height is used for every
+// level's Level of Detail thresholds, so that only level 0 is rendered.
+//
+// options may be NULL, in which case default values will be used.
+const char*  //
+iconvg_decode_mipmap_chain(iconvg_mipmap_chain* dst_chain,
+                           uint8_t* dst_ptr,
+                           size_t dst_len,
+                           uint32_t width,
+                           uint32_t height,
+                           iconvg_mipmap_render_func render,
+                           void* render_context,
+                           const uint8_t* src_ptr,
+                           size_t src_len,
+                           const iconvg_decode_options* options);
+
+// iconvg_convert_pixels converts a width x height rectangle of pixels from
+// src_format to dst_format, swizzling (swapping the B and R channels) and
+// converting to or from alpha-premultiplication as needed. Each row starts
+// stride bytes after the previous row.
+//
+// Converting from premultiplied to non-premultiplied alpha rounds down (with
+// invalid premultiplied colors, whose color channels exceed their alpha,
+// saturating at 0xFF). Converting to or from alpha-premultiplication also
+// sets fully transparent pixels to all zeroes.
+//
+// dst_ptr may equal src_ptr (converting in place), provided that dst_stride
+// equals src_stride. Otherwise, the two buffers must not overlap.
+const char*  //
+iconvg_convert_pixels(uint8_t* dst_ptr,
+                      size_t dst_len,
+                      size_t dst_stride,
+                      iconvg_pixel_format dst_format,
+                      const uint8_t* src_ptr,
+                      size_t src_len,
+                      size_t src_stride,
+                      iconvg_pixel_format src_format,
+                      uint32_t width,
+                      uint32_t height);
+
+// iconvg_raster_cache_hash returns a 64-bit hash of ptr[0 .. len], for
+// filling in an iconvg_raster_cache_key. The hash function is stable across
+// library versions, as the hashes are persisted.
+uint64_t  //
+iconvg_raster_cache_hash(const uint8_t* ptr, size_t len);
+
+// iconvg_place_subpixel sets *dst_placement for drawing at dst_rect, whose
+// fractional position is rounded to the nearest of num_phases_x horizontal
+// and num_phases_y vertical subpixel phases. For example, 4 and 1 quantize to
+// quarter pixels horizontally and snap to whole pixels vertically. Each
+// number of phases must be in the range [1 ..= 256].
+//
+// It fails with iconvg_error_invalid_raster_cache_argument if dst_rect is
+// not finite, is empty or is too far from the origin.
+const char*  //
+iconvg_place_subpixel(iconvg_subpixel_placement* dst_placement,
+                      iconvg_rectangle_f32 dst_rect,
+                      uint32_t num_phases_x,
+                      uint32_t num_phases_y);
+
+// iconvg_raster_cache__open_for_writing prepares self for
+// iconvg_raster_cache__insert calls. If self's memory does not already hold a
+// valid cache (for example, it is all zeroes or its length has changed) then
+// it is formatted as an empty one. The memory should be at least 8 KiB.
+const char*  //
+iconvg_raster_cache__open_for_writing(iconvg_raster_cache* self);
+
+// iconvg_raster_cache__lookup copies the cached pixels for key, if present,
+// to dst_ptr and returns true. Each of the key->height rows is key->width *
+// key->bytes_per_pixel bytes long and starts dst_stride bytes after the
+// previous row. dst_len must be large enough for all of the rows.
+//
+// It returns false (and dst_ptr's contents are unspecified) on a cache miss,
+// including when self does not hold a valid cache.
+bool  //
+iconvg_raster_cache__lookup(const iconvg_raster_cache* self,
+                            const iconvg_raster_cache_key* key,
+                            uint8_t* dst_ptr,
+                            size_t dst_len,
+                            size_t dst_stride);
+
+// iconvg_raster_cache__insert adds the src_ptr pixels (laid out as for
+// iconvg_raster_cache__lookup) to the cache under key, evicting older entries
+// if needed. It fails with iconvg_error_invalid_raster_cache_argument if the
+// entry would be larger than the cache's capacity.
+const char*  //
+iconvg_raster_cache__insert(iconvg_raster_cache* self,
+                            const iconvg_raster_cache_key* key,
+                            const uint8_t* src_ptr,
+                            size_t src_len,
+                            size_t src_stride);
+
+// ----
+
+// iconvg_growable_buffer__realloc_grow is an iconvg_growable_buffer grow
+// callback backed by the C standard library's realloc. A buffer that uses it
+// should start with ptr, len and cap all zero, and the caller is responsible
+// for eventually calling free(self->ptr).
+const char*  //
+iconvg_growable_buffer__realloc_grow(iconvg_growable_buffer* self,
+                                     size_t min_additional);
+
+// ----
+
+// iconvg_encoder__initialize prepares self to append to dst, writing the
+// IconVG magic identifier and metadata.
+//
+// viewbox and suggested_palette may be NULL, in which case the file format
+// defaults are used. Metadata equal to those defaults is not written.
+//
+// The caller is responsible for ensuring that dst remains valid while self is
+// in use. The iconvg_encoder__etc functions return the same error, once one
+// has occurred, without writing anything further.
+const char*  //
+iconvg_encoder__initialize(iconvg_encoder* self,
+                           iconvg_growable_buffer* dst,
+                           const iconvg_rectangle_f32* viewbox,
+                           const iconvg_palette* suggested_palette);
+
+// iconvg_encoder__begin_drawing_flat_color starts a drawing whose paint is the
+// given (alpha-premultiplied) color.
+//
+// Consecutive drawings that share a color also share its encoding: the color
+// is only written once.
+const char*  //
+iconvg_encoder__begin_drawing_flat_color(iconvg_encoder* self,
+                                         iconvg_premul_color color);
+
+// iconvg_encoder__begin_drawing_gradient starts a drawing whose paint is a
+// linear or radial gradient with num_stops color/offset stops. num_stops must
+// be at most 58, so that the stop offsets and transformation matrix fit in the
+// IconVG number registers.
+//
+// stop_offsets must be in the range 0.0 ..= 1.0 inclusive.
+//
+// The transformation matrix converts from src (graphic or viewbox) coordinate
+// space to pattern coordinate space. Note that this is the inverse direction
+// of the dst-to-pattern matrix returned by
+// iconvg_paint__gradient_transformation_matrix when decoding.
+const char*  //
+iconvg_encoder__begin_drawing_gradient(
+    iconvg_encoder* self,
+    bool radial,
+    iconvg_gradient_spread spread,
+    uint32_t num_stops,
+    const iconvg_premul_color* stop_colors,
+    const float* stop_offsets,
+    iconvg_matrix_2x3_f64 transformation_matrix);
+
+// iconvg_encoder__end_drawing ends the drawing started by the most recent
+// iconvg_encoder__begin_drawing_etc call. Any path must already be ended.
+const char*  //
+iconvg_encoder__end_drawing(iconvg_encoder* self);
+
+// iconvg_encoder__begin_path starts a path (a move_to) at (x0, y0).
+const char*  //
+iconvg_encoder__begin_path(iconvg_encoder* self, float x0, float y0);
+
+// iconvg_encoder__end_path closes the current path.
+const char*  //
+iconvg_encoder__end_path(iconvg_encoder* self);
+
+// iconvg_encoder__path_line_to adds a line segment to the current path.
+const char*  //
+iconvg_encoder__path_line_to(iconvg_encoder* self, float x1, float y1);
+
+// iconvg_encoder__path_quad_to adds a quadratic Bézier segment to the current
+// path.
+const char*  //
+iconvg_encoder__path_quad_to(iconvg_encoder* self,
+                             float x1,
+                             float y1,
+                             float x2,
+                             float y2);
+
+// iconvg_encoder__path_cube_to adds a cubic Bézier segment to the current
+// path.
+const char*  //
+iconvg_encoder__path_cube_to(iconvg_encoder* self,
+                             float x1,
+                             float y1,
+                             float x2,
+                             float y2,
+                             float x3,
+                             float y3);
+
+// iconvg_encoder__path_arc_to adds an elliptical arc segment to the current
+// path, with the same parameters as the SVG path "A" command except that
+// x_axis_rotation is measured in turns (1 turn is 360 degrees), not degrees.
+const char*  //
+iconvg_encoder__path_arc_to(iconvg_encoder* self,
+                            float radius_x,
+                            float radius_y,
+                            float x_axis_rotation,
+                            bool large_arc,
+                            bool sweep,
+                            float final_x,
+                            float final_y);
+
+// iconvg_encoder__finish returns an error if a drawing is still in progress.
+// On success, the encoded IconVG data is in the dst buffer.
+const char*  //
+iconvg_encoder__finish(iconvg_encoder* self);
+
 // ----
 
 // iconvg_paint__type returns what type of paint self is.
@@ -547,6 +1265,39 @@ iconvg_paint__gradient_stop_offset(const iconvg_paint* self,
 iconvg_matrix_2x3_f64  //
 iconvg_paint__gradient_transformation_matrix(const iconvg_paint* self);
 
+// iconvg_paint__snapshot sets *dst to a copy of self that no longer refers to
+// the decoder's state, so that it stays valid after the iconvg_canvas_vtable
+// method that was passed self returns. It returns the number of leading bytes
+// of *dst that are meaningful, which is at most sizeof(iconvg_paint_snapshot).
+//
+// If self or dst is NULL then it returns zero and *dst is unchanged.
+size_t  //
+iconvg_paint__snapshot(const iconvg_paint* self, iconvg_paint_snapshot* dst);
+
+// iconvg_paint__source_position returns which drawing self is for, and the
+// bytes of the IconVG source that produced it. Canvases can use this in their
+// end_drawing method to attribute or cache work per drawing, not per file.
+//
+// If self is NULL then the result is all zeroes. It is also all zeroes for
+// paints that did not come from iconvg_decode, such as when replaying traces.
+iconvg_source_position  //
+iconvg_paint__source_position(const iconvg_paint* self);
+
+// iconvg_paint__palette_dependencies returns the set of custom palette indices
+// that self's colors (its flat color or its gradient stops) depend on. Bit i
+// of the result is set if changing custom palette entry i (an
+// iconvg_decode_options palette entry or, without one, the suggested palette)
+// can change what self looks like.
+//
+// The set is tracked through the CREG registers, including CREG values that
+// refer to other CREG values and blends of two colors. It is conservative: a
+// bit may be set even if the palette entry ends up making no difference.
+//
+// If self is NULL then it returns zero. It also returns zero for paints that
+// did not come from iconvg_decode, such as when replaying traces.
+uint64_t  //
+iconvg_paint__palette_dependencies(const iconvg_paint* self);
+
 // ----
 
 // iconvg_matrix_2x3_f64__inverse returns self's inverse.
@@ -605,6 +1356,7 @@ make_skia_canvas(SkCanvas* sc) {
 // -------------------------------- #include "./aaa_private.h"
 
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define ICONVG_PRIVATE_TRY(err_msg)                   \
@@ -619,6 +1371,11 @@ make_skia_canvas(SkCanvas* sc) {
 
 extern const char iconvg_private_internal_error_unreachable[];
 
+// iconvg_private_error_from_string returns the iconvg_error_etc constant whose
+// message equals s, or NULL if there is no such constant.
+const char*  //
+iconvg_private_error_from_string(const char* s);
+
 // ----
 
 static inline uint16_t  //
@@ -640,6 +1397,26 @@ iconvg_private_poke_u32le(uint8_t* p, uint32_t x) {
   p[3] = (uint8_t)(x >> 24);
 }
 
+static inline uint64_t  //
+iconvg_private_peek_u64le(const uint8_t* p) {
+  return ((uint64_t)(p[0]) << 0) | ((uint64_t)(p[1]) << 8) |
+         ((uint64_t)(p[2]) << 16) | ((uint64_t)(p[3]) << 24) |
+         ((uint64_t)(p[4]) << 32) | ((uint64_t)(p[5]) << 40) |
+         ((uint64_t)(p[6]) << 48) | ((uint64_t)(p[7]) << 56);
+}
+
+static inline void  //
+iconvg_private_poke_u64le(uint8_t* p, uint64_t x) {
+  p[0] = (uint8_t)(x >> 0);
+  p[1] = (uint8_t)(x >> 8);
+  p[2] = (uint8_t)(x >> 16);
+  p[3] = (uint8_t)(x >> 24);
+  p[4] = (uint8_t)(x >> 32);
+  p[5] = (uint8_t)(x >> 40);
+  p[6] = (uint8_t)(x >> 48);
+  p[7] = (uint8_t)(x >> 56);
+}
+
 static inline float  //
 iconvg_private_reinterpret_from_u32_to_f32(uint32_t u) {
   float f = 0;
@@ -649,6 +1426,63 @@ iconvg_private_reinterpret_from_u32_to_f32(uint32_t u) {
   return f;
 }
 
+static inline uint32_t  //
+iconvg_private_reinterpret_from_f32_to_u32(float f) {
+  uint32_t u = 0;
+  if (sizeof(uint32_t) == sizeof(float)) {
+    memcpy(&u, &f, sizeof(uint32_t));
+  }
+  return u;
+}
+
+static inline double  //
+iconvg_private_reinterpret_from_u64_to_f64(uint64_t u) {
+  double f = 0;
+  if (sizeof(uint64_t) == sizeof(double)) {
+    memcpy(&f, &u, sizeof(uint64_t));
+  }
+  return f;
+}
+
+static inline uint64_t  //
+iconvg_private_reinterpret_from_f64_to_u64(double f) {
+  uint64_t u = 0;
+  if (sizeof(uint64_t) == sizeof(double)) {
+    memcpy(&u, &f, sizeof(uint64_t));
+  }
+  return u;
+}
+
+// ----
+
+const char*  //
+iconvg_private_growable_buffer__reserve(iconvg_growable_buffer* b, size_t n);
+
+// A path buffer is a growable buffer of path records. Each record is a 1 byte
+// opcode (the iconvg_canvas_vtable function pointer index, as per the trace
+// format) followed by that function's float arguments.
+
+#define ICONVG_PRIVATE_PATH_OP__BEGIN_PATH 0x05
+#define ICONVG_PRIVATE_PATH_OP__END_PATH 0x06
+#define ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO 0x07
+#define ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO 0x08
+#define ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO 0x09
+
+const char*  //
+iconvg_private_path_buffer__append(iconvg_growable_buffer* b,
+                                   uint8_t op,
+                                   const float* args,
+                                   size_t num_args);
+
+// iconvg_private_path_buffer__replay calls c's path methods for the ptr[0 ..
+// len] path records, translated by (dx, dy).
+const char*  //
+iconvg_private_path_buffer__replay(const uint8_t* ptr,
+                                   size_t len,
+                                   iconvg_canvas* c,
+                                   float dx,
+                                   float dy);
+
 // ----
 
 static inline size_t  //
@@ -673,6 +1507,68 @@ iconvg_private_default_viewbox() {
 
 // ----
 
+// iconvg_private_matrix_2x3_f64__mul returns the matrix that applies b and
+// then a.
+static inline iconvg_matrix_2x3_f64  //
+iconvg_private_matrix_2x3_f64__mul(const iconvg_matrix_2x3_f64* a,
+                                   const iconvg_matrix_2x3_f64* b) {
+  return iconvg_make_matrix_2x3_f64(
+      (a->elems[0][0] * b->elems[0][0]) + (a->elems[0][1] * b->elems[1][0]),
+      (a->elems[0][0] * b->elems[0][1]) + (a->elems[0][1] * b->elems[1][1]),
+      (a->elems[0][0] * b->elems[0][2]) + (a->elems[0][1] * b->elems[1][2]) +
+          a->elems[0][2],
+      (a->elems[1][0] * b->elems[0][0]) + (a->elems[1][1] * b->elems[1][0]),
+      (a->elems[1][0] * b->elems[0][1]) + (a->elems[1][1] * b->elems[1][1]),
+      (a->elems[1][0] * b->elems[0][2]) + (a->elems[1][1] * b->elems[1][2]) +
+          a->elems[1][2]);
+}
+
+static inline iconvg_matrix_2x3_f64  //
+iconvg_private_identity_matrix_2x3_f64() {
+  return iconvg_make_matrix_2x3_f64(1.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+}
+
+// ----
+
+// iconvg_private_decode_options__dst_transform returns options' dst_transform
+// field, or NULL if options is NULL or predates that field.
+static inline const iconvg_matrix_2x3_f64*  //
+iconvg_private_decode_options__dst_transform(
+    const iconvg_decode_options* options) {
+  if (!options || (options->sizeof__iconvg_decode_options <
+                   (offsetof(iconvg_decode_options, dst_transform) +
+                    sizeof(options->dst_transform)))) {
+    return NULL;
+  }
+  return options->dst_transform;
+}
+
+// iconvg_private_decode_options__cull_rect returns options' cull_rect field,
+// or NULL if options is NULL or predates that field.
+static inline const iconvg_rectangle_f32*  //
+iconvg_private_decode_options__cull_rect(const iconvg_decode_options* options) {
+  if (!options || (options->sizeof__iconvg_decode_options <
+                   (offsetof(iconvg_decode_options, cull_rect) +
+                    sizeof(options->cull_rect)))) {
+    return NULL;
+  }
+  return options->cull_rect;
+}
+
+// iconvg_private_make_transform_canvas returns an iconvg_canvas that applies
+// *m to every path point before forwarding the call on to wrapped.
+iconvg_canvas  //
+iconvg_private_make_transform_canvas(iconvg_canvas* wrapped,
+                                     const iconvg_matrix_2x3_f64* m);
+
+// iconvg_private_transform_rectangle sets *r to the bounding box of *r
+// transformed by *m, returning false if *m is not finite and invertible.
+bool  //
+iconvg_private_transform_rectangle(iconvg_rectangle_f32* r,
+                                   const iconvg_matrix_2x3_f64* m);
+
+// ----
+
 typedef struct iconvg_private_decoder_struct {
   const uint8_t* ptr;
   size_t len;
@@ -750,6 +1646,19 @@ struct iconvg_paint_struct {
   double d2s_bias_x;
   double d2s_scale_y;
   double d2s_bias_y;
+
+  // inverse_dst_transform is the inverse of the iconvg_decode_options
+  // dst_transform, mapping dst coordinates back to where they would be without
+  // that transform. It is the identity matrix if there is no dst_transform.
+  iconvg_matrix_2x3_f64 inverse_dst_transform;
+
+  // source_position is updated by the decoder before each end_drawing call.
+  iconvg_source_position source_position;
+
+  // palette_dependencies is the set of custom palette indices (bit i means
+  // index i) that this paint's colors depend on, tracked through CREG writes
+  // and blends. The decoder sets it when a drawing starts.
+  uint64_t palette_dependencies;
 };
 
 // ----
@@ -770,6 +1679,23 @@ iconvg_private_path_arc_to(iconvg_canvas* c,
                            float final_x,
                            float final_y);
 
+// iconvg_private_arc_bounds sets dst_bounds[0 .. 4] to the min_x, min_y,
+// max_x and max_y of the ellipse that iconvg_private_path_arc_to, with the
+// same arguments, draws part of. It returns false (and sets nothing) for a
+// zero radius or a non-finite result, when that function draws a straight
+// line.
+bool  //
+iconvg_private_arc_bounds(double* dst_bounds,
+                          float initial_x,
+                          float initial_y,
+                          float radius_x,
+                          float radius_y,
+                          float x_axis_rotation,
+                          bool large_arc,
+                          bool sweep,
+                          float final_x,
+                          float final_y);
+
 // -------------------------------- #include "./arc.c"
 
 // iconvg_private_angle returns the angle between two vectors u and v.
@@ -954,8 +1880,18 @@ iconvg_private_path_arc_to(iconvg_canvas* c,
   // https://www.w3.org/TR/SVG/implnote.html#ArcConversionEndpointToCenter
   // algorithm. What follows below is specific to this implementation.
 
+  // Extreme (e.g. infinite) coordinates or radii can overflow the arithmetic
+  // above, producing NaNs. Fall back to a straight line. This also keeps the
+  // (int) conversion below well-defined, bounding n to at most 4.
+  if (!isfinite(cx) || !isfinite(cy) || !isfinite(theta1) ||
+      !isfinite(delta_theta)) {
+    return (*c->vtable->path_line_to)(c,                             //
+                                      (final_x * scale_x) + bias_x,  //
+                                      (final_y * scale_y) + bias_y);
+  }
+
   // We approximate an arc by one or more cubic Bézier curves.
-  int n = (int)(ceil(abs(delta_theta) / ((pi / 2) + 0.001)));
+  int n = (int)(ceil(fabs(delta_theta) / ((pi / 2) + 0.001)));
   double inv_n = 1.0 / ((double)n);
   for (int i = 0; i < n; i++) {
     ICONVG_PRIVATE_TRY(iconvg_private_path_arc_segment_to(
@@ -967,41 +1903,446 @@ iconvg_private_path_arc_to(iconvg_canvas* c,
   return NULL;
 }
 
-// -------------------------------- #include "./broken.c"
-
-static const char*  //
-iconvg_private_broken_canvas__begin_decode(iconvg_canvas* c,
-                                           iconvg_rectangle_f32 dst_rect) {
-  return ((const char*)(c->context_const_ptr));
-}
-
-static const char*  //
-iconvg_private_broken_canvas__end_decode(iconvg_canvas* c,
-                                         const char* err_msg,
-                                         size_t num_bytes_consumed,
-                                         size_t num_bytes_remaining) {
-  return err_msg ? err_msg : ((const char*)(c->context_const_ptr));
-}
+bool  //
+iconvg_private_arc_bounds(double* dst_bounds,
+                          float initial_x,
+                          float initial_y,
+                          float radius_x,
+                          float radius_y,
+                          float x_axis_rotation,
+                          bool large_arc,
+                          bool sweep,
+                          float final_x,
+                          float final_y) {
+  const double tau = 6.2831853071795864769252867665590057683943;  // τ = 2*π
 
-static const char*  //
-iconvg_private_broken_canvas__begin_drawing(iconvg_canvas* c) {
-  return ((const char*)(c->context_const_ptr));
-}
+  // This follows steps 1, 2 and 3 of iconvg_private_path_arc_to.
+  double rx = fabs((double)radius_x);
+  double ry = fabs((double)radius_y);
+  if (!(rx > 0) || !(ry > 0)) {
+    return false;
+  }
+  double x1 = (double)initial_x;
+  double y1 = (double)initial_y;
+  double x2 = (double)final_x;
+  double y2 = (double)final_y;
+  double phi = tau * ((double)x_axis_rotation);
 
-static const char*  //
-iconvg_private_broken_canvas__end_drawing(iconvg_canvas* c,
-                                          const iconvg_paint* p) {
-  return ((const char*)(c->context_const_ptr));
-}
+  double half_dx = (x1 - x2) / 2;
+  double half_dy = (y1 - y2) / 2;
+  double cos_phi = cos(phi);
+  double sin_phi = sin(phi);
+  double x1_prime = +(cos_phi * half_dx) + (sin_phi * half_dy);
+  double y1_prime = -(sin_phi * half_dx) + (cos_phi * half_dy);
 
-static const char*  //
-iconvg_private_broken_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
-  return ((const char*)(c->context_const_ptr));
-}
+  double rx_sq = rx * rx;
+  double ry_sq = ry * ry;
+  double x1_prime_sq = x1_prime * x1_prime;
+  double y1_prime_sq = y1_prime * y1_prime;
+  double radii_check = (x1_prime_sq / rx_sq) + (y1_prime_sq / ry_sq);
+  if (radii_check > 1) {
+    double s = sqrt(radii_check);
+    rx *= s;
+    ry *= s;
+    rx_sq = rx * rx;
+    ry_sq = ry * ry;
+  }
 
-static const char*  //
-iconvg_private_broken_canvas__end_path(iconvg_canvas* c) {
-  return ((const char*)(c->context_const_ptr));
+  double denom = (rx_sq * y1_prime_sq) + (ry_sq * x1_prime_sq);
+  double step2 = 0.0;
+  double a = ((rx_sq * ry_sq) / denom) - 1.0;
+  if (a > 0.0) {
+    step2 = sqrt(a);
+  }
+  if (large_arc == sweep) {
+    step2 = -step2;
+  }
+  double cx_prime = +(step2 * rx * y1_prime) / ry;
+  double cy_prime = -(step2 * ry * x1_prime) / rx;
+
+  double cx = +(cos_phi * cx_prime) - (sin_phi * cy_prime) + ((x1 + x2) / 2);
+  double cy = +(sin_phi * cx_prime) + (cos_phi * cy_prime) + ((y1 + y2) / 2);
+
+  // The ellipse's axis-aligned bounding box is centered on (cx, cy), with
+  // half-width hw and half-height hh.
+  double hw = sqrt((rx_sq * cos_phi * cos_phi) + (ry_sq * sin_phi * sin_phi));
+  double hh = sqrt((rx_sq * sin_phi * sin_phi) + (ry_sq * cos_phi * cos_phi));
+  if (!isfinite(cx) || !isfinite(cy) || !isfinite(hw) || !isfinite(hh)) {
+    return false;
+  }
+  dst_bounds[0] = cx - hw;
+  dst_bounds[1] = cy - hh;
+  dst_bounds[2] = cx + hw;
+  dst_bounds[3] = cy + hh;
+  return true;
+}
+
+// -------------------------------- #include "./batch.c"
+
+// The containment canvas checks whether every path point (including control
+// points, whose convex hull contains the curve) lies within the rectangle
+// pointed to by context_nonconst_ptr0. That rectangle is set by begin_decode,
+// so that it accounts for any dst_transform. It stops the decode, returning
+// iconvg_private_batch_needs_clip, as soon as one does not.
+
+static const char iconvg_private_batch_needs_clip[] =  //
+    "iconvg: internal: batch item needs a clip";
+
+static inline const char*  //
+iconvg_private_containment_canvas__check(iconvg_canvas* c,
+                                         const float* xy,
+                                         size_t num_points) {
+  const iconvg_rectangle_f32* r =
+      (const iconvg_rectangle_f32*)(c->context_nonconst_ptr0);
+  for (size_t i = 0; i < num_points; i++) {
+    float x = xy[(2 * i) + 0];
+    float y = xy[(2 * i) + 1];
+    // Written so that NaNs need a clip.
+    if (!((r->min_x <= x) && (x <= r->max_x) &&  //
+          (r->min_y <= y) && (y <= r->max_y))) {
+      return iconvg_private_batch_needs_clip;
+    }
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__begin_decode(iconvg_canvas* c,
+                                                iconvg_rectangle_f32 dst_rect) {
+  *((iconvg_rectangle_f32*)(c->context_nonconst_ptr0)) = dst_rect;
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__end_decode(iconvg_canvas* c,
+                                              const char* err_msg,
+                                              size_t num_bytes_consumed,
+                                              size_t num_bytes_remaining) {
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__begin_drawing(iconvg_canvas* c) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__end_drawing(iconvg_canvas* c,
+                                               const iconvg_paint* p) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__begin_path(iconvg_canvas* c,
+                                              float x0,
+                                              float y0) {
+  float xy[2] = {x0, y0};
+  return iconvg_private_containment_canvas__check(c, xy, 1);
+}
+
+static const char*  //
+iconvg_private_containment_canvas__end_path(iconvg_canvas* c) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__path_line_to(iconvg_canvas* c,
+                                                float x1,
+                                                float y1) {
+  float xy[2] = {x1, y1};
+  return iconvg_private_containment_canvas__check(c, xy, 1);
+}
+
+static const char*  //
+iconvg_private_containment_canvas__path_quad_to(iconvg_canvas* c,
+                                                float x1,
+                                                float y1,
+                                                float x2,
+                                                float y2) {
+  float xy[4] = {x1, y1, x2, y2};
+  return iconvg_private_containment_canvas__check(c, xy, 2);
+}
+
+static const char*  //
+iconvg_private_containment_canvas__path_cube_to(iconvg_canvas* c,
+                                                float x1,
+                                                float y1,
+                                                float x2,
+                                                float y2,
+                                                float x3,
+                                                float y3) {
+  float xy[6] = {x1, y1, x2, y2, x3, y3};
+  return iconvg_private_containment_canvas__check(c, xy, 3);
+}
+
+static const char*  //
+iconvg_private_containment_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  return NULL;
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_containment_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_containment_canvas__begin_decode,
+        &iconvg_private_containment_canvas__end_decode,
+        &iconvg_private_containment_canvas__begin_drawing,
+        &iconvg_private_containment_canvas__end_drawing,
+        &iconvg_private_containment_canvas__begin_path,
+        &iconvg_private_containment_canvas__end_path,
+        &iconvg_private_containment_canvas__path_line_to,
+        &iconvg_private_containment_canvas__path_quad_to,
+        &iconvg_private_containment_canvas__path_cube_to,
+        &iconvg_private_containment_canvas__on_metadata_viewbox,
+        &iconvg_private_containment_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// ----
+
+// The session canvas forwards every call to the iconvg_canvas pointed to by
+// context_nonconst_ptr0, other than begin_decode and end_decode. Those are
+// made once per iconvg_decode_batch call, not once per item.
+
+static const char*  //
+iconvg_private_session_canvas__begin_decode(iconvg_canvas* c,
+                                            iconvg_rectangle_f32 dst_rect) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_session_canvas__end_decode(iconvg_canvas* c,
+                                          const char* err_msg,
+                                          size_t num_bytes_consumed,
+                                          size_t num_bytes_remaining) {
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_session_canvas__begin_drawing(iconvg_canvas* c) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->begin_drawing)(w);
+}
+
+static const char*  //
+iconvg_private_session_canvas__end_drawing(iconvg_canvas* c,
+                                           const iconvg_paint* p) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->end_drawing)(w, p);
+}
+
+static const char*  //
+iconvg_private_session_canvas__begin_path(iconvg_canvas* c,
+                                          float x0,
+                                          float y0) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->begin_path)(w, x0, y0);
+}
+
+static const char*  //
+iconvg_private_session_canvas__end_path(iconvg_canvas* c) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->end_path)(w);
+}
+
+static const char*  //
+iconvg_private_session_canvas__path_line_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_line_to)(w, x1, y1);
+}
+
+static const char*  //
+iconvg_private_session_canvas__path_quad_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1,
+                                            float x2,
+                                            float y2) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_quad_to)(w, x1, y1, x2, y2);
+}
+
+static const char*  //
+iconvg_private_session_canvas__path_cube_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1,
+                                            float x2,
+                                            float y2,
+                                            float x3,
+                                            float y3) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_cube_to)(w, x1, y1, x2, y2, x3, y3);
+}
+
+static const char*  //
+iconvg_private_session_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->on_metadata_viewbox)(w, viewbox);
+}
+
+static const char*  //
+iconvg_private_session_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->on_metadata_suggested_palette)(w, suggested_palette);
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_session_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_session_canvas__begin_decode,
+        &iconvg_private_session_canvas__end_decode,
+        &iconvg_private_session_canvas__begin_drawing,
+        &iconvg_private_session_canvas__end_drawing,
+        &iconvg_private_session_canvas__begin_path,
+        &iconvg_private_session_canvas__end_path,
+        &iconvg_private_session_canvas__path_line_to,
+        &iconvg_private_session_canvas__path_quad_to,
+        &iconvg_private_session_canvas__path_cube_to,
+        &iconvg_private_session_canvas__on_metadata_viewbox,
+        &iconvg_private_session_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// ----
+
+const char*  //
+iconvg_decode_batch(iconvg_canvas* dst_canvas,
+                    const iconvg_batch_item* items,
+                    size_t num_items,
+                    const char** dst_err_msgs,
+                    const iconvg_decode_options* options) {
+  iconvg_canvas fallback_canvas = iconvg_make_broken_canvas(NULL);
+  if (!dst_canvas || !dst_canvas->vtable) {
+    dst_canvas = &fallback_canvas;
+  }
+  if (dst_canvas->vtable->sizeof__iconvg_canvas_vtable !=
+      sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  } else if (num_items == 0) {
+    return NULL;
+  } else if (!items) {
+    return iconvg_error_invalid_batch_argument;
+  }
+
+  const iconvg_matrix_2x3_f64* t =
+      iconvg_private_decode_options__dst_transform(options);
+  iconvg_rectangle_f32 union_rect;
+  for (size_t i = 0; i < num_items; i++) {
+    iconvg_rectangle_f32 r = items[i].dst_rect;
+    if (t && !iconvg_private_transform_rectangle(&r, t)) {
+      return iconvg_error_invalid_dst_transform;
+    } else if (i == 0) {
+      union_rect = r;
+      continue;
+    }
+    if (union_rect.min_x > r.min_x) {
+      union_rect.min_x = r.min_x;
+    }
+    if (union_rect.min_y > r.min_y) {
+      union_rect.min_y = r.min_y;
+    }
+    if (union_rect.max_x < r.max_x) {
+      union_rect.max_x = r.max_x;
+    }
+    if (union_rect.max_y < r.max_y) {
+      union_rect.max_y = r.max_y;
+    }
+  }
+
+  iconvg_canvas session_canvas;
+  session_canvas.vtable = &iconvg_private_session_canvas_vtable;
+  session_canvas.context_nonconst_ptr0 = dst_canvas;
+  session_canvas.context_nonconst_ptr1 = NULL;
+  session_canvas.context_const_ptr = NULL;
+  session_canvas.context_extra = 0;
+
+  const char* session_err_msg =
+      (*dst_canvas->vtable->begin_decode)(dst_canvas, union_rect);
+  const char* first_err_msg = NULL;
+  for (size_t i = 0; i < num_items; i++) {
+    const iconvg_batch_item* item = &items[i];
+    const char* err_msg = session_err_msg;
+    if (!err_msg) {
+      iconvg_rectangle_f32 containment_rect = item->dst_rect;
+      iconvg_canvas containment_canvas;
+      containment_canvas.vtable = &iconvg_private_containment_canvas_vtable;
+      containment_canvas.context_nonconst_ptr0 = &containment_rect;
+      containment_canvas.context_nonconst_ptr1 = NULL;
+      containment_canvas.context_const_ptr = NULL;
+      containment_canvas.context_extra = 0;
+
+      // If the containment check fails, for whatever reason, fall back to a
+      // nested (clipped) decode. It reports any file format error and paints
+      // whatever a stand-alone iconvg_decode call would.
+      iconvg_canvas* c = &session_canvas;
+      if (iconvg_decode(&containment_canvas, item->dst_rect, item->src_ptr,
+                        item->src_len, options)) {
+        c = dst_canvas;
+      }
+      err_msg = iconvg_decode(c, item->dst_rect, item->src_ptr, item->src_len,
+                              options);
+    }
+    if (dst_err_msgs) {
+      dst_err_msgs[i] = err_msg;
+    }
+    if (!first_err_msg) {
+      first_err_msg = err_msg;
+    }
+  }
+
+  session_err_msg =
+      (*dst_canvas->vtable->end_decode)(dst_canvas, session_err_msg, 0, 0);
+  return session_err_msg ? session_err_msg : first_err_msg;
+}
+
+// -------------------------------- #include "./broken.c"
+
+static const char*  //
+iconvg_private_broken_canvas__begin_decode(iconvg_canvas* c,
+                                           iconvg_rectangle_f32 dst_rect) {
+  return ((const char*)(c->context_const_ptr));
+}
+
+static const char*  //
+iconvg_private_broken_canvas__end_decode(iconvg_canvas* c,
+                                         const char* err_msg,
+                                         size_t num_bytes_consumed,
+                                         size_t num_bytes_remaining) {
+  return err_msg ? err_msg : ((const char*)(c->context_const_ptr));
+}
+
+static const char*  //
+iconvg_private_broken_canvas__begin_drawing(iconvg_canvas* c) {
+  return ((const char*)(c->context_const_ptr));
+}
+
+static const char*  //
+iconvg_private_broken_canvas__end_drawing(iconvg_canvas* c,
+                                          const iconvg_paint* p) {
+  return ((const char*)(c->context_const_ptr));
+}
+
+static const char*  //
+iconvg_private_broken_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  return ((const char*)(c->context_const_ptr));
+}
+
+static const char*  //
+iconvg_private_broken_canvas__end_path(iconvg_canvas* c) {
+  return ((const char*)(c->context_const_ptr));
 }
 
 static const char*  //
@@ -1045,6 +2386,14 @@ iconvg_private_broken_canvas__on_metadata_suggested_palette(
   return ((const char*)(c->context_const_ptr));
 }
 
+static const char*  //
+iconvg_private_broken_canvas__end_drawing_instances(iconvg_canvas* c,
+                                                    const iconvg_paint* p,
+                                                    const float* offsets_xy,
+                                                    size_t num_instances) {
+  return ((const char*)(c->context_const_ptr));
+}
+
 static const iconvg_canvas_vtable  //
     iconvg_private_broken_canvas_vtable = {
         sizeof(iconvg_canvas_vtable),
@@ -1059,6 +2408,7 @@ static const iconvg_canvas_vtable  //
         &iconvg_private_broken_canvas__path_cube_to,
         &iconvg_private_broken_canvas__on_metadata_viewbox,
         &iconvg_private_broken_canvas__on_metadata_suggested_palette,
+        &iconvg_private_broken_canvas__end_drawing_instances,
 };
 
 iconvg_canvas  //
@@ -1078,43 +2428,574 @@ iconvg_canvas__does_nothing(const iconvg_canvas* self) {
          (self->vtable != &iconvg_private_broken_canvas_vtable);
 }
 
-// -------------------------------- #include "./cairo.c"
+// -------------------------------- #include "./buffer.c"
 
-#if !defined(ICONVG_CONFIG__ENABLE_CAIRO_BACKEND)
+const char*  //
+iconvg_private_growable_buffer__reserve(iconvg_growable_buffer* b, size_t n) {
+  if (!b) {
+    return iconvg_error_invalid_buffer_too_small;
+  } else if ((b->cap - b->len) >= n) {
+    return NULL;
+  } else if (!b->grow) {
+    return iconvg_error_invalid_buffer_too_small;
+  }
+  ICONVG_PRIVATE_TRY((*b->grow)(b, n));
+  if ((b->cap - b->len) < n) {
+    return iconvg_error_invalid_buffer_too_small;
+  }
+  return NULL;
+}
 
-iconvg_canvas  //
-iconvg_make_cairo_canvas(cairo_t* cr) {
-  return iconvg_make_broken_canvas(iconvg_error_invalid_backend_not_enabled);
+const char*  //
+iconvg_private_path_buffer__append(iconvg_growable_buffer* b,
+                                   uint8_t op,
+                                   const float* args,
+                                   size_t num_args) {
+  size_t n = 1 + (num_args * sizeof(float));
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(b, n));
+  uint8_t* q = b->ptr + b->len;
+  *q++ = op;
+  if (num_args > 0) {
+    memcpy(q, args, num_args * sizeof(float));
+  }
+  b->len += n;
+  return NULL;
 }
 
-#else  // ICONVG_CONFIG__ENABLE_CAIRO_BACKEND
+const char*  //
+iconvg_private_path_buffer__replay(const uint8_t* ptr,
+                                   size_t len,
+                                   iconvg_canvas* c,
+                                   float dx,
+                                   float dy) {
+  const uint8_t* q = ptr;
+  const uint8_t* q_end = ptr + len;
+  float a[6];
+  while (q < q_end) {
+    uint8_t op = *q++;
+    size_t num_args = 0;
+    switch (op) {
+      case ICONVG_PRIVATE_PATH_OP__BEGIN_PATH:
+      case ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO:
+        num_args = 2;
+        break;
+      case ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO:
+        num_args = 4;
+        break;
+      case ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO:
+        num_args = 6;
+        break;
+    }
+    memcpy(a, q, num_args * sizeof(float));
+    q += num_args * sizeof(float);
+    for (size_t i = 0; i < num_args; i += 2) {
+      a[i + 0] += dx;
+      a[i + 1] += dy;
+    }
 
-#include <cairo/cairo.h>
+    switch (op) {
+      case ICONVG_PRIVATE_PATH_OP__BEGIN_PATH:
+        ICONVG_PRIVATE_TRY((*c->vtable->begin_path)(c, a[0], a[1]));
+        break;
+      case ICONVG_PRIVATE_PATH_OP__END_PATH:
+        ICONVG_PRIVATE_TRY((*c->vtable->end_path)(c));
+        break;
+      case ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO:
+        ICONVG_PRIVATE_TRY((*c->vtable->path_line_to)(c, a[0], a[1]));
+        break;
+      case ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO:
+        ICONVG_PRIVATE_TRY(
+            (*c->vtable->path_quad_to)(c, a[0], a[1], a[2], a[3]));
+        break;
+      case ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO:
+        ICONVG_PRIVATE_TRY((*c->vtable->path_cube_to)(c, a[0], a[1], a[2],
+                                                      a[3], a[4], a[5]));
+        break;
+      default:
+        return iconvg_private_internal_error_unreachable;
+    }
+  }
+  return NULL;
+}
 
-static const cairo_extend_t
-    iconvg_private_gradient_spread_as_cairo_extend_t[4] = {
-        CAIRO_EXTEND_NONE,     //
-        CAIRO_EXTEND_PAD,      //
-        CAIRO_EXTEND_REFLECT,  //
-        CAIRO_EXTEND_REPEAT    //
-};
+// ----
 
-static inline cairo_matrix_t  //
-iconvg_private_matrix_2x3_f64_as_cairo_matrix_t(iconvg_matrix_2x3_f64 i) {
-  cairo_matrix_t c;
-  c.xx = i.elems[0][0];
-  c.xy = i.elems[0][1];
-  c.x0 = i.elems[0][2];
-  c.yx = i.elems[1][0];
-  c.yy = i.elems[1][1];
-  c.y0 = i.elems[1][2];
-  return c;
+const char*  //
+iconvg_growable_buffer__realloc_grow(iconvg_growable_buffer* self,
+                                     size_t min_additional) {
+  if (!self) {
+    return iconvg_error_invalid_buffer_too_small;
+  } else if (min_additional > (SIZE_MAX - self->len)) {
+    return iconvg_error_system_failure_out_of_memory;
+  }
+  size_t new_cap = self->len + min_additional;
+  // Grow geometrically, so that appending N bytes one at a time takes O(N)
+  // time overall instead of O(N*N).
+  if ((self->cap <= (SIZE_MAX / 2)) && (new_cap < (2 * self->cap))) {
+    new_cap = 2 * self->cap;
+  }
+  if (new_cap < 256) {
+    new_cap = 256;
+  }
+  uint8_t* new_ptr = (uint8_t*)realloc(self->ptr, new_cap);
+  if (!new_ptr) {
+    return iconvg_error_system_failure_out_of_memory;
+  }
+  self->ptr = new_ptr;
+  self->cap = new_cap;
+  return NULL;
 }
 
-// iconvg_private_cairo_set_gradient_stops sets the Cairo gradient stop colors
-// given the IconVG gradient stop colors.
+// -------------------------------- #include "./cache.c"
+
+// A raster cache region is laid out as a 64 byte header, an index of
+// num_slots 16 byte slots and then a log (a ring buffer) of entries. All
+// numbers are little-endian.
 //
-// Unlike SVG, IconVG works solely with premultiplied alpha. In contrast,
+// The header is the 8 byte magic, the u64 region length, the u32 num_slots
+// (a power of 2, at least 4), 4 reserved bytes, the u64 log offset, the u64
+// log length and the u64 write position, then 16 reserved bytes. Positions
+// count bytes appended to the log since it was formatted. Position p is at
+// byte offset (p % log_length) of the log.
+//
+// Each slot is a u64 tag (a hash of the key, zero meaning an empty slot) and
+// a u64 one-plus-position (zero meaning an empty slot). A key's slots are the
+// 4 consecutive slots starting at (tag & (num_slots - 4)).
+//
+// Each entry is an 80 byte entry header and then the pixels, tightly packed,
+// padded to a multiple of 16 bytes. The entry header is the u64 position
+// (echoed, so that a stale slot can be detected), the u64 entry length, the
+// key (u64 src_hash, u64 palette_hash, u32 width, u32 height, u32 backend,
+// u32 bytes_per_pixel, u8 subpixel_x, u8 subpixel_y, 2 reserved bytes, then
+// the f32 bits of content_width and of content_height), 12 reserved bytes and
+// then the u64 checksum of the first 72 bytes and the pixels. An entry never
+// straddles the end of the log.
+//
+// The writer advances the write position before over-writing older entries
+// and updates the slot last. Readers do not lock. They re-check the write
+// position after copying the pixels out and verify the checksum, so that an
+// entry that was being over-written (or not yet completely written) is
+// reported as a miss instead of as a hit with torn pixels.
+
+static const uint8_t iconvg_private_raster_cache_magic[8] = {
+    0x8A, 0x49, 0x56, 0x47, 0x52, 0x63, 0x68, 0x03,  // "\x8AIVGRch\x03".
+};
+
+#define ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE 64
+#define ICONVG_PRIVATE_RASTER_CACHE_SLOT_SIZE 16
+#define ICONVG_PRIVATE_RASTER_CACHE_ENTRY_HEADER_SIZE 80
+
+// Make one slot per 1 KiB of region, so that the index is less than 2% of the
+// region. Icons are often small, so their entries are too.
+#define ICONVG_PRIVATE_RASTER_CACHE_BYTES_PER_SLOT 1024
+
+#define ICONVG_PRIVATE_RASTER_CACHE_MIN_LOG_LENGTH 4096
+
+static inline uint64_t  //
+iconvg_private_raster_cache__hash(uint64_t h, const uint8_t* ptr, size_t len) {
+  // This is FNV-1a, over 8 byte words (and then over any trailing bytes)
+  // instead of single bytes.
+  for (; len >= 8; ptr += 8, len -= 8) {
+    h ^= iconvg_private_peek_u64le(ptr);
+    h *= 0x00000100000001B3ull;
+  }
+  for (; len > 0; ptr++, len--) {
+    h ^= *ptr;
+    h *= 0x00000100000001B3ull;
+  }
+  return h;
+}
+
+static inline uint64_t  //
+iconvg_private_raster_cache_key__tag(const iconvg_raster_cache_key* key) {
+  uint8_t b[42];
+  iconvg_private_poke_u64le(&b[0], key->src_hash);
+  iconvg_private_poke_u64le(&b[8], key->palette_hash);
+  iconvg_private_poke_u32le(&b[16], key->width);
+  iconvg_private_poke_u32le(&b[20], key->height);
+  iconvg_private_poke_u32le(&b[24], key->backend);
+  iconvg_private_poke_u32le(&b[28], key->bytes_per_pixel);
+  b[32] = key->subpixel_x;
+  b[33] = key->subpixel_y;
+  iconvg_private_poke_u32le(
+      &b[34], iconvg_private_reinterpret_from_f32_to_u32(key->content_width));
+  iconvg_private_poke_u32le(
+      &b[38], iconvg_private_reinterpret_from_f32_to_u32(key->content_height));
+  uint64_t h = iconvg_raster_cache_hash(&b[0], 42);
+  return h ? h : 1;
+}
+
+// iconvg_private_raster_cache_key__entry_length returns the entry length (a
+// multiple of 16) for key's pixels, or zero if key is invalid or too large.
+static inline uint64_t  //
+iconvg_private_raster_cache_key__entry_length(
+    const iconvg_raster_cache_key* key) {
+  if ((key->width == 0) || (key->height == 0) ||
+      ((key->bytes_per_pixel != 1) && (key->bytes_per_pixel != 4))) {
+    return 0;
+  }
+  uint64_t n = ((uint64_t)(key->width)) * ((uint64_t)(key->height));
+  if (n > (UINT64_MAX / 8)) {
+    return 0;
+  }
+  n *= key->bytes_per_pixel;
+  n += ICONVG_PRIVATE_RASTER_CACHE_ENTRY_HEADER_SIZE + 15;
+  return n & ~((uint64_t)15);
+}
+
+// iconvg_private_raster_cache__fits returns whether a buffer of length len
+// holds height rows of row_length bytes, each row starting stride bytes after
+// the previous one.
+static inline bool  //
+iconvg_private_raster_cache__fits(size_t len,
+                                  size_t stride,
+                                  size_t row_length,
+                                  uint32_t height) {
+  return (stride >= row_length) && (len >= row_length) &&
+         ((height - 1) <= ((len - row_length) / stride));
+}
+
+// iconvg_private_raster_cache__is_valid returns whether self's header is
+// valid, setting *num_slots, *log_offset and *log_length if so.
+static bool  //
+iconvg_private_raster_cache__is_valid(const iconvg_raster_cache* self,
+                                      uint32_t* num_slots,
+                                      uint64_t* log_offset,
+                                      uint64_t* log_length) {
+  if (!self || !self->ptr ||
+      (self->len < ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE) ||
+      memcmp(self->ptr, iconvg_private_raster_cache_magic, 8) ||
+      (iconvg_private_peek_u64le(self->ptr + 8) != self->len)) {
+    return false;
+  }
+  uint32_t n = iconvg_private_peek_u32le(self->ptr + 16);
+  uint64_t o = iconvg_private_peek_u64le(self->ptr + 24);
+  uint64_t l = iconvg_private_peek_u64le(self->ptr + 32);
+  if ((n < 4) || (n & (n - 1)) ||
+      (o != (ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE +
+             (((uint64_t)n) * ICONVG_PRIVATE_RASTER_CACHE_SLOT_SIZE))) ||
+      (l == 0) || (l & 15) || (o > self->len) || (l > (self->len - o))) {
+    return false;
+  }
+  *num_slots = n;
+  *log_offset = o;
+  *log_length = l;
+  return true;
+}
+
+// iconvg_private_place_subpixel__axis quantizes one axis of
+// iconvg_place_subpixel. min and max have already been checked to be finite,
+// ordered and not too far from the origin.
+static void  //
+iconvg_private_place_subpixel__axis(int32_t* dst_whole,
+                                    uint8_t* dst_subpixel,
+                                    uint32_t* dst_size,
+                                    float* dst_content_size,
+                                    float* dst_min,
+                                    float* dst_max,
+                                    float min,
+                                    float max,
+                                    uint32_t num_phases) {
+  // Round to the nearest phase, carrying into the whole pixel part when that
+  // rounds up to the next pixel.
+  double whole = floor((double)min);
+  uint32_t phase =
+      (uint32_t)(((((double)min) - whole) * ((double)num_phases)) + 0.5);
+  if (phase >= num_phases) {
+    phase = 0;
+    whole += 1.0;
+  }
+  uint32_t subpixel = (phase * 256) / num_phases;
+  float offset = ((float)subpixel) / 256.0f;
+  float size = max - min;
+
+  *dst_whole = (int32_t)whole;
+  *dst_subpixel = (uint8_t)subpixel;
+  *dst_size = (uint32_t)ceil((double)offset + (double)size);
+  *dst_content_size = size;
+  *dst_min = offset;
+  *dst_max = offset + size;
+}
+
+// ----
+
+uint64_t  //
+iconvg_raster_cache_hash(const uint8_t* ptr, size_t len) {
+  return iconvg_private_raster_cache__hash(0xCBF29CE484222325ull,
+                                           ptr ? ptr : (const uint8_t*)"",
+                                           ptr ? len : 0);
+}
+
+const char*  //
+iconvg_place_subpixel(iconvg_subpixel_placement* dst_placement,
+                      iconvg_rectangle_f32 dst_rect,
+                      uint32_t num_phases_x,
+                      uint32_t num_phases_y) {
+  // The 0x1p30 bound keeps every whole pixel position and size within an
+  // int32_t.
+  const float limit = 1073741824.0f;
+  if (!dst_placement ||
+      !iconvg_rectangle_f32__is_finite_and_not_empty(&dst_rect) ||
+      !(dst_rect.min_x >= -limit) || !(dst_rect.max_x <= +limit) ||
+      !(dst_rect.min_y >= -limit) || !(dst_rect.max_y <= +limit) ||
+      (num_phases_x < 1) || (num_phases_x > 256) ||  //
+      (num_phases_y < 1) || (num_phases_y > 256)) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+  iconvg_subpixel_placement* p = dst_placement;
+  iconvg_private_place_subpixel__axis(
+      &p->dst_x, &p->subpixel_x, &p->width, &p->content_width,
+      &p->dst_rect.min_x, &p->dst_rect.max_x, dst_rect.min_x, dst_rect.max_x,
+      num_phases_x);
+  iconvg_private_place_subpixel__axis(
+      &p->dst_y, &p->subpixel_y, &p->height, &p->content_height,
+      &p->dst_rect.min_y, &p->dst_rect.max_y, dst_rect.min_y, dst_rect.max_y,
+      num_phases_y);
+  return NULL;
+}
+
+const char*  //
+iconvg_raster_cache__open_for_writing(iconvg_raster_cache* self) {
+  if (!self || !self->ptr) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+  uint32_t num_slots;
+  uint64_t log_offset;
+  uint64_t log_length;
+  if (iconvg_private_raster_cache__is_valid(self, &num_slots, &log_offset,
+                                            &log_length)) {
+    return NULL;
+  }
+
+  uint64_t n = self->len / ICONVG_PRIVATE_RASTER_CACHE_BYTES_PER_SLOT;
+  num_slots = 4;
+  while ((num_slots < 0x40000000) && ((num_slots * 2) <= n)) {
+    num_slots *= 2;
+  }
+  log_offset = ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE +
+               (((uint64_t)num_slots) * ICONVG_PRIVATE_RASTER_CACHE_SLOT_SIZE);
+  if (self->len < (log_offset + ICONVG_PRIVATE_RASTER_CACHE_MIN_LOG_LENGTH)) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+  log_length = (self->len - log_offset) & ~((uint64_t)15);
+
+  // Write the magic last, so that a concurrent reader does not see a
+  // partially formatted region as valid.
+  memset(self->ptr, 0, (size_t)log_offset);
+  iconvg_private_poke_u64le(self->ptr + 8, self->len);
+  iconvg_private_poke_u32le(self->ptr + 16, num_slots);
+  iconvg_private_poke_u64le(self->ptr + 24, log_offset);
+  iconvg_private_poke_u64le(self->ptr + 32, log_length);
+  iconvg_private_poke_u64le(self->ptr + 40, 0);
+  memcpy(self->ptr, iconvg_private_raster_cache_magic, 8);
+  return NULL;
+}
+
+bool  //
+iconvg_raster_cache__lookup(const iconvg_raster_cache* self,
+                            const iconvg_raster_cache_key* key,
+                            uint8_t* dst_ptr,
+                            size_t dst_len,
+                            size_t dst_stride) {
+  uint32_t num_slots;
+  uint64_t log_offset;
+  uint64_t log_length;
+  if (!key || !dst_ptr ||
+      !iconvg_private_raster_cache__is_valid(self, &num_slots, &log_offset,
+                                             &log_length)) {
+    return false;
+  }
+  // The entry length is at most the log length, which is less than self->len,
+  // so row_length cannot overflow.
+  uint64_t entry_length = iconvg_private_raster_cache_key__entry_length(key);
+  if ((entry_length == 0) || (entry_length > log_length)) {
+    return false;
+  }
+  size_t row_length = ((size_t)(key->width)) * key->bytes_per_pixel;
+  if (!iconvg_private_raster_cache__fits(dst_len, dst_stride, row_length,
+                                         key->height)) {
+    return false;
+  }
+
+  uint64_t tag = iconvg_private_raster_cache_key__tag(key);
+  const uint8_t* slots = self->ptr + ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE;
+  uint32_t s0 = ((uint32_t)tag) & (num_slots - 4);
+  for (uint32_t s = s0; s < (s0 + 4); s++) {
+    const uint8_t* slot = slots + (s * ICONVG_PRIVATE_RASTER_CACHE_SLOT_SIZE);
+    uint64_t pos = iconvg_private_peek_u64le(slot + 8) - 1;
+    if ((iconvg_private_peek_u64le(slot + 0) != tag) || (pos == UINT64_MAX)) {
+      continue;
+    }
+    uint64_t write_pos = iconvg_private_peek_u64le(self->ptr + 40);
+    if ((pos >= write_pos) || ((write_pos - pos) > log_length) ||
+        ((log_length - (pos % log_length)) < entry_length)) {
+      continue;
+    }
+
+    const uint8_t* e = self->ptr + log_offset + (pos % log_length);
+    if ((iconvg_private_peek_u64le(e + 0) != pos) ||
+        (iconvg_private_peek_u64le(e + 8) != entry_length) ||
+        (iconvg_private_peek_u64le(e + 16) != key->src_hash) ||
+        (iconvg_private_peek_u64le(e + 24) != key->palette_hash) ||
+        (iconvg_private_peek_u32le(e + 32) != key->width) ||
+        (iconvg_private_peek_u32le(e + 36) != key->height) ||
+        (iconvg_private_peek_u32le(e + 40) != key->backend) ||
+        (iconvg_private_peek_u32le(e + 44) != key->bytes_per_pixel) ||
+        (e[48] != key->subpixel_x) || (e[49] != key->subpixel_y) ||
+        (iconvg_private_peek_u32le(e + 52) !=
+         iconvg_private_reinterpret_from_f32_to_u32(key->content_width)) ||
+        (iconvg_private_peek_u32le(e + 56) !=
+         iconvg_private_reinterpret_from_f32_to_u32(key->content_height))) {
+      continue;
+    }
+    uint64_t checksum = iconvg_private_peek_u64le(e + 72);
+
+    // Copy the pixels out, then check that what was copied is what was
+    // written and that it was not over-written in the meantime.
+    uint64_t h = iconvg_raster_cache_hash(e, 72);
+    const uint8_t* src = e + ICONVG_PRIVATE_RASTER_CACHE_ENTRY_HEADER_SIZE;
+    uint8_t* dst = dst_ptr;
+    for (uint32_t y = 0; y < key->height; y++) {
+      memcpy(dst, src, row_length);
+      h = iconvg_private_raster_cache__hash(h, dst, row_length);
+      src += row_length;
+      dst += dst_stride;
+    }
+    write_pos = iconvg_private_peek_u64le(self->ptr + 40);
+    if ((h == checksum) && ((write_pos - pos) <= log_length)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const char*  //
+iconvg_raster_cache__insert(iconvg_raster_cache* self,
+                            const iconvg_raster_cache_key* key,
+                            const uint8_t* src_ptr,
+                            size_t src_len,
+                            size_t src_stride) {
+  uint32_t num_slots;
+  uint64_t log_offset;
+  uint64_t log_length;
+  if (!key || !src_ptr ||
+      !iconvg_private_raster_cache__is_valid(self, &num_slots, &log_offset,
+                                             &log_length)) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+  uint64_t entry_length = iconvg_private_raster_cache_key__entry_length(key);
+  if ((entry_length == 0) || (entry_length > log_length)) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+  size_t row_length = ((size_t)(key->width)) * key->bytes_per_pixel;
+  if (!iconvg_private_raster_cache__fits(src_len, src_stride, row_length,
+                                         key->height)) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+
+  // Reserve room in the log, skipping any tail that is too short. Advancing
+  // the write position first marks any older entries in that room as stale.
+  uint64_t pos = iconvg_private_peek_u64le(self->ptr + 40);
+  uint64_t offset = pos % log_length;
+  if ((log_length - offset) < entry_length) {
+    pos += log_length - offset;
+    offset = 0;
+  }
+  iconvg_private_poke_u64le(self->ptr + 40, pos + entry_length);
+
+  uint8_t* e = self->ptr + log_offset + offset;
+  iconvg_private_poke_u64le(e + 0, pos);
+  iconvg_private_poke_u64le(e + 8, entry_length);
+  iconvg_private_poke_u64le(e + 16, key->src_hash);
+  iconvg_private_poke_u64le(e + 24, key->palette_hash);
+  iconvg_private_poke_u32le(e + 32, key->width);
+  iconvg_private_poke_u32le(e + 36, key->height);
+  iconvg_private_poke_u32le(e + 40, key->backend);
+  iconvg_private_poke_u32le(e + 44, key->bytes_per_pixel);
+  e[48] = key->subpixel_x;
+  e[49] = key->subpixel_y;
+  memset(e + 50, 0, 2);
+  iconvg_private_poke_u32le(
+      e + 52, iconvg_private_reinterpret_from_f32_to_u32(key->content_width));
+  iconvg_private_poke_u32le(
+      e + 56, iconvg_private_reinterpret_from_f32_to_u32(key->content_height));
+  memset(e + 60, 0, 12);
+  uint64_t h = iconvg_raster_cache_hash(e, 72);
+  uint8_t* dst = e + ICONVG_PRIVATE_RASTER_CACHE_ENTRY_HEADER_SIZE;
+  const uint8_t* src = src_ptr;
+  for (uint32_t y = 0; y < key->height; y++) {
+    memcpy(dst, src, row_length);
+    h = iconvg_private_raster_cache__hash(h, dst, row_length);
+    src += src_stride;
+    dst += row_length;
+  }
+  iconvg_private_poke_u64le(e + 72, h);
+
+  // Pick a slot: one with the same tag, an empty or stale one or, failing
+  // that, the one with the oldest entry.
+  uint64_t tag = iconvg_private_raster_cache_key__tag(key);
+  uint8_t* slots = self->ptr + ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE;
+  uint32_t s0 = ((uint32_t)tag) & (num_slots - 4);
+  uint8_t* slot = NULL;
+  uint64_t oldest = UINT64_MAX;
+  for (uint32_t s = s0; s < (s0 + 4); s++) {
+    uint8_t* t = slots + (s * ICONVG_PRIVATE_RASTER_CACHE_SLOT_SIZE);
+    uint64_t one_plus_pos = iconvg_private_peek_u64le(t + 8);
+    if (iconvg_private_peek_u64le(t + 0) == tag) {
+      slot = t;
+      break;
+    } else if ((one_plus_pos == 0) ||
+               ((pos + entry_length - (one_plus_pos - 1)) > log_length)) {
+      one_plus_pos = 0;
+    }
+    if (oldest > one_plus_pos) {
+      oldest = one_plus_pos;
+      slot = t;
+    }
+  }
+  iconvg_private_poke_u64le(slot + 0, 0);
+  iconvg_private_poke_u64le(slot + 8, pos + 1);
+  iconvg_private_poke_u64le(slot + 0, tag);
+  return NULL;
+}
+
+// -------------------------------- #include "./cairo.c"
+
+#if !defined(ICONVG_CONFIG__ENABLE_CAIRO_BACKEND)
+
+iconvg_canvas  //
+iconvg_make_cairo_canvas(cairo_t* cr) {
+  return iconvg_make_broken_canvas(iconvg_error_invalid_backend_not_enabled);
+}
+
+#else  // ICONVG_CONFIG__ENABLE_CAIRO_BACKEND
+
+#include <cairo/cairo.h>
+
+static const cairo_extend_t
+    iconvg_private_gradient_spread_as_cairo_extend_t[4] = {
+        CAIRO_EXTEND_NONE,     //
+        CAIRO_EXTEND_PAD,      //
+        CAIRO_EXTEND_REFLECT,  //
+        CAIRO_EXTEND_REPEAT    //
+};
+
+static inline cairo_matrix_t  //
+iconvg_private_matrix_2x3_f64_as_cairo_matrix_t(iconvg_matrix_2x3_f64 i) {
+  cairo_matrix_t c;
+  c.xx = i.elems[0][0];
+  c.xy = i.elems[0][1];
+  c.x0 = i.elems[0][2];
+  c.yx = i.elems[1][0];
+  c.yy = i.elems[1][1];
+  c.y0 = i.elems[1][2];
+  return c;
+}
+
+// iconvg_private_cairo_set_gradient_stops sets the Cairo gradient stop colors
+// given the IconVG gradient stop colors.
+//
+// Unlike SVG, IconVG works solely with premultiplied alpha. In contrast,
 // https://lists.freedesktop.org/archives/cairo/2006-June/007203.html says that
 // Cairo accepts "both pre- and non-premultiplied colors in different parts of
 // the API". Specifically, while CAIRO_FORMAT_ARGB32 is premultiplied, both
@@ -1240,9 +3121,43 @@ iconvg_private_cairo_canvas__begin_drawing(iconvg_canvas* c) {
   return NULL;
 }
 
+// iconvg_private_cairo_fill fills the current path with the current source,
+// once or, if offsets_xy is non-NULL, once per instance under a translation.
+// Cairo locks a source pattern to the user space in effect when it is set, so
+// the source is re-set after each translation, moving gradients with paths.
 static const char*  //
-iconvg_private_cairo_canvas__end_drawing(iconvg_canvas* c,
-                                         const iconvg_paint* p) {
+iconvg_private_cairo_fill(cairo_t* cr,
+                          const float* offsets_xy,
+                          size_t num_instances) {
+  if (!offsets_xy) {
+    cairo_fill(cr);
+    return NULL;
+  }
+  cairo_path_t* path = cairo_copy_path(cr);
+  cairo_new_path(cr);
+  if (path->status != CAIRO_STATUS_SUCCESS) {
+    cairo_path_destroy(path);
+    return iconvg_error_system_failure_out_of_memory;
+  }
+  cairo_pattern_t* source = cairo_pattern_reference(cairo_get_source(cr));
+  for (size_t i = 0; i < num_instances; i++) {
+    cairo_save(cr);
+    cairo_translate(cr, offsets_xy[(2 * i) + 0], offsets_xy[(2 * i) + 1]);
+    cairo_append_path(cr, path);
+    cairo_set_source(cr, source);
+    cairo_fill(cr);
+    cairo_restore(cr);
+  }
+  cairo_pattern_destroy(source);
+  cairo_path_destroy(path);
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_cairo_canvas__draw(iconvg_canvas* c,
+                                  const iconvg_paint* p,
+                                  const float* offsets_xy,
+                                  size_t num_instances) {
   cairo_t* cr = (cairo_t*)(c->context_nonconst_ptr0);
   cairo_pattern_t* cp = NULL;
   cairo_matrix_t cm = {0};
@@ -1252,8 +3167,7 @@ iconvg_private_cairo_canvas__end_drawing(iconvg_canvas* c,
       iconvg_nonpremul_color k = iconvg_paint__flat_color_as_nonpremul_color(p);
       cairo_set_source_rgba(cr, k.rgba[0] / 255.0, k.rgba[1] / 255.0,
                             k.rgba[2] / 255.0, k.rgba[3] / 255.0);
-      cairo_fill(cr);
-      return NULL;
+      return iconvg_private_cairo_fill(cr, offsets_xy, num_instances);
     }
 
     case ICONVG_PAINT_TYPE__LINEAR_GRADIENT: {
@@ -1290,9 +3204,24 @@ iconvg_private_cairo_canvas__end_drawing(iconvg_canvas* c,
     cairo_set_source_rgba(cr, 0.75, 0.25, 0.75, 0.5);
   }
 
-  cairo_fill(cr);
+  const char* err_msg =
+      iconvg_private_cairo_fill(cr, offsets_xy, num_instances);
   cairo_pattern_destroy(cp);
-  return NULL;
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_cairo_canvas__end_drawing(iconvg_canvas* c,
+                                         const iconvg_paint* p) {
+  return iconvg_private_cairo_canvas__draw(c, p, NULL, 0);
+}
+
+static const char*  //
+iconvg_private_cairo_canvas__end_drawing_instances(iconvg_canvas* c,
+                                                   const iconvg_paint* p,
+                                                   const float* offsets_xy,
+                                                   size_t num_instances) {
+  return iconvg_private_cairo_canvas__draw(c, p, offsets_xy, num_instances);
 }
 
 static const char*  //
@@ -1388,6 +3317,7 @@ static const iconvg_canvas_vtable  //
         &iconvg_private_cairo_canvas__path_cube_to,
         &iconvg_private_cairo_canvas__on_metadata_viewbox,
         &iconvg_private_cairo_canvas__on_metadata_suggested_palette,
+        &iconvg_private_cairo_canvas__end_drawing_instances,
 };
 
 iconvg_canvas  //
@@ -1606,99 +3536,413 @@ const iconvg_palette iconvg_private_default_palette = {{
     {{0x00, 0x00, 0x00, 0xFF}},  //
 }};
 
-// -------------------------------- #include "./debug.c"
+// -------------------------------- #include "./damage.c"
+
+// The damage recording canvas records, for each drawing, what it looks like
+// (its paint snapshot and its dst-space path) and the path's pixel bounding
+// box. context_nonconst_ptr0 points to an iconvg_private_damage_recording.
+// Two recordings can then be compared drawing by drawing.
+
+typedef struct iconvg_private_damage_drawing_struct {
+  // data_begin and data_end bound this drawing's bytes in the recording's
+  // data buffer: its path records followed by its iconvg_paint_snapshot.
+  size_t data_begin;
+  size_t data_end;
+
+  // The bounding box of the path's points (including control points), rounded
+  // outwards to whole pixels.
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+} iconvg_private_damage_drawing;
+
+typedef struct iconvg_private_damage_recording_struct {
+  // drawings holds an array of iconvg_private_damage_drawing elements.
+  iconvg_growable_buffer drawings;
+  iconvg_growable_buffer data;
+
+  // clip_rect is the dst_rect passed to begin_decode.
+  iconvg_rectangle_f32 clip_rect;
+
+  // The current drawing's data_begin and (unrounded) bounding box.
+  size_t data_begin;
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+} iconvg_private_damage_recording;
 
 static const char*  //
-iconvg_private_debug_canvas__begin_decode(iconvg_canvas* c,
-                                          iconvg_rectangle_f32 dst_rect) {
-  FILE* f = (FILE*)(c->context_nonconst_ptr1);
-  if (f) {
-    fprintf(f, "%sbegin_decode({%g, %g, %g, %g})\n",
-            ((const char*)(c->context_const_ptr)), dst_rect.min_x,
-            dst_rect.min_y, dst_rect.max_x, dst_rect.max_y);
-  }
-  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
-  if (!wrapped) {
-    return NULL;
-  } else if (iconvg_private_canvas_sizeof_vtable(wrapped) <
-             sizeof(iconvg_canvas_vtable)) {
-    return iconvg_error_unsupported_vtable;
+iconvg_private_damage_canvas__add_points(iconvg_canvas* c,
+                                         const float* xy,
+                                         size_t num_points,
+                                         uint8_t op) {
+  iconvg_private_damage_recording* r =
+      (iconvg_private_damage_recording*)(c->context_nonconst_ptr0);
+  for (size_t i = 0; i < num_points; i++) {
+    float x = xy[(2 * i) + 0];
+    float y = xy[(2 * i) + 1];
+    r->min_x = (r->min_x < x) ? r->min_x : x;
+    r->min_y = (r->min_y < y) ? r->min_y : y;
+    r->max_x = (r->max_x > x) ? r->max_x : x;
+    r->max_y = (r->max_y > y) ? r->max_y : y;
   }
-  return (*wrapped->vtable->begin_decode)(wrapped, dst_rect);
+  return iconvg_private_path_buffer__append(&r->data, op, xy, 2 * num_points);
 }
 
 static const char*  //
-iconvg_private_debug_canvas__end_decode(iconvg_canvas* c,
-                                        const char* err_msg,
-                                        size_t num_bytes_consumed,
-                                        size_t num_bytes_remaining) {
-  FILE* f = (FILE*)(c->context_nonconst_ptr1);
-  if (f) {
-    const char* quote = err_msg ? "\"" : "";
-    fprintf(f, "%send_decode(%s%s%s, %zu, %zu)\n",
-            ((const char*)(c->context_const_ptr)), quote,
-            err_msg ? err_msg : "NULL", quote, num_bytes_consumed,
-            num_bytes_remaining);
-  }
-  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
-  if (!wrapped) {
-    return err_msg;
-  } else if (iconvg_private_canvas_sizeof_vtable(wrapped) <
-             sizeof(iconvg_canvas_vtable)) {
-    return iconvg_error_unsupported_vtable;
-  }
-  return (*wrapped->vtable->end_decode)(wrapped, err_msg, num_bytes_consumed,
-                                        num_bytes_remaining);
+iconvg_private_damage_canvas__begin_decode(iconvg_canvas* c,
+                                           iconvg_rectangle_f32 dst_rect) {
+  iconvg_private_damage_recording* r =
+      (iconvg_private_damage_recording*)(c->context_nonconst_ptr0);
+  r->clip_rect = dst_rect;
+  return NULL;
 }
 
 static const char*  //
-iconvg_private_debug_canvas__begin_drawing(iconvg_canvas* c) {
-  FILE* f = (FILE*)(c->context_nonconst_ptr1);
-  if (f) {
-    fprintf(f, "%sbegin_drawing()\n", ((const char*)(c->context_const_ptr)));
-  }
-  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
-  if (!wrapped) {
-    return NULL;
-  } else if (iconvg_private_canvas_sizeof_vtable(wrapped) <
-             sizeof(iconvg_canvas_vtable)) {
-    return iconvg_error_unsupported_vtable;
-  }
-  return (*wrapped->vtable->begin_drawing)(wrapped);
+iconvg_private_damage_canvas__end_decode(iconvg_canvas* c,
+                                         const char* err_msg,
+                                         size_t num_bytes_consumed,
+                                         size_t num_bytes_remaining) {
+  return err_msg;
 }
 
 static const char*  //
-iconvg_private_debug_canvas__end_drawing(iconvg_canvas* c,
-                                         const iconvg_paint* p) {
-  static const char* spread_names[4] = {"none", "pad", "reflect", "repeat"};
+iconvg_private_damage_canvas__begin_drawing(iconvg_canvas* c) {
+  iconvg_private_damage_recording* r =
+      (iconvg_private_damage_recording*)(c->context_nonconst_ptr0);
+  r->data_begin = r->data.len;
+  r->min_x = +INFINITY;
+  r->min_y = +INFINITY;
+  r->max_x = -INFINITY;
+  r->max_y = -INFINITY;
+  return NULL;
+}
 
-  FILE* f = (FILE*)(c->context_nonconst_ptr1);
-  if (f) {
-    switch (iconvg_paint__type(p)) {
-      case ICONVG_PAINT_TYPE__FLAT_COLOR: {
-        iconvg_premul_color k = iconvg_paint__flat_color_as_premul_color(p);
-        fprintf(f, "%send_drawing(flat_color{%02X:%02X:%02X:%02X})\n",
-                ((const char*)(c->context_const_ptr)), ((int)(k.rgba[0])),
-                ((int)(k.rgba[1])), ((int)(k.rgba[2])), ((int)(k.rgba[3])));
-        break;
-      }
+static const char*  //
+iconvg_private_damage_canvas__end_drawing(iconvg_canvas* c,
+                                          const iconvg_paint* p) {
+  iconvg_private_damage_recording* r =
+      (iconvg_private_damage_recording*)(c->context_nonconst_ptr0);
+
+  iconvg_paint_snapshot snapshot;
+  size_t n = iconvg_paint__snapshot(p, &snapshot);
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(&r->data, n));
+  memcpy(r->data.ptr + r->data.len, &snapshot, n);
+  r->data.len += n;
+
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(
+      &r->drawings, sizeof(iconvg_private_damage_drawing)));
+  iconvg_private_damage_drawing* d =
+      (iconvg_private_damage_drawing*)(r->drawings.ptr + r->drawings.len);
+  r->drawings.len += sizeof(iconvg_private_damage_drawing);
+
+  d->data_begin = r->data_begin;
+  d->data_end = r->data.len;
+  // Anti-aliasing touches every pixel that the path's bounding box touches.
+  // This assumes that dst coordinate space units are pixels.
+  d->min_x = floorf(r->min_x);
+  d->min_y = floorf(r->min_y);
+  d->max_x = ceilf(r->max_x);
+  d->max_y = ceilf(r->max_y);
+  return NULL;
+}
 
-      case ICONVG_PAINT_TYPE__LINEAR_GRADIENT: {
-        fprintf(f,
-                "%send_drawing(linear_gradient{nstops=%d, spread=%s, ...})\n",
-                ((const char*)(c->context_const_ptr)),
-                ((int)(iconvg_paint__gradient_number_of_stops(p))),
-                spread_names[iconvg_paint__gradient_spread(p)]);
-        break;
-      }
+static const char*  //
+iconvg_private_damage_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  float xy[2] = {x0, y0};
+  return iconvg_private_damage_canvas__add_points(
+      c, xy, 1, ICONVG_PRIVATE_PATH_OP__BEGIN_PATH);
+}
 
-      case ICONVG_PAINT_TYPE__RADIAL_GRADIENT: {
-        fprintf(f,
-                "%send_drawing(radial_gradient{nstops=%d, spread=%s, ...})\n",
-                ((const char*)(c->context_const_ptr)),
-                ((int)(iconvg_paint__gradient_number_of_stops(p))),
-                spread_names[iconvg_paint__gradient_spread(p)]);
-        break;
+static const char*  //
+iconvg_private_damage_canvas__end_path(iconvg_canvas* c) {
+  return iconvg_private_damage_canvas__add_points(
+      c, NULL, 0, ICONVG_PRIVATE_PATH_OP__END_PATH);
+}
+
+static const char*  //
+iconvg_private_damage_canvas__path_line_to(iconvg_canvas* c,
+                                           float x1,
+                                           float y1) {
+  float xy[2] = {x1, y1};
+  return iconvg_private_damage_canvas__add_points(
+      c, xy, 1, ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO);
+}
+
+static const char*  //
+iconvg_private_damage_canvas__path_quad_to(iconvg_canvas* c,
+                                           float x1,
+                                           float y1,
+                                           float x2,
+                                           float y2) {
+  float xy[4] = {x1, y1, x2, y2};
+  return iconvg_private_damage_canvas__add_points(
+      c, xy, 2, ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO);
+}
+
+static const char*  //
+iconvg_private_damage_canvas__path_cube_to(iconvg_canvas* c,
+                                           float x1,
+                                           float y1,
+                                           float x2,
+                                           float y2,
+                                           float x3,
+                                           float y3) {
+  float xy[6] = {x1, y1, x2, y2, x3, y3};
+  return iconvg_private_damage_canvas__add_points(
+      c, xy, 3, ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO);
+}
+
+static const char*  //
+iconvg_private_damage_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_damage_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  return NULL;
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_damage_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_damage_canvas__begin_decode,
+        &iconvg_private_damage_canvas__end_decode,
+        &iconvg_private_damage_canvas__begin_drawing,
+        &iconvg_private_damage_canvas__end_drawing,
+        &iconvg_private_damage_canvas__begin_path,
+        &iconvg_private_damage_canvas__end_path,
+        &iconvg_private_damage_canvas__path_line_to,
+        &iconvg_private_damage_canvas__path_quad_to,
+        &iconvg_private_damage_canvas__path_cube_to,
+        &iconvg_private_damage_canvas__on_metadata_viewbox,
+        &iconvg_private_damage_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// ----
+
+static const char*  //
+iconvg_private_damage_recording__record(iconvg_private_damage_recording* r,
+                                        iconvg_rectangle_f32 dst_rect,
+                                        const uint8_t* src_ptr,
+                                        size_t src_len,
+                                        const iconvg_decode_options* options) {
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_damage_canvas_vtable;
+  c.context_nonconst_ptr0 = r;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+  return iconvg_decode(&c, dst_rect, src_ptr, src_len, options);
+}
+
+static inline bool  //
+iconvg_private_damage_recording__same(const iconvg_private_damage_recording* a,
+                                      size_t i,
+                                      const iconvg_private_damage_recording* b,
+                                      size_t j) {
+  const iconvg_private_damage_drawing* da =
+      ((const iconvg_private_damage_drawing*)(a->drawings.ptr)) + i;
+  const iconvg_private_damage_drawing* db =
+      ((const iconvg_private_damage_drawing*)(b->drawings.ptr)) + j;
+  size_t n = da->data_end - da->data_begin;
+  return (n == (db->data_end - db->data_begin)) &&
+         !memcmp(a->data.ptr + da->data_begin, b->data.ptr + db->data_begin, n);
+}
+
+// iconvg_private_damage_recording__add_to sets *dst to its union with the
+// bounding boxes of r's drawings in the range [i, j).
+static void  //
+iconvg_private_damage_recording__add_to(
+    iconvg_rectangle_f32* dst,
+    const iconvg_private_damage_recording* r,
+    size_t i,
+    size_t j) {
+  const iconvg_private_damage_drawing* d =
+      (const iconvg_private_damage_drawing*)(r->drawings.ptr);
+  for (; i < j; i++) {
+    dst->min_x = (dst->min_x < d[i].min_x) ? dst->min_x : d[i].min_x;
+    dst->min_y = (dst->min_y < d[i].min_y) ? dst->min_y : d[i].min_y;
+    dst->max_x = (dst->max_x > d[i].max_x) ? dst->max_x : d[i].max_x;
+    dst->max_y = (dst->max_y > d[i].max_y) ? dst->max_y : d[i].max_y;
+  }
+}
+
+const char*  //
+iconvg_decode_damage(iconvg_rectangle_f32* dst_damage,
+                     iconvg_rectangle_f32 dst_rect,
+                     const uint8_t* old_src_ptr,
+                     size_t old_src_len,
+                     const uint8_t* new_src_ptr,
+                     size_t new_src_len,
+                     const iconvg_decode_options* options) {
+  if (!dst_damage) {
+    return iconvg_error_invalid_damage_argument;
+  }
+
+  iconvg_private_damage_recording r[2];
+  memset(&r[0], 0, sizeof(r));
+  for (int i = 0; i < 2; i++) {
+    r[i].drawings.grow = &iconvg_growable_buffer__realloc_grow;
+    r[i].data.grow = &iconvg_growable_buffer__realloc_grow;
+    r[i].clip_rect = dst_rect;
+  }
+
+  const char* err_msg = iconvg_private_damage_recording__record(
+      &r[0], dst_rect, old_src_ptr, old_src_len, options);
+  if (!err_msg) {
+    err_msg = iconvg_private_damage_recording__record(
+        &r[1], dst_rect, new_src_ptr, new_src_len, options);
+  }
+
+  if (err_msg) {
+    // Be conservative: everything is damaged.
+    *dst_damage = r[0].clip_rect;
+  } else {
+    size_t n0 = r[0].drawings.len / sizeof(iconvg_private_damage_drawing);
+    size_t n1 = r[1].drawings.len / sizeof(iconvg_private_damage_drawing);
+
+    // Skip the common prefix and the common suffix. Every pixel outside of
+    // the remaining drawings' bounding boxes is covered by the same sequence
+    // of drawings, old and new, so it is unchanged.
+    size_t prefix = 0;
+    while ((prefix < n0) && (prefix < n1) &&
+           iconvg_private_damage_recording__same(&r[0], prefix,  //
+                                                 &r[1], prefix)) {
+      prefix++;
+    }
+    size_t suffix = 0;
+    while (((prefix + suffix) < n0) && ((prefix + suffix) < n1) &&
+           iconvg_private_damage_recording__same(&r[0], n0 - suffix - 1,  //
+                                                 &r[1], n1 - suffix - 1)) {
+      suffix++;
+    }
+
+    iconvg_rectangle_f32 d = iconvg_make_rectangle_f32(
+        +INFINITY, +INFINITY, -INFINITY, -INFINITY);
+    iconvg_private_damage_recording__add_to(&d, &r[0], prefix, n0 - suffix);
+    iconvg_private_damage_recording__add_to(&d, &r[1], prefix, n1 - suffix);
+
+    // Intersect with the clip rectangle, which is the same for both.
+    const iconvg_rectangle_f32* k = &r[1].clip_rect;
+    d.min_x = (d.min_x > k->min_x) ? d.min_x : k->min_x;
+    d.min_y = (d.min_y > k->min_y) ? d.min_y : k->min_y;
+    d.max_x = (d.max_x < k->max_x) ? d.max_x : k->max_x;
+    d.max_y = (d.max_y < k->max_y) ? d.max_y : k->max_y;
+    if (iconvg_rectangle_f32__is_finite_and_not_empty(&d)) {
+      *dst_damage = d;
+    } else {
+      *dst_damage = iconvg_make_rectangle_f32(0, 0, 0, 0);
+    }
+  }
+
+  for (int i = 0; i < 2; i++) {
+    free(r[i].drawings.ptr);
+    free(r[i].data.ptr);
+  }
+  return err_msg;
+}
+
+// -------------------------------- #include "./debug.c"
+
+static const char*  //
+iconvg_private_debug_canvas__begin_decode(iconvg_canvas* c,
+                                          iconvg_rectangle_f32 dst_rect) {
+  FILE* f = (FILE*)(c->context_nonconst_ptr1);
+  if (f) {
+    fprintf(f, "%sbegin_decode({%g, %g, %g, %g})\n",
+            ((const char*)(c->context_const_ptr)), dst_rect.min_x,
+            dst_rect.min_y, dst_rect.max_x, dst_rect.max_y);
+  }
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return NULL;
+  } else if (iconvg_private_canvas_sizeof_vtable(wrapped) <
+             sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  }
+  return (*wrapped->vtable->begin_decode)(wrapped, dst_rect);
+}
+
+static const char*  //
+iconvg_private_debug_canvas__end_decode(iconvg_canvas* c,
+                                        const char* err_msg,
+                                        size_t num_bytes_consumed,
+                                        size_t num_bytes_remaining) {
+  FILE* f = (FILE*)(c->context_nonconst_ptr1);
+  if (f) {
+    const char* quote = err_msg ? "\"" : "";
+    fprintf(f, "%send_decode(%s%s%s, %zu, %zu)\n",
+            ((const char*)(c->context_const_ptr)), quote,
+            err_msg ? err_msg : "NULL", quote, num_bytes_consumed,
+            num_bytes_remaining);
+  }
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return err_msg;
+  } else if (iconvg_private_canvas_sizeof_vtable(wrapped) <
+             sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  }
+  return (*wrapped->vtable->end_decode)(wrapped, err_msg, num_bytes_consumed,
+                                        num_bytes_remaining);
+}
+
+static const char*  //
+iconvg_private_debug_canvas__begin_drawing(iconvg_canvas* c) {
+  FILE* f = (FILE*)(c->context_nonconst_ptr1);
+  if (f) {
+    fprintf(f, "%sbegin_drawing()\n", ((const char*)(c->context_const_ptr)));
+  }
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return NULL;
+  } else if (iconvg_private_canvas_sizeof_vtable(wrapped) <
+             sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  }
+  return (*wrapped->vtable->begin_drawing)(wrapped);
+}
+
+static const char*  //
+iconvg_private_debug_canvas__end_drawing(iconvg_canvas* c,
+                                         const iconvg_paint* p) {
+  static const char* spread_names[4] = {"none", "pad", "reflect", "repeat"};
+
+  FILE* f = (FILE*)(c->context_nonconst_ptr1);
+  if (f) {
+    switch (iconvg_paint__type(p)) {
+      case ICONVG_PAINT_TYPE__FLAT_COLOR: {
+        iconvg_premul_color k = iconvg_paint__flat_color_as_premul_color(p);
+        fprintf(f, "%send_drawing(flat_color{%02X:%02X:%02X:%02X})\n",
+                ((const char*)(c->context_const_ptr)), ((int)(k.rgba[0])),
+                ((int)(k.rgba[1])), ((int)(k.rgba[2])), ((int)(k.rgba[3])));
+        break;
+      }
+
+      case ICONVG_PAINT_TYPE__LINEAR_GRADIENT: {
+        fprintf(f,
+                "%send_drawing(linear_gradient{nstops=%d, spread=%s, ...})\n",
+                ((const char*)(c->context_const_ptr)),
+                ((int)(iconvg_paint__gradient_number_of_stops(p))),
+                spread_names[iconvg_paint__gradient_spread(p)]);
+        break;
+      }
+
+      case ICONVG_PAINT_TYPE__RADIAL_GRADIENT: {
+        fprintf(f,
+                "%send_drawing(radial_gradient{nstops=%d, spread=%s, ...})\n",
+                ((const char*)(c->context_const_ptr)),
+                ((int)(iconvg_paint__gradient_number_of_stops(p))),
+                spread_names[iconvg_paint__gradient_spread(p)]);
+        break;
       }
 
       case ICONVG_PAINT_TYPE__INVALID:
@@ -1885,6 +4129,9 @@ static const iconvg_canvas_vtable  //
         &iconvg_private_debug_canvas__path_cube_to,
         &iconvg_private_debug_canvas__on_metadata_viewbox,
         &iconvg_private_debug_canvas__on_metadata_suggested_palette,
+        // end_drawing_instances is NULL so that iconvg_decode_instances
+        // replays each instance as ordinary (logged) calls.
+        NULL,
 };
 
 iconvg_canvas  //
@@ -2170,13 +4417,125 @@ iconvg_private_decoder__decode_metadata_suggested_palette(
   return true;
 }
 
+// iconvg_private_drawing_index_entry is one drawing's entry in a MID 2
+// (Drawing Index) metadata chunk: where the drawing's bytes are, relative to
+// the end of the previous drawing (or to the start of the bytecode), its
+// bounds in graphic (ViewBox) coordinates and the LOD0 and LOD1 registers'
+// values when it starts.
+typedef struct iconvg_private_drawing_index_entry_struct {
+  uint32_t gap;
+  uint32_t length;
+  iconvg_rectangle_f32 bounds;
+  float lod0;
+  float lod1;
+} iconvg_private_drawing_index_entry;
+
+static bool  //
+iconvg_private_decoder__decode_drawing_index_entry(
+    iconvg_private_decoder* self,
+    iconvg_private_drawing_index_entry* dst) {
+  return iconvg_private_decoder__decode_natural_number(self, &dst->gap) &&
+         iconvg_private_decoder__decode_natural_number(self, &dst->length) &&
+         iconvg_private_decoder__decode_coordinate_number(self,
+                                                          &dst->bounds.min_x) &&
+         iconvg_private_decoder__decode_coordinate_number(self,
+                                                          &dst->bounds.min_y) &&
+         iconvg_private_decoder__decode_coordinate_number(self,
+                                                          &dst->bounds.max_x) &&
+         iconvg_private_decoder__decode_coordinate_number(self,
+                                                          &dst->bounds.max_y) &&
+         iconvg_private_decoder__decode_real_number(self, &dst->lod0) &&
+         iconvg_private_decoder__decode_real_number(self, &dst->lod1);
+}
+
+// iconvg_private_decoder__decode_metadata_drawing_index checks that self
+// holds a well-formed drawing index: a number of entries and then exactly
+// that many entries. Whether those entries match the bytecode is checked as
+// the bytecode is executed.
+static bool  //
+iconvg_private_decoder__decode_metadata_drawing_index(
+    iconvg_private_decoder* self) {
+  uint32_t n;
+  if (!iconvg_private_decoder__decode_natural_number(self, &n)) {
+    return false;
+  }
+  for (; n > 0; n--) {
+    iconvg_private_drawing_index_entry e;
+    if (!iconvg_private_decoder__decode_drawing_index_entry(self, &e)) {
+      return false;
+    }
+  }
+  return self->len == 0;
+}
+
+// iconvg_private_check_index_bounds returns an error if index_bounds is
+// non-NULL and does not contain the point (x, y), given in graphic (ViewBox)
+// coordinates. A NaN point is never contained.
+static inline const char*  //
+iconvg_private_check_index_bounds(const iconvg_rectangle_f32* index_bounds,
+                                  double x,
+                                  double y) {
+  if (index_bounds &&
+      !((index_bounds->min_x <= x) && (x <= index_bounds->max_x) &&
+        (index_bounds->min_y <= y) && (y <= index_bounds->max_y))) {
+    return iconvg_error_bad_metadata_drawing_index;
+  }
+  return NULL;
+}
+
+// iconvg_private_check_index_arc_bounds is like
+// iconvg_private_check_index_bounds but for an arc, with the same arguments as
+// iconvg_private_path_arc_to.
+static const char*  //
+iconvg_private_check_index_arc_bounds(const iconvg_rectangle_f32* index_bounds,
+                                      float initial_x,
+                                      float initial_y,
+                                      float radius_x,
+                                      float radius_y,
+                                      float x_axis_rotation,
+                                      bool large_arc,
+                                      bool sweep,
+                                      float final_x,
+                                      float final_y) {
+  if (!index_bounds) {
+    return NULL;
+  }
+  double b[4];
+  if (iconvg_private_arc_bounds(&b[0], initial_x, initial_y, radius_x, radius_y,
+                                x_axis_rotation, large_arc, sweep, final_x,
+                                final_y)) {
+    ICONVG_PRIVATE_TRY(
+        iconvg_private_check_index_bounds(index_bounds, b[0], b[1]));
+    ICONVG_PRIVATE_TRY(
+        iconvg_private_check_index_bounds(index_bounds, b[2], b[3]));
+  }
+  return iconvg_private_check_index_bounds(index_bounds, final_x, final_y);
+}
+
 // ----
 
+// iconvg_private_one_byte_color_palette_mask returns the set of custom
+// palette indices that the one byte color u depends on, given the sets for
+// each CREG register. See iconvg_private_set_one_byte_color.
+static inline uint64_t  //
+iconvg_private_one_byte_color_palette_mask(const uint64_t* palette_masks,
+                                           uint8_t u) {
+  if (u < 0x80) {
+    return 0;
+  } else if (u < 0xC0) {
+    return ((uint64_t)1) << (u & 0x3F);
+  }
+  return palette_masks[u & 0x3F];
+}
+
 static const char*  //
 iconvg_private_execute_bytecode(iconvg_canvas* c_arg,
                                 iconvg_rectangle_f32 r,
                                 iconvg_private_decoder* d,
-                                iconvg_paint* state) {
+                                iconvg_paint* state,
+                                const uint8_t* src_ptr,
+                                iconvg_private_decoder drawing_index,
+                                const iconvg_rectangle_f32* cull_rect) {
   // adjustments are the ADJ values from the IconVG spec.
   static const uint32_t adjustments[8] = {0, 1, 2, 3, 4, 5, 6, 0};
 
@@ -2195,6 +4554,12 @@ iconvg_private_execute_bytecode(iconvg_canvas* c_arg,
   float y3 = +0.0f;
   uint32_t flags = 0;
 
+  // start_x and start_y are where the current path started. As in SVG,
+  // closing a path moves the current point back there, so that 'z; m' is
+  // relative to it.
+  float start_x = +0.0f;
+  float start_y = +0.0f;
+
   double scale_x = +1.0;
   double bias_x = +0.0;
   double scale_y = +1.0;
@@ -2226,10 +4591,49 @@ iconvg_private_execute_bytecode(iconvg_canvas* c_arg,
   lod[0] = 0.0;
   lod[1] = INFINITY;
 
+  // palette_masks[i] is the set of custom palette indices that CREG[i]'s
+  // value depends on. CREG starts as a copy of the custom palette.
+  uint64_t palette_masks[64];
+  for (int i = 0; i < 64; i++) {
+    palette_masks[i] = ((uint64_t)1) << i;
+  }
+
+  // drawing_begin is where the next drawing's styling opcodes start.
+  const uint8_t* drawing_begin = d->ptr;
+  state->source_position.drawing_index = 0;
+
+  // The drawing index (MID 2), if present, lets us skip painting drawings
+  // that lie outside of the cull rectangle. They are still decoded (onto the
+  // no-op canvas), and every entry is checked against the bytecode, so that
+  // an invalid index is always an error, regardless of the cull rectangle or
+  // of which drawings pass their Level of Detail thresholds.
+  //
+  // index_remaining counts the unused entries. index_end is where the
+  // current (or, in styling mode, previous) indexed drawing ends.
+  // index_bounds is NULL if there is no index, otherwise it points to the
+  // current drawing's bounds, which must contain all of its points.
+  uint32_t index_remaining = 0;
+  bool has_index = iconvg_private_decoder__decode_natural_number(
+      &drawing_index, &index_remaining);
+  const uint8_t* index_end = d->ptr;
+  iconvg_rectangle_f32 index_bounds_storage =
+      iconvg_make_rectangle_f32(0, 0, 0, 0);
+  const iconvg_rectangle_f32* index_bounds = NULL;
+
+  // cull holds the cull rectangle (if any) in graphic coordinates.
+  double cull[4] = {-INFINITY, -INFINITY, +INFINITY, +INFINITY};
+  if (cull_rect) {
+    cull[0] = (cull_rect->min_x * state->d2s_scale_x) + state->d2s_bias_x;
+    cull[1] = (cull_rect->min_y * state->d2s_scale_y) + state->d2s_bias_y;
+    cull[2] = (cull_rect->max_x * state->d2s_scale_x) + state->d2s_bias_x;
+    cull[3] = (cull_rect->max_y * state->d2s_scale_y) + state->d2s_bias_y;
+  }
+
 styling_mode:
   while (true) {
     if (d->len == 0) {
-      return NULL;
+      return (index_remaining > 0) ? iconvg_error_bad_metadata_drawing_index
+                                   : NULL;
     }
     uint8_t opcode = d->ptr[0];
     d->ptr += 1;
@@ -2247,6 +4651,8 @@ styling_mode:
       uint8_t* rgba = &state->creg.colors[creg_index].rgba[0];
       iconvg_private_set_one_byte_color(rgba, &state->custom_palette,
                                         &state->creg, d->ptr[0]);
+      palette_masks[creg_index] =
+          iconvg_private_one_byte_color_palette_mask(palette_masks, d->ptr[0]);
       d->ptr += 1;
       d->len -= 1;
       sel[0] += ((opcode & 0x07) == 0x07) ? 1 : 0;
@@ -2262,6 +4668,7 @@ styling_mode:
       rgba[1] = 0x11 * (d->ptr[0] & 0x0F);
       rgba[2] = 0x11 * (d->ptr[1] >> 4);
       rgba[3] = 0x11 * (d->ptr[1] & 0x0F);
+      palette_masks[creg_index] = 0;
       d->ptr += 2;
       d->len -= 2;
       sel[0] += ((opcode & 0x07) == 0x07) ? 1 : 0;
@@ -2277,6 +4684,7 @@ styling_mode:
       rgba[1] = d->ptr[1];
       rgba[2] = d->ptr[2];
       rgba[3] = 0xFF;
+      palette_masks[creg_index] = 0;
       d->ptr += 3;
       d->len -= 3;
       sel[0] += ((opcode & 0x07) == 0x07) ? 1 : 0;
@@ -2292,6 +4700,7 @@ styling_mode:
       rgba[1] = d->ptr[1];
       rgba[2] = d->ptr[2];
       rgba[3] = d->ptr[3];
+      palette_masks[creg_index] = 0;
       d->ptr += 4;
       d->len -= 4;
       sel[0] += ((opcode & 0x07) == 0x07) ? 1 : 0;
@@ -2315,6 +4724,9 @@ styling_mode:
       rgba[1] = (uint8_t)(((p_blend * p[1]) + (q_blend * q[1]) + 128) / 255);
       rgba[2] = (uint8_t)(((p_blend * p[2]) + (q_blend * q[2]) + 128) / 255);
       rgba[3] = (uint8_t)(((p_blend * p[3]) + (q_blend * q[3]) + 128) / 255);
+      palette_masks[creg_index] =
+          iconvg_private_one_byte_color_palette_mask(palette_masks, d->ptr[1]) |
+          iconvg_private_one_byte_color_palette_mask(palette_masks, d->ptr[2]);
       d->ptr += 3;
       d->len -= 3;
       sel[0] += ((opcode & 0x07) == 0x07) ? 1 : 0;
@@ -2348,23 +4760,59 @@ styling_mode:
       continue;
 
     } else if (opcode < 0xC7) {  // Switch to the drawing mode.
+      const uint8_t* drawing_ptr = d->ptr - 1;
       uint8_t creg_index = (sel[0] - adjustments[opcode & 0x07]) & 0x3F;
       memcpy(&state->paint_rgba, &state->creg.colors[creg_index],
              sizeof(state->paint_rgba));
       if (iconvg_paint__type(state) == ICONVG_PAINT_TYPE__INVALID) {
         return iconvg_error_invalid_paint_type;
       }
+      state->palette_dependencies = palette_masks[creg_index];
+      if (iconvg_paint__type(state) != ICONVG_PAINT_TYPE__FLAT_COLOR) {
+        uint32_t cbase = state->paint_rgba[1];
+        uint32_t n = iconvg_paint__gradient_number_of_stops(state);
+        for (uint32_t i = 0; i < n; i++) {
+          state->palette_dependencies |= palette_masks[0x3F & (cbase + i)];
+        }
+      }
       if (!iconvg_private_decoder__decode_coordinate_number(d, &curr_x) ||
           !iconvg_private_decoder__decode_coordinate_number(d, &curr_y)) {
         return iconvg_error_bad_coordinate;
       }
       double h = (double)state->height_in_pixels;
       c = ((lod[0] <= h) && (h < lod[1])) ? c_arg : &no_op_canvas;
+
+      if (has_index) {
+        // The entry must agree with the bytecode. Its LENGTH and bounds are
+        // checked as the drawing is decoded.
+        iconvg_private_drawing_index_entry e;
+        if ((index_remaining == 0) ||
+            !iconvg_private_decoder__decode_drawing_index_entry(&drawing_index,
+                                                                &e) ||
+            (((size_t)(drawing_ptr - index_end)) != e.gap) ||
+            (e.length > ((size_t)((d->ptr + d->len) - drawing_ptr))) ||
+            (((double)e.lod0) != lod[0]) || (((double)e.lod1) != lod[1])) {
+          return iconvg_error_bad_metadata_drawing_index;
+        }
+        index_remaining--;
+        index_end = drawing_ptr + e.length;
+        index_bounds_storage = e.bounds;
+        index_bounds = &index_bounds_storage;
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
+        if ((e.bounds.max_x < cull[0]) || (e.bounds.max_y < cull[1]) ||
+            (e.bounds.min_x > cull[2]) || (e.bounds.min_y > cull[3])) {
+          c = &no_op_canvas;
+        }
+      }
+
       ICONVG_PRIVATE_TRY((*c->vtable->begin_drawing)(c));
       ICONVG_PRIVATE_TRY(
           (*c->vtable->begin_path)(c,                            //
                                    (curr_x * scale_x) + bias_x,  //
                                    (curr_y * scale_y) + bias_y));
+      start_x = curr_x;
+      start_y = curr_y;
       x1 = curr_x;
       y1 = curr_y;
       goto drawing_mode;
@@ -2401,6 +4849,8 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &curr_y)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_line_to)(c,                            //
                                          (curr_x * scale_x) + bias_x,  //
@@ -2420,6 +4870,8 @@ drawing_mode:
           }
           curr_x += x1;
           curr_y += y1;
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_line_to)(c,                            //
                                          (curr_x * scale_x) + bias_x,  //
@@ -2436,6 +4888,10 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &y2)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_quad_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -2458,6 +4914,10 @@ drawing_mode:
           }
           x2 += curr_x;
           y2 += curr_y;
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_quad_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -2480,6 +4940,10 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &y2)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_quad_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -2506,6 +4970,10 @@ drawing_mode:
           y1 += curr_y;
           x2 += curr_x;
           y2 += curr_y;
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_quad_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -2528,6 +4996,12 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &y3)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x3, y3));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_cube_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -2556,6 +5030,12 @@ drawing_mode:
           y2 += curr_y;
           x3 += curr_x;
           y3 += curr_y;
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x3, y3));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_cube_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -2582,6 +5062,12 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &y3)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x3, y3));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_cube_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -2614,6 +5100,12 @@ drawing_mode:
           y2 += curr_y;
           x3 += curr_x;
           y3 += curr_y;
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x3, y3));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_cube_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -2642,6 +5134,9 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &curr_y)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(iconvg_private_check_index_arc_bounds(
+              index_bounds, x0, y0, x1, y1, x2, flags & 0x01, flags & 0x02,
+              curr_x, curr_y));
           ICONVG_PRIVATE_TRY(iconvg_private_path_arc_to(
               c, scale_x, bias_x, scale_y, bias_y, x0, y0, x1, y1, x2,
               flags & 0x01, flags & 0x02, curr_x, curr_y));
@@ -2665,6 +5160,9 @@ drawing_mode:
           }
           curr_x += x3;
           curr_y += y3;
+          ICONVG_PRIVATE_TRY(iconvg_private_check_index_arc_bounds(
+              index_bounds, x0, y0, x1, y1, x2, flags & 0x01, flags & 0x02,
+              curr_x, curr_y));
           ICONVG_PRIVATE_TRY(iconvg_private_path_arc_to(
               c, scale_x, bias_x, scale_y, bias_y, x0, y0, x1, y1, x2,
               flags & 0x01, flags & 0x02, curr_x, curr_y));
@@ -2677,8 +5175,15 @@ drawing_mode:
 
     switch (opcode) {
       case 0xE1: {  // 'z' mnemonic: close_path.
+        if (index_bounds && (d->ptr != index_end)) {
+          return iconvg_error_bad_metadata_drawing_index;
+        }
         ICONVG_PRIVATE_TRY((*c->vtable->end_path)(c));
+        state->source_position.src_begin = (size_t)(drawing_begin - src_ptr);
+        state->source_position.src_end = (size_t)(d->ptr - src_ptr);
         ICONVG_PRIVATE_TRY((*c->vtable->end_drawing)(c, state));
+        state->source_position.drawing_index++;
+        drawing_begin = d->ptr;
         goto styling_mode;
       }
 
@@ -2688,10 +5193,14 @@ drawing_mode:
             !iconvg_private_decoder__decode_coordinate_number(d, &curr_y)) {
           return iconvg_error_bad_coordinate;
         }
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->begin_path)(c,                            //
                                      (curr_x * scale_x) + bias_x,  //
                                      (curr_y * scale_y) + bias_y));
+        start_x = curr_x;
+        start_y = curr_y;
         x1 = curr_x;
         y1 = curr_y;
         continue;
@@ -2703,12 +5212,16 @@ drawing_mode:
             !iconvg_private_decoder__decode_coordinate_number(d, &y1)) {
           return iconvg_error_bad_coordinate;
         }
-        curr_x += x1;
-        curr_y += y1;
+        curr_x = start_x + x1;
+        curr_y = start_y + y1;
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->begin_path)(c,                            //
                                      (curr_x * scale_x) + bias_x,  //
                                      (curr_y * scale_y) + bias_y));
+        start_x = curr_x;
+        start_y = curr_y;
         x1 = curr_x;
         y1 = curr_y;
         continue;
@@ -2718,6 +5231,8 @@ drawing_mode:
         if (!iconvg_private_decoder__decode_coordinate_number(d, &curr_x)) {
           return iconvg_error_bad_coordinate;
         }
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->path_line_to)(c,                            //
                                        (curr_x * scale_x) + bias_x,  //
@@ -2732,6 +5247,8 @@ drawing_mode:
           return iconvg_error_bad_coordinate;
         }
         curr_x += x1;
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->path_line_to)(c,                            //
                                        (curr_x * scale_x) + bias_x,  //
@@ -2745,6 +5262,8 @@ drawing_mode:
         if (!iconvg_private_decoder__decode_coordinate_number(d, &curr_y)) {
           return iconvg_error_bad_coordinate;
         }
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->path_line_to)(c,                            //
                                        (curr_x * scale_x) + bias_x,  //
@@ -2759,6 +5278,8 @@ drawing_mode:
           return iconvg_error_bad_coordinate;
         }
         curr_y += y1;
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->path_line_to)(c,                            //
                                        (curr_x * scale_x) + bias_x,  //
@@ -2837,6 +5358,7 @@ iconvg_private_decode(iconvg_canvas* c,
                       iconvg_rectangle_f32 r,
                       iconvg_private_decoder* d,
                       const iconvg_decode_options* options) {
+  const uint8_t* src_ptr = d->ptr;
   iconvg_paint state;
   state.viewbox = iconvg_private_default_viewbox();
   if (options && options->height_in_pixels.has_value) {
@@ -2853,6 +5375,8 @@ iconvg_private_decode(iconvg_canvas* c,
     }
   }
   memset(&state.paint_rgba, 0, sizeof(state.paint_rgba));
+  memset(&state.source_position, 0, sizeof(state.source_position));
+  state.palette_dependencies = 0;
   memcpy(&state.custom_palette, &iconvg_private_default_palette,
          sizeof(state.custom_palette));
 
@@ -2864,6 +5388,10 @@ iconvg_private_decode(iconvg_canvas* c,
     return iconvg_error_bad_metadata;
   }
 
+  iconvg_private_decoder drawing_index;
+  drawing_index.ptr = NULL;
+  drawing_index.len = 0;
+
   int32_t previous_metadata_id = -1;
   for (; num_metadata_chunks > 0; num_metadata_chunks--) {
     uint32_t chunk_length;
@@ -2897,6 +5425,13 @@ iconvg_private_decode(iconvg_canvas* c,
         }
         break;
 
+      case 2:  // MID 2 (Drawing Index).
+        drawing_index = chunk;
+        if (!iconvg_private_decoder__decode_metadata_drawing_index(&chunk)) {
+          return iconvg_error_bad_metadata_drawing_index;
+        }
+        break;
+
       default:
         return iconvg_error_bad_metadata;
     }
@@ -2926,7 +5461,36 @@ iconvg_private_decode(iconvg_canvas* c,
   state.d2s_scale_y = +1.0;
   state.d2s_bias_y = +0.0;
 
-  return iconvg_private_execute_bytecode(c, r, d, &state);
+  const iconvg_matrix_2x3_f64* t =
+      iconvg_private_decode_options__dst_transform(options);
+  if (t) {
+    iconvg_matrix_2x3_f64 m = *t;
+    state.inverse_dst_transform = iconvg_matrix_2x3_f64__inverse(&m);
+  } else {
+    state.inverse_dst_transform = iconvg_private_identity_matrix_2x3_f64();
+  }
+
+  // Map the cull rectangle back through any dst_transform, to the bounding
+  // box of its pre-image. Culling is conservative: it only skips drawings
+  // that are certainly outside.
+  iconvg_rectangle_f32 cull_rect_storage;
+  const iconvg_rectangle_f32* cull_rect =
+      iconvg_private_decode_options__cull_rect(options);
+  if (cull_rect && t) {
+    cull_rect_storage = *cull_rect;
+    cull_rect = iconvg_private_transform_rectangle(&cull_rect_storage,
+                                                   &state.inverse_dst_transform)
+                    ? &cull_rect_storage
+                    : NULL;
+  }
+
+  if (t) {
+    iconvg_canvas tc = iconvg_private_make_transform_canvas(c, t);
+    return iconvg_private_execute_bytecode(&tc, r, d, &state, src_ptr,
+                                           drawing_index, cull_rect);
+  }
+  return iconvg_private_execute_bytecode(c, r, d, &state, src_ptr,
+                                         drawing_index, cull_rect);
 }
 
 const char*  //
@@ -2948,12 +5512,19 @@ iconvg_decode(iconvg_canvas* dst_canvas,
     return iconvg_error_unsupported_vtable;
   }
 
+  iconvg_rectangle_f32 clip_rect = dst_rect;
+  const iconvg_matrix_2x3_f64* t =
+      iconvg_private_decode_options__dst_transform(options);
+  if (t && !iconvg_private_transform_rectangle(&clip_rect, t)) {
+    return iconvg_error_invalid_dst_transform;
+  }
+
   iconvg_private_decoder d;
   d.ptr = src_ptr;
   d.len = src_len;
 
   const char* err_msg =
-      (*dst_canvas->vtable->begin_decode)(dst_canvas, dst_rect);
+      (*dst_canvas->vtable->begin_decode)(dst_canvas, clip_rect);
   if (!err_msg) {
     err_msg = iconvg_private_decode(dst_canvas, dst_rect, &d, options);
   }
@@ -2961,6 +5532,1007 @@ iconvg_decode(iconvg_canvas* dst_canvas,
                                            d.len);
 }
 
+// -------------------------------- #include "./encoder.c"
+
+// The iconvg_encoder's private_mode field tracks where we are in the
+// "styling, drawing, styling, drawing, etc" sequence. A zero-valued
+// iconvg_encoder (one that hasn't been initialized) is in no valid mode.
+#define ICONVG_PRIVATE_ENCODER_MODE__STYLING 1
+#define ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH 2
+#define ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH 3
+#define ICONVG_PRIVATE_ENCODER_MODE__DRAWING_AFTER_PATH 4
+
+// iconvg_private_encoded_number is a number's encoding (1, 2 or 4 bytes) and
+// the value that the decoder will produce from those bytes. A zero len means
+// that there is no exact encoding.
+typedef struct iconvg_private_encoded_number_struct {
+  uint8_t bytes[4];
+  uint32_t len;
+  float value;
+} iconvg_private_encoded_number;
+
+static iconvg_private_encoded_number  //
+iconvg_private_encode_4_byte_number(float f) {
+  uint32_t u = iconvg_private_reinterpret_from_f32_to_u32(f);
+
+  // Round the fractional bits (the low 23 bits) to the nearest multiple of 4,
+  // being careful not to overflow into the upper bits. This matches the Go
+  // encoder.
+  uint32_t v = u & 0x007FFFFFu;
+  if (v < 0x007FFFFEu) {
+    v += 2;
+  }
+  u = (u & 0xFF800000u) | v;
+
+  // A 4 byte encoding has the low two bits set.
+  iconvg_private_encoded_number e;
+  iconvg_private_poke_u32le(&e.bytes[0], u | 0x03);
+  e.len = 4;
+  e.value = iconvg_private_reinterpret_from_u32_to_f32(u & 0xFFFFFFFCu);
+  return e;
+}
+
+static iconvg_private_encoded_number  //
+iconvg_private_encode_coordinate_number(float f) {
+  iconvg_private_encoded_number e;
+  if ((-64.0f <= f) && (f < +64.0f)) {
+    int32_t i = (int32_t)f;
+    if (((float)i) == f) {
+      e.bytes[0] = (uint8_t)((i + 64) << 1);
+      e.len = 1;
+      e.value = (float)i;
+      return e;
+    }
+  }
+  if ((-128.0f <= f) && (f < +128.0f)) {
+    float g = f * 64.0f;
+    int32_t i = (int32_t)g;
+    if (((float)i) == g) {
+      uint32_t u = (((uint32_t)(i + (128 * 64))) << 2) | 0x01;
+      e.bytes[0] = (uint8_t)(u >> 0);
+      e.bytes[1] = (uint8_t)(u >> 8);
+      e.len = 2;
+      e.value = ((float)i) / 64.0f;
+      return e;
+    }
+  }
+  return iconvg_private_encode_4_byte_number(f);
+}
+
+static iconvg_private_encoded_number  //
+iconvg_private_encode_natural_number(uint32_t u) {
+  iconvg_private_encoded_number e;
+  if (u < (1u << 7)) {
+    e.bytes[0] = (uint8_t)(u << 1);
+    e.len = 1;
+  } else if (u < (1u << 14)) {
+    u = (u << 2) | 0x01;
+    e.bytes[0] = (uint8_t)(u >> 0);
+    e.bytes[1] = (uint8_t)(u >> 8);
+    e.len = 2;
+  } else {
+    iconvg_private_poke_u32le(&e.bytes[0], (u << 2) | 0x03);
+    e.len = 4;
+  }
+  e.value = 0;
+  return e;
+}
+
+static iconvg_private_encoded_number  //
+iconvg_private_encode_real_number(float f) {
+  if ((0.0f <= f) && (f < 16384.0f)) {
+    uint32_t u = (uint32_t)f;
+    if (((float)u) == f) {
+      iconvg_private_encoded_number e = iconvg_private_encode_natural_number(u);
+      e.value = (float)u;
+      return e;
+    }
+  }
+  return iconvg_private_encode_4_byte_number(f);
+}
+
+static iconvg_private_encoded_number  //
+iconvg_private_encode_zero_to_one_number(float f) {
+  iconvg_private_encoded_number e;
+  if ((0.0f <= f) && (f < 2.0f)) {
+    // The decoder divides (in double precision) by 120 or 15120 before
+    // converting to float, so check that round-trip exactly.
+    uint32_t u = (uint32_t)((((double)f) * 120.0) + 0.5);
+    if ((u < (1u << 7)) && (((float)(((double)u) / 120.0)) == f)) {
+      e.bytes[0] = (uint8_t)(u << 1);
+      e.len = 1;
+      e.value = f;
+      return e;
+    }
+    u = (uint32_t)((((double)f) * 15120.0) + 0.5);
+    if ((u < (1u << 14)) && (((float)(((double)u) / 15120.0)) == f)) {
+      u = (u << 2) | 0x01;
+      e.bytes[0] = (uint8_t)(u >> 0);
+      e.bytes[1] = (uint8_t)(u >> 8);
+      e.len = 2;
+      e.value = f;
+      return e;
+    }
+  }
+  return iconvg_private_encode_4_byte_number(f);
+}
+
+// iconvg_private_encode_relative_coordinate_number returns the encoding of
+// (target - origin), if the decoder's (origin + decoded_difference) exactly
+// equals target. Its value field is that sum, an absolute coordinate.
+static iconvg_private_encoded_number  //
+iconvg_private_encode_relative_coordinate_number(float origin, float target) {
+  iconvg_private_encoded_number e =
+      iconvg_private_encode_coordinate_number(target - origin);
+  float sum = origin + e.value;
+  if (sum != target) {
+    e.len = 0;
+  }
+  e.value = sum;
+  return e;
+}
+
+// iconvg_private_encode_color returns the number of bytes (1, 2, 3 or 4)
+// written to dst and sets *opcode to the matching "Set CREG[etc]" opcode,
+// before adding its ADJ bits.
+static size_t  //
+iconvg_private_encode_color(uint8_t* dst,
+                            uint8_t* opcode,
+                            iconvg_premul_color c) {
+  const uint8_t* rgba = &c.rgba[0];
+  uint32_t u = iconvg_private_peek_u32le(rgba);
+  for (size_t i = 0; i < 0x80; i++) {
+    if (u ==
+        iconvg_private_peek_u32le(&iconvg_private_one_byte_colors[4 * i])) {
+      dst[0] = (uint8_t)i;
+      *opcode = 0x80;
+      return 1;
+    }
+  }
+  if (((rgba[0] % 0x11) == 0) && ((rgba[1] % 0x11) == 0) &&
+      ((rgba[2] % 0x11) == 0) && ((rgba[3] % 0x11) == 0)) {
+    dst[0] = (uint8_t)(((rgba[0] / 0x11) << 4) | (rgba[1] / 0x11));
+    dst[1] = (uint8_t)(((rgba[2] / 0x11) << 4) | (rgba[3] / 0x11));
+    *opcode = 0x88;
+    return 2;
+  } else if (rgba[3] == 0xFF) {
+    memcpy(dst, rgba, 3);
+    *opcode = 0x90;
+    return 3;
+  }
+  memcpy(dst, rgba, 4);
+  *opcode = 0x98;
+  return 4;
+}
+
+static inline size_t  //
+iconvg_private_append_encoded_number(uint8_t* dst,
+                                     iconvg_private_encoded_number e) {
+  memcpy(dst, &e.bytes[0], e.len);
+  return e.len;
+}
+
+// ----
+
+static inline bool  //
+iconvg_private_is_valid_premul_color(iconvg_premul_color c) {
+  return (c.rgba[0] <= c.rgba[3]) &&  //
+         (c.rgba[1] <= c.rgba[3]) &&  //
+         (c.rgba[2] <= c.rgba[3]);
+}
+
+// iconvg_private_encoder__check returns self's error, if it already has one,
+// or sets (and returns) iconvg_error_invalid_encoder_state if self is not in
+// the given mode.
+static const char*  //
+iconvg_private_encoder__check(iconvg_encoder* self, uint32_t mode) {
+  if (!self) {
+    return iconvg_error_invalid_encoder_state;
+  } else if (self->private_err_msg) {
+    return self->private_err_msg;
+  } else if (self->private_mode != mode) {
+    self->private_err_msg = iconvg_error_invalid_encoder_state;
+    return self->private_err_msg;
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_encoder__fail(iconvg_encoder* self, const char* err_msg) {
+  self->private_err_msg = err_msg;
+  return err_msg;
+}
+
+// iconvg_private_encoder__write appends src[0 .. n] to the dst buffer, or
+// appends nothing at all (on failure).
+static const char*  //
+iconvg_private_encoder__write(iconvg_encoder* self,
+                              const uint8_t* src,
+                              size_t n) {
+  iconvg_growable_buffer* b = self->private_dst;
+  const char* err_msg = iconvg_private_growable_buffer__reserve(b, n);
+  if (err_msg) {
+    return iconvg_private_encoder__fail(self, err_msg);
+  }
+  memcpy(b->ptr + b->len, src, n);
+  b->len += n;
+  return NULL;
+}
+
+// iconvg_private_encoder__can_extend_run returns whether the most recent
+// drawing opcode was opcode_base (such as 0x00 for 'L' or 0x60 for 'Q') with
+// a repeat count that can be incremented. Incrementing it, instead of writing
+// a fresh opcode byte, saves 1 byte per segment.
+static bool  //
+iconvg_private_encoder__can_extend_run(iconvg_encoder* self,
+                                       uint8_t opcode_base) {
+  if (self->private_run_index == 0) {
+    return false;
+  }
+  uint8_t opcode = self->private_dst->ptr[self->private_run_index];
+  uint8_t mask = (opcode_base < 0x40) ? 0x1F : 0x0F;
+  return ((opcode & ~mask) == opcode_base) && ((opcode & mask) < mask);
+}
+
+static size_t  //
+iconvg_private_encoder__segment_cost(iconvg_encoder* self,
+                                     uint8_t opcode_base,
+                                     const iconvg_private_encoded_number* args,
+                                     size_t num_args) {
+  size_t cost =
+      iconvg_private_encoder__can_extend_run(self, opcode_base) ? 0 : 1;
+  for (size_t i = 0; i < num_args; i++) {
+    if (args[i].len == 0) {
+      return SIZE_MAX;
+    }
+    cost += args[i].len;
+  }
+  return cost;
+}
+
+static const char*  //
+iconvg_private_encoder__write_segment(iconvg_encoder* self,
+                                      uint8_t opcode_base,
+                                      const iconvg_private_encoded_number* args,
+                                      size_t num_args) {
+  uint8_t buf[32];
+  size_t n = 0;
+  bool extend = iconvg_private_encoder__can_extend_run(self, opcode_base);
+  if (!extend) {
+    buf[n++] = opcode_base;
+  }
+  for (size_t i = 0; i < num_args; i++) {
+    n += iconvg_private_append_encoded_number(&buf[n], args[i]);
+  }
+
+  iconvg_growable_buffer* b = self->private_dst;
+  const char* err_msg = iconvg_private_growable_buffer__reserve(b, n);
+  if (err_msg) {
+    return iconvg_private_encoder__fail(self, err_msg);
+  } else if (extend) {
+    b->ptr[self->private_run_index]++;
+  } else {
+    self->private_run_index = b->len;
+  }
+  memcpy(b->ptr + b->len, &buf[0], n);
+  b->len += n;
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_encoder__write_single(iconvg_encoder* self,
+                                     uint8_t opcode,
+                                     const iconvg_private_encoded_number* args,
+                                     size_t num_args) {
+  uint8_t buf[16];
+  size_t n = 0;
+  buf[n++] = opcode;
+  for (size_t i = 0; i < num_args; i++) {
+    n += iconvg_private_append_encoded_number(&buf[n], args[i]);
+  }
+  self->private_run_index = 0;
+  return iconvg_private_encoder__write(self, &buf[0], n);
+}
+
+// ----
+
+const char*  //
+iconvg_encoder__initialize(iconvg_encoder* self,
+                           iconvg_growable_buffer* dst,
+                           const iconvg_rectangle_f32* viewbox,
+                           const iconvg_palette* suggested_palette) {
+  if (!self) {
+    return iconvg_error_invalid_encoder_argument;
+  }
+  memset(self, 0, sizeof(*self));
+  if (!dst) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+  self->private_dst = dst;
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__STYLING;
+
+  // The metadata is at most 4 + 1 + (1 + 1 + 16) + (2 + 1 + 1 + 256) bytes.
+  uint8_t buf[320];
+  size_t n = 0;
+  buf[n++] = 0x89;
+  buf[n++] = 0x49;
+  buf[n++] = 0x56;
+  buf[n++] = 0x47;
+
+  uint8_t viewbox_chunk[20];
+  size_t viewbox_chunk_len = 0;
+  if (viewbox) {
+    if (!(-INFINITY < viewbox->min_x) ||         //
+        !(viewbox->min_x <= viewbox->max_x) ||   //
+        !(viewbox->max_x < +INFINITY) ||         //
+        !(-INFINITY < viewbox->min_y) ||         //
+        !(viewbox->min_y <= viewbox->max_y) ||   //
+        !(viewbox->max_y < +INFINITY)) {
+      return iconvg_private_encoder__fail(
+          self, iconvg_error_invalid_encoder_argument);
+    }
+    iconvg_rectangle_f32 d = iconvg_private_default_viewbox();
+    if ((viewbox->min_x != d.min_x) || (viewbox->min_y != d.min_y) ||
+        (viewbox->max_x != d.max_x) || (viewbox->max_y != d.max_y)) {
+      uint8_t* p = &viewbox_chunk[0];
+      *p++ = 0x00;  // MID 0 (ViewBox).
+      p += iconvg_private_append_encoded_number(
+          p, iconvg_private_encode_coordinate_number(viewbox->min_x));
+      p += iconvg_private_append_encoded_number(
+          p, iconvg_private_encode_coordinate_number(viewbox->min_y));
+      p += iconvg_private_append_encoded_number(
+          p, iconvg_private_encode_coordinate_number(viewbox->max_x));
+      p += iconvg_private_append_encoded_number(
+          p, iconvg_private_encode_coordinate_number(viewbox->max_y));
+      viewbox_chunk_len = (size_t)(p - &viewbox_chunk[0]);
+    }
+  }
+
+  uint8_t palette_chunk[258];
+  size_t palette_chunk_len = 0;
+  int last = -1;
+  if (suggested_palette) {
+    last = iconvg_private_last_color_that_isnt_opaque_black(suggested_palette);
+  }
+  if (last >= 0) {
+    // Use the smallest per-color encoding that is exact for all of the colors,
+    // as the Go encoder's encodeSuggestedPalette does. This is not simply the
+    // longest of each color's own encoding: a 1-byte color (such as opaque
+    // 0x40 gray) isn't always 2-byte exact and a 1-byte or 2-byte color isn't
+    // always opaque. Only the first (last + 1) colors are written: the
+    // remainder default to opaque black.
+    bool all_1 = true;
+    bool all_2 = true;
+    bool all_3 = true;
+    for (int i = 0; i <= last; i++) {
+      iconvg_premul_color c = suggested_palette->colors[i];
+      uint8_t ignored_bytes[4];
+      uint8_t opcode = 0;
+      all_1 = all_1 &&
+              (iconvg_private_encode_color(&ignored_bytes[0], &opcode, c) == 1);
+      all_2 = all_2 && ((c.rgba[0] % 0x11) == 0) &&
+              ((c.rgba[1] % 0x11) == 0) && ((c.rgba[2] % 0x11) == 0) &&
+              ((c.rgba[3] % 0x11) == 0);
+      all_3 = all_3 && (c.rgba[3] == 0xFF);
+    }
+    size_t bytes_per_elem = 4;
+    if (all_1) {
+      bytes_per_elem = 1;
+    } else if (all_2) {
+      bytes_per_elem = 2;
+    } else if (all_3) {
+      bytes_per_elem = 3;
+    }
+
+    uint8_t* p = &palette_chunk[0];
+    *p++ = 0x02;  // MID 1 (Suggested Palette).
+    *p++ = (uint8_t)(((bytes_per_elem - 1) << 6) | ((size_t)last));
+    for (int i = 0; i <= last; i++) {
+      const uint8_t* rgba = &suggested_palette->colors[i].rgba[0];
+      switch (bytes_per_elem) {
+        case 1: {
+          uint8_t opcode = 0;
+          iconvg_private_encode_color(p, &opcode, suggested_palette->colors[i]);
+          p += 1;
+          break;
+        }
+        case 2:
+          *p++ = (uint8_t)(((rgba[0] / 0x11) << 4) | (rgba[1] / 0x11));
+          *p++ = (uint8_t)(((rgba[2] / 0x11) << 4) | (rgba[3] / 0x11));
+          break;
+        case 3:
+          memcpy(p, rgba, 3);
+          p += 3;
+          break;
+        default:
+          memcpy(p, rgba, 4);
+          p += 4;
+          break;
+      }
+    }
+    palette_chunk_len = (size_t)(p - &palette_chunk[0]);
+  }
+
+  n += iconvg_private_append_encoded_number(
+      &buf[n], iconvg_private_encode_natural_number(
+                   (viewbox_chunk_len ? 1 : 0) + (palette_chunk_len ? 1 : 0)));
+  if (viewbox_chunk_len) {
+    n += iconvg_private_append_encoded_number(
+        &buf[n],
+        iconvg_private_encode_natural_number((uint32_t)viewbox_chunk_len));
+    memcpy(&buf[n], &viewbox_chunk[0], viewbox_chunk_len);
+    n += viewbox_chunk_len;
+  }
+  if (palette_chunk_len) {
+    n += iconvg_private_append_encoded_number(
+        &buf[n],
+        iconvg_private_encode_natural_number((uint32_t)palette_chunk_len));
+    memcpy(&buf[n], &palette_chunk[0], palette_chunk_len);
+    n += palette_chunk_len;
+  }
+  return iconvg_private_encoder__write(self, &buf[0], n);
+}
+
+// ----
+
+static void  //
+iconvg_private_encoder__set_known_creg(iconvg_encoder* self,
+                                       uint32_t index,
+                                       iconvg_premul_color c) {
+  index &= 0x3F;
+  self->private_creg_known_bits |= ((uint64_t)1) << index;
+  self->private_creg[index] = c;
+}
+
+// iconvg_private_encoder__append_creg_incr appends a "Set CREG[CSEL-0]; then
+// increment CSEL" styling op to dst, returning the number of bytes appended
+// (at most 5).
+static size_t  //
+iconvg_private_encoder__append_creg_incr(iconvg_encoder* self,
+                                         uint8_t* dst,
+                                         iconvg_premul_color c) {
+  uint8_t opcode = 0;
+  size_t n = 1 + iconvg_private_encode_color(dst + 1, &opcode, c);
+  dst[0] = opcode | 0x07;
+  iconvg_private_encoder__set_known_creg(self, self->private_csel, c);
+  self->private_csel = (self->private_csel + 1) & 0x3F;
+  return n;
+}
+
+// iconvg_private_encoder__append_nreg_incr appends a "Set NREG[NSEL-0]; then
+// increment NSEL" styling op to dst, returning the number of bytes appended
+// (at most 5). It uses whichever of the real, coordinate or zero-to-one number
+// encodings is shortest.
+static size_t  //
+iconvg_private_encoder__append_nreg_incr(iconvg_encoder* self,
+                                         uint8_t* dst,
+                                         float f) {
+  iconvg_private_encoded_number e = iconvg_private_encode_real_number(f);
+  uint8_t opcode = 0xA8;
+  iconvg_private_encoded_number e1 = iconvg_private_encode_coordinate_number(f);
+  if (e.len > e1.len) {
+    e = e1;
+    opcode = 0xB0;
+  }
+  iconvg_private_encoded_number e2 =
+      iconvg_private_encode_zero_to_one_number(f);
+  if (e.len > e2.len) {
+    e = e2;
+    opcode = 0xB8;
+  }
+  dst[0] = opcode | 0x07;
+  self->private_nsel = (self->private_nsel + 1) & 0x3F;
+  return 1 + iconvg_private_append_encoded_number(dst + 1, e);
+}
+
+const char*  //
+iconvg_encoder__begin_drawing_flat_color(iconvg_encoder* self,
+                                         iconvg_premul_color color) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__STYLING));
+  if (!iconvg_private_is_valid_premul_color(color)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+
+  // Re-use a recently written color register if we can. The "Start path"
+  // opcode can refer to any of CREG[CSEL-0] .. CREG[CSEL-6].
+  uint32_t color_u32 = iconvg_private_peek_u32le(&color.rgba[0]);
+  for (uint32_t adj = 0; adj <= 6; adj++) {
+    uint32_t index = (self->private_csel - adj) & 0x3F;
+    if (((self->private_creg_known_bits >> index) & 1) &&
+        (color_u32 ==
+         iconvg_private_peek_u32le(&self->private_creg[index].rgba[0]))) {
+      self->private_start_path_adj = adj;
+      self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH;
+      return NULL;
+    }
+  }
+
+  // Otherwise, write the color to CREG[CSEL] and increment CSEL, so that the
+  // previous few colors remain available for re-use.
+  iconvg_growable_buffer* b = self->private_dst;
+  const char* err_msg = iconvg_private_growable_buffer__reserve(b, 5);
+  if (err_msg) {
+    return iconvg_private_encoder__fail(self, err_msg);
+  }
+  b->len += iconvg_private_encoder__append_creg_incr(self, b->ptr + b->len,
+                                                      color);
+  self->private_run_index = 0;
+  self->private_start_path_adj = 1;
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__begin_drawing_gradient(
+    iconvg_encoder* self,
+    bool radial,
+    iconvg_gradient_spread spread,
+    uint32_t num_stops,
+    const iconvg_premul_color* stop_colors,
+    const float* stop_offsets,
+    iconvg_matrix_2x3_f64 transformation_matrix) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__STYLING));
+
+  // The NREG registers hold the 6 matrix elements and then the N offsets.
+  // There are only 64 registers.
+  if ((num_stops > 58) || (((uint32_t)spread) > 3) ||
+      ((num_stops > 0) && (!stop_colors || !stop_offsets))) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+  float m[6];
+  for (int i = 0; i < 6; i++) {
+    m[i] = (float)(transformation_matrix.elems[i / 3][i % 3]);
+    if (!isfinite(m[i])) {
+      return iconvg_private_encoder__fail(
+          self, iconvg_error_invalid_encoder_argument);
+    }
+  }
+  for (uint32_t i = 0; i < num_stops; i++) {
+    if (!iconvg_private_is_valid_premul_color(stop_colors[i]) ||
+        !(0.0f <= stop_offsets[i]) || !(stop_offsets[i] <= 1.0f)) {
+      return iconvg_private_encoder__fail(
+          self, iconvg_error_invalid_encoder_argument);
+    }
+  }
+
+  // Reserve room for (num_stops + 1) color ops and (num_stops + 6) number
+  // ops, each at most 5 bytes, so that the rest of this function can't fail
+  // half-way through.
+  size_t max_n = 5 * ((2 * ((size_t)num_stops)) + 7);
+  iconvg_growable_buffer* b = self->private_dst;
+  const char* err_msg = iconvg_private_growable_buffer__reserve(b, max_n);
+  if (err_msg) {
+    return iconvg_private_encoder__fail(self, err_msg);
+  }
+  uint8_t* p = b->ptr + b->len;
+
+  // The stops' colors go in CREG[CBASE ..], followed by the gradient paint
+  // itself. The matrix goes in NREG[NBASE - 6 ..], followed by the offsets.
+  uint32_t cbase = self->private_csel;
+  for (uint32_t i = 0; i < num_stops; i++) {
+    p += iconvg_private_encoder__append_creg_incr(self, p, stop_colors[i]);
+  }
+  for (int i = 0; i < 6; i++) {
+    p += iconvg_private_encoder__append_nreg_incr(self, p, m[i]);
+  }
+  uint32_t nbase = self->private_nsel;
+  for (uint32_t i = 0; i < num_stops; i++) {
+    p += iconvg_private_encoder__append_nreg_incr(self, p, stop_offsets[i]);
+  }
+
+  iconvg_premul_color paint;
+  paint.rgba[0] = (uint8_t)num_stops;
+  paint.rgba[1] = (uint8_t)((((uint32_t)spread) << 6) | cbase);
+  paint.rgba[2] = (uint8_t)(0x80 | (radial ? 0x40 : 0x00) | nbase);
+  paint.rgba[3] = 0x00;
+  p += iconvg_private_encoder__append_creg_incr(self, p, paint);
+
+  b->len = (size_t)(p - b->ptr);
+  self->private_run_index = 0;
+  self->private_start_path_adj = 1;
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__end_drawing(iconvg_encoder* self) {
+  if (!self) {
+    return iconvg_error_invalid_encoder_state;
+  } else if (self->private_err_msg) {
+    return self->private_err_msg;
+  } else if (self->private_mode ==
+             ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH) {
+    // An empty drawing. There are no drawing opcodes to write. The styling
+    // opcodes, if any, are harmless.
+    self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__STYLING;
+    return NULL;
+  }
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_AFTER_PATH));
+  ICONVG_PRIVATE_TRY(
+      iconvg_private_encoder__write_single(self, 0xE1, NULL, 0));  // 'z'.
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__STYLING;
+  return NULL;
+}
+
+// ----
+
+const char*  //
+iconvg_encoder__begin_path(iconvg_encoder* self, float x0, float y0) {
+  if (!self) {
+    return iconvg_error_invalid_encoder_state;
+  } else if (self->private_err_msg) {
+    return self->private_err_msg;
+  } else if (!isfinite(x0) || !isfinite(y0)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+
+  iconvg_private_encoded_number args[2];
+  args[0] = iconvg_private_encode_coordinate_number(x0);
+  args[1] = iconvg_private_encode_coordinate_number(y0);
+
+  if (self->private_mode == ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH) {
+    // "Start path" is always absolute.
+    ICONVG_PRIVATE_TRY(iconvg_private_encoder__write_single(
+        self, (uint8_t)(0xC0 | self->private_start_path_adj), args, 2));
+
+  } else {
+    ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+        self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_AFTER_PATH));
+    // As in SVG, closing a path moves the current point back to where the
+    // path started, so 'z; m' is relative to that.
+    iconvg_private_encoded_number relative[2];
+    relative[0] = iconvg_private_encode_relative_coordinate_number(
+        self->private_start_x, args[0].value);
+    relative[1] = iconvg_private_encode_relative_coordinate_number(
+        self->private_start_y, args[1].value);
+    if (relative[0].len && relative[1].len &&
+        ((relative[0].len + relative[1].len) < (args[0].len + args[1].len))) {
+      ICONVG_PRIVATE_TRY(iconvg_private_encoder__write_single(
+          self, 0xE3, relative, 2));  // 'z; m'.
+      args[0].value = relative[0].value;
+      args[1].value = relative[1].value;
+    } else {
+      ICONVG_PRIVATE_TRY(iconvg_private_encoder__write_single(
+          self, 0xE2, args, 2));  // 'z; M'.
+    }
+  }
+
+  self->private_curr_x = args[0].value;
+  self->private_curr_y = args[1].value;
+  self->private_start_x = args[0].value;
+  self->private_start_y = args[1].value;
+  self->private_refl_x = args[0].value;
+  self->private_refl_y = args[1].value;
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__end_path(iconvg_encoder* self) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH));
+  // Closing a path doesn't write anything yet. The next opcode ('z', 'z; M'
+  // or 'z; m') does that, depending on what comes next.
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__DRAWING_AFTER_PATH;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__path_line_to(iconvg_encoder* self, float x1, float y1) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH));
+  if (!isfinite(x1) || !isfinite(y1)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+  float curr_x = self->private_curr_x;
+  float curr_y = self->private_curr_y;
+
+  iconvg_private_encoded_number absolute[2];
+  absolute[0] = iconvg_private_encode_coordinate_number(x1);
+  absolute[1] = iconvg_private_encode_coordinate_number(y1);
+  iconvg_private_encoded_number relative[2];
+  relative[0] = iconvg_private_encode_relative_coordinate_number(curr_x,
+                                                            absolute[0].value);
+  relative[1] = iconvg_private_encode_relative_coordinate_number(curr_y,
+                                                            absolute[1].value);
+
+  // Pick the cheapest of 'L', 'l', 'H', 'h', 'V' and 'v'. Ties go to the
+  // earlier (in that list) mnemonic.
+  uint8_t opcode = 0x00;
+  const iconvg_private_encoded_number* args = absolute;
+  size_t num_args = 2;
+  size_t cost = iconvg_private_encoder__segment_cost(self, 0x00, absolute, 2);
+  size_t c = iconvg_private_encoder__segment_cost(self, 0x20, relative, 2);
+  if (c < cost) {
+    opcode = 0x20;
+    args = relative;
+    num_args = 2;
+    cost = c;
+  }
+  if (absolute[1].value == curr_y) {
+    if ((1 + absolute[0].len) < cost) {
+      opcode = 0xE6;
+      args = &absolute[0];
+      num_args = 1;
+      cost = 1 + absolute[0].len;
+    }
+    if (relative[0].len && ((1 + relative[0].len) < cost)) {
+      opcode = 0xE7;
+      args = &relative[0];
+      num_args = 1;
+      cost = 1 + relative[0].len;
+    }
+  }
+  if (absolute[0].value == curr_x) {
+    if ((1 + absolute[1].len) < cost) {
+      opcode = 0xE8;
+      args = &absolute[1];
+      num_args = 1;
+      cost = 1 + absolute[1].len;
+    }
+    if (relative[1].len && ((1 + relative[1].len) < cost)) {
+      opcode = 0xE9;
+      args = &relative[1];
+      num_args = 1;
+      cost = 1 + relative[1].len;
+    }
+  }
+
+  switch (opcode) {
+    case 0x00:
+    case 0x20:
+      ICONVG_PRIVATE_TRY(
+          iconvg_private_encoder__write_segment(self, opcode, args, num_args));
+      curr_x = args[0].value;
+      curr_y = args[1].value;
+      break;
+    case 0xE6:
+    case 0xE7:
+      ICONVG_PRIVATE_TRY(
+          iconvg_private_encoder__write_single(self, opcode, args, num_args));
+      curr_x = args[0].value;
+      break;
+    default:
+      ICONVG_PRIVATE_TRY(
+          iconvg_private_encoder__write_single(self, opcode, args, num_args));
+      curr_y = args[0].value;
+      break;
+  }
+
+  self->private_curr_x = curr_x;
+  self->private_curr_y = curr_y;
+  self->private_refl_x = curr_x;
+  self->private_refl_y = curr_y;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__path_quad_to(iconvg_encoder* self,
+                             float x1,
+                             float y1,
+                             float x2,
+                             float y2) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH));
+  if (!isfinite(x1) || !isfinite(y1) || !isfinite(x2) || !isfinite(y2)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+  float curr_x = self->private_curr_x;
+  float curr_y = self->private_curr_y;
+
+  iconvg_private_encoded_number absolute[4];
+  absolute[0] = iconvg_private_encode_coordinate_number(x1);
+  absolute[1] = iconvg_private_encode_coordinate_number(y1);
+  absolute[2] = iconvg_private_encode_coordinate_number(x2);
+  absolute[3] = iconvg_private_encode_coordinate_number(y2);
+  iconvg_private_encoded_number relative[4];
+  relative[0] = iconvg_private_encode_relative_coordinate_number(curr_x,
+                                                            absolute[0].value);
+  relative[1] = iconvg_private_encode_relative_coordinate_number(curr_y,
+                                                            absolute[1].value);
+  relative[2] = iconvg_private_encode_relative_coordinate_number(curr_x,
+                                                            absolute[2].value);
+  relative[3] = iconvg_private_encode_relative_coordinate_number(curr_y,
+                                                            absolute[3].value);
+
+  // Pick the cheapest of 'T', 't', 'Q' and 'q'. The smooth forms ('T' and
+  // 't') are only possible if the control point is the reflection of the
+  // previous one, as the decoder computes it.
+  bool smooth = (absolute[0].value == self->private_refl_x) &&
+                (absolute[1].value == self->private_refl_y);
+  uint8_t opcode = 0x60;
+  const iconvg_private_encoded_number* args = absolute;
+  size_t num_args = 4;
+  size_t cost = iconvg_private_encoder__segment_cost(self, 0x60, absolute, 4);
+  size_t c = iconvg_private_encoder__segment_cost(self, 0x70, relative, 4);
+  if (c < cost) {
+    opcode = 0x70;
+    args = relative;
+    num_args = 4;
+    cost = c;
+  }
+  if (smooth) {
+    c = iconvg_private_encoder__segment_cost(self, 0x40, &absolute[2], 2);
+    if (c < cost) {
+      opcode = 0x40;
+      args = &absolute[2];
+      num_args = 2;
+      cost = c;
+    }
+    c = iconvg_private_encoder__segment_cost(self, 0x50, &relative[2], 2);
+    if (c < cost) {
+      opcode = 0x50;
+      args = &relative[2];
+      num_args = 2;
+      cost = c;
+    }
+  }
+  ICONVG_PRIVATE_TRY(
+      iconvg_private_encoder__write_segment(self, opcode, args, num_args));
+
+  float ctrl_x = (num_args == 4) ? args[0].value : self->private_refl_x;
+  float ctrl_y = (num_args == 4) ? args[1].value : self->private_refl_y;
+  curr_x = args[num_args - 2].value;
+  curr_y = args[num_args - 1].value;
+  self->private_curr_x = curr_x;
+  self->private_curr_y = curr_y;
+  self->private_refl_x = (2 * curr_x) - ctrl_x;
+  self->private_refl_y = (2 * curr_y) - ctrl_y;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__path_cube_to(iconvg_encoder* self,
+                             float x1,
+                             float y1,
+                             float x2,
+                             float y2,
+                             float x3,
+                             float y3) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH));
+  if (!isfinite(x1) || !isfinite(y1) || !isfinite(x2) || !isfinite(y2) ||
+      !isfinite(x3) || !isfinite(y3)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+  float curr_x = self->private_curr_x;
+  float curr_y = self->private_curr_y;
+
+  iconvg_private_encoded_number absolute[6];
+  absolute[0] = iconvg_private_encode_coordinate_number(x1);
+  absolute[1] = iconvg_private_encode_coordinate_number(y1);
+  absolute[2] = iconvg_private_encode_coordinate_number(x2);
+  absolute[3] = iconvg_private_encode_coordinate_number(y2);
+  absolute[4] = iconvg_private_encode_coordinate_number(x3);
+  absolute[5] = iconvg_private_encode_coordinate_number(y3);
+  iconvg_private_encoded_number relative[6];
+  for (int i = 0; i < 6; i += 2) {
+    relative[i + 0] = iconvg_private_encode_relative_coordinate_number(
+        curr_x, absolute[i + 0].value);
+    relative[i + 1] = iconvg_private_encode_relative_coordinate_number(
+        curr_y, absolute[i + 1].value);
+  }
+
+  // Pick the cheapest of 'S', 's', 'C' and 'c'. The smooth forms ('S' and
+  // 's') are only possible if the first control point is the reflection of
+  // the previous one, as the decoder computes it.
+  bool smooth = (absolute[0].value == self->private_refl_x) &&
+                (absolute[1].value == self->private_refl_y);
+  uint8_t opcode = 0xA0;
+  const iconvg_private_encoded_number* args = absolute;
+  size_t num_args = 6;
+  size_t cost = iconvg_private_encoder__segment_cost(self, 0xA0, absolute, 6);
+  size_t c = iconvg_private_encoder__segment_cost(self, 0xB0, relative, 6);
+  if (c < cost) {
+    opcode = 0xB0;
+    args = relative;
+    num_args = 6;
+    cost = c;
+  }
+  if (smooth) {
+    c = iconvg_private_encoder__segment_cost(self, 0x80, &absolute[2], 4);
+    if (c < cost) {
+      opcode = 0x80;
+      args = &absolute[2];
+      num_args = 4;
+      cost = c;
+    }
+    c = iconvg_private_encoder__segment_cost(self, 0x90, &relative[2], 4);
+    if (c < cost) {
+      opcode = 0x90;
+      args = &relative[2];
+      num_args = 4;
+      cost = c;
+    }
+  }
+  ICONVG_PRIVATE_TRY(
+      iconvg_private_encoder__write_segment(self, opcode, args, num_args));
+
+  float ctrl_x = args[num_args - 4].value;
+  float ctrl_y = args[num_args - 3].value;
+  curr_x = args[num_args - 2].value;
+  curr_y = args[num_args - 1].value;
+  self->private_curr_x = curr_x;
+  self->private_curr_y = curr_y;
+  self->private_refl_x = (2 * curr_x) - ctrl_x;
+  self->private_refl_y = (2 * curr_y) - ctrl_y;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__path_arc_to(iconvg_encoder* self,
+                            float radius_x,
+                            float radius_y,
+                            float x_axis_rotation,
+                            bool large_arc,
+                            bool sweep,
+                            float final_x,
+                            float final_y) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH));
+  if (!isfinite(radius_x) || !isfinite(radius_y) ||
+      !isfinite(x_axis_rotation) || !isfinite(final_x) || !isfinite(final_y)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+
+  // Normalize the rotation to the range [0, 1).
+  double rotation = (double)x_axis_rotation;
+  rotation -= floor(rotation);
+  if (((float)rotation) >= 1.0f) {
+    rotation = 0;
+  }
+
+  iconvg_private_encoded_number args[6];
+  args[0] = iconvg_private_encode_coordinate_number(radius_x);
+  args[1] = iconvg_private_encode_coordinate_number(radius_y);
+  args[2] = iconvg_private_encode_zero_to_one_number((float)rotation);
+  args[3] = iconvg_private_encode_natural_number((large_arc ? 0x01 : 0x00) |
+                                                 (sweep ? 0x02 : 0x00));
+  args[4] = iconvg_private_encode_coordinate_number(final_x);
+  args[5] = iconvg_private_encode_coordinate_number(final_y);
+  iconvg_private_encoded_number relative[6];
+  memcpy(&relative[0], &args[0], 4 * sizeof(args[0]));
+  relative[4] = iconvg_private_encode_relative_coordinate_number(
+      self->private_curr_x, args[4].value);
+  relative[5] = iconvg_private_encode_relative_coordinate_number(
+      self->private_curr_y, args[5].value);
+
+  uint8_t opcode = 0xC0;
+  size_t cost = iconvg_private_encoder__segment_cost(self, 0xC0, args, 6);
+  size_t c = iconvg_private_encoder__segment_cost(self, 0xD0, relative, 6);
+  if (c < cost) {
+    opcode = 0xD0;
+    memcpy(&args[0], &relative[0], 6 * sizeof(args[0]));
+  }
+  ICONVG_PRIVATE_TRY(
+      iconvg_private_encoder__write_segment(self, opcode, args, 6));
+
+  self->private_curr_x = args[4].value;
+  self->private_curr_y = args[5].value;
+  self->private_refl_x = args[4].value;
+  self->private_refl_y = args[5].value;
+  return NULL;
+}
+
+// ----
+
+const char*  //
+iconvg_encoder__finish(iconvg_encoder* self) {
+  return iconvg_private_encoder__check(self,
+                                       ICONVG_PRIVATE_ENCODER_MODE__STYLING);
+}
+
 // -------------------------------- #include "./error.c"
 
 const char iconvg_error_bad_color[] =  //
@@ -2973,6 +6545,8 @@ const char iconvg_error_bad_magic_identifier[] =  //
     "iconvg: bad magic identifier";
 const char iconvg_error_bad_metadata[] =  //
     "iconvg: bad metadata";
+const char iconvg_error_bad_metadata_drawing_index[] =  //
+    "iconvg: bad metadata (drawing index)";
 const char iconvg_error_bad_metadata_id_order[] =  //
     "iconvg: bad metadata ID order";
 const char iconvg_error_bad_metadata_suggested_palette[] =  //
@@ -2991,10 +6565,32 @@ const char iconvg_error_system_failure_out_of_memory[] =  //
 
 const char iconvg_error_invalid_backend_not_enabled[] =  //
     "iconvg: invalid backend (not enabled)";
+const char iconvg_error_invalid_batch_argument[] =  //
+    "iconvg: invalid batch argument";
+const char iconvg_error_invalid_buffer_too_small[] =  //
+    "iconvg: invalid buffer (too small)";
 const char iconvg_error_invalid_constructor_argument[] =  //
     "iconvg: invalid constructor argument";
+const char iconvg_error_invalid_damage_argument[] =  //
+    "iconvg: invalid damage argument";
+const char iconvg_error_invalid_dst_transform[] =  //
+    "iconvg: invalid dst transform";
+const char iconvg_error_invalid_encoder_argument[] =  //
+    "iconvg: invalid encoder argument";
+const char iconvg_error_invalid_encoder_state[] =  //
+    "iconvg: invalid encoder state";
+const char iconvg_error_invalid_instances_argument[] =  //
+    "iconvg: invalid instances argument";
+const char iconvg_error_invalid_mipmap_argument[] =  //
+    "iconvg: invalid mipmap argument";
 const char iconvg_error_invalid_paint_type[] =  //
     "iconvg: invalid paint type";
+const char iconvg_error_invalid_pixel_argument[] =  //
+    "iconvg: invalid pixel argument";
+const char iconvg_error_invalid_raster_cache_argument[] =  //
+    "iconvg: invalid raster cache argument";
+const char iconvg_error_invalid_trace[] =  //
+    "iconvg: invalid trace";
 const char iconvg_error_unsupported_vtable[] =  //
     "iconvg: unsupported vtable";
 
@@ -3010,6 +6606,7 @@ iconvg_error_is_file_format_error(const char* err_msg) {
          (err_msg == iconvg_error_bad_drawing_opcode) ||
          (err_msg == iconvg_error_bad_magic_identifier) ||
          (err_msg == iconvg_error_bad_metadata) ||
+         (err_msg == iconvg_error_bad_metadata_drawing_index) ||
          (err_msg == iconvg_error_bad_metadata_id_order) ||
          (err_msg == iconvg_error_bad_metadata_suggested_palette) ||
          (err_msg == iconvg_error_bad_metadata_viewbox) ||
@@ -3018,30 +6615,338 @@ iconvg_error_is_file_format_error(const char* err_msg) {
          (err_msg == iconvg_error_bad_styling_opcode);
 }
 
-// -------------------------------- #include "./matrix.c"
-
-iconvg_matrix_2x3_f64  //
-iconvg_matrix_2x3_f64__inverse(iconvg_matrix_2x3_f64* self) {
-  double inv = 1.0 / iconvg_matrix_2x3_f64__determinant(self);
-  if (isinf(inv) || isnan(inv)) {
-    return iconvg_make_matrix_2x3_f64(1.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+const char*  //
+iconvg_private_error_from_string(const char* s) {
+  static const char* const errors[] = {
+      iconvg_error_bad_color,
+      iconvg_error_bad_coordinate,
+      iconvg_error_bad_drawing_opcode,
+      iconvg_error_bad_magic_identifier,
+      iconvg_error_bad_metadata,
+      iconvg_error_bad_metadata_drawing_index,
+      iconvg_error_bad_metadata_id_order,
+      iconvg_error_bad_metadata_suggested_palette,
+      iconvg_error_bad_metadata_viewbox,
+      iconvg_error_bad_number,
+      iconvg_error_bad_path_unfinished,
+      iconvg_error_bad_styling_opcode,
+      iconvg_error_system_failure_out_of_memory,
+      iconvg_error_invalid_backend_not_enabled,
+      iconvg_error_invalid_batch_argument,
+      iconvg_error_invalid_buffer_too_small,
+      iconvg_error_invalid_constructor_argument,
+      iconvg_error_invalid_damage_argument,
+      iconvg_error_invalid_dst_transform,
+      iconvg_error_invalid_encoder_argument,
+      iconvg_error_invalid_encoder_state,
+      iconvg_error_invalid_instances_argument,
+      iconvg_error_invalid_mipmap_argument,
+      iconvg_error_invalid_paint_type,
+      iconvg_error_invalid_pixel_argument,
+      iconvg_error_invalid_raster_cache_argument,
+      iconvg_error_invalid_trace,
+      iconvg_error_unsupported_vtable,
+      iconvg_private_internal_error_unreachable,
+  };
+  if (s) {
+    for (size_t i = 0; i < (sizeof(errors) / sizeof(errors[0])); i++) {
+      if (!strcmp(s, errors[i])) {
+        return errors[i];
+      }
+    }
   }
+  return NULL;
+}
 
-  // https://ardoris.wordpress.com/2008/07/18/general-formula-for-the-inverse-of-a-3x3-matrix/
-  // recalling that self's implicit bottom row is [0, 0, 1].
-  double e02 = (self->elems[0][1] * self->elems[1][2]) -
-               (self->elems[0][2] * self->elems[1][1]);
-  double e12 = (self->elems[0][0] * self->elems[1][2]) -
-               (self->elems[0][2] * self->elems[1][0]);
-  return iconvg_make_matrix_2x3_f64(+inv * self->elems[1][1],  //
-                                    -inv * self->elems[0][1],  //
-                                    +inv * e02,                //
-                                    -inv * self->elems[1][0],  //
-                                    +inv * self->elems[0][0],  //
-                                    -inv * e12);               //
+// -------------------------------- #include "./instance.c"
+
+// The instances canvas sits between iconvg_decode and the wrapped canvas
+// passed to iconvg_decode_instances. context_nonconst_ptr0 points to an
+// iconvg_private_instances_state.
+//
+// If the wrapped canvas implements end_drawing_instances then every call is
+// forwarded as is, other than end_drawing. Otherwise, each drawing's path is
+// buffered and, at end_drawing, replayed once per instance.
+
+typedef struct iconvg_private_instances_state_struct {
+  iconvg_canvas* wrapped;
+  float min_dx;
+  float min_dy;
+  float max_dx;
+  float max_dy;
+  const float* offsets_xy;
+  size_t num_instances;
+  bool forward;
+  iconvg_growable_buffer path;
+} iconvg_private_instances_state;
+
+static const char*  //
+iconvg_private_instances_canvas__begin_decode(iconvg_canvas* c,
+                                              iconvg_rectangle_f32 dst_rect) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  iconvg_canvas* w = s->wrapped;
+  // dst_rect already accounts for any dst_transform. Grow it to cover every
+  // instance.
+  iconvg_rectangle_f32 union_rect = iconvg_make_rectangle_f32(
+      dst_rect.min_x + s->min_dx, dst_rect.min_y + s->min_dy,  //
+      dst_rect.max_x + s->max_dx, dst_rect.max_y + s->max_dy);
+  return (*w->vtable->begin_decode)(w, union_rect);
 }
 
-void  //
+static const char*  //
+iconvg_private_instances_canvas__end_decode(iconvg_canvas* c,
+                                            const char* err_msg,
+                                            size_t num_bytes_consumed,
+                                            size_t num_bytes_remaining) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  iconvg_canvas* w = s->wrapped;
+  return (*w->vtable->end_decode)(w, err_msg, num_bytes_consumed,
+                                  num_bytes_remaining);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__begin_drawing(iconvg_canvas* c) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->begin_drawing)(w);
+  }
+  s->path.len = 0;
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_instances_canvas__end_drawing(iconvg_canvas* c,
+                                             const iconvg_paint* p) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  iconvg_canvas* w = s->wrapped;
+  if (s->forward) {
+    return (*w->vtable->end_drawing_instances)(w, p, s->offsets_xy,
+                                               s->num_instances);
+  }
+
+  for (size_t i = 0; i < s->num_instances; i++) {
+    float dx = s->offsets_xy[(2 * i) + 0];
+    float dy = s->offsets_xy[(2 * i) + 1];
+    ICONVG_PRIVATE_TRY((*w->vtable->begin_drawing)(w));
+    ICONVG_PRIVATE_TRY(iconvg_private_path_buffer__replay(
+        s->path.ptr, s->path.len, w, dx, dy));
+
+    // Translate the paint too, so that gradients move with their paths. The
+    // offset applies after any dst_transform, so it is folded into the
+    // inverse_dst_transform (as a translation by -offset, applied first).
+    iconvg_paint q = *p;
+    iconvg_matrix_2x3_f64* m = &q.inverse_dst_transform;
+    m->elems[0][2] -= (m->elems[0][0] * dx) + (m->elems[0][1] * dy);
+    m->elems[1][2] -= (m->elems[1][0] * dx) + (m->elems[1][1] * dy);
+    ICONVG_PRIVATE_TRY((*w->vtable->end_drawing)(w, &q));
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_instances_canvas__begin_path(iconvg_canvas* c,
+                                            float x0,
+                                            float y0) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->begin_path)(w, x0, y0);
+  }
+  float args[2] = {x0, y0};
+  return iconvg_private_path_buffer__append(
+      &s->path, ICONVG_PRIVATE_PATH_OP__BEGIN_PATH, args, 2);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__end_path(iconvg_canvas* c) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->end_path)(w);
+  }
+  return iconvg_private_path_buffer__append(
+      &s->path, ICONVG_PRIVATE_PATH_OP__END_PATH, NULL, 0);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__path_line_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->path_line_to)(w, x1, y1);
+  }
+  float args[2] = {x1, y1};
+  return iconvg_private_path_buffer__append(
+      &s->path, ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO, args, 2);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__path_quad_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1,
+                                              float x2,
+                                              float y2) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->path_quad_to)(w, x1, y1, x2, y2);
+  }
+  float args[4] = {x1, y1, x2, y2};
+  return iconvg_private_path_buffer__append(
+      &s->path, ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO, args, 4);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__path_cube_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1,
+                                              float x2,
+                                              float y2,
+                                              float x3,
+                                              float y3) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->path_cube_to)(w, x1, y1, x2, y2, x3, y3);
+  }
+  float args[6] = {x1, y1, x2, y2, x3, y3};
+  return iconvg_private_path_buffer__append(
+      &s->path, ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO, args, 6);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  iconvg_canvas* w = s->wrapped;
+  return (*w->vtable->on_metadata_viewbox)(w, viewbox);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  iconvg_canvas* w = s->wrapped;
+  return (*w->vtable->on_metadata_suggested_palette)(w, suggested_palette);
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_instances_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_instances_canvas__begin_decode,
+        &iconvg_private_instances_canvas__end_decode,
+        &iconvg_private_instances_canvas__begin_drawing,
+        &iconvg_private_instances_canvas__end_drawing,
+        &iconvg_private_instances_canvas__begin_path,
+        &iconvg_private_instances_canvas__end_path,
+        &iconvg_private_instances_canvas__path_line_to,
+        &iconvg_private_instances_canvas__path_quad_to,
+        &iconvg_private_instances_canvas__path_cube_to,
+        &iconvg_private_instances_canvas__on_metadata_viewbox,
+        &iconvg_private_instances_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// ----
+
+const char*  //
+iconvg_decode_instances(iconvg_canvas* dst_canvas,
+                        iconvg_rectangle_f32 dst_rect,
+                        const uint8_t* src_ptr,
+                        size_t src_len,
+                        const float* offsets_xy,
+                        size_t num_instances,
+                        const iconvg_decode_options* options) {
+  iconvg_canvas fallback_canvas = iconvg_make_broken_canvas(NULL);
+  if (!dst_canvas || !dst_canvas->vtable) {
+    dst_canvas = &fallback_canvas;
+  }
+  if (dst_canvas->vtable->sizeof__iconvg_canvas_vtable !=
+      sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  } else if (!offsets_xy && (num_instances > 0)) {
+    return iconvg_error_invalid_instances_argument;
+  }
+
+  iconvg_private_instances_state s;
+  s.wrapped = dst_canvas;
+  s.min_dx = 0.0f;
+  s.min_dy = 0.0f;
+  s.max_dx = 0.0f;
+  s.max_dy = 0.0f;
+  s.offsets_xy = offsets_xy;
+  s.num_instances = num_instances;
+  s.forward = dst_canvas->vtable->end_drawing_instances && (num_instances > 0);
+  s.path = iconvg_make_growable_buffer(NULL, 0);
+  s.path.grow = &iconvg_growable_buffer__realloc_grow;
+
+  if (num_instances > 0) {
+    s.min_dx = offsets_xy[0];
+    s.min_dy = offsets_xy[1];
+    s.max_dx = offsets_xy[0];
+    s.max_dy = offsets_xy[1];
+    for (size_t i = 1; i < num_instances; i++) {
+      float dx = offsets_xy[(2 * i) + 0];
+      float dy = offsets_xy[(2 * i) + 1];
+      s.min_dx = (s.min_dx < dx) ? s.min_dx : dx;
+      s.min_dy = (s.min_dy < dy) ? s.min_dy : dy;
+      s.max_dx = (s.max_dx > dx) ? s.max_dx : dx;
+      s.max_dy = (s.max_dy > dy) ? s.max_dy : dy;
+    }
+  }
+
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_instances_canvas_vtable;
+  c.context_nonconst_ptr0 = &s;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+
+  const char* err_msg = iconvg_decode(&c, dst_rect, src_ptr, src_len, options);
+  free(s.path.ptr);
+  return err_msg;
+}
+
+// -------------------------------- #include "./matrix.c"
+
+iconvg_matrix_2x3_f64  //
+iconvg_matrix_2x3_f64__inverse(iconvg_matrix_2x3_f64* self) {
+  double inv = 1.0 / iconvg_matrix_2x3_f64__determinant(self);
+  if (isinf(inv) || isnan(inv)) {
+    return iconvg_make_matrix_2x3_f64(1.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+  }
+
+  // https://ardoris.wordpress.com/2008/07/18/general-formula-for-the-inverse-of-a-3x3-matrix/
+  // recalling that self's implicit bottom row is [0, 0, 1].
+  double e02 = (self->elems[0][1] * self->elems[1][2]) -
+               (self->elems[0][2] * self->elems[1][1]);
+  double e12 = (self->elems[0][0] * self->elems[1][2]) -
+               (self->elems[0][2] * self->elems[1][0]);
+  return iconvg_make_matrix_2x3_f64(+inv * self->elems[1][1],  //
+                                    -inv * self->elems[0][1],  //
+                                    +inv * e02,                //
+                                    -inv * self->elems[1][0],  //
+                                    +inv * self->elems[0][0],  //
+                                    -inv * e12);               //
+}
+
+void  //
 iconvg_matrix_2x3_f64__override_second_row(iconvg_matrix_2x3_f64* self) {
   if (!self) {
     return;
@@ -3062,6 +6967,306 @@ iconvg_matrix_2x3_f64__override_second_row(iconvg_matrix_2x3_f64* self) {
   }
 }
 
+// -------------------------------- #include "./mipmap.c"
+
+// The hash canvas computes a 64-bit FNV-1a hash of its vtable calls and their
+// arguments. context_nonconst_ptr0 points to the uint64_t hash.
+
+static inline void  //
+iconvg_private_hash_canvas__update(iconvg_canvas* c,
+                                   const void* ptr,
+                                   size_t len) {
+  uint64_t* hash = (uint64_t*)(c->context_nonconst_ptr0);
+  uint64_t h = *hash;
+  const uint8_t* p = (const uint8_t*)ptr;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 0x00000100000001B3ull;
+  }
+  *hash = h;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__begin_decode(iconvg_canvas* c,
+                                         iconvg_rectangle_f32 dst_rect) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__end_decode(iconvg_canvas* c,
+                                       const char* err_msg,
+                                       size_t num_bytes_consumed,
+                                       size_t num_bytes_remaining) {
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__begin_drawing(iconvg_canvas* c) {
+  static const uint8_t op = 0x03;
+  iconvg_private_hash_canvas__update(c, &op, 1);
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__end_drawing(iconvg_canvas* c,
+                                        const iconvg_paint* p) {
+  static const uint8_t op = 0x04;
+  iconvg_private_hash_canvas__update(c, &op, 1);
+  iconvg_private_hash_canvas__update(c, &p->paint_rgba[0], 4);
+  switch (iconvg_paint__type(p)) {
+    case ICONVG_PAINT_TYPE__LINEAR_GRADIENT:
+    case ICONVG_PAINT_TYPE__RADIAL_GRADIENT: {
+      iconvg_matrix_2x3_f64 m = iconvg_paint__gradient_transformation_matrix(p);
+      iconvg_private_hash_canvas__update(c, &m, sizeof(m));
+      uint32_t nstops = iconvg_paint__gradient_number_of_stops(p);
+      for (uint32_t i = 0; i < nstops; i++) {
+        iconvg_premul_color k =
+            iconvg_paint__gradient_stop_color_as_premul_color(p, i);
+        float offset = iconvg_paint__gradient_stop_offset(p, i);
+        iconvg_private_hash_canvas__update(c, &k, sizeof(k));
+        iconvg_private_hash_canvas__update(c, &offset, sizeof(offset));
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  float args[3] = {5, x0, y0};
+  iconvg_private_hash_canvas__update(c, &args[0], sizeof(args));
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__end_path(iconvg_canvas* c) {
+  static const uint8_t op = 0x06;
+  iconvg_private_hash_canvas__update(c, &op, 1);
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__path_line_to(iconvg_canvas* c, float x1, float y1) {
+  float args[3] = {7, x1, y1};
+  iconvg_private_hash_canvas__update(c, &args[0], sizeof(args));
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__path_quad_to(iconvg_canvas* c,
+                                         float x1,
+                                         float y1,
+                                         float x2,
+                                         float y2) {
+  float args[5] = {8, x1, y1, x2, y2};
+  iconvg_private_hash_canvas__update(c, &args[0], sizeof(args));
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__path_cube_to(iconvg_canvas* c,
+                                         float x1,
+                                         float y1,
+                                         float x2,
+                                         float y2,
+                                         float x3,
+                                         float y3) {
+  float args[7] = {9, x1, y1, x2, y2, x3, y3};
+  iconvg_private_hash_canvas__update(c, &args[0], sizeof(args));
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__on_metadata_viewbox(iconvg_canvas* c,
+                                                iconvg_rectangle_f32 viewbox) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  return NULL;
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_hash_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_hash_canvas__begin_decode,
+        &iconvg_private_hash_canvas__end_decode,
+        &iconvg_private_hash_canvas__begin_drawing,
+        &iconvg_private_hash_canvas__end_drawing,
+        &iconvg_private_hash_canvas__begin_path,
+        &iconvg_private_hash_canvas__end_path,
+        &iconvg_private_hash_canvas__path_line_to,
+        &iconvg_private_hash_canvas__path_quad_to,
+        &iconvg_private_hash_canvas__path_cube_to,
+        &iconvg_private_hash_canvas__on_metadata_viewbox,
+        &iconvg_private_hash_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// iconvg_private_mipmap_signature sets *dst_hash to a hash of what decoding
+// src would draw, with Level of Detail thresholds evaluated at the given
+// height (in pixels) but with geometry always mapped to the fixed dst_rect.
+// Two heights with equal signatures draw the same paths and paints.
+static const char*  //
+iconvg_private_mipmap_signature(uint64_t* dst_hash,
+                                iconvg_rectangle_f32 dst_rect,
+                                int64_t height_in_pixels,
+                                const uint8_t* src_ptr,
+                                size_t src_len,
+                                const iconvg_decode_options* options) {
+  iconvg_decode_options o = iconvg_make_decode_options_ffv1(NULL);
+  if (options) {
+    o.palette = options->palette;
+    o.height_in_pixels = options->height_in_pixels;
+  }
+  if (!o.height_in_pixels.has_value) {
+    o.height_in_pixels = iconvg_make_optional_i64_some(height_in_pixels);
+  }
+
+  *dst_hash = 0xCBF29CE484222325ull;  // The FNV-1a offset basis.
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_hash_canvas_vtable;
+  c.context_nonconst_ptr0 = dst_hash;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+  return iconvg_decode(&c, dst_rect, src_ptr, src_len, &o);
+}
+
+// ----
+
+// iconvg_private_mipmap_downsample sets dst to a 2x2 box filter of src. Both
+// hold 4 bytes (4 premultiplied-alpha channels, in any order) per pixel. When
+// a src dimension is 1, that single row or column is weighted double.
+//
+// Each uint32_t pixel is split into two 0x00FF00FF-masked halves, so that one
+// integer addition sums two channels at a time (SIMD within a register). The
+// per-channel sums are at most ((4 * 0xFF) + 2), which cannot overflow into
+// the neighboring 16-bit lane.
+static void  //
+iconvg_private_mipmap_downsample(iconvg_mipmap_level* dst,
+                                 const iconvg_mipmap_level* src) {
+  const uint32_t mask = 0x00FF00FF;
+  for (uint32_t y = 0; y < dst->height; y++) {
+    uint32_t sy0 = 2 * y;
+    uint32_t sy1 = ((sy0 + 1) < src->height) ? (sy0 + 1) : sy0;
+    const uint8_t* row0 = src->ptr + (sy0 * src->stride);
+    const uint8_t* row1 = src->ptr + (sy1 * src->stride);
+    uint8_t* d = dst->ptr + (y * dst->stride);
+    for (uint32_t x = 0; x < dst->width; x++) {
+      uint32_t sx0 = 2 * x;
+      uint32_t sx1 = ((sx0 + 1) < src->width) ? (sx0 + 1) : sx0;
+      uint32_t p = iconvg_private_peek_u32le(row0 + (4 * sx0));
+      uint32_t q = iconvg_private_peek_u32le(row0 + (4 * sx1));
+      uint32_t r = iconvg_private_peek_u32le(row1 + (4 * sx0));
+      uint32_t s = iconvg_private_peek_u32le(row1 + (4 * sx1));
+      uint32_t lo = (p & mask) + (q & mask) + (r & mask) + (s & mask) +
+                    0x00020002;
+      uint32_t hi = ((p >> 8) & mask) + ((q >> 8) & mask) +
+                    ((r >> 8) & mask) + ((s >> 8) & mask) + 0x00020002;
+      iconvg_private_poke_u32le(
+          d + (4 * x), ((lo >> 2) & mask) | (((hi >> 2) & mask) << 8));
+    }
+  }
+}
+
+// ----
+
+size_t  //
+iconvg_mipmap_chain_byte_length(uint32_t width, uint32_t height) {
+  if ((width == 0) || (height == 0)) {
+    return 0;
+  }
+  size_t n = 0;
+  while (true) {
+    size_t w = width;
+    size_t h = height;
+    if ((h > ((SIZE_MAX / 4) / w)) || ((4 * w * h) > (SIZE_MAX - n))) {
+      return 0;
+    }
+    n += 4 * w * h;
+    if ((width == 1) && (height == 1)) {
+      break;
+    }
+    width = (width > 1) ? (width / 2) : 1;
+    height = (height > 1) ? (height / 2) : 1;
+  }
+  return n;
+}
+
+const char*  //
+iconvg_decode_mipmap_chain(iconvg_mipmap_chain* dst_chain,
+                           uint8_t* dst_ptr,
+                           size_t dst_len,
+                           uint32_t width,
+                           uint32_t height,
+                           iconvg_mipmap_render_func render,
+                           void* render_context,
+                           const uint8_t* src_ptr,
+                           size_t src_len,
+                           const iconvg_decode_options* options) {
+  if (!dst_chain || !render || (width == 0) || (height == 0)) {
+    return iconvg_error_invalid_mipmap_argument;
+  }
+  size_t n = iconvg_mipmap_chain_byte_length(width, height);
+  if ((n == 0) || (n > dst_len) || !dst_ptr) {
+    return iconvg_error_invalid_buffer_too_small;
+  }
+
+  // Lay out the levels, largest first.
+  dst_chain->num_levels = 0;
+  {
+    uint8_t* ptr = dst_ptr;
+    uint32_t w = width;
+    uint32_t h = height;
+    while (true) {
+      iconvg_mipmap_level* level = &dst_chain->levels[dst_chain->num_levels++];
+      level->ptr = ptr;
+      level->stride = 4 * ((size_t)w);
+      level->width = w;
+      level->height = h;
+      level->rendered = false;
+      ptr += level->stride * h;
+      if ((w == 1) && (h == 1)) {
+        break;
+      }
+      w = (w > 1) ? (w / 2) : 1;
+      h = (h > 1) ? (h / 2) : 1;
+    }
+  }
+
+  // Level 0 is always rendered. Each subsequent level is downsampled from the
+  // previous level, unless the Level of Detail thresholds select a different
+  // set of paths at the smaller height, in which case it is rendered too.
+  iconvg_rectangle_f32 signature_rect =
+      iconvg_make_rectangle_f32(0, 0, (float)width, (float)height);
+  uint64_t prev_signature = 0;
+  for (uint32_t i = 0; i < dst_chain->num_levels; i++) {
+    iconvg_mipmap_level* level = &dst_chain->levels[i];
+    uint64_t signature = 0;
+    ICONVG_PRIVATE_TRY(iconvg_private_mipmap_signature(
+        &signature, signature_rect, (int64_t)(level->height), src_ptr, src_len,
+        options));
+
+    if ((i > 0) && (signature == prev_signature)) {
+      iconvg_private_mipmap_downsample(level, &dst_chain->levels[i - 1]);
+    } else {
+      memset(level->ptr, 0, level->stride * level->height);
+      level->rendered = true;
+      ICONVG_PRIVATE_TRY(
+          (*render)(render_context, level, src_ptr, src_len, options));
+    }
+    prev_signature = signature;
+  }
+  return NULL;
+}
+
 // -------------------------------- #include "./paint.c"
 
 iconvg_paint_type  //
@@ -3215,39 +7420,512 @@ iconvg_paint__gradient_transformation_matrix(const iconvg_paint* self) {
   double d11 = s11 * self->d2s_scale_y;
   double d12 = (s10 * self->d2s_bias_x) + (s11 * self->d2s_bias_y) + s12;
 
-  return iconvg_make_matrix_2x3_f64(d00, d01, d02, d10, d11, d12);
+  // Those dst coordinates are before any iconvg_decode_options dst_transform.
+  // Applying its inverse first gives the matrix for the transformed dst.
+  iconvg_matrix_2x3_f64 m =
+      iconvg_make_matrix_2x3_f64(d00, d01, d02, d10, d11, d12);
+  return iconvg_private_matrix_2x3_f64__mul(&m, &self->inverse_dst_transform);
 }
 
-// -------------------------------- #include "./rectangle.c"
-
-// Note that iconvg_rectangle_f32 fields may be NaN, so that (min < max) is not
-// the same as !(min >= max).
+size_t  //
+iconvg_paint__snapshot(const iconvg_paint* self, iconvg_paint_snapshot* dst) {
+  if (!self || !dst) {
+    return 0;
+  }
+  dst->type = iconvg_paint__type(self);
+  switch (dst->type) {
+    case ICONVG_PAINT_TYPE__LINEAR_GRADIENT:
+    case ICONVG_PAINT_TYPE__RADIAL_GRADIENT:
+      break;
+    default:
+      dst->flat_color = iconvg_paint__flat_color_as_premul_color(self);
+      dst->gradient_spread = ICONVG_GRADIENT_SPREAD__NONE;
+      dst->gradient_number_of_stops = 0;
+      return offsetof(iconvg_paint_snapshot, gradient_transformation_matrix);
+  }
 
-bool  //
-iconvg_rectangle_f32__is_finite_and_not_empty(
-    const iconvg_rectangle_f32* self) {
-  return self &&                         //
-         (-INFINITY < self->min_x) &&    //
-         (self->min_x < self->max_x) &&  //
-         (self->max_x < +INFINITY) &&    //
-         (-INFINITY < self->min_y) &&    //
-         (self->min_y < self->max_y) &&  //
-         (self->max_y < +INFINITY);
+  uint32_t n = iconvg_paint__gradient_number_of_stops(self);
+  memset(&dst->flat_color, 0, sizeof(dst->flat_color));
+  dst->gradient_spread = iconvg_paint__gradient_spread(self);
+  dst->gradient_number_of_stops = n;
+  dst->gradient_transformation_matrix =
+      iconvg_paint__gradient_transformation_matrix(self);
+  for (uint32_t i = 0; i < n; i++) {
+    dst->gradient_stops[i].color =
+        iconvg_paint__gradient_stop_color_as_premul_color(self, i);
+    dst->gradient_stops[i].offset = iconvg_paint__gradient_stop_offset(self, i);
+  }
+  return offsetof(iconvg_paint_snapshot, gradient_stops) +
+         (n * sizeof(iconvg_paint_snapshot_stop));
 }
 
-double  //
-iconvg_rectangle_f32__width_f64(const iconvg_rectangle_f32* self) {
-  if (self && (self->max_x > self->min_x)) {
-    return ((double)self->max_x) - ((double)self->min_x);
+iconvg_source_position  //
+iconvg_paint__source_position(const iconvg_paint* self) {
+  if (!self) {
+    iconvg_source_position z;
+    memset(&z, 0, sizeof(z));
+    return z;
   }
-  return 0.0;
+  return self->source_position;
 }
 
-double  //
-iconvg_rectangle_f32__height_f64(const iconvg_rectangle_f32* self) {
-  if (self && (self->max_y > self->min_y)) {
-    return ((double)self->max_y) - ((double)self->min_y);
-  }
+uint64_t  //
+iconvg_paint__palette_dependencies(const iconvg_paint* self) {
+  return self ? self->palette_dependencies : 0;
+}
+
+// -------------------------------- #include "./palette.c"
+
+// The palette canvas ORs each drawing's palette dependencies into the uint64_t
+// pointed to by context_nonconst_ptr0. It paints nothing.
+
+static const char*  //
+iconvg_private_palette_canvas__begin_decode(iconvg_canvas* c,
+                                            iconvg_rectangle_f32 dst_rect) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__end_decode(iconvg_canvas* c,
+                                          const char* err_msg,
+                                          size_t num_bytes_consumed,
+                                          size_t num_bytes_remaining) {
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__begin_drawing(iconvg_canvas* c) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__end_drawing(iconvg_canvas* c,
+                                           const iconvg_paint* p) {
+  uint64_t* mask = (uint64_t*)(c->context_nonconst_ptr0);
+  *mask |= iconvg_paint__palette_dependencies(p);
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__begin_path(iconvg_canvas* c,
+                                          float x0,
+                                          float y0) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__end_path(iconvg_canvas* c) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__path_line_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__path_quad_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1,
+                                            float x2,
+                                            float y2) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__path_cube_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1,
+                                            float x2,
+                                            float y2,
+                                            float x3,
+                                            float y3) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  return NULL;
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_palette_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_palette_canvas__begin_decode,
+        &iconvg_private_palette_canvas__end_decode,
+        &iconvg_private_palette_canvas__begin_drawing,
+        &iconvg_private_palette_canvas__end_drawing,
+        &iconvg_private_palette_canvas__begin_path,
+        &iconvg_private_palette_canvas__end_path,
+        &iconvg_private_palette_canvas__path_line_to,
+        &iconvg_private_palette_canvas__path_quad_to,
+        &iconvg_private_palette_canvas__path_cube_to,
+        &iconvg_private_palette_canvas__on_metadata_viewbox,
+        &iconvg_private_palette_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// ----
+
+const char*  //
+iconvg_decode_palette_dependencies(uint64_t* dst_mask,
+                                   iconvg_rectangle_f32 dst_rect,
+                                   const uint8_t* src_ptr,
+                                   size_t src_len,
+                                   const iconvg_decode_options* options) {
+  uint64_t mask = 0;
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_palette_canvas_vtable;
+  c.context_nonconst_ptr0 = &mask;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+
+  const char* err_msg = iconvg_decode(&c, dst_rect, src_ptr, src_len, options);
+  if (dst_mask) {
+    *dst_mask = mask;
+  }
+  return err_msg;
+}
+
+// -------------------------------- #include "./pixel.c"
+
+// The SIMD code paths are used when the compiler targets SSE2 (every x86_64
+// CPU) or NEON (every AArch64 CPU), unless ICONVG_CONFIG__DISABLE_SIMD is
+// defined. They only handle pixels that are fully opaque or fully
+// transparent, which are the majority in typical IconVG renderings, deferring
+// to the scalar code for the rest. There is no run-time CPU detection, so
+// wider instruction sets (such as AVX2) are not used.
+
+#if !defined(ICONVG_CONFIG__DISABLE_SIMD)
+#if defined(__SSE2__)
+#define ICONVG_PRIVATE_PIXEL_USE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ICONVG_PRIVATE_PIXEL_USE_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#define ICONVG_PRIVATE_ALPHA_OP__NONE 0
+#define ICONVG_PRIVATE_ALPHA_OP__PREMULTIPLY 1
+#define ICONVG_PRIVATE_ALPHA_OP__UNPREMULTIPLY 2
+
+// iconvg_private_unpremul_reciprocals[a] is ceil((255 << 16) / a), so that
+// ((c * iconvg_private_unpremul_reciprocals[a]) >> 16) equals ((c * 255) / a)
+// for every 0 <= c <= a, replacing a division with a multiplication.
+static const uint32_t iconvg_private_unpremul_reciprocals[256] = {
+    0x00000000, 0x00FF0000, 0x007F8000, 0x00550000,  //
+    0x003FC000, 0x00330000, 0x002A8000, 0x00246DB7,  //
+    0x001FE000, 0x001C5556, 0x00198000, 0x00172E8C,  //
+    0x00154000, 0x00139D8A, 0x001236DC, 0x00110000,  //
+    0x000FF000, 0x000F0000, 0x000E2AAB, 0x000D6BCB,  //
+    0x000CC000, 0x000C2493, 0x000B9746, 0x000B1643,  //
+    0x000AA000, 0x000A3334, 0x0009CEC5, 0x000971C8,  //
+    0x00091B6E, 0x0008CB09, 0x00088000, 0x000839CF,  //
+    0x0007F800, 0x0007BA2F, 0x00078000, 0x00074925,  //
+    0x00071556, 0x0006E454, 0x0006B5E6, 0x000689D9,  //
+    0x00066000, 0x00063832, 0x0006124A, 0x0005EE24,  //
+    0x0005CBA3, 0x0005AAAB, 0x00058B22, 0x00056CF0,  //
+    0x00055000, 0x0005343F, 0x0005199A, 0x00050000,  //
+    0x0004E763, 0x0004CFB3, 0x0004B8E4, 0x0004A2E9,  //
+    0x00048DB7, 0x00047944, 0x00046585, 0x00045271,  //
+    0x00044000, 0x00042E2A, 0x00041CE8, 0x00040C31,  //
+    0x0003FC00, 0x0003EC4F, 0x0003DD18, 0x0003CE55,  //
+    0x0003C000, 0x0003B217, 0x0003A493, 0x00039770,  //
+    0x00038AAB, 0x00037E40, 0x0003722A, 0x00036667,  //
+    0x00035AF3, 0x00034FCB, 0x000344ED, 0x00033A55,  //
+    0x00033000, 0x000325EE, 0x00031C19, 0x00031282,  //
+    0x00030925, 0x00030000, 0x0002F712, 0x0002EE59,  //
+    0x0002E5D2, 0x0002DD7C, 0x0002D556, 0x0002CD5D,  //
+    0x0002C591, 0x0002BDF0, 0x0002B678, 0x0002AF29,  //
+    0x0002A800, 0x0002A0FE, 0x00029A20, 0x00029365,  //
+    0x00028CCD, 0x00028657, 0x00028000, 0x000279CA,  //
+    0x000273B2, 0x00026DB7, 0x000267DA, 0x00026218,  //
+    0x00025C72, 0x000256E7, 0x00025175, 0x00024C1C,  //
+    0x000246DC, 0x000241B3, 0x00023CA2, 0x000237A7,  //
+    0x000232C3, 0x00022DF3, 0x00022939, 0x00022493,  //
+    0x00022000, 0x00021B82, 0x00021715, 0x000212BC,  //
+    0x00020E74, 0x00020A3E, 0x00020619, 0x00020205,  //
+    0x0001FE00, 0x0001FA0C, 0x0001F628, 0x0001F253,  //
+    0x0001EE8C, 0x0001EAD4, 0x0001E72B, 0x0001E38F,  //
+    0x0001E000, 0x0001DC80, 0x0001D90C, 0x0001D5A4,  //
+    0x0001D24A, 0x0001CEFB, 0x0001CBB8, 0x0001C881,  //
+    0x0001C556, 0x0001C235, 0x0001BF20, 0x0001BC15,  //
+    0x0001B915, 0x0001B61F, 0x0001B334, 0x0001B052,  //
+    0x0001AD7A, 0x0001AAAB, 0x0001A7E6, 0x0001A52A,  //
+    0x0001A277, 0x00019FCC, 0x00019D2B, 0x00019A91,  //
+    0x00019800, 0x00019578, 0x000192F7, 0x0001907E,  //
+    0x00018E0D, 0x00018BA3, 0x00018941, 0x000186E6,  //
+    0x00018493, 0x00018246, 0x00018000, 0x00017DC2,  //
+    0x00017B89, 0x00017958, 0x0001772D, 0x00017508,  //
+    0x000172E9, 0x000170D1, 0x00016EBE, 0x00016CB2,  //
+    0x00016AAB, 0x000168AA, 0x000166AF, 0x000164B9,  //
+    0x000162C9, 0x000160DE, 0x00015EF8, 0x00015D18,  //
+    0x00015B3C, 0x00015966, 0x00015795, 0x000155C8,  //
+    0x00015400, 0x0001523E, 0x0001507F, 0x00014EC5,  //
+    0x00014D10, 0x00014B5F, 0x000149B3, 0x0001480B,  //
+    0x00014667, 0x000144C7, 0x0001432C, 0x00014194,  //
+    0x00014000, 0x00013E71, 0x00013CE5, 0x00013B5D,  //
+    0x000139D9, 0x00013859, 0x000136DC, 0x00013563,  //
+    0x000133ED, 0x0001327B, 0x0001310C, 0x00012FA1,  //
+    0x00012E39, 0x00012CD5, 0x00012B74, 0x00012A16,  //
+    0x000128BB, 0x00012763, 0x0001260E, 0x000124BD,  //
+    0x0001236E, 0x00012223, 0x000120DA, 0x00011F94,  //
+    0x00011E51, 0x00011D11, 0x00011BD4, 0x00011A99,  //
+    0x00011962, 0x0001182C, 0x000116FA, 0x000115CA,  //
+    0x0001149D, 0x00011372, 0x0001124A, 0x00011124,  //
+    0x00011000, 0x00010EE0, 0x00010DC1, 0x00010CA5,  //
+    0x00010B8B, 0x00010A73, 0x0001095E, 0x0001084B,  //
+    0x0001073A, 0x0001062C, 0x0001051F, 0x00010415,  //
+    0x0001030D, 0x00010207, 0x00010103, 0x00010000,  //
+};
+
+static bool  //
+iconvg_private_pixel_format__is_valid(iconvg_pixel_format f) {
+  return (ICONVG_PIXEL_FORMAT__BGRA_PREMUL <= f) &&
+         (f <= ICONVG_PIXEL_FORMAT__RGBA_NONPREMUL);
+}
+
+static bool  //
+iconvg_private_pixel_format__is_bgra(iconvg_pixel_format f) {
+  return (f == ICONVG_PIXEL_FORMAT__BGRA_PREMUL) ||
+         (f == ICONVG_PIXEL_FORMAT__BGRA_NONPREMUL);
+}
+
+static bool  //
+iconvg_private_pixel_format__is_premul(iconvg_pixel_format f) {
+  return (f == ICONVG_PIXEL_FORMAT__BGRA_PREMUL) ||
+         (f == ICONVG_PIXEL_FORMAT__RGBA_PREMUL);
+}
+
+// iconvg_private_convert_pixels__scalar converts n pixels. It reads each
+// pixel before writing it, so dst may equal src.
+static void  //
+iconvg_private_convert_pixels__scalar(uint8_t* dst,
+                                      const uint8_t* src,
+                                      size_t n,
+                                      bool swizzle,
+                                      int alpha_op) {
+  for (; n > 0; n--, dst += 4, src += 4) {
+    uint32_t c0 = src[0];
+    uint32_t c1 = src[1];
+    uint32_t c2 = src[2];
+    uint32_t a = src[3];
+    if (a == 0xFF) {
+      // No-op. Opaque pixels are unchanged by (un)premultiplication.
+    } else if (alpha_op == ICONVG_PRIVATE_ALPHA_OP__UNPREMULTIPLY) {
+      uint32_t r = iconvg_private_unpremul_reciprocals[a];
+      c0 = (c0 * r) >> 16;
+      c1 = (c1 * r) >> 16;
+      c2 = (c2 * r) >> 16;
+      // Invalid premultiplied colors (with c > a) saturate.
+      c0 = (c0 < 0xFF) ? c0 : 0xFF;
+      c1 = (c1 < 0xFF) ? c1 : 0xFF;
+      c2 = (c2 < 0xFF) ? c2 : 0xFF;
+    } else if (alpha_op == ICONVG_PRIVATE_ALPHA_OP__PREMULTIPLY) {
+      c0 = ((c0 * a) + 127) / 255;
+      c1 = ((c1 * a) + 127) / 255;
+      c2 = ((c2 * a) + 127) / 255;
+    }
+    dst[0] = (uint8_t)(swizzle ? c2 : c0);
+    dst[1] = (uint8_t)(c1);
+    dst[2] = (uint8_t)(swizzle ? c0 : c2);
+    dst[3] = (uint8_t)(a);
+  }
+}
+
+#if defined(ICONVG_PRIVATE_PIXEL_USE_SSE2)
+
+// iconvg_private_convert_pixels__sse2 converts 4 * n pixels, 4 at a time.
+static void  //
+iconvg_private_convert_pixels__sse2(uint8_t* dst,
+                                    const uint8_t* src,
+                                    size_t n,
+                                    bool swizzle,
+                                    int alpha_op) {
+  const __m128i ff = _mm_set1_epi32(0xFF);
+  const __m128i mask_ga = _mm_set1_epi32((int)0xFF00FF00);
+  const __m128i mask_c0 = _mm_set1_epi32(0x000000FF);
+  const __m128i mask_c2 = _mm_set1_epi32(0x00FF0000);
+  for (; n > 0; n--, dst += 16, src += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(const void*)src);
+    if (alpha_op != ICONVG_PRIVATE_ALPHA_OP__NONE) {
+      // Each 32-bit lane is one pixel, with alpha in the high byte.
+      __m128i a = _mm_srli_epi32(v, 24);
+      __m128i opaque = _mm_cmpeq_epi32(a, ff);
+      __m128i transparent = _mm_cmpeq_epi32(a, _mm_setzero_si128());
+      if (_mm_movemask_epi8(_mm_or_si128(opaque, transparent)) != 0xFFFF) {
+        iconvg_private_convert_pixels__scalar(dst, src, 4, swizzle, alpha_op);
+        continue;
+      }
+      // Opaque pixels are unchanged by (un)premultiplication. Transparent
+      // pixels become all zeroes.
+      v = _mm_and_si128(v, opaque);
+    }
+    if (swizzle) {
+      v = _mm_or_si128(
+          _mm_and_si128(v, mask_ga),
+          _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), mask_c0),
+                       _mm_and_si128(_mm_slli_epi32(v, 16), mask_c2)));
+    }
+    _mm_storeu_si128((__m128i*)(void*)dst, v);
+  }
+}
+
+#elif defined(ICONVG_PRIVATE_PIXEL_USE_NEON)
+
+// iconvg_private_convert_pixels__neon converts 16 * n pixels, 16 at a time.
+static void  //
+iconvg_private_convert_pixels__neon(uint8_t* dst,
+                                    const uint8_t* src,
+                                    size_t n,
+                                    bool swizzle,
+                                    int alpha_op) {
+  const uint8x16_t ff = vdupq_n_u8(0xFF);
+  const uint8x16_t zero = vdupq_n_u8(0x00);
+  for (; n > 0; n--, dst += 64, src += 64) {
+    // vld4q_u8 de-interleaves, so that v.val[3] holds 16 alpha values.
+    uint8x16x4_t v = vld4q_u8(src);
+    if (alpha_op != ICONVG_PRIVATE_ALPHA_OP__NONE) {
+      uint8x16_t opaque = vceqq_u8(v.val[3], ff);
+      uint8x16_t transparent = vceqq_u8(v.val[3], zero);
+      uint64x2_t ok = vreinterpretq_u64_u8(vorrq_u8(opaque, transparent));
+      if ((vgetq_lane_u64(ok, 0) & vgetq_lane_u64(ok, 1)) != ~0ull) {
+        iconvg_private_convert_pixels__scalar(dst, src, 16, swizzle,
+                                              alpha_op);
+        continue;
+      }
+      // Opaque pixels are unchanged by (un)premultiplication. Transparent
+      // pixels become all zeroes.
+      v.val[0] = vandq_u8(v.val[0], opaque);
+      v.val[1] = vandq_u8(v.val[1], opaque);
+      v.val[2] = vandq_u8(v.val[2], opaque);
+    }
+    if (swizzle) {
+      uint8x16_t t = v.val[0];
+      v.val[0] = v.val[2];
+      v.val[2] = t;
+    }
+    vst4q_u8(dst, v);
+  }
+}
+
+#endif
+
+const char*  //
+iconvg_convert_pixels(uint8_t* dst_ptr,
+                      size_t dst_len,
+                      size_t dst_stride,
+                      iconvg_pixel_format dst_format,
+                      const uint8_t* src_ptr,
+                      size_t src_len,
+                      size_t src_stride,
+                      iconvg_pixel_format src_format,
+                      uint32_t width,
+                      uint32_t height) {
+  if (!iconvg_private_pixel_format__is_valid(dst_format) ||
+      !iconvg_private_pixel_format__is_valid(src_format)) {
+    return iconvg_error_invalid_pixel_argument;
+  } else if ((width == 0) || (height == 0)) {
+    return NULL;
+  } else if (!dst_ptr || !src_ptr) {
+    return iconvg_error_invalid_pixel_argument;
+  }
+  // This multiplication can only overflow when size_t is 32 bits. Comparing
+  // width to (SIZE_MAX / 4) instead would be always false (and warned about by
+  // -Wtype-limits) when size_t is 64 bits.
+  size_t row_len = 4 * ((size_t)width);
+  if (((row_len / 4) != width) ||  //
+      (dst_stride < row_len) || (src_stride < row_len)) {
+    return iconvg_error_invalid_pixel_argument;
+  } else if ((dst_ptr == src_ptr) && (dst_stride != src_stride)) {
+    return iconvg_error_invalid_pixel_argument;
+  } else if ((dst_len < row_len) || (src_len < row_len) ||
+             (((dst_len - row_len) / dst_stride) < (height - 1)) ||
+             (((src_len - row_len) / src_stride) < (height - 1))) {
+    return iconvg_error_invalid_buffer_too_small;
+  }
+
+  bool swizzle = iconvg_private_pixel_format__is_bgra(dst_format) !=
+                 iconvg_private_pixel_format__is_bgra(src_format);
+  int alpha_op = ICONVG_PRIVATE_ALPHA_OP__NONE;
+  if (iconvg_private_pixel_format__is_premul(dst_format) !=
+      iconvg_private_pixel_format__is_premul(src_format)) {
+    alpha_op = iconvg_private_pixel_format__is_premul(src_format)
+                   ? ICONVG_PRIVATE_ALPHA_OP__UNPREMULTIPLY
+                   : ICONVG_PRIVATE_ALPHA_OP__PREMULTIPLY;
+  }
+
+  for (uint32_t y = 0; y < height; y++) {
+    uint8_t* d = dst_ptr + (y * dst_stride);
+    const uint8_t* s = src_ptr + (y * src_stride);
+    if (!swizzle && (alpha_op == ICONVG_PRIVATE_ALPHA_OP__NONE)) {
+      if (d != s) {
+        memcpy(d, s, row_len);
+      }
+      continue;
+    }
+    size_t n = width;
+#if defined(ICONVG_PRIVATE_PIXEL_USE_SSE2)
+    size_t m = n / 4;
+    iconvg_private_convert_pixels__sse2(d, s, m, swizzle, alpha_op);
+    d += 16 * m;
+    s += 16 * m;
+    n -= 4 * m;
+#elif defined(ICONVG_PRIVATE_PIXEL_USE_NEON)
+    size_t m = n / 16;
+    iconvg_private_convert_pixels__neon(d, s, m, swizzle, alpha_op);
+    d += 64 * m;
+    s += 64 * m;
+    n -= 16 * m;
+#endif
+    iconvg_private_convert_pixels__scalar(d, s, n, swizzle, alpha_op);
+  }
+  return NULL;
+}
+
+// -------------------------------- #include "./rectangle.c"
+
+// Note that iconvg_rectangle_f32 fields may be NaN, so that (min < max) is not
+// the same as !(min >= max).
+
+bool  //
+iconvg_rectangle_f32__is_finite_and_not_empty(
+    const iconvg_rectangle_f32* self) {
+  return self &&                         //
+         (-INFINITY < self->min_x) &&    //
+         (self->min_x < self->max_x) &&  //
+         (self->max_x < +INFINITY) &&    //
+         (-INFINITY < self->min_y) &&    //
+         (self->min_y < self->max_y) &&  //
+         (self->max_y < +INFINITY);
+}
+
+double  //
+iconvg_rectangle_f32__width_f64(const iconvg_rectangle_f32* self) {
+  if (self && (self->max_x > self->min_x)) {
+    return ((double)self->max_x) - ((double)self->min_x);
+  }
+  return 0.0;
+}
+
+double  //
+iconvg_rectangle_f32__height_f64(const iconvg_rectangle_f32* self) {
+  if (self && (self->max_y > self->min_y)) {
+    return ((double)self->max_y) - ((double)self->min_y);
+  }
   return 0.0;
 }
 
@@ -3422,9 +8100,32 @@ iconvg_private_skia_canvas__begin_drawing(iconvg_canvas* c) {
   return NULL;
 }
 
+// iconvg_private_skia_draw_path draws path once, or once per instance if
+// offsets_xy is non-NULL, each under a translation. The paint's shader (if
+// any) is in local coordinates, so that gradients move with their paths.
+static void  //
+iconvg_private_skia_draw_path(sk_canvas_t* sc,
+                              const sk_path_t* path,
+                              const sk_paint_t* paint,
+                              const float* offsets_xy,
+                              size_t num_instances) {
+  if (!offsets_xy) {
+    sk_canvas_draw_path(sc, path, paint);
+    return;
+  }
+  for (size_t i = 0; i < num_instances; i++) {
+    sk_canvas_save(sc);
+    sk_canvas_translate(sc, offsets_xy[(2 * i) + 0], offsets_xy[(2 * i) + 1]);
+    sk_canvas_draw_path(sc, path, paint);
+    sk_canvas_restore(sc);
+  }
+}
+
 static const char*  //
-iconvg_private_skia_canvas__end_drawing(iconvg_canvas* c,
-                                        const iconvg_paint* p) {
+iconvg_private_skia_canvas__draw(iconvg_canvas* c,
+                                 const iconvg_paint* p,
+                                 const float* offsets_xy,
+                                 size_t num_instances) {
   sk_canvas_t* sc = (sk_canvas_t*)(c->context_nonconst_ptr0);
   sk_pathbuilder_t* spb = (sk_pathbuilder_t*)(c->context_nonconst_ptr1);
 
@@ -3437,7 +8138,8 @@ iconvg_private_skia_canvas__end_drawing(iconvg_canvas* c,
       sk_paint_set_antialias(paint, true);
       sk_paint_set_color(
           paint, sk_color_set_argb(k.rgba[3], k.rgba[0], k.rgba[1], k.rgba[2]));
-      sk_canvas_draw_path(sc, path, paint);
+      iconvg_private_skia_draw_path(sc, path, paint, offsets_xy,
+                                    num_instances);
       sk_paint_delete(paint);
       sk_path_delete(path);
       return NULL;
@@ -3533,7 +8235,7 @@ iconvg_private_skia_canvas__end_drawing(iconvg_canvas* c,
     sk_paint_set_antialias(paint, true);
     sk_paint_set_shader(paint, shader);
     sk_shader_unref(shader);
-    sk_canvas_draw_path(sc, path, paint);
+    iconvg_private_skia_draw_path(sc, path, paint, offsets_xy, num_instances);
     sk_paint_delete(paint);
     sk_path_delete(path);
   }
@@ -3546,6 +8248,20 @@ iconvg_private_skia_canvas__end_drawing(iconvg_canvas* c,
   return NULL;
 }
 
+static const char*  //
+iconvg_private_skia_canvas__end_drawing(iconvg_canvas* c,
+                                        const iconvg_paint* p) {
+  return iconvg_private_skia_canvas__draw(c, p, NULL, 0);
+}
+
+static const char*  //
+iconvg_private_skia_canvas__end_drawing_instances(iconvg_canvas* c,
+                                                  const iconvg_paint* p,
+                                                  const float* offsets_xy,
+                                                  size_t num_instances) {
+  return iconvg_private_skia_canvas__draw(c, p, offsets_xy, num_instances);
+}
+
 static const char*  //
 iconvg_private_skia_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
   sk_pathbuilder_t* spb = (sk_pathbuilder_t*)(c->context_nonconst_ptr1);
@@ -3618,6 +8334,7 @@ static const iconvg_canvas_vtable  //
         &iconvg_private_skia_canvas__path_cube_to,
         &iconvg_private_skia_canvas__on_metadata_viewbox,
         &iconvg_private_skia_canvas__on_metadata_suggested_palette,
+        &iconvg_private_skia_canvas__end_drawing_instances,
 };
 
 iconvg_canvas  //
@@ -3636,6 +8353,1303 @@ iconvg_make_skia_canvas(sk_canvas_t* sc) {
 
 #endif  // ICONVG_CONFIG__ENABLE_SKIA_BACKEND
 
+// -------------------------------- #include "./sort.c"
+
+// The paint sorting canvas buffers drawings (their paint, path and pixel
+// bounding box) between begin_decode and end_decode, then forwards them to
+// the wrapped canvas, context_nonconst_ptr0, in a possibly different order.
+// context_nonconst_ptr1 points to the iconvg_private_sort_state, allocated by
+// begin_decode and freed by end_decode.
+//
+// Drawings are only re-ordered within a window of up to
+// ICONVG_PRIVATE_SORT_WINDOW_SIZE consecutive drawings. Each full window is
+// forwarded as soon as its last drawing ends, which bounds both the memory
+// used and the (quadratic in the window size) sorting work per drawing.
+
+#define ICONVG_PRIVATE_SORT_WINDOW_SIZE 256
+
+typedef struct iconvg_private_sort_drawing_struct {
+  // The drawing's path records are data.ptr[data_begin .. path_end] and its
+  // iconvg_paint_snapshot prefix is data.ptr[path_end .. data_end].
+  size_t data_begin;
+  size_t path_end;
+  size_t data_end;
+
+  // The parts of the iconvg_paint that are not in its snapshot but that are
+  // needed to re-make an equivalent iconvg_paint: its RGBA value (which, for
+  // gradients, holds CBASE and NBASE), the NREG elements that form the
+  // gradient's matrix and the dst to src coordinate conversion.
+  uint8_t paint_rgba[4];
+  float nreg_matrix[6];
+  double d2s_scale_x;
+  double d2s_bias_x;
+  double d2s_scale_y;
+  double d2s_bias_y;
+  iconvg_matrix_2x3_f64 inverse_dst_transform;
+  iconvg_source_position source_position;
+  uint64_t palette_dependencies;
+
+  // The bounding box of the path's points (including control points), rounded
+  // outwards to whole pixels.
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+
+  // paint_class is the index of the first drawing (in the window) whose paint
+  // looks the same as this one's.
+  size_t paint_class;
+
+  // num_blockers is the number of earlier, overlapping and not yet forwarded
+  // drawings.
+  size_t num_blockers;
+  bool forwarded;
+} iconvg_private_sort_drawing;
+
+typedef struct iconvg_private_sort_state_struct {
+  // drawings holds an array of iconvg_private_sort_drawing elements.
+  iconvg_growable_buffer drawings;
+  iconvg_growable_buffer data;
+
+  // The current drawing's data_begin and (unrounded) bounding box.
+  size_t data_begin;
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+
+  // previous_snapshot is the snapshot prefix of the most recently forwarded
+  // drawing, if previous_snapshot_len is non-zero, so that the next window
+  // can continue with the same paint.
+  size_t previous_snapshot_len;
+  iconvg_paint_snapshot previous_snapshot;
+} iconvg_private_sort_state;
+
+static inline bool  //
+iconvg_private_sort_drawing__overlaps(const iconvg_private_sort_drawing* a,
+                                      const iconvg_private_sort_drawing* b) {
+  // Written so that NaNs overlap.
+  return !((a->max_x <= b->min_x) || (b->max_x <= a->min_x) ||
+           (a->max_y <= b->min_y) || (b->max_y <= a->min_y));
+}
+
+// iconvg_private_sort_drawing__looks_the_same returns whether the drawings'
+// paints look the same, comparing their snapshots.
+static inline bool  //
+iconvg_private_sort_drawing__looks_the_same(
+    const iconvg_private_sort_drawing* a,
+    const iconvg_private_sort_drawing* b,
+    const uint8_t* data) {
+  size_t n = a->data_end - a->path_end;
+  return (n == (b->data_end - b->path_end)) &&
+         !memcmp(data + a->path_end, data + b->path_end, n);
+}
+
+// iconvg_private_sort_drawing__make_paint re-makes the iconvg_paint that was
+// passed to end_drawing, or at least one that the public iconvg_paint__etc
+// functions cannot tell apart from it.
+static void  //
+iconvg_private_sort_drawing__make_paint(const iconvg_private_sort_drawing* d,
+                                        const uint8_t* data,
+                                        iconvg_paint* p) {
+  memset(p, 0, sizeof(*p));
+  memcpy(&p->paint_rgba[0], &d->paint_rgba[0], 4);
+  p->d2s_scale_x = d->d2s_scale_x;
+  p->d2s_bias_x = d->d2s_bias_x;
+  p->d2s_scale_y = d->d2s_scale_y;
+  p->d2s_bias_y = d->d2s_bias_y;
+  p->s2d_scale_x = 1.0 / p->d2s_scale_x;
+  p->s2d_bias_x = -p->d2s_bias_x * p->s2d_scale_x;
+  p->s2d_scale_y = 1.0 / p->d2s_scale_y;
+  p->s2d_bias_y = -p->d2s_bias_y * p->s2d_scale_y;
+  p->inverse_dst_transform = d->inverse_dst_transform;
+  p->source_position = d->source_position;
+  p->palette_dependencies = d->palette_dependencies;
+
+  iconvg_paint_snapshot snapshot;
+  memcpy(&snapshot, data + d->path_end, d->data_end - d->path_end);
+  uint32_t cbase = p->paint_rgba[1];
+  uint32_t nbase = p->paint_rgba[2];
+  // With more than 58 stops, the matrix and the stop offsets share NREG
+  // elements. Writing the matrix first, like the decoder's NREG writes that
+  // the matrix was read after, gives the same values.
+  for (uint32_t i = 0; i < 6; i++) {
+    p->nreg[0x3F & (nbase - 6 + i)] = d->nreg_matrix[i];
+  }
+  for (uint32_t i = 0; i < snapshot.gradient_number_of_stops; i++) {
+    p->creg.colors[0x3F & (cbase + i)] = snapshot.gradient_stops[i].color;
+    p->nreg[0x3F & (nbase + i)] = snapshot.gradient_stops[i].offset;
+  }
+}
+
+static const char*  //
+iconvg_private_sort_canvas__add_points(iconvg_canvas* c,
+                                       const float* xy,
+                                       size_t num_points,
+                                       uint8_t op) {
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  if (!s) {
+    return NULL;
+  }
+  for (size_t i = 0; i < num_points; i++) {
+    float x = xy[(2 * i) + 0];
+    float y = xy[(2 * i) + 1];
+    s->min_x = (s->min_x < x) ? s->min_x : x;
+    s->min_y = (s->min_y < y) ? s->min_y : y;
+    s->max_x = (s->max_x > x) ? s->max_x : x;
+    s->max_y = (s->max_y > y) ? s->max_y : y;
+  }
+  return iconvg_private_path_buffer__append(&s->data, op, xy, 2 * num_points);
+}
+
+// iconvg_private_sort_canvas__flush forwards the buffered drawings and then
+// clears the buffers. Among the drawings whose earlier overlapping drawings
+// have all been forwarded, it picks one that looks the same as the previously
+// forwarded drawing, if there is one, and otherwise the earliest.
+static const char*  //
+iconvg_private_sort_canvas__flush(iconvg_canvas* c) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  iconvg_private_sort_drawing* d =
+      (iconvg_private_sort_drawing*)(s->drawings.ptr);
+  size_t n = s->drawings.len / sizeof(iconvg_private_sort_drawing);
+  const uint8_t* data = s->data.ptr;
+  // Clear the buffers up front, so that no drawing is forwarded twice if
+  // this fails part way. Their contents stay valid until the next append.
+  s->drawings.len = 0;
+  s->data.len = 0;
+
+  size_t previous_paint_class = SIZE_MAX;
+  for (size_t i = 0; i < n; i++) {
+    d[i].paint_class = i;
+    d[i].num_blockers = 0;
+    d[i].forwarded = false;
+    for (size_t j = 0; j < i; j++) {
+      if ((d[j].paint_class == j) &&
+          iconvg_private_sort_drawing__looks_the_same(&d[i], &d[j], data)) {
+        d[i].paint_class = j;
+        break;
+      }
+    }
+    for (size_t j = 0; j < i; j++) {
+      if (iconvg_private_sort_drawing__overlaps(&d[i], &d[j])) {
+        d[i].num_blockers++;
+      }
+    }
+    if ((previous_paint_class == SIZE_MAX) && (d[i].paint_class == i) &&
+        (s->previous_snapshot_len == (d[i].data_end - d[i].path_end)) &&
+        !memcmp(&s->previous_snapshot, data + d[i].path_end,
+                s->previous_snapshot_len)) {
+      previous_paint_class = i;
+    }
+  }
+
+  for (size_t num_forwarded = 0; num_forwarded < n; num_forwarded++) {
+    size_t k = SIZE_MAX;
+    for (size_t i = 0; i < n; i++) {
+      if (d[i].forwarded || (d[i].num_blockers > 0)) {
+        continue;
+      } else if (k == SIZE_MAX) {
+        k = i;
+      }
+      if (d[i].paint_class == previous_paint_class) {
+        k = i;
+        break;
+      }
+    }
+    if (k == SIZE_MAX) {
+      return iconvg_private_internal_error_unreachable;
+    }
+
+    iconvg_paint p;
+    iconvg_private_sort_drawing__make_paint(&d[k], data, &p);
+    ICONVG_PRIVATE_TRY((*wrapped->vtable->begin_drawing)(wrapped));
+    ICONVG_PRIVATE_TRY(iconvg_private_path_buffer__replay(
+        data + d[k].data_begin, d[k].path_end - d[k].data_begin, wrapped,
+        0.0f, 0.0f));
+    ICONVG_PRIVATE_TRY((*wrapped->vtable->end_drawing)(wrapped, &p));
+
+    d[k].forwarded = true;
+    previous_paint_class = d[k].paint_class;
+    for (size_t i = k + 1; i < n; i++) {
+      if (!d[i].forwarded &&
+          iconvg_private_sort_drawing__overlaps(&d[i], &d[k])) {
+        d[i].num_blockers--;
+      }
+    }
+
+    if (num_forwarded + 1 == n) {
+      s->previous_snapshot_len = d[k].data_end - d[k].path_end;
+      memcpy(&s->previous_snapshot, data + d[k].path_end,
+             s->previous_snapshot_len);
+    }
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_sort_canvas__begin_decode(iconvg_canvas* c,
+                                         iconvg_rectangle_f32 dst_rect) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return NULL;
+  } else if (iconvg_private_canvas_sizeof_vtable(wrapped) <
+             sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  }
+
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  if (!s) {
+    s = (iconvg_private_sort_state*)calloc(1, sizeof(*s));
+    if (!s) {
+      return iconvg_error_system_failure_out_of_memory;
+    }
+    s->drawings.grow = &iconvg_growable_buffer__realloc_grow;
+    s->data.grow = &iconvg_growable_buffer__realloc_grow;
+    c->context_nonconst_ptr1 = s;
+  }
+  s->drawings.len = 0;
+  s->data.len = 0;
+  s->previous_snapshot_len = 0;
+  return (*wrapped->vtable->begin_decode)(wrapped, dst_rect);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__end_decode(iconvg_canvas* c,
+                                       const char* err_msg,
+                                       size_t num_bytes_consumed,
+                                       size_t num_bytes_remaining) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return err_msg;
+  } else if (iconvg_private_canvas_sizeof_vtable(wrapped) <
+             sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  }
+
+  // Like iconvg_decode, forward the drawings completed before any error.
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  if (s) {
+    const char* flush_err_msg = iconvg_private_sort_canvas__flush(c);
+    if (!err_msg) {
+      err_msg = flush_err_msg;
+    }
+    free(s->drawings.ptr);
+    free(s->data.ptr);
+    free(s);
+    c->context_nonconst_ptr1 = NULL;
+  }
+  return (*wrapped->vtable->end_decode)(wrapped, err_msg, num_bytes_consumed,
+                                        num_bytes_remaining);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__begin_drawing(iconvg_canvas* c) {
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  if (s) {
+    s->data_begin = s->data.len;
+    s->min_x = +INFINITY;
+    s->min_y = +INFINITY;
+    s->max_x = -INFINITY;
+    s->max_y = -INFINITY;
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_sort_canvas__end_drawing(iconvg_canvas* c,
+                                        const iconvg_paint* p) {
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  if (!s) {
+    return NULL;
+  }
+  size_t path_end = s->data.len;
+  iconvg_paint_snapshot snapshot;
+  size_t n = iconvg_paint__snapshot(p, &snapshot);
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(&s->data, n));
+  memcpy(s->data.ptr + s->data.len, &snapshot, n);
+  s->data.len += n;
+
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(
+      &s->drawings, sizeof(iconvg_private_sort_drawing)));
+  iconvg_private_sort_drawing* d =
+      (iconvg_private_sort_drawing*)(s->drawings.ptr + s->drawings.len);
+  s->drawings.len += sizeof(iconvg_private_sort_drawing);
+
+  d->data_begin = s->data_begin;
+  d->path_end = path_end;
+  d->data_end = s->data.len;
+  memcpy(&d->paint_rgba[0], &p->paint_rgba[0], 4);
+  uint32_t nbase = p->paint_rgba[2];
+  for (uint32_t i = 0; i < 6; i++) {
+    d->nreg_matrix[i] = p->nreg[0x3F & (nbase - 6 + i)];
+  }
+  d->d2s_scale_x = p->d2s_scale_x;
+  d->d2s_bias_x = p->d2s_bias_x;
+  d->d2s_scale_y = p->d2s_scale_y;
+  d->d2s_bias_y = p->d2s_bias_y;
+  d->inverse_dst_transform = p->inverse_dst_transform;
+  d->source_position = p->source_position;
+  d->palette_dependencies = p->palette_dependencies;
+  // Anti-aliasing touches every pixel that the path's bounding box touches,
+  // so two drawings can only be re-ordered if they share no pixels. This
+  // assumes that dst coordinate space units are pixels.
+  d->min_x = floorf(s->min_x);
+  d->min_y = floorf(s->min_y);
+  d->max_x = ceilf(s->max_x);
+  d->max_y = ceilf(s->max_y);
+
+  if (s->drawings.len >=
+      (ICONVG_PRIVATE_SORT_WINDOW_SIZE * sizeof(iconvg_private_sort_drawing))) {
+    return iconvg_private_sort_canvas__flush(c);
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_sort_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  float xy[2] = {x0, y0};
+  return iconvg_private_sort_canvas__add_points(
+      c, xy, 1, ICONVG_PRIVATE_PATH_OP__BEGIN_PATH);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__end_path(iconvg_canvas* c) {
+  return iconvg_private_sort_canvas__add_points(
+      c, NULL, 0, ICONVG_PRIVATE_PATH_OP__END_PATH);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__path_line_to(iconvg_canvas* c, float x1, float y1) {
+  float xy[2] = {x1, y1};
+  return iconvg_private_sort_canvas__add_points(
+      c, xy, 1, ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__path_quad_to(iconvg_canvas* c,
+                                         float x1,
+                                         float y1,
+                                         float x2,
+                                         float y2) {
+  float xy[4] = {x1, y1, x2, y2};
+  return iconvg_private_sort_canvas__add_points(
+      c, xy, 2, ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__path_cube_to(iconvg_canvas* c,
+                                         float x1,
+                                         float y1,
+                                         float x2,
+                                         float y2,
+                                         float x3,
+                                         float y3) {
+  float xy[6] = {x1, y1, x2, y2, x3, y3};
+  return iconvg_private_sort_canvas__add_points(
+      c, xy, 3, ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__on_metadata_viewbox(iconvg_canvas* c,
+                                                iconvg_rectangle_f32 viewbox) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return NULL;
+  }
+  return (*wrapped->vtable->on_metadata_viewbox)(wrapped, viewbox);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return NULL;
+  }
+  return (*wrapped->vtable->on_metadata_suggested_palette)(wrapped,
+                                                           suggested_palette);
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_sort_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_sort_canvas__begin_decode,
+        &iconvg_private_sort_canvas__end_decode,
+        &iconvg_private_sort_canvas__begin_drawing,
+        &iconvg_private_sort_canvas__end_drawing,
+        &iconvg_private_sort_canvas__begin_path,
+        &iconvg_private_sort_canvas__end_path,
+        &iconvg_private_sort_canvas__path_line_to,
+        &iconvg_private_sort_canvas__path_quad_to,
+        &iconvg_private_sort_canvas__path_cube_to,
+        &iconvg_private_sort_canvas__on_metadata_viewbox,
+        &iconvg_private_sort_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+iconvg_canvas  //
+iconvg_make_paint_sorting_canvas(iconvg_canvas* wrapped) {
+  if (wrapped && !wrapped->vtable) {
+    wrapped = NULL;
+  }
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_sort_canvas_vtable;
+  c.context_nonconst_ptr0 = wrapped;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+  return c;
+}
+
+// -------------------------------- #include "./trace.c"
+
+// A trace is an 8 byte magic identifier followed by zero or more records. Each
+// record is a 1 byte opcode (the index of the iconvg_canvas_vtable function
+// pointer, counting sizeof__iconvg_canvas_vtable as index 0) followed by that
+// function's arguments. All numbers are little-endian:
+//
+//  - float arguments are 4 bytes and size_t arguments are 8 bytes.
+//  - iconvg_rectangle_f32 arguments are 4 floats.
+//  - iconvg_palette arguments are 64 RGBA colors, 4 bytes each.
+//  - const char* arguments are a 4 byte length n and then n bytes. A NULL
+//    pointer has n = 0. Otherwise, n includes the terminating NUL byte.
+//  - const iconvg_paint* arguments are the paint's 4 byte RGBA value. For
+//    gradients, this is followed by the 4 d2s_etc doubles (8 bytes each), the
+//    6 inverse_dst_transform doubles (row-major), the 6 NREG elements of the
+//    transformation matrix (4 bytes each) and then, for each stop, its 4 byte
+//    CREG color and its 4 byte NREG offset.
+//
+// The trace format is not stable across library versions. It is intended for
+// benchmarking, where traces are re-recorded when the library changes.
+
+static const uint8_t iconvg_private_trace_magic[8] = {
+    0x8A, 0x49, 0x56, 0x47, 0x54, 0x72, 0x63, 0x02,  // "\x8AIVGTrc\x02".
+};
+
+#define ICONVG_PRIVATE_TRACE_OP__BEGIN_DECODE 0x01
+#define ICONVG_PRIVATE_TRACE_OP__END_DECODE 0x02
+#define ICONVG_PRIVATE_TRACE_OP__BEGIN_DRAWING 0x03
+#define ICONVG_PRIVATE_TRACE_OP__END_DRAWING 0x04
+#define ICONVG_PRIVATE_TRACE_OP__BEGIN_PATH 0x05
+#define ICONVG_PRIVATE_TRACE_OP__END_PATH 0x06
+#define ICONVG_PRIVATE_TRACE_OP__PATH_LINE_TO 0x07
+#define ICONVG_PRIVATE_TRACE_OP__PATH_QUAD_TO 0x08
+#define ICONVG_PRIVATE_TRACE_OP__PATH_CUBE_TO 0x09
+#define ICONVG_PRIVATE_TRACE_OP__ON_METADATA_VIEWBOX 0x0A
+#define ICONVG_PRIVATE_TRACE_OP__ON_METADATA_SUGGESTED_PALETTE 0x0B
+
+// ICONVG_PRIVATE_TRACE_MAX_PAINT_SIZE is the largest encoded iconvg_paint
+// argument: 4 bytes RGBA, 10 doubles, 6 floats and 63 stops.
+#define ICONVG_PRIVATE_TRACE_MAX_PAINT_SIZE (4 + (10 * 8) + (6 * 4) + (63 * 8))
+
+static inline uint8_t*  //
+iconvg_private_trace_poke_f32(uint8_t* p, float f) {
+  iconvg_private_poke_u32le(p, iconvg_private_reinterpret_from_f32_to_u32(f));
+  return p + 4;
+}
+
+static inline uint8_t*  //
+iconvg_private_trace_poke_f64(uint8_t* p, double f) {
+  iconvg_private_poke_u64le(p, iconvg_private_reinterpret_from_f64_to_u64(f));
+  return p + 8;
+}
+
+static inline float  //
+iconvg_private_trace_peek_f32(const uint8_t* p) {
+  return iconvg_private_reinterpret_from_u32_to_f32(
+      iconvg_private_peek_u32le(p));
+}
+
+static inline double  //
+iconvg_private_trace_peek_f64(const uint8_t* p) {
+  return iconvg_private_reinterpret_from_u64_to_f64(
+      iconvg_private_peek_u64le(p));
+}
+
+// iconvg_private_trace_canvas__record appends ptr[0 .. len] to the trace. It
+// writes the magic identifier first, if the trace is empty.
+static const char*  //
+iconvg_private_trace_canvas__record(iconvg_canvas* c,
+                                    const uint8_t* ptr,
+                                    size_t len) {
+  iconvg_growable_buffer* b =
+      (iconvg_growable_buffer*)(c->context_nonconst_ptr1);
+  if (!b) {
+    return NULL;
+  }
+  size_t n = len;
+  if (b->len == 0) {
+    n += sizeof(iconvg_private_trace_magic);
+  }
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(b, n));
+  if (b->len == 0) {
+    memcpy(b->ptr, iconvg_private_trace_magic,
+           sizeof(iconvg_private_trace_magic));
+    b->len = sizeof(iconvg_private_trace_magic);
+  }
+  memcpy(b->ptr + b->len, ptr, len);
+  b->len += len;
+  return NULL;
+}
+
+// iconvg_private_trace_canvas__wrapped returns the wrapped canvas, or NULL if
+// there is none. It sets *err_msg if the wrapped canvas is unusable.
+static inline iconvg_canvas*  //
+iconvg_private_trace_canvas__wrapped(iconvg_canvas* c, const char** err_msg) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (wrapped && (iconvg_private_canvas_sizeof_vtable(wrapped) <
+                  sizeof(iconvg_canvas_vtable))) {
+    *err_msg = iconvg_error_unsupported_vtable;
+    return NULL;
+  }
+  return wrapped;
+}
+
+static const char*  //
+iconvg_private_trace_canvas__begin_decode(iconvg_canvas* c,
+                                          iconvg_rectangle_f32 dst_rect) {
+  uint8_t buf[1 + 16];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__BEGIN_DECODE;
+  p = iconvg_private_trace_poke_f32(p, dst_rect.min_x);
+  p = iconvg_private_trace_poke_f32(p, dst_rect.min_y);
+  p = iconvg_private_trace_poke_f32(p, dst_rect.max_x);
+  p = iconvg_private_trace_poke_f32(p, dst_rect.max_y);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->begin_decode)(wrapped, dst_rect);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__end_decode(iconvg_canvas* c,
+                                        const char* err_msg,
+                                        size_t num_bytes_consumed,
+                                        size_t num_bytes_remaining) {
+  size_t n = err_msg ? (strlen(err_msg) + 1) : 0;
+  if (n > 0xFFFFFFFF) {
+    n = 0;
+  }
+  uint8_t buf0[1 + 4];
+  buf0[0] = ICONVG_PRIVATE_TRACE_OP__END_DECODE;
+  iconvg_private_poke_u32le(buf0 + 1, (uint32_t)n);
+  uint8_t buf1[16];
+  iconvg_private_poke_u64le(buf1 + 0, (uint64_t)num_bytes_consumed);
+  iconvg_private_poke_u64le(buf1 + 8, (uint64_t)num_bytes_remaining);
+  const char* record_err_msg =
+      iconvg_private_trace_canvas__record(c, buf0, sizeof(buf0));
+  if (!record_err_msg && (n > 0)) {
+    record_err_msg =
+        iconvg_private_trace_canvas__record(c, (const uint8_t*)err_msg, n);
+  }
+  if (!record_err_msg) {
+    record_err_msg = iconvg_private_trace_canvas__record(c, buf1, sizeof(buf1));
+  }
+  if (record_err_msg && !err_msg) {
+    err_msg = record_err_msg;
+  }
+
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->end_decode)(wrapped, err_msg, num_bytes_consumed,
+                                        num_bytes_remaining);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__begin_drawing(iconvg_canvas* c) {
+  uint8_t buf[1];
+  buf[0] = ICONVG_PRIVATE_TRACE_OP__BEGIN_DRAWING;
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->begin_drawing)(wrapped);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__end_drawing(iconvg_canvas* c,
+                                         const iconvg_paint* p) {
+  iconvg_paint_type paint_type = iconvg_paint__type(p);
+  if (paint_type == ICONVG_PAINT_TYPE__INVALID) {
+    return iconvg_error_invalid_paint_type;
+  }
+  uint8_t buf[1 + ICONVG_PRIVATE_TRACE_MAX_PAINT_SIZE];
+  uint8_t* q = buf;
+  *q++ = ICONVG_PRIVATE_TRACE_OP__END_DRAWING;
+  memcpy(q, &p->paint_rgba[0], 4);
+  q += 4;
+  switch (paint_type) {
+
+    case ICONVG_PAINT_TYPE__LINEAR_GRADIENT:
+    case ICONVG_PAINT_TYPE__RADIAL_GRADIENT: {
+      q = iconvg_private_trace_poke_f64(q, p->d2s_scale_x);
+      q = iconvg_private_trace_poke_f64(q, p->d2s_bias_x);
+      q = iconvg_private_trace_poke_f64(q, p->d2s_scale_y);
+      q = iconvg_private_trace_poke_f64(q, p->d2s_bias_y);
+      for (uint32_t i = 0; i < 6; i++) {
+        q = iconvg_private_trace_poke_f64(
+            q, p->inverse_dst_transform.elems[i / 3][i % 3]);
+      }
+      uint32_t cbase = p->paint_rgba[1];
+      uint32_t nbase = p->paint_rgba[2];
+      for (uint32_t i = 0; i < 6; i++) {
+        q = iconvg_private_trace_poke_f32(q, p->nreg[0x3F & (nbase - 6 + i)]);
+      }
+      uint32_t nstops = iconvg_paint__gradient_number_of_stops(p);
+      for (uint32_t i = 0; i < nstops; i++) {
+        memcpy(q, &p->creg.colors[0x3F & (cbase + i)].rgba[0], 4);
+        q = iconvg_private_trace_poke_f32(q + 4, p->nreg[0x3F & (nbase + i)]);
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+  ICONVG_PRIVATE_TRY(
+      iconvg_private_trace_canvas__record(c, buf, (size_t)(q - buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->end_drawing)(wrapped, p);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  uint8_t buf[1 + 8];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__BEGIN_PATH;
+  p = iconvg_private_trace_poke_f32(p, x0);
+  p = iconvg_private_trace_poke_f32(p, y0);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->begin_path)(wrapped, x0, y0);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__end_path(iconvg_canvas* c) {
+  uint8_t buf[1];
+  buf[0] = ICONVG_PRIVATE_TRACE_OP__END_PATH;
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->end_path)(wrapped);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__path_line_to(iconvg_canvas* c,
+                                          float x1,
+                                          float y1) {
+  uint8_t buf[1 + 8];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__PATH_LINE_TO;
+  p = iconvg_private_trace_poke_f32(p, x1);
+  p = iconvg_private_trace_poke_f32(p, y1);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->path_line_to)(wrapped, x1, y1);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__path_quad_to(iconvg_canvas* c,
+                                          float x1,
+                                          float y1,
+                                          float x2,
+                                          float y2) {
+  uint8_t buf[1 + 16];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__PATH_QUAD_TO;
+  p = iconvg_private_trace_poke_f32(p, x1);
+  p = iconvg_private_trace_poke_f32(p, y1);
+  p = iconvg_private_trace_poke_f32(p, x2);
+  p = iconvg_private_trace_poke_f32(p, y2);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->path_quad_to)(wrapped, x1, y1, x2, y2);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__path_cube_to(iconvg_canvas* c,
+                                          float x1,
+                                          float y1,
+                                          float x2,
+                                          float y2,
+                                          float x3,
+                                          float y3) {
+  uint8_t buf[1 + 24];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__PATH_CUBE_TO;
+  p = iconvg_private_trace_poke_f32(p, x1);
+  p = iconvg_private_trace_poke_f32(p, y1);
+  p = iconvg_private_trace_poke_f32(p, x2);
+  p = iconvg_private_trace_poke_f32(p, y2);
+  p = iconvg_private_trace_poke_f32(p, x3);
+  p = iconvg_private_trace_poke_f32(p, y3);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->path_cube_to)(wrapped, x1, y1, x2, y2, x3, y3);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__on_metadata_viewbox(iconvg_canvas* c,
+                                                 iconvg_rectangle_f32 viewbox) {
+  uint8_t buf[1 + 16];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__ON_METADATA_VIEWBOX;
+  p = iconvg_private_trace_poke_f32(p, viewbox.min_x);
+  p = iconvg_private_trace_poke_f32(p, viewbox.min_y);
+  p = iconvg_private_trace_poke_f32(p, viewbox.max_x);
+  p = iconvg_private_trace_poke_f32(p, viewbox.max_y);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->on_metadata_viewbox)(wrapped, viewbox);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  uint8_t buf[1 + sizeof(iconvg_palette)];
+  buf[0] = ICONVG_PRIVATE_TRACE_OP__ON_METADATA_SUGGESTED_PALETTE;
+  memcpy(buf + 1, suggested_palette, sizeof(iconvg_palette));
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->on_metadata_suggested_palette)(wrapped,
+                                                           suggested_palette);
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_trace_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_trace_canvas__begin_decode,
+        &iconvg_private_trace_canvas__end_decode,
+        &iconvg_private_trace_canvas__begin_drawing,
+        &iconvg_private_trace_canvas__end_drawing,
+        &iconvg_private_trace_canvas__begin_path,
+        &iconvg_private_trace_canvas__end_path,
+        &iconvg_private_trace_canvas__path_line_to,
+        &iconvg_private_trace_canvas__path_quad_to,
+        &iconvg_private_trace_canvas__path_cube_to,
+        &iconvg_private_trace_canvas__on_metadata_viewbox,
+        &iconvg_private_trace_canvas__on_metadata_suggested_palette,
+        // end_drawing_instances is NULL so that iconvg_decode_instances
+        // replays each instance as ordinary (recorded) calls.
+        NULL,
+};
+
+iconvg_canvas  //
+iconvg_make_trace_canvas(iconvg_growable_buffer* dst, iconvg_canvas* wrapped) {
+  if (wrapped && !wrapped->vtable) {
+    wrapped = NULL;
+  }
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_trace_canvas_vtable;
+  c.context_nonconst_ptr0 = wrapped;
+  c.context_nonconst_ptr1 = dst;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+  return c;
+}
+
+// ----
+
+// iconvg_private_trace_replay_paint decodes a const iconvg_paint* argument.
+// It returns false if there were not enough source bytes.
+static bool  //
+iconvg_private_trace_replay_paint(iconvg_paint* p,
+                                  iconvg_private_decoder* d) {
+  memset(p, 0, sizeof(*p));
+  p->inverse_dst_transform = iconvg_private_identity_matrix_2x3_f64();
+  if (d->len < 4) {
+    return false;
+  }
+  memcpy(&p->paint_rgba[0], d->ptr, 4);
+  d->ptr += 4;
+  d->len -= 4;
+
+  switch (iconvg_paint__type(p)) {
+    case ICONVG_PAINT_TYPE__LINEAR_GRADIENT:
+    case ICONVG_PAINT_TYPE__RADIAL_GRADIENT:
+      break;
+    default:
+      return true;
+  }
+
+  uint32_t cbase = p->paint_rgba[1];
+  uint32_t nbase = p->paint_rgba[2];
+  uint32_t nstops = iconvg_paint__gradient_number_of_stops(p);
+  size_t n = (10 * 8) + (6 * 4) + (nstops * 8);
+  if (d->len < n) {
+    return false;
+  }
+  const uint8_t* q = d->ptr;
+  d->ptr += n;
+  d->len -= n;
+
+  p->d2s_scale_x = iconvg_private_trace_peek_f64(q + 0);
+  p->d2s_bias_x = iconvg_private_trace_peek_f64(q + 8);
+  p->d2s_scale_y = iconvg_private_trace_peek_f64(q + 16);
+  p->d2s_bias_y = iconvg_private_trace_peek_f64(q + 24);
+  q += 32;
+  for (uint32_t i = 0; i < 6; i++) {
+    p->inverse_dst_transform.elems[i / 3][i % 3] =
+        iconvg_private_trace_peek_f64(q);
+    q += 8;
+  }
+  p->s2d_scale_x = 1.0 / p->d2s_scale_x;
+  p->s2d_bias_x = -p->d2s_bias_x * p->s2d_scale_x;
+  p->s2d_scale_y = 1.0 / p->d2s_scale_y;
+  p->s2d_bias_y = -p->d2s_bias_y * p->s2d_scale_y;
+
+  // With more than 58 stops, the matrix and the stop offsets share NREG
+  // elements. Writing them in the same order as the recording (matrix first)
+  // reproduces the recorded values.
+  for (uint32_t i = 0; i < 6; i++) {
+    p->nreg[0x3F & (nbase - 6 + i)] = iconvg_private_trace_peek_f32(q);
+    q += 4;
+  }
+  for (uint32_t i = 0; i < nstops; i++) {
+    memcpy(&p->creg.colors[0x3F & (cbase + i)].rgba[0], q, 4);
+    p->nreg[0x3F & (nbase + i)] = iconvg_private_trace_peek_f32(q + 4);
+    q += 8;
+  }
+  return true;
+}
+
+// iconvg_private_trace_replay_f32s decodes n float arguments. It returns false
+// if there were not enough source bytes.
+static inline bool  //
+iconvg_private_trace_replay_f32s(float* dst,
+                                 size_t n,
+                                 iconvg_private_decoder* d) {
+  if (d->len < (4 * n)) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = iconvg_private_trace_peek_f32(d->ptr + (4 * i));
+  }
+  d->ptr += 4 * n;
+  d->len -= 4 * n;
+  return true;
+}
+
+const char*  //
+iconvg_replay_trace(iconvg_canvas* dst_canvas,
+                    const uint8_t* src_ptr,
+                    size_t src_len) {
+  iconvg_canvas fallback_canvas = iconvg_make_broken_canvas(NULL);
+  if (!dst_canvas || !dst_canvas->vtable) {
+    dst_canvas = &fallback_canvas;
+  }
+  iconvg_canvas* c = dst_canvas;
+
+  if (c->vtable->sizeof__iconvg_canvas_vtable != sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  } else if ((src_len < sizeof(iconvg_private_trace_magic)) ||
+             memcmp(src_ptr, iconvg_private_trace_magic,
+                    sizeof(iconvg_private_trace_magic))) {
+    return iconvg_error_invalid_trace;
+  }
+
+  iconvg_private_decoder d;
+  d.ptr = src_ptr + sizeof(iconvg_private_trace_magic);
+  d.len = src_len - sizeof(iconvg_private_trace_magic);
+  bool in_decode = false;
+  const char* err_msg = NULL;
+
+  while (d.len > 0) {
+    uint8_t opcode = *d.ptr++;
+    d.len--;
+    // Every record other than begin_decode must be within a decode.
+    if ((opcode == ICONVG_PRIVATE_TRACE_OP__BEGIN_DECODE) == in_decode) {
+      err_msg = iconvg_error_invalid_trace;
+      goto fail;
+    }
+
+    float f[6];
+    switch (opcode) {
+      case ICONVG_PRIVATE_TRACE_OP__BEGIN_DECODE: {
+        if (!iconvg_private_trace_replay_f32s(f, 4, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        in_decode = true;
+        err_msg = (*c->vtable->begin_decode)(
+            c, iconvg_make_rectangle_f32(f[0], f[1], f[2], f[3]));
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__END_DECODE: {
+        if (d.len < 4) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        uint32_t n = iconvg_private_peek_u32le(d.ptr);
+        d.ptr += 4;
+        d.len -= 4;
+        if ((d.len < n) || ((d.len - n) < 16) ||
+            ((n > 0) && (d.ptr[n - 1] != 0))) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        const char* recorded_err_msg = NULL;
+        if (n > 0) {
+          recorded_err_msg = (const char*)(d.ptr);
+          const char* e = iconvg_private_error_from_string(recorded_err_msg);
+          if (e) {
+            recorded_err_msg = e;
+          }
+        }
+        uint64_t num_bytes_consumed = iconvg_private_peek_u64le(d.ptr + n + 0);
+        uint64_t num_bytes_remaining = iconvg_private_peek_u64le(d.ptr + n + 8);
+        d.ptr += n + 16;
+        d.len -= n + 16;
+        in_decode = false;
+        ICONVG_PRIVATE_TRY((*c->vtable->end_decode)(
+            c, recorded_err_msg, (size_t)num_bytes_consumed,
+            (size_t)num_bytes_remaining));
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__BEGIN_DRAWING: {
+        err_msg = (*c->vtable->begin_drawing)(c);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__END_DRAWING: {
+        iconvg_paint p;
+        if (!iconvg_private_trace_replay_paint(&p, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg = (*c->vtable->end_drawing)(c, &p);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__BEGIN_PATH: {
+        if (!iconvg_private_trace_replay_f32s(f, 2, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg = (*c->vtable->begin_path)(c, f[0], f[1]);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__END_PATH: {
+        err_msg = (*c->vtable->end_path)(c);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__PATH_LINE_TO: {
+        if (!iconvg_private_trace_replay_f32s(f, 2, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg = (*c->vtable->path_line_to)(c, f[0], f[1]);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__PATH_QUAD_TO: {
+        if (!iconvg_private_trace_replay_f32s(f, 4, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg = (*c->vtable->path_quad_to)(c, f[0], f[1], f[2], f[3]);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__PATH_CUBE_TO: {
+        if (!iconvg_private_trace_replay_f32s(f, 6, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg =
+            (*c->vtable->path_cube_to)(c, f[0], f[1], f[2], f[3], f[4], f[5]);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__ON_METADATA_VIEWBOX: {
+        if (!iconvg_private_trace_replay_f32s(f, 4, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg = (*c->vtable->on_metadata_viewbox)(
+            c, iconvg_make_rectangle_f32(f[0], f[1], f[2], f[3]));
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__ON_METADATA_SUGGESTED_PALETTE: {
+        iconvg_palette palette;
+        if (d.len < sizeof(palette)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        memcpy(&palette, d.ptr, sizeof(palette));
+        d.ptr += sizeof(palette);
+        d.len -= sizeof(palette);
+        err_msg = (*c->vtable->on_metadata_suggested_palette)(c, &palette);
+        break;
+      }
+
+      default:
+        err_msg = iconvg_error_invalid_trace;
+        goto fail;
+    }
+
+    if (err_msg) {
+      goto fail;
+    }
+  }
+
+  if (!in_decode) {
+    return NULL;
+  }
+  err_msg = iconvg_error_invalid_trace;
+
+fail:
+  if (!in_decode) {
+    return err_msg;
+  }
+  return (*c->vtable->end_decode)(c, err_msg, src_len - d.len, d.len);
+}
+
+// -------------------------------- #include "./transform.c"
+
+// The transform canvas forwards every call to the iconvg_canvas pointed to by
+// context_nonconst_ptr0, after mapping path points through the
+// iconvg_matrix_2x3_f64 pointed to by context_const_ptr. Gradient paints are
+// handled separately, via the iconvg_paint's inverse_dst_transform.
+
+static inline void  //
+iconvg_private_transform_canvas__map(iconvg_canvas* c, float* x, float* y) {
+  const iconvg_matrix_2x3_f64* m =
+      (const iconvg_matrix_2x3_f64*)(c->context_const_ptr);
+  double x0 = *x;
+  double y0 = *y;
+  *x = (float)((m->elems[0][0] * x0) + (m->elems[0][1] * y0) + m->elems[0][2]);
+  *y = (float)((m->elems[1][0] * x0) + (m->elems[1][1] * y0) + m->elems[1][2]);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__begin_decode(iconvg_canvas* c,
+                                              iconvg_rectangle_f32 dst_rect) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->begin_decode)(w, dst_rect);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__end_decode(iconvg_canvas* c,
+                                            const char* err_msg,
+                                            size_t num_bytes_consumed,
+                                            size_t num_bytes_remaining) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->end_decode)(w, err_msg, num_bytes_consumed,
+                                  num_bytes_remaining);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__begin_drawing(iconvg_canvas* c) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->begin_drawing)(w);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__end_drawing(iconvg_canvas* c,
+                                             const iconvg_paint* p) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->end_drawing)(w, p);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__begin_path(iconvg_canvas* c,
+                                            float x0,
+                                            float y0) {
+  iconvg_private_transform_canvas__map(c, &x0, &y0);
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->begin_path)(w, x0, y0);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__end_path(iconvg_canvas* c) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->end_path)(w);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__path_line_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1) {
+  iconvg_private_transform_canvas__map(c, &x1, &y1);
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_line_to)(w, x1, y1);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__path_quad_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1,
+                                              float x2,
+                                              float y2) {
+  iconvg_private_transform_canvas__map(c, &x1, &y1);
+  iconvg_private_transform_canvas__map(c, &x2, &y2);
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_quad_to)(w, x1, y1, x2, y2);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__path_cube_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1,
+                                              float x2,
+                                              float y2,
+                                              float x3,
+                                              float y3) {
+  iconvg_private_transform_canvas__map(c, &x1, &y1);
+  iconvg_private_transform_canvas__map(c, &x2, &y2);
+  iconvg_private_transform_canvas__map(c, &x3, &y3);
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_cube_to)(w, x1, y1, x2, y2, x3, y3);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->on_metadata_viewbox)(w, viewbox);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->on_metadata_suggested_palette)(w, suggested_palette);
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_transform_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_transform_canvas__begin_decode,
+        &iconvg_private_transform_canvas__end_decode,
+        &iconvg_private_transform_canvas__begin_drawing,
+        &iconvg_private_transform_canvas__end_drawing,
+        &iconvg_private_transform_canvas__begin_path,
+        &iconvg_private_transform_canvas__end_path,
+        &iconvg_private_transform_canvas__path_line_to,
+        &iconvg_private_transform_canvas__path_quad_to,
+        &iconvg_private_transform_canvas__path_cube_to,
+        &iconvg_private_transform_canvas__on_metadata_viewbox,
+        &iconvg_private_transform_canvas__on_metadata_suggested_palette,
+        // Instanced drawing would need each offset mapped by the matrix's
+        // linear part. Not forwarding it keeps this canvas simple, as callers
+        // fall back to end_drawing.
+        NULL,
+};
+
+iconvg_canvas  //
+iconvg_private_make_transform_canvas(iconvg_canvas* wrapped,
+                                     const iconvg_matrix_2x3_f64* m) {
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_transform_canvas_vtable;
+  c.context_nonconst_ptr0 = wrapped;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = m;
+  c.context_extra = 0;
+  return c;
+}
+
+bool  //
+iconvg_private_transform_rectangle(iconvg_rectangle_f32* r,
+                                   const iconvg_matrix_2x3_f64* m) {
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (!((-INFINITY < m->elems[i][j]) && (m->elems[i][j] < +INFINITY))) {
+        return false;
+      }
+    }
+  }
+  double det = (m->elems[0][0] * m->elems[1][1]) -
+               (m->elems[0][1] * m->elems[1][0]);
+  if (det == 0) {
+    return false;
+  }
+
+  double xs[2] = {r->min_x, r->max_x};
+  double ys[2] = {r->min_y, r->max_y};
+  double min_x = +INFINITY;
+  double min_y = +INFINITY;
+  double max_x = -INFINITY;
+  double max_y = -INFINITY;
+  for (int i = 0; i < 4; i++) {
+    double x = xs[i & 1];
+    double y = ys[i >> 1];
+    double tx = (m->elems[0][0] * x) + (m->elems[0][1] * y) + m->elems[0][2];
+    double ty = (m->elems[1][0] * x) + (m->elems[1][1] * y) + m->elems[1][2];
+    min_x = (min_x < tx) ? min_x : tx;
+    min_y = (min_y < ty) ? min_y : ty;
+    max_x = (max_x > tx) ? max_x : tx;
+    max_y = (max_y > ty) ? max_y : ty;
+  }
+  *r = iconvg_make_rectangle_f32((float)min_x, (float)min_y,  //
+                                 (float)max_x, (float)max_y);
+  return true;
+}
+
 #endif  // ICONVG_IMPLEMENTATION
 
 #endif  // ICONVG_INCLUDE_GUARD
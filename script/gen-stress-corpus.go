@@ -0,0 +1,378 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//go:build ignore
+
+package main
+
+// gen-stress-corpus.go writes synthetic IconVG files that stress particular
+// parts of a decoder or renderer, for benchmarking. The output depends only on
+// the flags, so that results are reproducible.
+//
+// Usage: go run script/gen-stress-corpus.go -dir=gen/stress
+//
+// The files are:
+//   - stress-drawings.ivg has many (by default, 100000) small drawings.
+//   - stress-reps.ivg has long runs of each repeatable drawing opcode, so that
+//     most opcodes have the maximum repetition count.
+//   - stress-arcs.ivg has arc-heavy paths, with every flag combination.
+//   - stress-gradients.ivg has linear and radial gradients, with every spread
+//     and from 2 up to 63 stops.
+//   - stress-lods.ivg has many narrow and overlapping Level of Detail bands.
+//   - stress-numbers.ivg uses every 1, 2 and 4 byte number encoding.
+
+import (
+	"flag"
+	"fmt"
+	"image/color"
+	"math"
+	"math/rand"
+	"os"
+	"path/filepath"
+
+	"github.com/google/iconvg/src/go/lowlevel"
+)
+
+var (
+	dirFlag      = flag.String("dir", ".", "output directory")
+	drawingsFlag = flag.Int("drawings", 100000, "number of drawings in stress-drawings.ivg")
+	seedFlag     = flag.Int64("seed", 1, "random number generator seed")
+)
+
+func main() {
+	if err := main1(); err != nil {
+		os.Stderr.WriteString(err.Error() + "\n")
+		os.Exit(1)
+	}
+}
+
+func main1() error {
+	flag.Parse()
+	if err := os.MkdirAll(*dirFlag, 0755); err != nil {
+		return err
+	}
+
+	generators := []struct {
+		name string
+		gen  func(e *lowlevel.Encoder, r *rand.Rand)
+	}{
+		{"stress-drawings.ivg", genDrawings},
+		{"stress-reps.ivg", genReps},
+		{"stress-arcs.ivg", genArcs},
+		{"stress-gradients.ivg", genGradients},
+		{"stress-lods.ivg", genLODs},
+		{"stress-numbers.ivg", genNumbers},
+	}
+	for i, g := range generators {
+		// Each file gets its own generator, so that changing one file's
+		// parameters does not change the others.
+		r := rand.New(rand.NewSource(*seedFlag + int64(i)))
+		e := &lowlevel.Encoder{}
+		g.gen(e, r)
+		data, err := e.Bytes()
+		if err != nil {
+			return fmt.Errorf("%s: %v", g.name, err)
+		}
+
+		// Check that the output is valid, by decoding it.
+		if err := lowlevel.Decode(&lowlevel.Encoder{}, data, nil); err != nil {
+			return fmt.Errorf("%s: %v", g.name, err)
+		}
+
+		filename := filepath.Join(*dirFlag, g.name)
+		if err := os.WriteFile(filename, data, 0644); err != nil {
+			return err
+		}
+		fmt.Printf("%8d bytes  %s\n", len(data), filename)
+	}
+	return nil
+}
+
+// coord returns a random integer coordinate in [-32, +32], which encodes as
+// a 1 byte coordinate.
+func coord(r *rand.Rand) float32 {
+	return float32(r.Intn(65) - 32)
+}
+
+// flatColor returns a random opaque color from the 1 byte color table.
+func flatColor(r *rand.Rand) lowlevel.Color {
+	table := [5]uint8{0x00, 0x40, 0x80, 0xC0, 0xFF}
+	return lowlevel.RGBAColor(color.RGBA{
+		table[r.Intn(5)], table[r.Intn(5)], table[r.Intn(5)], 0xFF,
+	})
+}
+
+// genDrawings writes *drawingsFlag small, randomly colored triangles.
+func genDrawings(e *lowlevel.Encoder, r *rand.Rand) {
+	e.Reset(lowlevel.Metadata{
+		ViewBox: lowlevel.DefaultViewBox,
+		Palette: lowlevel.DefaultPalette,
+	})
+	for i := 0; i < *drawingsFlag; i++ {
+		e.SetCReg(0, false, flatColor(r))
+		x, y := coord(r), coord(r)
+		e.StartPath(0, x, y)
+		e.RelLineTo(float32(r.Intn(8)+1), 0)
+		e.RelLineTo(0, float32(r.Intn(8)+1))
+		e.ClosePathEndPath()
+	}
+}
+
+// genReps writes, for each repeatable drawing opcode, one path with a long
+// run of that opcode. The Encoder merges each run into opcodes with the
+// maximum repetition count (32 for lineTo, 16 for the others).
+func genReps(e *lowlevel.Encoder, r *rand.Rand) {
+	const n = 4096
+	e.Reset(lowlevel.Metadata{
+		ViewBox: lowlevel.DefaultViewBox,
+		Palette: lowlevel.DefaultPalette,
+	})
+	for op := 0; op < 12; op++ {
+		e.SetCReg(0, false, flatColor(r))
+		e.StartPath(0, coord(r), coord(r))
+		for i := 0; i < n; i++ {
+			x, y := coord(r), coord(r)
+			x1, y1 := coord(r), coord(r)
+			x2, y2 := coord(r), coord(r)
+			switch op {
+			case 0:
+				e.AbsLineTo(x, y)
+			case 1:
+				e.RelLineTo(x/8, y/8)
+			case 2:
+				e.AbsSmoothQuadTo(x, y)
+			case 3:
+				e.RelSmoothQuadTo(x/8, y/8)
+			case 4:
+				e.AbsQuadTo(x1, y1, x, y)
+			case 5:
+				e.RelQuadTo(x1/8, y1/8, x/8, y/8)
+			case 6:
+				e.AbsSmoothCubeTo(x2, y2, x, y)
+			case 7:
+				e.RelSmoothCubeTo(x2/8, y2/8, x/8, y/8)
+			case 8:
+				e.AbsCubeTo(x1, y1, x2, y2, x, y)
+			case 9:
+				e.RelCubeTo(x1/8, y1/8, x2/8, y2/8, x/8, y/8)
+			case 10:
+				e.AbsArcTo(8, 8, 0, false, i&1 != 0, x, y)
+			case 11:
+				e.RelArcTo(2, 2, 0, false, i&1 != 0, x/8, y/8)
+			}
+		}
+		e.ClosePathEndPath()
+	}
+}
+
+// genArcs writes paths made almost entirely of arcs, with varied radii and
+// rotations (including degenerate zero radii and radii too small to reach
+// the end point) and every largeArc and sweep flag combination.
+func genArcs(e *lowlevel.Encoder, r *rand.Rand) {
+	const numPaths, numArcs = 256, 64
+	e.Reset(lowlevel.Metadata{
+		ViewBox: lowlevel.DefaultViewBox,
+		Palette: lowlevel.DefaultPalette,
+	})
+	for p := 0; p < numPaths; p++ {
+		e.SetCReg(0, false, flatColor(r))
+		e.StartPath(0, coord(r), coord(r))
+		for i := 0; i < numArcs; i++ {
+			rx := float32(r.Intn(33))
+			ry := float32(r.Intn(33))
+			rotation := float32(r.Intn(64)) / 64
+			largeArc, sweep := i&1 != 0, i&2 != 0
+			if i&4 != 0 {
+				e.AbsArcTo(rx, ry, rotation, largeArc, sweep, coord(r), coord(r))
+			} else {
+				e.RelArcTo(rx, ry, rotation, largeArc, sweep, coord(r)/4, coord(r)/4)
+			}
+		}
+		e.ClosePathEndPath()
+	}
+}
+
+// genGradients writes one square per combination of gradient shape, spread
+// and number of stops.
+//
+// A gradient uses NSTOPS number registers, starting at NBASE, for its stop
+// offsets and the six registers before NBASE for its transformation matrix.
+// There are only 64 registers, so gradients with more than 58 stops share
+// some registers between the two: the matrix's first (NSTOPS - 58) elements
+// are also the last stop offsets.
+func genGradients(e *lowlevel.Encoder, r *rand.Rand) {
+	e.Reset(lowlevel.Metadata{
+		ViewBox: lowlevel.DefaultViewBox,
+		Palette: lowlevel.DefaultPalette,
+	})
+	for nStops := 2; nStops <= 63; nStops++ {
+		for spread := 0; spread < 4; spread++ {
+			for radial := 0; radial < 2; radial++ {
+				genGradient(e, r, nStops, spread, radial != 0)
+			}
+		}
+	}
+}
+
+func genGradient(e *lowlevel.Encoder, r *rand.Rand, nStops int, spread int, radial bool) {
+	cBase := uint8(r.Intn(64))
+	nBase := uint8(r.Intn(64))
+
+	x0, y0 := coord(r), coord(r)
+	size := float32(r.Intn(32) + 1)
+	matrix := [6]float32{1 / size, 0, -x0 / size, 0, 1 / size, -y0 / size}
+	if !radial {
+		matrix[2] = (-x0 + 32) / size
+	}
+	offsets := make([]float32, nStops)
+	for i := range offsets {
+		offsets[i] = float32(i) / float32(nStops-1)
+	}
+	for i := 58; i < nStops; i++ {
+		matrix[i-58] = offsets[i]
+	}
+
+	e.SetCSel(cBase)
+	for i := 0; i < nStops; i++ {
+		e.SetCReg(0, true, lowlevel.RGBAColor(color.RGBA{
+			uint8(r.Intn(256)), uint8(r.Intn(256)), uint8(r.Intn(256)), 0xFF,
+		}))
+	}
+	e.SetNSel(nBase - 6)
+	for _, m := range matrix {
+		e.SetNReg(0, true, m)
+	}
+	for _, o := range offsets {
+		e.SetNReg(0, true, o)
+	}
+
+	// CSEL is now (cBase + nStops), which is not one of the stops.
+	descriptor := color.RGBA{
+		R: uint8(nStops),
+		G: cBase | uint8(spread<<6),
+		B: 0x80 | (nBase & 0x3f),
+	}
+	if radial {
+		descriptor.B |= 0x40
+	}
+	e.SetCReg(0, false, lowlevel.RGBAColor(descriptor))
+	e.StartPath(0, x0, y0)
+	e.RelHLineTo(size)
+	e.RelVLineTo(size)
+	e.RelHLineTo(-size)
+	e.ClosePathEndPath()
+}
+
+// genLODs writes drawings in many Level of Detail bands: narrow bands, one
+// pixel high, and bands that nest within each other at every power of two.
+func genLODs(e *lowlevel.Encoder, r *rand.Rand) {
+	e.Reset(lowlevel.Metadata{
+		ViewBox: lowlevel.DefaultViewBox,
+		Palette: lowlevel.DefaultPalette,
+	})
+	inf := float32(math.Inf(+1))
+	for h := 0; h < 256; h++ {
+		e.SetLOD(float32(h), float32(h+1))
+		genLODDrawing(e, r)
+	}
+	for shift := 0; shift < 24; shift++ {
+		lo := float32(int(1) << shift)
+		e.SetLOD(lo, inf)
+		genLODDrawing(e, r)
+		e.SetLOD(0, lo)
+		genLODDrawing(e, r)
+	}
+	e.SetLOD(0, inf)
+	genLODDrawing(e, r)
+}
+
+func genLODDrawing(e *lowlevel.Encoder, r *rand.Rand) {
+	e.SetCReg(0, false, flatColor(r))
+	e.StartPath(0, coord(r), coord(r))
+	e.AbsLineTo(coord(r), coord(r))
+	e.AbsLineTo(coord(r), coord(r))
+	e.ClosePathEndPath()
+}
+
+// genNumbers writes coordinates, naturals, reals and zero-to-one numbers that
+// need each of the 1, 2 and 4 byte encodings. The ViewBox is large enough to
+// hold the 4 byte coordinates.
+func genNumbers(e *lowlevel.Encoder, r *rand.Rand) {
+	e.Reset(lowlevel.Metadata{
+		ViewBox: lowlevel.Rectangle{
+			Min: [2]float32{-1024, -1024},
+			Max: [2]float32{+1024, +1024},
+		},
+		Palette: lowlevel.DefaultPalette,
+	})
+	coords := []func() float32{
+		// 1 byte: integers in [-64, +64).
+		func() float32 { return float32(r.Intn(128) - 64) },
+		// 2 bytes: multiples of 1/64 in [-128, +128).
+		func() float32 { return float32(r.Intn(128*128)-64*128) / 64 },
+		// 4 bytes: anything else.
+		func() float32 { return (r.Float32() - 0.5) * 2048 },
+	}
+	for _, c := range coords {
+		e.SetCReg(0, false, flatColor(r))
+		e.StartPath(0, c(), c())
+		for i := 0; i < 256; i++ {
+			e.AbsLineTo(c(), c())
+			e.RelCubeTo(c(), c(), c(), c(), c(), c())
+			e.AbsHLineTo(c())
+			e.AbsVLineTo(c())
+		}
+		e.ClosePathEndPath()
+	}
+
+	// Number registers can hold reals, coordinates and zero-to-one numbers,
+	// and Set LOD takes reals. Use a wide range of magnitudes, so that every
+	// encoding length is exercised.
+	for i := 0; i < 1024; i++ {
+		var f float32
+		switch i % 4 {
+		case 0:
+			f = float32(r.Intn(1 << 7))
+		case 1:
+			f = float32(r.Intn(1 << 14))
+		case 2:
+			f = float32(r.Intn(1<<14)) / (1 << 14)
+		case 3:
+			f = r.Float32() * float32(math.Pow(2, float64(r.Intn(64)-32)))
+		}
+		e.SetNReg(0, true, f)
+	}
+	for i := 0; i < 64; i++ {
+		lod0 := float32(r.Intn(1 << uint(i%30)))
+		e.SetLOD(lod0, lod0+float32(r.Intn(1<<14)+1))
+	}
+	e.SetLOD(0, float32(math.Inf(+1)))
+
+	// Arc rotations and flags are zero-to-one numbers and naturals.
+	e.SetCReg(0, false, flatColor(r))
+	e.StartPath(0, 0, 0)
+	for i := 0; i < 256; i++ {
+		var rotation float32
+		switch i % 3 {
+		case 0:
+			rotation = float32(r.Intn(120)) / 120
+		case 1:
+			rotation = float32(r.Intn(1<<14)) / (1 << 14)
+		case 2:
+			rotation = r.Float32()
+		}
+		e.RelArcTo(coords[i%3](), coords[i%3](), rotation, i&1 != 0, i&2 != 0, coords[i%3](), coords[i%3]())
+	}
+	e.ClosePathEndPath()
+}
@@ -28,16 +28,28 @@
 #ifdef ICONVG_IMPLEMENTATION
 #include "./aaa_private.h"
 #include "./arc.c"
+#include "./batch.c"
 #include "./broken.c"
+#include "./buffer.c"
+#include "./cache.c"
 #include "./cairo.c"
 #include "./color.c"
+#include "./damage.c"
 #include "./debug.c"
 #include "./decoder.c"
+#include "./encoder.c"
 #include "./error.c"
+#include "./instance.c"
 #include "./matrix.c"
+#include "./mipmap.c"
 #include "./paint.c"
+#include "./palette.c"
+#include "./pixel.c"
 #include "./rectangle.c"
 #include "./skia.c"
+#include "./sort.c"
+#include "./trace.c"
+#include "./transform.c"
 #endif  // ICONVG_IMPLEMENTATION
 
 #endif  // ICONVG_INCLUDE_GUARD
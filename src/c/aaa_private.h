@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "./aaa_public.h"
@@ -29,6 +30,11 @@
 
 extern const char iconvg_private_internal_error_unreachable[];
 
+// iconvg_private_error_from_string returns the iconvg_error_etc constant whose
+// message equals s, or NULL if there is no such constant.
+const char*  //
+iconvg_private_error_from_string(const char* s);
+
 // ----
 
 static inline uint16_t  //
@@ -50,6 +56,26 @@ iconvg_private_poke_u32le(uint8_t* p, uint32_t x) {
   p[3] = (uint8_t)(x >> 24);
 }
 
+static inline uint64_t  //
+iconvg_private_peek_u64le(const uint8_t* p) {
+  return ((uint64_t)(p[0]) << 0) | ((uint64_t)(p[1]) << 8) |
+         ((uint64_t)(p[2]) << 16) | ((uint64_t)(p[3]) << 24) |
+         ((uint64_t)(p[4]) << 32) | ((uint64_t)(p[5]) << 40) |
+         ((uint64_t)(p[6]) << 48) | ((uint64_t)(p[7]) << 56);
+}
+
+static inline void  //
+iconvg_private_poke_u64le(uint8_t* p, uint64_t x) {
+  p[0] = (uint8_t)(x >> 0);
+  p[1] = (uint8_t)(x >> 8);
+  p[2] = (uint8_t)(x >> 16);
+  p[3] = (uint8_t)(x >> 24);
+  p[4] = (uint8_t)(x >> 32);
+  p[5] = (uint8_t)(x >> 40);
+  p[6] = (uint8_t)(x >> 48);
+  p[7] = (uint8_t)(x >> 56);
+}
+
 static inline float  //
 iconvg_private_reinterpret_from_u32_to_f32(uint32_t u) {
   float f = 0;
@@ -59,6 +85,63 @@ iconvg_private_reinterpret_from_u32_to_f32(uint32_t u) {
   return f;
 }
 
+static inline uint32_t  //
+iconvg_private_reinterpret_from_f32_to_u32(float f) {
+  uint32_t u = 0;
+  if (sizeof(uint32_t) == sizeof(float)) {
+    memcpy(&u, &f, sizeof(uint32_t));
+  }
+  return u;
+}
+
+static inline double  //
+iconvg_private_reinterpret_from_u64_to_f64(uint64_t u) {
+  double f = 0;
+  if (sizeof(uint64_t) == sizeof(double)) {
+    memcpy(&f, &u, sizeof(uint64_t));
+  }
+  return f;
+}
+
+static inline uint64_t  //
+iconvg_private_reinterpret_from_f64_to_u64(double f) {
+  uint64_t u = 0;
+  if (sizeof(uint64_t) == sizeof(double)) {
+    memcpy(&u, &f, sizeof(uint64_t));
+  }
+  return u;
+}
+
+// ----
+
+const char*  //
+iconvg_private_growable_buffer__reserve(iconvg_growable_buffer* b, size_t n);
+
+// A path buffer is a growable buffer of path records. Each record is a 1 byte
+// opcode (the iconvg_canvas_vtable function pointer index, as per the trace
+// format) followed by that function's float arguments.
+
+#define ICONVG_PRIVATE_PATH_OP__BEGIN_PATH 0x05
+#define ICONVG_PRIVATE_PATH_OP__END_PATH 0x06
+#define ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO 0x07
+#define ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO 0x08
+#define ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO 0x09
+
+const char*  //
+iconvg_private_path_buffer__append(iconvg_growable_buffer* b,
+                                   uint8_t op,
+                                   const float* args,
+                                   size_t num_args);
+
+// iconvg_private_path_buffer__replay calls c's path methods for the ptr[0 ..
+// len] path records, translated by (dx, dy).
+const char*  //
+iconvg_private_path_buffer__replay(const uint8_t* ptr,
+                                   size_t len,
+                                   iconvg_canvas* c,
+                                   float dx,
+                                   float dy);
+
 // ----
 
 static inline size_t  //
@@ -83,6 +166,68 @@ iconvg_private_default_viewbox() {
 
 // ----
 
+// iconvg_private_matrix_2x3_f64__mul returns the matrix that applies b and
+// then a.
+static inline iconvg_matrix_2x3_f64  //
+iconvg_private_matrix_2x3_f64__mul(const iconvg_matrix_2x3_f64* a,
+                                   const iconvg_matrix_2x3_f64* b) {
+  return iconvg_make_matrix_2x3_f64(
+      (a->elems[0][0] * b->elems[0][0]) + (a->elems[0][1] * b->elems[1][0]),
+      (a->elems[0][0] * b->elems[0][1]) + (a->elems[0][1] * b->elems[1][1]),
+      (a->elems[0][0] * b->elems[0][2]) + (a->elems[0][1] * b->elems[1][2]) +
+          a->elems[0][2],
+      (a->elems[1][0] * b->elems[0][0]) + (a->elems[1][1] * b->elems[1][0]),
+      (a->elems[1][0] * b->elems[0][1]) + (a->elems[1][1] * b->elems[1][1]),
+      (a->elems[1][0] * b->elems[0][2]) + (a->elems[1][1] * b->elems[1][2]) +
+          a->elems[1][2]);
+}
+
+static inline iconvg_matrix_2x3_f64  //
+iconvg_private_identity_matrix_2x3_f64() {
+  return iconvg_make_matrix_2x3_f64(1.0, 0.0, 0.0, 0.0, 1.0, 0.0);
+}
+
+// ----
+
+// iconvg_private_decode_options__dst_transform returns options' dst_transform
+// field, or NULL if options is NULL or predates that field.
+static inline const iconvg_matrix_2x3_f64*  //
+iconvg_private_decode_options__dst_transform(
+    const iconvg_decode_options* options) {
+  if (!options || (options->sizeof__iconvg_decode_options <
+                   (offsetof(iconvg_decode_options, dst_transform) +
+                    sizeof(options->dst_transform)))) {
+    return NULL;
+  }
+  return options->dst_transform;
+}
+
+// iconvg_private_decode_options__cull_rect returns options' cull_rect field,
+// or NULL if options is NULL or predates that field.
+static inline const iconvg_rectangle_f32*  //
+iconvg_private_decode_options__cull_rect(const iconvg_decode_options* options) {
+  if (!options || (options->sizeof__iconvg_decode_options <
+                   (offsetof(iconvg_decode_options, cull_rect) +
+                    sizeof(options->cull_rect)))) {
+    return NULL;
+  }
+  return options->cull_rect;
+}
+
+// iconvg_private_make_transform_canvas returns an iconvg_canvas that applies
+// *m to every path point before forwarding the call on to wrapped.
+iconvg_canvas  //
+iconvg_private_make_transform_canvas(iconvg_canvas* wrapped,
+                                     const iconvg_matrix_2x3_f64* m);
+
+// iconvg_private_transform_rectangle sets *r to the bounding box of *r
+// transformed by *m, returning false if *m is not finite and invertible.
+bool  //
+iconvg_private_transform_rectangle(iconvg_rectangle_f32* r,
+                                   const iconvg_matrix_2x3_f64* m);
+
+// ----
+
 typedef struct iconvg_private_decoder_struct {
   const uint8_t* ptr;
   size_t len;
@@ -160,6 +305,19 @@ struct iconvg_paint_struct {
   double d2s_bias_x;
   double d2s_scale_y;
   double d2s_bias_y;
+
+  // inverse_dst_transform is the inverse of the iconvg_decode_options
+  // dst_transform, mapping dst coordinates back to where they would be without
+  // that transform. It is the identity matrix if there is no dst_transform.
+  iconvg_matrix_2x3_f64 inverse_dst_transform;
+
+  // source_position is updated by the decoder before each end_drawing call.
+  iconvg_source_position source_position;
+
+  // palette_dependencies is the set of custom palette indices (bit i means
+  // index i) that this paint's colors depend on, tracked through CREG writes
+  // and blends. The decoder sets it when a drawing starts.
+  uint64_t palette_dependencies;
 };
 
 // ----
@@ -179,3 +337,20 @@ iconvg_private_path_arc_to(iconvg_canvas* c,
                            bool sweep,
                            float final_x,
                            float final_y);
+
+// iconvg_private_arc_bounds sets dst_bounds[0 .. 4] to the min_x, min_y,
+// max_x and max_y of the ellipse that iconvg_private_path_arc_to, with the
+// same arguments, draws part of. It returns false (and sets nothing) for a
+// zero radius or a non-finite result, when that function draws a straight
+// line.
+bool  //
+iconvg_private_arc_bounds(double* dst_bounds,
+                          float initial_x,
+                          float initial_y,
+                          float radius_x,
+                          float radius_y,
+                          float x_axis_rotation,
+                          bool large_arc,
+                          bool sweep,
+                          float final_x,
+                          float final_y);
@@ -69,6 +69,7 @@ extern const char iconvg_error_bad_coordinate[];
 extern const char iconvg_error_bad_drawing_opcode[];
 extern const char iconvg_error_bad_magic_identifier[];
 extern const char iconvg_error_bad_metadata[];
+extern const char iconvg_error_bad_metadata_drawing_index[];
 extern const char iconvg_error_bad_metadata_id_order[];
 extern const char iconvg_error_bad_metadata_suggested_palette[];
 extern const char iconvg_error_bad_metadata_viewbox[];
@@ -79,8 +80,19 @@ extern const char iconvg_error_bad_styling_opcode[];
 extern const char iconvg_error_system_failure_out_of_memory[];
 
 extern const char iconvg_error_invalid_backend_not_enabled[];
+extern const char iconvg_error_invalid_batch_argument[];
+extern const char iconvg_error_invalid_buffer_too_small[];
 extern const char iconvg_error_invalid_constructor_argument[];
+extern const char iconvg_error_invalid_damage_argument[];
+extern const char iconvg_error_invalid_dst_transform[];
+extern const char iconvg_error_invalid_encoder_argument[];
+extern const char iconvg_error_invalid_encoder_state[];
+extern const char iconvg_error_invalid_instances_argument[];
+extern const char iconvg_error_invalid_mipmap_argument[];
 extern const char iconvg_error_invalid_paint_type[];
+extern const char iconvg_error_invalid_pixel_argument[];
+extern const char iconvg_error_invalid_raster_cache_argument[];
+extern const char iconvg_error_invalid_trace[];
 extern const char iconvg_error_unsupported_vtable[];
 
 // ----
@@ -159,6 +171,18 @@ typedef struct iconvg_palette_struct {
   iconvg_premul_color colors[64];
 } iconvg_palette;
 
+// iconvg_pixel_format is a 4 bytes per pixel memory layout. BGRA means that
+// the bytes are in B, G, R, A order, which is what Cairo's CAIRO_FORMAT_ARGB32
+// and Skia's BGRA_8888_SK_COLORTYPE are on little-endian systems. RGBA means
+// R, G, B, A order, which is what PNG expects.
+typedef enum iconvg_pixel_format_enum {
+  ICONVG_PIXEL_FORMAT__INVALID = 0,
+  ICONVG_PIXEL_FORMAT__BGRA_PREMUL = 1,
+  ICONVG_PIXEL_FORMAT__BGRA_NONPREMUL = 2,
+  ICONVG_PIXEL_FORMAT__RGBA_PREMUL = 3,
+  ICONVG_PIXEL_FORMAT__RGBA_NONPREMUL = 4,
+} iconvg_pixel_format;
+
 // ----
 
 typedef enum iconvg_paint_type_enum {
@@ -230,6 +254,55 @@ iconvg_matrix_2x3_f64__determinant(iconvg_matrix_2x3_f64* self) {
 
 // ----
 
+// iconvg_paint_snapshot_stop is one gradient stop of an iconvg_paint_snapshot.
+typedef struct iconvg_paint_snapshot_stop_struct {
+  iconvg_premul_color color;
+  float offset;
+} iconvg_paint_snapshot_stop;
+
+// iconvg_paint_snapshot is a self-contained copy of what an iconvg_paint
+// looks like, for canvases that defer their drawing (such as recorders,
+// batchers or tile binners). Unlike an iconvg_paint, it does not hold the
+// decoder's registers, palettes or coordinate transforms.
+//
+// Its fields are ordered so that only a prefix of the struct is meaningful,
+// whose length is returned by iconvg_paint__snapshot. A flat color needs only
+// the fields up to and including gradient_number_of_stops (which is zero). A
+// gradient also needs the transformation matrix and its first
+// gradient_number_of_stops stops. Callers may store just that prefix and later
+// copy it back into an iconvg_paint_snapshot.
+typedef struct iconvg_paint_snapshot_struct {
+  iconvg_paint_type type;
+  iconvg_premul_color flat_color;
+  iconvg_gradient_spread gradient_spread;
+  uint32_t gradient_number_of_stops;
+  // gradient_transformation_matrix has the same meaning as the result of
+  // iconvg_paint__gradient_transformation_matrix.
+  iconvg_matrix_2x3_f64 gradient_transformation_matrix;
+  iconvg_paint_snapshot_stop gradient_stops[63];
+} iconvg_paint_snapshot;
+
+// iconvg_source_position is where, in the IconVG source bytes, a drawing
+// came from.
+typedef struct iconvg_source_position_struct {
+  // drawing_index counts the drawings in the IconVG graphic, starting at
+  // zero. Drawings that are skipped by Level of Detail thresholds still count,
+  // so that the index does not depend on the rasterization size.
+  uint64_t drawing_index;
+
+  // src_begin and src_end are byte offsets, relative to the src_ptr passed
+  // to iconvg_decode. The range covers the styling opcodes that immediately
+  // precede the drawing (after the previous drawing, if any) through to the
+  // drawing's final opcode.
+  //
+  // Register values set before src_begin (including by the metadata) can
+  // still affect what the drawing looks like.
+  size_t src_begin;
+  size_t src_end;
+} iconvg_source_position;
+
+// ----
+
 // iconvg_decode_options holds the optional arguments to iconvg_decode.
 typedef struct iconvg_decode_options_struct {
   // sizeof__iconvg_decode_options should be set to the sizeof this data
@@ -250,6 +323,33 @@ typedef struct iconvg_decode_options_struct {
   // palette, if non-NULL, is the custom palette used for rendering. If NULL,
   // the IconVG file's suggested palette is used instead.
   iconvg_palette* palette;
+
+  // dst_transform, if non-NULL, is an affine transformation applied to every
+  // point after it is mapped from the ViewBox to the dst_rect. Gradients are
+  // transformed to match. This lets a graphic be rotated or skewed without a
+  // backend-specific transform, keeping the backend's identity matrix (and
+  // any faster code paths that come with it).
+  //
+  // begin_decode receives the bounding box of the transformed dst_rect, so
+  // that backends that clip to it do not clip the graphic. Level of Detail
+  // thresholds still use height_in_pixels or the untransformed dst_rect.
+  //
+  // The matrix must be invertible, otherwise decoding fails with
+  // iconvg_error_invalid_dst_transform.
+  const iconvg_matrix_2x3_f64* dst_transform;
+
+  // cull_rect, if non-NULL, is the part of dst coordinate space (after any
+  // dst_transform) that needs painting, such as the dst canvas' clip or a
+  // damaged region. If the IconVG graphic has a drawing index (MID 2) then
+  // drawings whose bounds lie wholly outside of cull_rect are skipped: their
+  // canvas callbacks are not called. They still count towards
+  // iconvg_source_position's drawing_index.
+  //
+  // Without a drawing index, cull_rect has no effect. Either way, every
+  // drawing is still decoded, so that whether decoding succeeds does not
+  // depend on cull_rect. An index that does not match the drawings is
+  // rejected with iconvg_error_bad_metadata_drawing_index.
+  const iconvg_rectangle_f32* cull_rect;
 } iconvg_decode_options;
 
 // iconvg_make_decode_options_ffv1 returns an iconvg_decode_options suitable
@@ -264,6 +364,166 @@ iconvg_make_decode_options_ffv1(iconvg_palette* palette) {
 
 // ----
 
+// iconvg_batch_item is one graphic for iconvg_decode_batch to paint: the
+// src_ptr[0 .. src_len] IconVG-formatted data, painted into dst_rect.
+typedef struct iconvg_batch_item_struct {
+  iconvg_rectangle_f32 dst_rect;
+  const uint8_t* src_ptr;
+  size_t src_len;
+} iconvg_batch_item;
+
+// ----
+
+// ICONVG_MIPMAP_CHAIN_MAX_LEVELS is the maximum number of levels in an
+// iconvg_mipmap_chain, enough for a level 0 up to 0xFFFFFFFF pixels wide.
+#define ICONVG_MIPMAP_CHAIN_MAX_LEVELS 32
+
+// iconvg_mipmap_level is one level of an iconvg_mipmap_chain: a width x height
+// pixel buffer with 4 bytes (premultiplied alpha) per pixel. The order of the
+// 4 channels within a pixel is whatever the render callback produces.
+typedef struct iconvg_mipmap_level_struct {
+  uint8_t* ptr;
+  size_t stride;
+  uint32_t width;
+  uint32_t height;
+
+  // rendered is whether this level was painted by the render callback. If
+  // false, it was downsampled from the previous (larger) level.
+  bool rendered;
+} iconvg_mipmap_level;
+
+// iconvg_mipmap_chain is a sequence of iconvg_mipmap_level values, from the
+// largest (levels[0]) to the smallest (1x1 pixels), each level's width and
+// height being half of the previous level's (rounded down, but at least 1).
+typedef struct iconvg_mipmap_chain_struct {
+  uint32_t num_levels;
+  iconvg_mipmap_level levels[ICONVG_MIPMAP_CHAIN_MAX_LEVELS];
+} iconvg_mipmap_chain;
+
+// iconvg_mipmap_render_func paints the src IconVG-formatted data onto a
+// mipmap level's pixels (which have been zeroed beforehand), typically by
+// calling iconvg_decode with a backend-specific canvas and a dst_rect of
+// {0, 0, level->width, level->height}. options is passed through from
+// iconvg_decode_mipmap_chain.
+typedef const char* (*iconvg_mipmap_render_func)(
+    void* context,
+    const iconvg_mipmap_level* level,
+    const uint8_t* src_ptr,
+    size_t src_len,
+    const iconvg_decode_options* options);
+
+// ----
+
+// iconvg_raster_cache_key identifies a rasterization in an iconvg_raster_cache.
+typedef struct iconvg_raster_cache_key_struct {
+  // src_hash is the iconvg_raster_cache_hash of the IconVG source bytes.
+  uint64_t src_hash;
+
+  // palette_hash is the iconvg_raster_cache_hash of the custom palette, or
+  // zero when rendering with the IconVG source's suggested palette.
+  uint64_t palette_hash;
+
+  // width and height are the rasterization's size in pixels.
+  uint32_t width;
+  uint32_t height;
+
+  // backend is chosen by the caller, to distinguish rasterizations that would
+  // otherwise look the same, such as Cairo's versus Skia's, or BGRA versus
+  // RGBA channel order.
+  uint32_t backend;
+
+  // bytes_per_pixel is either 4 (alpha-premultiplied color, in whatever
+  // channel order the backend uses) or 1 (an 8-bit alpha mask).
+  uint32_t bytes_per_pixel;
+
+  // subpixel_x and subpixel_y are the rasterization's subpixel phase, in
+  // 1/256ths of a pixel (see iconvg_subpixel_placement). Both are zero for
+  // rasterizations that are not subpixel positioned.
+  uint8_t subpixel_x;
+  uint8_t subpixel_y;
+
+  // content_width and content_height are the size, in possibly fractional
+  // pixels, of the destination rectangle that the graphic was rasterized to
+  // (see iconvg_subpixel_placement). Rasterizations whose width and height
+  // are equal can still differ in scale. Both are zero when that rectangle is
+  // the whole {0, 0, width, height} rasterization. They are compared by
+  // their bits, so callers should compute them the same way each time.
+  float content_width;
+  float content_height;
+} iconvg_raster_cache_key;
+
+// iconvg_subpixel_placement is how to rasterize and then blit a graphic whose
+// destination rectangle is at a fractional pixel position, such as an icon
+// placed inline with text. The fractional part is quantized to one of a small
+// number of subpixel phases, so that the rasterization can be cached (keyed
+// by the phase) and re-used for every placement with that phase, as glyph
+// caches do. This avoids both re-rasterizing per placement and the jitter of
+// snapping to whole pixels.
+typedef struct iconvg_subpixel_placement_struct {
+  // dst_x and dst_y are the whole pixel position at which to blit the
+  // rasterization's top-left corner.
+  int32_t dst_x;
+  int32_t dst_y;
+
+  // subpixel_x and subpixel_y are the quantized phase, in 1/256ths of a
+  // pixel, for the iconvg_raster_cache_key fields of the same name.
+  uint8_t subpixel_x;
+  uint8_t subpixel_y;
+
+  // width and height are the rasterization's size in pixels, for the
+  // iconvg_raster_cache_key fields of the same name. They are large enough to
+  // hold dst_rect, which can take one more pixel than the destination
+  // rectangle's (rounded up) size when the phase is non-zero.
+  uint32_t width;
+  uint32_t height;
+
+  // content_width and content_height are the destination rectangle's size,
+  // unrounded, for the iconvg_raster_cache_key fields of the same name. Two
+  // placements can share a phase, width and height but not a content size,
+  // such as 15.5 and 16 pixels wide, and their rasterizations differ.
+  float content_width;
+  float content_height;
+
+  // dst_rect is what to pass to iconvg_decode when rasterizing, relative to
+  // the rasterization's top-left corner. Its offset from (0, 0) is exactly the
+  // quantized phase.
+  iconvg_rectangle_f32 dst_rect;
+} iconvg_subpixel_placement;
+
+// iconvg_raster_cache is a persistent cache of rasterizations, held in
+// ptr[0 .. len]. That memory is typically a file mapped (e.g. by mmap with
+// MAP_SHARED) into multiple processes, so that the cache survives restarts
+// and is shared. The data format is little-endian and independent of the
+// process' pointer size, but may change across library versions (in which
+// case the cache is re-formatted, i.e. emptied, by the writer).
+//
+// The memory is both the cache's storage and its size cap. Older entries are
+// evicted (over-written) to make room for newer ones, in first-in-first-out
+// order.
+//
+// There may be many concurrent readers (iconvg_raster_cache__lookup) but at
+// most one writer (iconvg_raster_cache__open_for_writing and
+// iconvg_raster_cache__insert) at a time. Coordinating writers (e.g. with a
+// file lock) is the caller's responsibility. Readers take no locks. They
+// detect entries that are concurrently being over-written, which are then
+// cache misses.
+typedef struct iconvg_raster_cache_struct {
+  uint8_t* ptr;
+  size_t len;
+} iconvg_raster_cache;
+
+// iconvg_make_raster_cache returns an iconvg_raster_cache that wraps the
+// caller-owned ptr[0 .. len] memory. It does not read or write that memory.
+static inline iconvg_raster_cache  //
+iconvg_make_raster_cache(uint8_t* ptr, size_t len) {
+  iconvg_raster_cache c;
+  c.ptr = ptr;
+  c.len = ptr ? len : 0;
+  return c;
+}
+
+// ----
+
 // iconvg_canvas is conceptually a 'virtual super-class' with e.g. Cairo-backed
 // or Skia-backed 'sub-classes'.
 //
@@ -310,6 +570,15 @@ typedef struct iconvg_canvas_vtable_struct {
   const char* (*on_metadata_suggested_palette)(
       struct iconvg_canvas_struct* c,
       const iconvg_palette* suggested_palette);
+
+  // end_drawing_instances is optional and may be NULL. If non-NULL, it is
+  // like end_drawing but paints the path num_instances times, translated by
+  // (offsets_xy[2*i+0], offsets_xy[2*i+1]) for each i. It is only called by
+  // iconvg_decode_instances.
+  const char* (*end_drawing_instances)(struct iconvg_canvas_struct* c,
+                                       const iconvg_paint* p,
+                                       const float* offsets_xy,
+                                       size_t num_instances);
 } iconvg_canvas_vtable;
 
 typedef struct iconvg_canvas_struct {
@@ -329,6 +598,67 @@ typedef struct iconvg_canvas_struct {
 
 // ----
 
+// iconvg_growable_buffer is a contiguous byte buffer that the IconVG encoder
+// appends to. Bytes ptr[0 .. len] hold data. Bytes ptr[len .. cap] are
+// available for appending to.
+//
+// grow, if non-NULL, is called when more capacity is needed. It should make
+// (cap - len) at least min_additional, possibly by changing ptr, or return an
+// error. If NULL, appending past cap fails with
+// iconvg_error_invalid_buffer_too_small.
+//
+// context is not used by the library, other than being available to grow.
+typedef struct iconvg_growable_buffer_struct {
+  uint8_t* ptr;
+  size_t len;
+  size_t cap;
+  const char* (*grow)(struct iconvg_growable_buffer_struct* self,
+                      size_t min_additional);
+  void* context;
+} iconvg_growable_buffer;
+
+// iconvg_make_growable_buffer returns an iconvg_growable_buffer that wraps the
+// caller-owned ptr[0 .. cap] memory. It never grows.
+static inline iconvg_growable_buffer  //
+iconvg_make_growable_buffer(uint8_t* ptr, size_t cap) {
+  iconvg_growable_buffer b;
+  b.ptr = ptr;
+  b.len = 0;
+  b.cap = ptr ? cap : 0;
+  b.grow = NULL;
+  b.context = NULL;
+  return b;
+}
+
+// ----
+
+// iconvg_encoder writes IconVG-formatted data to an iconvg_growable_buffer.
+// Its methods mirror the iconvg_canvas_vtable callbacks, except that the paint
+// is given at the start of a drawing instead of the end.
+//
+// The fields should be considered private implementation details. Users
+// should not read or write them directly and their semantics may change
+// between minor library releases. Use iconvg_encoder__initialize instead.
+typedef struct iconvg_encoder_struct {
+  iconvg_growable_buffer* private_dst;
+  const char* private_err_msg;
+  uint32_t private_mode;
+  uint32_t private_csel;
+  uint32_t private_nsel;
+  uint32_t private_start_path_adj;
+  size_t private_run_index;
+  float private_curr_x;
+  float private_curr_y;
+  float private_start_x;
+  float private_start_y;
+  float private_refl_x;
+  float private_refl_y;
+  uint64_t private_creg_known_bits;
+  iconvg_premul_color private_creg[64];
+} iconvg_encoder;
+
+// ----
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -371,6 +701,51 @@ iconvg_make_debug_canvas(FILE* f,
                          const char* message_prefix,
                          iconvg_canvas* wrapped);
 
+// iconvg_make_trace_canvas returns an iconvg_canvas that records vtable calls,
+// and their arguments, to dst in a compact binary format before forwarding the
+// call on to the wrapped iconvg_canvas. It is like iconvg_make_debug_canvas
+// but the trace can later be played back, by iconvg_replay_trace, without
+// re-running the IconVG decoder. This helps benchmark a canvas in isolation.
+//
+// dst may be NULL, in which case nothing is recorded. Recording multiple
+// iconvg_decode calls to the same dst is valid. The trace format is not
+// stable across library versions.
+//
+// wrapped may be NULL, in which case the iconvg_canvas vtable calls always
+// return success (a NULL error message) except that end_decode returns its
+// (possibly non-NULL) err_msg argument unchanged. Recording can also fail,
+// e.g. with iconvg_error_invalid_buffer_too_small.
+//
+// If any of the pointer-typed arguments are non-NULL then the caller of this
+// function is responsible for ensuring that the pointers remain valid while
+// the returned iconvg_canvas is in use.
+iconvg_canvas  //
+iconvg_make_trace_canvas(iconvg_growable_buffer* dst, iconvg_canvas* wrapped);
+
+// iconvg_make_paint_sorting_canvas returns an iconvg_canvas that buffers each
+// decode's drawings and then forwards them on to the wrapped iconvg_canvas,
+// re-ordered so that drawings with the same paint are more often adjacent.
+// This reduces how often the wrapped canvas switches paints (e.g. creating
+// Cairo patterns or Skia shaders), which helps busy, many-colored graphics.
+//
+// Only drawings that share no pixels are re-ordered relative to each other.
+// Overlapping drawings keep their relative order, so the painted result is
+// unchanged. Pixels are judged by bounding boxes, presuming that dst
+// coordinate space units are pixels. Drawings are only re-ordered within
+// windows of (up to) 256 consecutive drawings, so that the sorting work per
+// drawing, and the memory used, is bounded. Buffering allocates memory, so
+// decoding can fail with iconvg_error_system_failure_out_of_memory.
+//
+// wrapped may be NULL, in which case the iconvg_canvas vtable calls always
+// return success (a NULL error message) except that end_decode returns its
+// (possibly non-NULL) err_msg argument unchanged.
+//
+// If wrapped is non-NULL then the caller of this function is responsible for
+// ensuring that the pointer remains valid while the returned iconvg_canvas is
+// in use.
+iconvg_canvas  //
+iconvg_make_paint_sorting_canvas(iconvg_canvas* wrapped);
+
 // iconvg_canvas__does_nothing returns whether self is NULL or *self is
 // zero-valued or broken. Other canvas values are presumed to do something.
 // Zero-valued means the result of "iconvg_canvas c = {0}". Broken means the
@@ -441,6 +816,105 @@ iconvg_decode(iconvg_canvas* dst_canvas,
               size_t src_len,
               const iconvg_decode_options* options);
 
+// iconvg_decode_instances is like iconvg_decode but paints the src graphic
+// num_instances times, the i'th copy translated (in dst coordinate space) by
+// (offsets_xy[2*i+0], offsets_xy[2*i+1]) relative to dst_rect. The src is
+// parsed only once. Each of its drawings is painted at every offset before
+// moving on to the next drawing, so overlapping instances can composite
+// differently than separate iconvg_decode calls would.
+//
+// If dst_canvas's vtable has a non-NULL end_drawing_instances then each path
+// is built once and handed over with the whole offsets_xy array. Otherwise,
+// the path is buffered and replayed, translated, once per instance. Either
+// way, begin_decode receives the union of the translated dst_rects.
+//
+// offsets_xy may be NULL only if num_instances is zero.
+//
+// options may be NULL, in which case default values will be used.
+const char*  //
+iconvg_decode_instances(iconvg_canvas* dst_canvas,
+                        iconvg_rectangle_f32 dst_rect,
+                        const uint8_t* src_ptr,
+                        size_t src_len,
+                        const float* offsets_xy,
+                        size_t num_instances,
+                        const iconvg_decode_options* options);
+
+// iconvg_decode_batch paints num_items graphics, like calling iconvg_decode
+// once per item, but within a single begin_decode / end_decode session whose
+// dst_rect is the union of the items' dst_rects. This amortizes a backend's
+// per-decode setup, such as Cairo's or Skia's save, clip and restore.
+//
+// An item whose path coordinates all lie within its dst_rect is painted
+// without a clip of its own. Any other item (including one whose src is not
+// well-formed) is painted by a nested iconvg_decode call, which clips to that
+// item's dst_rect. Finding out which is which costs an extra parse (but no
+// painting) of each item's src.
+//
+// dst_err_msgs may be NULL. If non-NULL, it should have room for num_items
+// elements and dst_err_msgs[i] is set to the i'th item's error (NULL meaning
+// success). A failing item does not stop later items from being painted.
+//
+// It returns the first non-NULL item error, unless end_decode returns an
+// error of its own. end_decode's byte counts are zero and its err_msg argument
+// is NULL unless begin_decode failed, in which case no item is painted.
+//
+// options may be NULL, in which case default values will be used. They apply
+// to every item.
+const char*  //
+iconvg_decode_batch(iconvg_canvas* dst_canvas,
+                    const iconvg_batch_item* items,
+                    size_t num_items,
+                    const char** dst_err_msgs,
+                    const iconvg_decode_options* options);
+
+// iconvg_decode_damage compares two versions of an IconVG graphic, drawing by
+// drawing, and sets *dst_damage to the region of dst_rect whose pixels can
+// differ between them. An editor can then re-paint only that region (with a
+// clip) after an edit, instead of the whole graphic.
+//
+// Drawings are compared by what they look like (their dst-space paths and
+// their resolved colors and gradients), not by their bytes, so that edits to
+// the CREG and NREG registers are accounted for. The damage is the union of
+// the pixel bounding boxes of the drawings that changed, were added or were
+// removed, after skipping the drawings that both versions start and end with.
+// This presumes that dst coordinate space units are pixels.
+//
+// If nothing changed then *dst_damage is set to the all-zero (empty)
+// rectangle. If either version fails to decode then *dst_damage is set to the
+// whole dst_rect (or its bounding box after any dst_transform) and the first
+// error is returned. Comparing allocates memory, so it can also fail with
+// iconvg_error_system_failure_out_of_memory.
+//
+// options may be NULL, in which case default values will be used. They apply
+// to both versions, as they should be the same as when painting them.
+const char*  //
+iconvg_decode_damage(iconvg_rectangle_f32* dst_damage,
+                     iconvg_rectangle_f32 dst_rect,
+                     const uint8_t* old_src_ptr,
+                     size_t old_src_len,
+                     const uint8_t* new_src_ptr,
+                     size_t new_src_len,
+                     const iconvg_decode_options* options);
+
+// iconvg_decode_palette_dependencies sets *dst_mask to the union of
+// iconvg_paint__palette_dependencies over the drawings that iconvg_decode,
+// with the same arguments, would paint. A cache of rendered graphics can then
+// skip invalidating a graphic when none of its bits are among the changed
+// custom palette entries. Finer-grained (per drawing) invalidation can call
+// iconvg_paint__palette_dependencies in a canvas' end_drawing method.
+//
+// Drawings skipped by Level of Detail thresholds do not count, so the mask can
+// depend on dst_rect and options' height_in_pixels.
+//
+// options may be NULL, in which case default values will be used.
+const char*  //
+iconvg_decode_palette_dependencies(uint64_t* dst_mask,
+                                   iconvg_rectangle_f32 dst_rect,
+                                   const uint8_t* src_ptr,
+                                   size_t src_len,
+                                   const iconvg_decode_options* options);
+
 // iconvg_decode_viewbox sets *dst_viewbox to the ViewBox Metadata from the src
 // IconVG-formatted data.
 //
@@ -454,6 +928,250 @@ iconvg_decode_viewbox(iconvg_rectangle_f32* dst_viewbox,
                       const uint8_t* src_ptr,
                       size_t src_len);
 
+// iconvg_replay_trace plays back a trace, recorded by an
+// iconvg_make_trace_canvas canvas, calling dst_canvas's callbacks with the
+// recorded arguments. This skips decoding the IconVG data, so that the
+// dst_canvas's cost can be measured in isolation.
+//
+// The trace may hold multiple begin_decode ... end_decode call sequences. As
+// with iconvg_decode, if a callback returns an error (or the trace is
+// malformed) part-way through a call sequence then that sequence stops and
+// the error becomes the err_msg argument to end_decode, whose
+// num_bytes_etc arguments then count trace bytes instead of IconVG bytes.
+// This function returns the first non-NULL error returned by end_decode (or
+// iconvg_error_invalid_trace), or NULL if there were none.
+//
+// Error messages recorded in the trace are passed to end_decode as the
+// equivalent iconvg_error_etc constant where there is one, so that they can
+// be compared by the == operator. Other (non-library) messages are passed as
+// pointers into src_ptr.
+const char*  //
+iconvg_replay_trace(iconvg_canvas* dst_canvas,
+                    const uint8_t* src_ptr,
+                    size_t src_len);
+
+// iconvg_mipmap_chain_byte_length returns the number of bytes needed to hold
+// every level of a mipmap chain whose level 0 is width x height pixels. It
+// returns zero if width or height is zero or if the total overflows a size_t.
+size_t  //
+iconvg_mipmap_chain_byte_length(uint32_t width, uint32_t height);
+
+// iconvg_decode_mipmap_chain fills in a complete mipmap chain for the src
+// IconVG-formatted data, whose level 0 is width x height pixels. All levels
+// are laid out, tightly packed, in the single dst_ptr buffer, whose dst_len
+// should be at least iconvg_mipmap_chain_byte_length(width, height).
+//
+// Level 0 is painted by the render callback. Each subsequent level is either
+// painted by the render callback or is a 2x2 box-filter downsampling of the
+// previous level. It is re-rendered only when the src's Level of Detail
+// thresholds select a different set of paths at that level's height, since
+// downsampling is much cheaper than rendering but would otherwise blend away
+// paths that are meant to appear (or disappear) at smaller sizes.
+//
+// If options->height_in_pixels has_value then that height is used for every
+// level's Level of Detail thresholds, so that only level 0 is rendered.
+//
+// options may be NULL, in which case default values will be used.
+const char*  //
+iconvg_decode_mipmap_chain(iconvg_mipmap_chain* dst_chain,
+                           uint8_t* dst_ptr,
+                           size_t dst_len,
+                           uint32_t width,
+                           uint32_t height,
+                           iconvg_mipmap_render_func render,
+                           void* render_context,
+                           const uint8_t* src_ptr,
+                           size_t src_len,
+                           const iconvg_decode_options* options);
+
+// iconvg_convert_pixels converts a width x height rectangle of pixels from
+// src_format to dst_format, swizzling (swapping the B and R channels) and
+// converting to or from alpha-premultiplication as needed. Each row starts
+// stride bytes after the previous row.
+//
+// Converting from premultiplied to non-premultiplied alpha rounds down (with
+// invalid premultiplied colors, whose color channels exceed their alpha,
+// saturating at 0xFF). Converting to or from alpha-premultiplication also
+// sets fully transparent pixels to all zeroes.
+//
+// dst_ptr may equal src_ptr (converting in place), provided that dst_stride
+// equals src_stride. Otherwise, the two buffers must not overlap.
+const char*  //
+iconvg_convert_pixels(uint8_t* dst_ptr,
+                      size_t dst_len,
+                      size_t dst_stride,
+                      iconvg_pixel_format dst_format,
+                      const uint8_t* src_ptr,
+                      size_t src_len,
+                      size_t src_stride,
+                      iconvg_pixel_format src_format,
+                      uint32_t width,
+                      uint32_t height);
+
+// iconvg_raster_cache_hash returns a 64-bit hash of ptr[0 .. len], for
+// filling in an iconvg_raster_cache_key. The hash function is stable across
+// library versions, as the hashes are persisted.
+uint64_t  //
+iconvg_raster_cache_hash(const uint8_t* ptr, size_t len);
+
+// iconvg_place_subpixel sets *dst_placement for drawing at dst_rect, whose
+// fractional position is rounded to the nearest of num_phases_x horizontal
+// and num_phases_y vertical subpixel phases. For example, 4 and 1 quantize to
+// quarter pixels horizontally and snap to whole pixels vertically. Each
+// number of phases must be in the range [1 ..= 256].
+//
+// It fails with iconvg_error_invalid_raster_cache_argument if dst_rect is
+// not finite, is empty or is too far from the origin.
+const char*  //
+iconvg_place_subpixel(iconvg_subpixel_placement* dst_placement,
+                      iconvg_rectangle_f32 dst_rect,
+                      uint32_t num_phases_x,
+                      uint32_t num_phases_y);
+
+// iconvg_raster_cache__open_for_writing prepares self for
+// iconvg_raster_cache__insert calls. If self's memory does not already hold a
+// valid cache (for example, it is all zeroes or its length has changed) then
+// it is formatted as an empty one. The memory should be at least 8 KiB.
+const char*  //
+iconvg_raster_cache__open_for_writing(iconvg_raster_cache* self);
+
+// iconvg_raster_cache__lookup copies the cached pixels for key, if present,
+// to dst_ptr and returns true. Each of the key->height rows is key->width *
+// key->bytes_per_pixel bytes long and starts dst_stride bytes after the
+// previous row. dst_len must be large enough for all of the rows.
+//
+// It returns false (and dst_ptr's contents are unspecified) on a cache miss,
+// including when self does not hold a valid cache.
+bool  //
+iconvg_raster_cache__lookup(const iconvg_raster_cache* self,
+                            const iconvg_raster_cache_key* key,
+                            uint8_t* dst_ptr,
+                            size_t dst_len,
+                            size_t dst_stride);
+
+// iconvg_raster_cache__insert adds the src_ptr pixels (laid out as for
+// iconvg_raster_cache__lookup) to the cache under key, evicting older entries
+// if needed. It fails with iconvg_error_invalid_raster_cache_argument if the
+// entry would be larger than the cache's capacity.
+const char*  //
+iconvg_raster_cache__insert(iconvg_raster_cache* self,
+                            const iconvg_raster_cache_key* key,
+                            const uint8_t* src_ptr,
+                            size_t src_len,
+                            size_t src_stride);
+
+// ----
+
+// iconvg_growable_buffer__realloc_grow is an iconvg_growable_buffer grow
+// callback backed by the C standard library's realloc. A buffer that uses it
+// should start with ptr, len and cap all zero, and the caller is responsible
+// for eventually calling free(self->ptr).
+const char*  //
+iconvg_growable_buffer__realloc_grow(iconvg_growable_buffer* self,
+                                     size_t min_additional);
+
+// ----
+
+// iconvg_encoder__initialize prepares self to append to dst, writing the
+// IconVG magic identifier and metadata.
+//
+// viewbox and suggested_palette may be NULL, in which case the file format
+// defaults are used. Metadata equal to those defaults is not written.
+//
+// The caller is responsible for ensuring that dst remains valid while self is
+// in use. The iconvg_encoder__etc functions return the same error, once one
+// has occurred, without writing anything further.
+const char*  //
+iconvg_encoder__initialize(iconvg_encoder* self,
+                           iconvg_growable_buffer* dst,
+                           const iconvg_rectangle_f32* viewbox,
+                           const iconvg_palette* suggested_palette);
+
+// iconvg_encoder__begin_drawing_flat_color starts a drawing whose paint is the
+// given (alpha-premultiplied) color.
+//
+// Consecutive drawings that share a color also share its encoding: the color
+// is only written once.
+const char*  //
+iconvg_encoder__begin_drawing_flat_color(iconvg_encoder* self,
+                                         iconvg_premul_color color);
+
+// iconvg_encoder__begin_drawing_gradient starts a drawing whose paint is a
+// linear or radial gradient with num_stops color/offset stops. num_stops must
+// be at most 58, so that the stop offsets and transformation matrix fit in the
+// IconVG number registers.
+//
+// stop_offsets must be in the range 0.0 ..= 1.0 inclusive.
+//
+// The transformation matrix converts from src (graphic or viewbox) coordinate
+// space to pattern coordinate space. Note that this is the inverse direction
+// of the dst-to-pattern matrix returned by
+// iconvg_paint__gradient_transformation_matrix when decoding.
+const char*  //
+iconvg_encoder__begin_drawing_gradient(
+    iconvg_encoder* self,
+    bool radial,
+    iconvg_gradient_spread spread,
+    uint32_t num_stops,
+    const iconvg_premul_color* stop_colors,
+    const float* stop_offsets,
+    iconvg_matrix_2x3_f64 transformation_matrix);
+
+// iconvg_encoder__end_drawing ends the drawing started by the most recent
+// iconvg_encoder__begin_drawing_etc call. Any path must already be ended.
+const char*  //
+iconvg_encoder__end_drawing(iconvg_encoder* self);
+
+// iconvg_encoder__begin_path starts a path (a move_to) at (x0, y0).
+const char*  //
+iconvg_encoder__begin_path(iconvg_encoder* self, float x0, float y0);
+
+// iconvg_encoder__end_path closes the current path.
+const char*  //
+iconvg_encoder__end_path(iconvg_encoder* self);
+
+// iconvg_encoder__path_line_to adds a line segment to the current path.
+const char*  //
+iconvg_encoder__path_line_to(iconvg_encoder* self, float x1, float y1);
+
+// iconvg_encoder__path_quad_to adds a quadratic Bézier segment to the current
+// path.
+const char*  //
+iconvg_encoder__path_quad_to(iconvg_encoder* self,
+                             float x1,
+                             float y1,
+                             float x2,
+                             float y2);
+
+// iconvg_encoder__path_cube_to adds a cubic Bézier segment to the current
+// path.
+const char*  //
+iconvg_encoder__path_cube_to(iconvg_encoder* self,
+                             float x1,
+                             float y1,
+                             float x2,
+                             float y2,
+                             float x3,
+                             float y3);
+
+// iconvg_encoder__path_arc_to adds an elliptical arc segment to the current
+// path, with the same parameters as the SVG path "A" command except that
+// x_axis_rotation is measured in turns (1 turn is 360 degrees), not degrees.
+const char*  //
+iconvg_encoder__path_arc_to(iconvg_encoder* self,
+                            float radius_x,
+                            float radius_y,
+                            float x_axis_rotation,
+                            bool large_arc,
+                            bool sweep,
+                            float final_x,
+                            float final_y);
+
+// iconvg_encoder__finish returns an error if a drawing is still in progress.
+// On success, the encoded IconVG data is in the dst buffer.
+const char*  //
+iconvg_encoder__finish(iconvg_encoder* self);
+
 // ----
 
 // iconvg_paint__type returns what type of paint self is.
@@ -533,6 +1251,39 @@ iconvg_paint__gradient_stop_offset(const iconvg_paint* self,
 iconvg_matrix_2x3_f64  //
 iconvg_paint__gradient_transformation_matrix(const iconvg_paint* self);
 
+// iconvg_paint__snapshot sets *dst to a copy of self that no longer refers to
+// the decoder's state, so that it stays valid after the iconvg_canvas_vtable
+// method that was passed self returns. It returns the number of leading bytes
+// of *dst that are meaningful, which is at most sizeof(iconvg_paint_snapshot).
+//
+// If self or dst is NULL then it returns zero and *dst is unchanged.
+size_t  //
+iconvg_paint__snapshot(const iconvg_paint* self, iconvg_paint_snapshot* dst);
+
+// iconvg_paint__source_position returns which drawing self is for, and the
+// bytes of the IconVG source that produced it. Canvases can use this in their
+// end_drawing method to attribute or cache work per drawing, not per file.
+//
+// If self is NULL then the result is all zeroes. It is also all zeroes for
+// paints that did not come from iconvg_decode, such as when replaying traces.
+iconvg_source_position  //
+iconvg_paint__source_position(const iconvg_paint* self);
+
+// iconvg_paint__palette_dependencies returns the set of custom palette indices
+// that self's colors (its flat color or its gradient stops) depend on. Bit i
+// of the result is set if changing custom palette entry i (an
+// iconvg_decode_options palette entry or, without one, the suggested palette)
+// can change what self looks like.
+//
+// The set is tracked through the CREG registers, including CREG values that
+// refer to other CREG values and blends of two colors. It is conservative: a
+// bit may be set even if the palette entry ends up making no difference.
+//
+// If self is NULL then it returns zero. It also returns zero for paints that
+// did not come from iconvg_decode, such as when replaying traces.
+uint64_t  //
+iconvg_paint__palette_dependencies(const iconvg_paint* self);
+
 // ----
 
 // iconvg_matrix_2x3_f64__inverse returns self's inverse.
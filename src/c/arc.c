@@ -196,8 +196,18 @@ iconvg_private_path_arc_to(iconvg_canvas* c,
   // https://www.w3.org/TR/SVG/implnote.html#ArcConversionEndpointToCenter
   // algorithm. What follows below is specific to this implementation.
 
+  // Extreme (e.g. infinite) coordinates or radii can overflow the arithmetic
+  // above, producing NaNs. Fall back to a straight line. This also keeps the
+  // (int) conversion below well-defined, bounding n to at most 4.
+  if (!isfinite(cx) || !isfinite(cy) || !isfinite(theta1) ||
+      !isfinite(delta_theta)) {
+    return (*c->vtable->path_line_to)(c,                             //
+                                      (final_x * scale_x) + bias_x,  //
+                                      (final_y * scale_y) + bias_y);
+  }
+
   // We approximate an arc by one or more cubic Bézier curves.
-  int n = (int)(ceil(abs(delta_theta) / ((pi / 2) + 0.001)));
+  int n = (int)(ceil(fabs(delta_theta) / ((pi / 2) + 0.001)));
   double inv_n = 1.0 / ((double)n);
   for (int i = 0; i < n; i++) {
     ICONVG_PRIVATE_TRY(iconvg_private_path_arc_segment_to(
@@ -208,3 +218,77 @@ iconvg_private_path_arc_to(iconvg_canvas* c,
   }
   return NULL;
 }
+
+bool  //
+iconvg_private_arc_bounds(double* dst_bounds,
+                          float initial_x,
+                          float initial_y,
+                          float radius_x,
+                          float radius_y,
+                          float x_axis_rotation,
+                          bool large_arc,
+                          bool sweep,
+                          float final_x,
+                          float final_y) {
+  const double tau = 6.2831853071795864769252867665590057683943;  // τ = 2*π
+
+  // This follows steps 1, 2 and 3 of iconvg_private_path_arc_to.
+  double rx = fabs((double)radius_x);
+  double ry = fabs((double)radius_y);
+  if (!(rx > 0) || !(ry > 0)) {
+    return false;
+  }
+  double x1 = (double)initial_x;
+  double y1 = (double)initial_y;
+  double x2 = (double)final_x;
+  double y2 = (double)final_y;
+  double phi = tau * ((double)x_axis_rotation);
+
+  double half_dx = (x1 - x2) / 2;
+  double half_dy = (y1 - y2) / 2;
+  double cos_phi = cos(phi);
+  double sin_phi = sin(phi);
+  double x1_prime = +(cos_phi * half_dx) + (sin_phi * half_dy);
+  double y1_prime = -(sin_phi * half_dx) + (cos_phi * half_dy);
+
+  double rx_sq = rx * rx;
+  double ry_sq = ry * ry;
+  double x1_prime_sq = x1_prime * x1_prime;
+  double y1_prime_sq = y1_prime * y1_prime;
+  double radii_check = (x1_prime_sq / rx_sq) + (y1_prime_sq / ry_sq);
+  if (radii_check > 1) {
+    double s = sqrt(radii_check);
+    rx *= s;
+    ry *= s;
+    rx_sq = rx * rx;
+    ry_sq = ry * ry;
+  }
+
+  double denom = (rx_sq * y1_prime_sq) + (ry_sq * x1_prime_sq);
+  double step2 = 0.0;
+  double a = ((rx_sq * ry_sq) / denom) - 1.0;
+  if (a > 0.0) {
+    step2 = sqrt(a);
+  }
+  if (large_arc == sweep) {
+    step2 = -step2;
+  }
+  double cx_prime = +(step2 * rx * y1_prime) / ry;
+  double cy_prime = -(step2 * ry * x1_prime) / rx;
+
+  double cx = +(cos_phi * cx_prime) - (sin_phi * cy_prime) + ((x1 + x2) / 2);
+  double cy = +(sin_phi * cx_prime) + (cos_phi * cy_prime) + ((y1 + y2) / 2);
+
+  // The ellipse's axis-aligned bounding box is centered on (cx, cy), with
+  // half-width hw and half-height hh.
+  double hw = sqrt((rx_sq * cos_phi * cos_phi) + (ry_sq * sin_phi * sin_phi));
+  double hh = sqrt((rx_sq * sin_phi * sin_phi) + (ry_sq * cos_phi * cos_phi));
+  if (!isfinite(cx) || !isfinite(cy) || !isfinite(hw) || !isfinite(hh)) {
+    return false;
+  }
+  dst_bounds[0] = cx - hw;
+  dst_bounds[1] = cy - hh;
+  dst_bounds[2] = cx + hw;
+  dst_bounds[3] = cy + hh;
+  return true;
+}
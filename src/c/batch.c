@@ -0,0 +1,344 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// The containment canvas checks whether every path point (including control
+// points, whose convex hull contains the curve) lies within the rectangle
+// pointed to by context_nonconst_ptr0. That rectangle is set by begin_decode,
+// so that it accounts for any dst_transform. It stops the decode, returning
+// iconvg_private_batch_needs_clip, as soon as one does not.
+
+static const char iconvg_private_batch_needs_clip[] =  //
+    "iconvg: internal: batch item needs a clip";
+
+static inline const char*  //
+iconvg_private_containment_canvas__check(iconvg_canvas* c,
+                                         const float* xy,
+                                         size_t num_points) {
+  const iconvg_rectangle_f32* r =
+      (const iconvg_rectangle_f32*)(c->context_nonconst_ptr0);
+  for (size_t i = 0; i < num_points; i++) {
+    float x = xy[(2 * i) + 0];
+    float y = xy[(2 * i) + 1];
+    // Written so that NaNs need a clip.
+    if (!((r->min_x <= x) && (x <= r->max_x) &&  //
+          (r->min_y <= y) && (y <= r->max_y))) {
+      return iconvg_private_batch_needs_clip;
+    }
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__begin_decode(iconvg_canvas* c,
+                                                iconvg_rectangle_f32 dst_rect) {
+  *((iconvg_rectangle_f32*)(c->context_nonconst_ptr0)) = dst_rect;
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__end_decode(iconvg_canvas* c,
+                                              const char* err_msg,
+                                              size_t num_bytes_consumed,
+                                              size_t num_bytes_remaining) {
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__begin_drawing(iconvg_canvas* c) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__end_drawing(iconvg_canvas* c,
+                                               const iconvg_paint* p) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__begin_path(iconvg_canvas* c,
+                                              float x0,
+                                              float y0) {
+  float xy[2] = {x0, y0};
+  return iconvg_private_containment_canvas__check(c, xy, 1);
+}
+
+static const char*  //
+iconvg_private_containment_canvas__end_path(iconvg_canvas* c) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__path_line_to(iconvg_canvas* c,
+                                                float x1,
+                                                float y1) {
+  float xy[2] = {x1, y1};
+  return iconvg_private_containment_canvas__check(c, xy, 1);
+}
+
+static const char*  //
+iconvg_private_containment_canvas__path_quad_to(iconvg_canvas* c,
+                                                float x1,
+                                                float y1,
+                                                float x2,
+                                                float y2) {
+  float xy[4] = {x1, y1, x2, y2};
+  return iconvg_private_containment_canvas__check(c, xy, 2);
+}
+
+static const char*  //
+iconvg_private_containment_canvas__path_cube_to(iconvg_canvas* c,
+                                                float x1,
+                                                float y1,
+                                                float x2,
+                                                float y2,
+                                                float x3,
+                                                float y3) {
+  float xy[6] = {x1, y1, x2, y2, x3, y3};
+  return iconvg_private_containment_canvas__check(c, xy, 3);
+}
+
+static const char*  //
+iconvg_private_containment_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_containment_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  return NULL;
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_containment_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_containment_canvas__begin_decode,
+        &iconvg_private_containment_canvas__end_decode,
+        &iconvg_private_containment_canvas__begin_drawing,
+        &iconvg_private_containment_canvas__end_drawing,
+        &iconvg_private_containment_canvas__begin_path,
+        &iconvg_private_containment_canvas__end_path,
+        &iconvg_private_containment_canvas__path_line_to,
+        &iconvg_private_containment_canvas__path_quad_to,
+        &iconvg_private_containment_canvas__path_cube_to,
+        &iconvg_private_containment_canvas__on_metadata_viewbox,
+        &iconvg_private_containment_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// ----
+
+// The session canvas forwards every call to the iconvg_canvas pointed to by
+// context_nonconst_ptr0, other than begin_decode and end_decode. Those are
+// made once per iconvg_decode_batch call, not once per item.
+
+static const char*  //
+iconvg_private_session_canvas__begin_decode(iconvg_canvas* c,
+                                            iconvg_rectangle_f32 dst_rect) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_session_canvas__end_decode(iconvg_canvas* c,
+                                          const char* err_msg,
+                                          size_t num_bytes_consumed,
+                                          size_t num_bytes_remaining) {
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_session_canvas__begin_drawing(iconvg_canvas* c) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->begin_drawing)(w);
+}
+
+static const char*  //
+iconvg_private_session_canvas__end_drawing(iconvg_canvas* c,
+                                           const iconvg_paint* p) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->end_drawing)(w, p);
+}
+
+static const char*  //
+iconvg_private_session_canvas__begin_path(iconvg_canvas* c,
+                                          float x0,
+                                          float y0) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->begin_path)(w, x0, y0);
+}
+
+static const char*  //
+iconvg_private_session_canvas__end_path(iconvg_canvas* c) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->end_path)(w);
+}
+
+static const char*  //
+iconvg_private_session_canvas__path_line_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_line_to)(w, x1, y1);
+}
+
+static const char*  //
+iconvg_private_session_canvas__path_quad_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1,
+                                            float x2,
+                                            float y2) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_quad_to)(w, x1, y1, x2, y2);
+}
+
+static const char*  //
+iconvg_private_session_canvas__path_cube_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1,
+                                            float x2,
+                                            float y2,
+                                            float x3,
+                                            float y3) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_cube_to)(w, x1, y1, x2, y2, x3, y3);
+}
+
+static const char*  //
+iconvg_private_session_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->on_metadata_viewbox)(w, viewbox);
+}
+
+static const char*  //
+iconvg_private_session_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->on_metadata_suggested_palette)(w, suggested_palette);
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_session_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_session_canvas__begin_decode,
+        &iconvg_private_session_canvas__end_decode,
+        &iconvg_private_session_canvas__begin_drawing,
+        &iconvg_private_session_canvas__end_drawing,
+        &iconvg_private_session_canvas__begin_path,
+        &iconvg_private_session_canvas__end_path,
+        &iconvg_private_session_canvas__path_line_to,
+        &iconvg_private_session_canvas__path_quad_to,
+        &iconvg_private_session_canvas__path_cube_to,
+        &iconvg_private_session_canvas__on_metadata_viewbox,
+        &iconvg_private_session_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// ----
+
+const char*  //
+iconvg_decode_batch(iconvg_canvas* dst_canvas,
+                    const iconvg_batch_item* items,
+                    size_t num_items,
+                    const char** dst_err_msgs,
+                    const iconvg_decode_options* options) {
+  iconvg_canvas fallback_canvas = iconvg_make_broken_canvas(NULL);
+  if (!dst_canvas || !dst_canvas->vtable) {
+    dst_canvas = &fallback_canvas;
+  }
+  if (dst_canvas->vtable->sizeof__iconvg_canvas_vtable !=
+      sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  } else if (num_items == 0) {
+    return NULL;
+  } else if (!items) {
+    return iconvg_error_invalid_batch_argument;
+  }
+
+  const iconvg_matrix_2x3_f64* t =
+      iconvg_private_decode_options__dst_transform(options);
+  iconvg_rectangle_f32 union_rect;
+  for (size_t i = 0; i < num_items; i++) {
+    iconvg_rectangle_f32 r = items[i].dst_rect;
+    if (t && !iconvg_private_transform_rectangle(&r, t)) {
+      return iconvg_error_invalid_dst_transform;
+    } else if (i == 0) {
+      union_rect = r;
+      continue;
+    }
+    if (union_rect.min_x > r.min_x) {
+      union_rect.min_x = r.min_x;
+    }
+    if (union_rect.min_y > r.min_y) {
+      union_rect.min_y = r.min_y;
+    }
+    if (union_rect.max_x < r.max_x) {
+      union_rect.max_x = r.max_x;
+    }
+    if (union_rect.max_y < r.max_y) {
+      union_rect.max_y = r.max_y;
+    }
+  }
+
+  iconvg_canvas session_canvas;
+  session_canvas.vtable = &iconvg_private_session_canvas_vtable;
+  session_canvas.context_nonconst_ptr0 = dst_canvas;
+  session_canvas.context_nonconst_ptr1 = NULL;
+  session_canvas.context_const_ptr = NULL;
+  session_canvas.context_extra = 0;
+
+  const char* session_err_msg =
+      (*dst_canvas->vtable->begin_decode)(dst_canvas, union_rect);
+  const char* first_err_msg = NULL;
+  for (size_t i = 0; i < num_items; i++) {
+    const iconvg_batch_item* item = &items[i];
+    const char* err_msg = session_err_msg;
+    if (!err_msg) {
+      iconvg_rectangle_f32 containment_rect = item->dst_rect;
+      iconvg_canvas containment_canvas;
+      containment_canvas.vtable = &iconvg_private_containment_canvas_vtable;
+      containment_canvas.context_nonconst_ptr0 = &containment_rect;
+      containment_canvas.context_nonconst_ptr1 = NULL;
+      containment_canvas.context_const_ptr = NULL;
+      containment_canvas.context_extra = 0;
+
+      // If the containment check fails, for whatever reason, fall back to a
+      // nested (clipped) decode. It reports any file format error and paints
+      // whatever a stand-alone iconvg_decode call would.
+      iconvg_canvas* c = &session_canvas;
+      if (iconvg_decode(&containment_canvas, item->dst_rect, item->src_ptr,
+                        item->src_len, options)) {
+        c = dst_canvas;
+      }
+      err_msg = iconvg_decode(c, item->dst_rect, item->src_ptr, item->src_len,
+                              options);
+    }
+    if (dst_err_msgs) {
+      dst_err_msgs[i] = err_msg;
+    }
+    if (!first_err_msg) {
+      first_err_msg = err_msg;
+    }
+  }
+
+  session_err_msg =
+      (*dst_canvas->vtable->end_decode)(dst_canvas, session_err_msg, 0, 0);
+  return session_err_msg ? session_err_msg : first_err_msg;
+}
@@ -90,6 +90,14 @@ iconvg_private_broken_canvas__on_metadata_suggested_palette(
   return ((const char*)(c->context_const_ptr));
 }
 
+static const char*  //
+iconvg_private_broken_canvas__end_drawing_instances(iconvg_canvas* c,
+                                                    const iconvg_paint* p,
+                                                    const float* offsets_xy,
+                                                    size_t num_instances) {
+  return ((const char*)(c->context_const_ptr));
+}
+
 static const iconvg_canvas_vtable  //
     iconvg_private_broken_canvas_vtable = {
         sizeof(iconvg_canvas_vtable),
@@ -104,6 +112,7 @@ static const iconvg_canvas_vtable  //
         &iconvg_private_broken_canvas__path_cube_to,
         &iconvg_private_broken_canvas__on_metadata_viewbox,
         &iconvg_private_broken_canvas__on_metadata_suggested_palette,
+        &iconvg_private_broken_canvas__end_drawing_instances,
 };
 
 iconvg_canvas  //
@@ -0,0 +1,131 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+const char*  //
+iconvg_private_growable_buffer__reserve(iconvg_growable_buffer* b, size_t n) {
+  if (!b) {
+    return iconvg_error_invalid_buffer_too_small;
+  } else if ((b->cap - b->len) >= n) {
+    return NULL;
+  } else if (!b->grow) {
+    return iconvg_error_invalid_buffer_too_small;
+  }
+  ICONVG_PRIVATE_TRY((*b->grow)(b, n));
+  if ((b->cap - b->len) < n) {
+    return iconvg_error_invalid_buffer_too_small;
+  }
+  return NULL;
+}
+
+const char*  //
+iconvg_private_path_buffer__append(iconvg_growable_buffer* b,
+                                   uint8_t op,
+                                   const float* args,
+                                   size_t num_args) {
+  size_t n = 1 + (num_args * sizeof(float));
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(b, n));
+  uint8_t* q = b->ptr + b->len;
+  *q++ = op;
+  if (num_args > 0) {
+    memcpy(q, args, num_args * sizeof(float));
+  }
+  b->len += n;
+  return NULL;
+}
+
+const char*  //
+iconvg_private_path_buffer__replay(const uint8_t* ptr,
+                                   size_t len,
+                                   iconvg_canvas* c,
+                                   float dx,
+                                   float dy) {
+  const uint8_t* q = ptr;
+  const uint8_t* q_end = ptr + len;
+  float a[6];
+  while (q < q_end) {
+    uint8_t op = *q++;
+    size_t num_args = 0;
+    switch (op) {
+      case ICONVG_PRIVATE_PATH_OP__BEGIN_PATH:
+      case ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO:
+        num_args = 2;
+        break;
+      case ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO:
+        num_args = 4;
+        break;
+      case ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO:
+        num_args = 6;
+        break;
+    }
+    memcpy(a, q, num_args * sizeof(float));
+    q += num_args * sizeof(float);
+    for (size_t i = 0; i < num_args; i += 2) {
+      a[i + 0] += dx;
+      a[i + 1] += dy;
+    }
+
+    switch (op) {
+      case ICONVG_PRIVATE_PATH_OP__BEGIN_PATH:
+        ICONVG_PRIVATE_TRY((*c->vtable->begin_path)(c, a[0], a[1]));
+        break;
+      case ICONVG_PRIVATE_PATH_OP__END_PATH:
+        ICONVG_PRIVATE_TRY((*c->vtable->end_path)(c));
+        break;
+      case ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO:
+        ICONVG_PRIVATE_TRY((*c->vtable->path_line_to)(c, a[0], a[1]));
+        break;
+      case ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO:
+        ICONVG_PRIVATE_TRY(
+            (*c->vtable->path_quad_to)(c, a[0], a[1], a[2], a[3]));
+        break;
+      case ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO:
+        ICONVG_PRIVATE_TRY((*c->vtable->path_cube_to)(c, a[0], a[1], a[2],
+                                                      a[3], a[4], a[5]));
+        break;
+      default:
+        return iconvg_private_internal_error_unreachable;
+    }
+  }
+  return NULL;
+}
+
+// ----
+
+const char*  //
+iconvg_growable_buffer__realloc_grow(iconvg_growable_buffer* self,
+                                     size_t min_additional) {
+  if (!self) {
+    return iconvg_error_invalid_buffer_too_small;
+  } else if (min_additional > (SIZE_MAX - self->len)) {
+    return iconvg_error_system_failure_out_of_memory;
+  }
+  size_t new_cap = self->len + min_additional;
+  // Grow geometrically, so that appending N bytes one at a time takes O(N)
+  // time overall instead of O(N*N).
+  if ((self->cap <= (SIZE_MAX / 2)) && (new_cap < (2 * self->cap))) {
+    new_cap = 2 * self->cap;
+  }
+  if (new_cap < 256) {
+    new_cap = 256;
+  }
+  uint8_t* new_ptr = (uint8_t*)realloc(self->ptr, new_cap);
+  if (!new_ptr) {
+    return iconvg_error_system_failure_out_of_memory;
+  }
+  self->ptr = new_ptr;
+  self->cap = new_cap;
+  return NULL;
+}
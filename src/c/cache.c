@@ -0,0 +1,426 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// A raster cache region is laid out as a 64 byte header, an index of
+// num_slots 16 byte slots and then a log (a ring buffer) of entries. All
+// numbers are little-endian.
+//
+// The header is the 8 byte magic, the u64 region length, the u32 num_slots
+// (a power of 2, at least 4), 4 reserved bytes, the u64 log offset, the u64
+// log length and the u64 write position, then 16 reserved bytes. Positions
+// count bytes appended to the log since it was formatted. Position p is at
+// byte offset (p % log_length) of the log.
+//
+// Each slot is a u64 tag (a hash of the key, zero meaning an empty slot) and
+// a u64 one-plus-position (zero meaning an empty slot). A key's slots are the
+// 4 consecutive slots starting at (tag & (num_slots - 4)).
+//
+// Each entry is an 80 byte entry header and then the pixels, tightly packed,
+// padded to a multiple of 16 bytes. The entry header is the u64 position
+// (echoed, so that a stale slot can be detected), the u64 entry length, the
+// key (u64 src_hash, u64 palette_hash, u32 width, u32 height, u32 backend,
+// u32 bytes_per_pixel, u8 subpixel_x, u8 subpixel_y, 2 reserved bytes, then
+// the f32 bits of content_width and of content_height), 12 reserved bytes and
+// then the u64 checksum of the first 72 bytes and the pixels. An entry never
+// straddles the end of the log.
+//
+// The writer advances the write position before over-writing older entries
+// and updates the slot last. Readers do not lock. They re-check the write
+// position after copying the pixels out and verify the checksum, so that an
+// entry that was being over-written (or not yet completely written) is
+// reported as a miss instead of as a hit with torn pixels.
+
+static const uint8_t iconvg_private_raster_cache_magic[8] = {
+    0x8A, 0x49, 0x56, 0x47, 0x52, 0x63, 0x68, 0x03,  // "\x8AIVGRch\x03".
+};
+
+#define ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE 64
+#define ICONVG_PRIVATE_RASTER_CACHE_SLOT_SIZE 16
+#define ICONVG_PRIVATE_RASTER_CACHE_ENTRY_HEADER_SIZE 80
+
+// Make one slot per 1 KiB of region, so that the index is less than 2% of the
+// region. Icons are often small, so their entries are too.
+#define ICONVG_PRIVATE_RASTER_CACHE_BYTES_PER_SLOT 1024
+
+#define ICONVG_PRIVATE_RASTER_CACHE_MIN_LOG_LENGTH 4096
+
+static inline uint64_t  //
+iconvg_private_raster_cache__hash(uint64_t h, const uint8_t* ptr, size_t len) {
+  // This is FNV-1a, over 8 byte words (and then over any trailing bytes)
+  // instead of single bytes.
+  for (; len >= 8; ptr += 8, len -= 8) {
+    h ^= iconvg_private_peek_u64le(ptr);
+    h *= 0x00000100000001B3ull;
+  }
+  for (; len > 0; ptr++, len--) {
+    h ^= *ptr;
+    h *= 0x00000100000001B3ull;
+  }
+  return h;
+}
+
+static inline uint64_t  //
+iconvg_private_raster_cache_key__tag(const iconvg_raster_cache_key* key) {
+  uint8_t b[42];
+  iconvg_private_poke_u64le(&b[0], key->src_hash);
+  iconvg_private_poke_u64le(&b[8], key->palette_hash);
+  iconvg_private_poke_u32le(&b[16], key->width);
+  iconvg_private_poke_u32le(&b[20], key->height);
+  iconvg_private_poke_u32le(&b[24], key->backend);
+  iconvg_private_poke_u32le(&b[28], key->bytes_per_pixel);
+  b[32] = key->subpixel_x;
+  b[33] = key->subpixel_y;
+  iconvg_private_poke_u32le(
+      &b[34], iconvg_private_reinterpret_from_f32_to_u32(key->content_width));
+  iconvg_private_poke_u32le(
+      &b[38], iconvg_private_reinterpret_from_f32_to_u32(key->content_height));
+  uint64_t h = iconvg_raster_cache_hash(&b[0], 42);
+  return h ? h : 1;
+}
+
+// iconvg_private_raster_cache_key__entry_length returns the entry length (a
+// multiple of 16) for key's pixels, or zero if key is invalid or too large.
+static inline uint64_t  //
+iconvg_private_raster_cache_key__entry_length(
+    const iconvg_raster_cache_key* key) {
+  if ((key->width == 0) || (key->height == 0) ||
+      ((key->bytes_per_pixel != 1) && (key->bytes_per_pixel != 4))) {
+    return 0;
+  }
+  uint64_t n = ((uint64_t)(key->width)) * ((uint64_t)(key->height));
+  if (n > (UINT64_MAX / 8)) {
+    return 0;
+  }
+  n *= key->bytes_per_pixel;
+  n += ICONVG_PRIVATE_RASTER_CACHE_ENTRY_HEADER_SIZE + 15;
+  return n & ~((uint64_t)15);
+}
+
+// iconvg_private_raster_cache__fits returns whether a buffer of length len
+// holds height rows of row_length bytes, each row starting stride bytes after
+// the previous one.
+static inline bool  //
+iconvg_private_raster_cache__fits(size_t len,
+                                  size_t stride,
+                                  size_t row_length,
+                                  uint32_t height) {
+  return (stride >= row_length) && (len >= row_length) &&
+         ((height - 1) <= ((len - row_length) / stride));
+}
+
+// iconvg_private_raster_cache__is_valid returns whether self's header is
+// valid, setting *num_slots, *log_offset and *log_length if so.
+static bool  //
+iconvg_private_raster_cache__is_valid(const iconvg_raster_cache* self,
+                                      uint32_t* num_slots,
+                                      uint64_t* log_offset,
+                                      uint64_t* log_length) {
+  if (!self || !self->ptr ||
+      (self->len < ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE) ||
+      memcmp(self->ptr, iconvg_private_raster_cache_magic, 8) ||
+      (iconvg_private_peek_u64le(self->ptr + 8) != self->len)) {
+    return false;
+  }
+  uint32_t n = iconvg_private_peek_u32le(self->ptr + 16);
+  uint64_t o = iconvg_private_peek_u64le(self->ptr + 24);
+  uint64_t l = iconvg_private_peek_u64le(self->ptr + 32);
+  if ((n < 4) || (n & (n - 1)) ||
+      (o != (ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE +
+             (((uint64_t)n) * ICONVG_PRIVATE_RASTER_CACHE_SLOT_SIZE))) ||
+      (l == 0) || (l & 15) || (o > self->len) || (l > (self->len - o))) {
+    return false;
+  }
+  *num_slots = n;
+  *log_offset = o;
+  *log_length = l;
+  return true;
+}
+
+// iconvg_private_place_subpixel__axis quantizes one axis of
+// iconvg_place_subpixel. min and max have already been checked to be finite,
+// ordered and not too far from the origin.
+static void  //
+iconvg_private_place_subpixel__axis(int32_t* dst_whole,
+                                    uint8_t* dst_subpixel,
+                                    uint32_t* dst_size,
+                                    float* dst_content_size,
+                                    float* dst_min,
+                                    float* dst_max,
+                                    float min,
+                                    float max,
+                                    uint32_t num_phases) {
+  // Round to the nearest phase, carrying into the whole pixel part when that
+  // rounds up to the next pixel.
+  double whole = floor((double)min);
+  uint32_t phase =
+      (uint32_t)(((((double)min) - whole) * ((double)num_phases)) + 0.5);
+  if (phase >= num_phases) {
+    phase = 0;
+    whole += 1.0;
+  }
+  uint32_t subpixel = (phase * 256) / num_phases;
+  float offset = ((float)subpixel) / 256.0f;
+  float size = max - min;
+
+  *dst_whole = (int32_t)whole;
+  *dst_subpixel = (uint8_t)subpixel;
+  *dst_size = (uint32_t)ceil((double)offset + (double)size);
+  *dst_content_size = size;
+  *dst_min = offset;
+  *dst_max = offset + size;
+}
+
+// ----
+
+uint64_t  //
+iconvg_raster_cache_hash(const uint8_t* ptr, size_t len) {
+  return iconvg_private_raster_cache__hash(0xCBF29CE484222325ull,
+                                           ptr ? ptr : (const uint8_t*)"",
+                                           ptr ? len : 0);
+}
+
+const char*  //
+iconvg_place_subpixel(iconvg_subpixel_placement* dst_placement,
+                      iconvg_rectangle_f32 dst_rect,
+                      uint32_t num_phases_x,
+                      uint32_t num_phases_y) {
+  // The 0x1p30 bound keeps every whole pixel position and size within an
+  // int32_t.
+  const float limit = 1073741824.0f;
+  if (!dst_placement ||
+      !iconvg_rectangle_f32__is_finite_and_not_empty(&dst_rect) ||
+      !(dst_rect.min_x >= -limit) || !(dst_rect.max_x <= +limit) ||
+      !(dst_rect.min_y >= -limit) || !(dst_rect.max_y <= +limit) ||
+      (num_phases_x < 1) || (num_phases_x > 256) ||  //
+      (num_phases_y < 1) || (num_phases_y > 256)) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+  iconvg_subpixel_placement* p = dst_placement;
+  iconvg_private_place_subpixel__axis(
+      &p->dst_x, &p->subpixel_x, &p->width, &p->content_width,
+      &p->dst_rect.min_x, &p->dst_rect.max_x, dst_rect.min_x, dst_rect.max_x,
+      num_phases_x);
+  iconvg_private_place_subpixel__axis(
+      &p->dst_y, &p->subpixel_y, &p->height, &p->content_height,
+      &p->dst_rect.min_y, &p->dst_rect.max_y, dst_rect.min_y, dst_rect.max_y,
+      num_phases_y);
+  return NULL;
+}
+
+const char*  //
+iconvg_raster_cache__open_for_writing(iconvg_raster_cache* self) {
+  if (!self || !self->ptr) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+  uint32_t num_slots;
+  uint64_t log_offset;
+  uint64_t log_length;
+  if (iconvg_private_raster_cache__is_valid(self, &num_slots, &log_offset,
+                                            &log_length)) {
+    return NULL;
+  }
+
+  uint64_t n = self->len / ICONVG_PRIVATE_RASTER_CACHE_BYTES_PER_SLOT;
+  num_slots = 4;
+  while ((num_slots < 0x40000000) && ((num_slots * 2) <= n)) {
+    num_slots *= 2;
+  }
+  log_offset = ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE +
+               (((uint64_t)num_slots) * ICONVG_PRIVATE_RASTER_CACHE_SLOT_SIZE);
+  if (self->len < (log_offset + ICONVG_PRIVATE_RASTER_CACHE_MIN_LOG_LENGTH)) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+  log_length = (self->len - log_offset) & ~((uint64_t)15);
+
+  // Write the magic last, so that a concurrent reader does not see a
+  // partially formatted region as valid.
+  memset(self->ptr, 0, (size_t)log_offset);
+  iconvg_private_poke_u64le(self->ptr + 8, self->len);
+  iconvg_private_poke_u32le(self->ptr + 16, num_slots);
+  iconvg_private_poke_u64le(self->ptr + 24, log_offset);
+  iconvg_private_poke_u64le(self->ptr + 32, log_length);
+  iconvg_private_poke_u64le(self->ptr + 40, 0);
+  memcpy(self->ptr, iconvg_private_raster_cache_magic, 8);
+  return NULL;
+}
+
+bool  //
+iconvg_raster_cache__lookup(const iconvg_raster_cache* self,
+                            const iconvg_raster_cache_key* key,
+                            uint8_t* dst_ptr,
+                            size_t dst_len,
+                            size_t dst_stride) {
+  uint32_t num_slots;
+  uint64_t log_offset;
+  uint64_t log_length;
+  if (!key || !dst_ptr ||
+      !iconvg_private_raster_cache__is_valid(self, &num_slots, &log_offset,
+                                             &log_length)) {
+    return false;
+  }
+  // The entry length is at most the log length, which is less than self->len,
+  // so row_length cannot overflow.
+  uint64_t entry_length = iconvg_private_raster_cache_key__entry_length(key);
+  if ((entry_length == 0) || (entry_length > log_length)) {
+    return false;
+  }
+  size_t row_length = ((size_t)(key->width)) * key->bytes_per_pixel;
+  if (!iconvg_private_raster_cache__fits(dst_len, dst_stride, row_length,
+                                         key->height)) {
+    return false;
+  }
+
+  uint64_t tag = iconvg_private_raster_cache_key__tag(key);
+  const uint8_t* slots = self->ptr + ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE;
+  uint32_t s0 = ((uint32_t)tag) & (num_slots - 4);
+  for (uint32_t s = s0; s < (s0 + 4); s++) {
+    const uint8_t* slot = slots + (s * ICONVG_PRIVATE_RASTER_CACHE_SLOT_SIZE);
+    uint64_t pos = iconvg_private_peek_u64le(slot + 8) - 1;
+    if ((iconvg_private_peek_u64le(slot + 0) != tag) || (pos == UINT64_MAX)) {
+      continue;
+    }
+    uint64_t write_pos = iconvg_private_peek_u64le(self->ptr + 40);
+    if ((pos >= write_pos) || ((write_pos - pos) > log_length) ||
+        ((log_length - (pos % log_length)) < entry_length)) {
+      continue;
+    }
+
+    const uint8_t* e = self->ptr + log_offset + (pos % log_length);
+    if ((iconvg_private_peek_u64le(e + 0) != pos) ||
+        (iconvg_private_peek_u64le(e + 8) != entry_length) ||
+        (iconvg_private_peek_u64le(e + 16) != key->src_hash) ||
+        (iconvg_private_peek_u64le(e + 24) != key->palette_hash) ||
+        (iconvg_private_peek_u32le(e + 32) != key->width) ||
+        (iconvg_private_peek_u32le(e + 36) != key->height) ||
+        (iconvg_private_peek_u32le(e + 40) != key->backend) ||
+        (iconvg_private_peek_u32le(e + 44) != key->bytes_per_pixel) ||
+        (e[48] != key->subpixel_x) || (e[49] != key->subpixel_y) ||
+        (iconvg_private_peek_u32le(e + 52) !=
+         iconvg_private_reinterpret_from_f32_to_u32(key->content_width)) ||
+        (iconvg_private_peek_u32le(e + 56) !=
+         iconvg_private_reinterpret_from_f32_to_u32(key->content_height))) {
+      continue;
+    }
+    uint64_t checksum = iconvg_private_peek_u64le(e + 72);
+
+    // Copy the pixels out, then check that what was copied is what was
+    // written and that it was not over-written in the meantime.
+    uint64_t h = iconvg_raster_cache_hash(e, 72);
+    const uint8_t* src = e + ICONVG_PRIVATE_RASTER_CACHE_ENTRY_HEADER_SIZE;
+    uint8_t* dst = dst_ptr;
+    for (uint32_t y = 0; y < key->height; y++) {
+      memcpy(dst, src, row_length);
+      h = iconvg_private_raster_cache__hash(h, dst, row_length);
+      src += row_length;
+      dst += dst_stride;
+    }
+    write_pos = iconvg_private_peek_u64le(self->ptr + 40);
+    if ((h == checksum) && ((write_pos - pos) <= log_length)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const char*  //
+iconvg_raster_cache__insert(iconvg_raster_cache* self,
+                            const iconvg_raster_cache_key* key,
+                            const uint8_t* src_ptr,
+                            size_t src_len,
+                            size_t src_stride) {
+  uint32_t num_slots;
+  uint64_t log_offset;
+  uint64_t log_length;
+  if (!key || !src_ptr ||
+      !iconvg_private_raster_cache__is_valid(self, &num_slots, &log_offset,
+                                             &log_length)) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+  uint64_t entry_length = iconvg_private_raster_cache_key__entry_length(key);
+  if ((entry_length == 0) || (entry_length > log_length)) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+  size_t row_length = ((size_t)(key->width)) * key->bytes_per_pixel;
+  if (!iconvg_private_raster_cache__fits(src_len, src_stride, row_length,
+                                         key->height)) {
+    return iconvg_error_invalid_raster_cache_argument;
+  }
+
+  // Reserve room in the log, skipping any tail that is too short. Advancing
+  // the write position first marks any older entries in that room as stale.
+  uint64_t pos = iconvg_private_peek_u64le(self->ptr + 40);
+  uint64_t offset = pos % log_length;
+  if ((log_length - offset) < entry_length) {
+    pos += log_length - offset;
+    offset = 0;
+  }
+  iconvg_private_poke_u64le(self->ptr + 40, pos + entry_length);
+
+  uint8_t* e = self->ptr + log_offset + offset;
+  iconvg_private_poke_u64le(e + 0, pos);
+  iconvg_private_poke_u64le(e + 8, entry_length);
+  iconvg_private_poke_u64le(e + 16, key->src_hash);
+  iconvg_private_poke_u64le(e + 24, key->palette_hash);
+  iconvg_private_poke_u32le(e + 32, key->width);
+  iconvg_private_poke_u32le(e + 36, key->height);
+  iconvg_private_poke_u32le(e + 40, key->backend);
+  iconvg_private_poke_u32le(e + 44, key->bytes_per_pixel);
+  e[48] = key->subpixel_x;
+  e[49] = key->subpixel_y;
+  memset(e + 50, 0, 2);
+  iconvg_private_poke_u32le(
+      e + 52, iconvg_private_reinterpret_from_f32_to_u32(key->content_width));
+  iconvg_private_poke_u32le(
+      e + 56, iconvg_private_reinterpret_from_f32_to_u32(key->content_height));
+  memset(e + 60, 0, 12);
+  uint64_t h = iconvg_raster_cache_hash(e, 72);
+  uint8_t* dst = e + ICONVG_PRIVATE_RASTER_CACHE_ENTRY_HEADER_SIZE;
+  const uint8_t* src = src_ptr;
+  for (uint32_t y = 0; y < key->height; y++) {
+    memcpy(dst, src, row_length);
+    h = iconvg_private_raster_cache__hash(h, dst, row_length);
+    src += src_stride;
+    dst += row_length;
+  }
+  iconvg_private_poke_u64le(e + 72, h);
+
+  // Pick a slot: one with the same tag, an empty or stale one or, failing
+  // that, the one with the oldest entry.
+  uint64_t tag = iconvg_private_raster_cache_key__tag(key);
+  uint8_t* slots = self->ptr + ICONVG_PRIVATE_RASTER_CACHE_HEADER_SIZE;
+  uint32_t s0 = ((uint32_t)tag) & (num_slots - 4);
+  uint8_t* slot = NULL;
+  uint64_t oldest = UINT64_MAX;
+  for (uint32_t s = s0; s < (s0 + 4); s++) {
+    uint8_t* t = slots + (s * ICONVG_PRIVATE_RASTER_CACHE_SLOT_SIZE);
+    uint64_t one_plus_pos = iconvg_private_peek_u64le(t + 8);
+    if (iconvg_private_peek_u64le(t + 0) == tag) {
+      slot = t;
+      break;
+    } else if ((one_plus_pos == 0) ||
+               ((pos + entry_length - (one_plus_pos - 1)) > log_length)) {
+      one_plus_pos = 0;
+    }
+    if (oldest > one_plus_pos) {
+      oldest = one_plus_pos;
+      slot = t;
+    }
+  }
+  iconvg_private_poke_u64le(slot + 0, 0);
+  iconvg_private_poke_u64le(slot + 8, pos + 1);
+  iconvg_private_poke_u64le(slot + 0, tag);
+  return NULL;
+}
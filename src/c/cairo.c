@@ -174,9 +174,43 @@ iconvg_private_cairo_canvas__begin_drawing(iconvg_canvas* c) {
   return NULL;
 }
 
+// iconvg_private_cairo_fill fills the current path with the current source,
+// once or, if offsets_xy is non-NULL, once per instance under a translation.
+// Cairo locks a source pattern to the user space in effect when it is set, so
+// the source is re-set after each translation, moving gradients with paths.
 static const char*  //
-iconvg_private_cairo_canvas__end_drawing(iconvg_canvas* c,
-                                         const iconvg_paint* p) {
+iconvg_private_cairo_fill(cairo_t* cr,
+                          const float* offsets_xy,
+                          size_t num_instances) {
+  if (!offsets_xy) {
+    cairo_fill(cr);
+    return NULL;
+  }
+  cairo_path_t* path = cairo_copy_path(cr);
+  cairo_new_path(cr);
+  if (path->status != CAIRO_STATUS_SUCCESS) {
+    cairo_path_destroy(path);
+    return iconvg_error_system_failure_out_of_memory;
+  }
+  cairo_pattern_t* source = cairo_pattern_reference(cairo_get_source(cr));
+  for (size_t i = 0; i < num_instances; i++) {
+    cairo_save(cr);
+    cairo_translate(cr, offsets_xy[(2 * i) + 0], offsets_xy[(2 * i) + 1]);
+    cairo_append_path(cr, path);
+    cairo_set_source(cr, source);
+    cairo_fill(cr);
+    cairo_restore(cr);
+  }
+  cairo_pattern_destroy(source);
+  cairo_path_destroy(path);
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_cairo_canvas__draw(iconvg_canvas* c,
+                                  const iconvg_paint* p,
+                                  const float* offsets_xy,
+                                  size_t num_instances) {
   cairo_t* cr = (cairo_t*)(c->context_nonconst_ptr0);
   cairo_pattern_t* cp = NULL;
   cairo_matrix_t cm = {0};
@@ -186,8 +220,7 @@ iconvg_private_cairo_canvas__end_drawing(iconvg_canvas* c,
       iconvg_nonpremul_color k = iconvg_paint__flat_color_as_nonpremul_color(p);
       cairo_set_source_rgba(cr, k.rgba[0] / 255.0, k.rgba[1] / 255.0,
                             k.rgba[2] / 255.0, k.rgba[3] / 255.0);
-      cairo_fill(cr);
-      return NULL;
+      return iconvg_private_cairo_fill(cr, offsets_xy, num_instances);
     }
 
     case ICONVG_PAINT_TYPE__LINEAR_GRADIENT: {
@@ -224,9 +257,24 @@ iconvg_private_cairo_canvas__end_drawing(iconvg_canvas* c,
     cairo_set_source_rgba(cr, 0.75, 0.25, 0.75, 0.5);
   }
 
-  cairo_fill(cr);
+  const char* err_msg =
+      iconvg_private_cairo_fill(cr, offsets_xy, num_instances);
   cairo_pattern_destroy(cp);
-  return NULL;
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_cairo_canvas__end_drawing(iconvg_canvas* c,
+                                         const iconvg_paint* p) {
+  return iconvg_private_cairo_canvas__draw(c, p, NULL, 0);
+}
+
+static const char*  //
+iconvg_private_cairo_canvas__end_drawing_instances(iconvg_canvas* c,
+                                                   const iconvg_paint* p,
+                                                   const float* offsets_xy,
+                                                   size_t num_instances) {
+  return iconvg_private_cairo_canvas__draw(c, p, offsets_xy, num_instances);
 }
 
 static const char*  //
@@ -322,6 +370,7 @@ static const iconvg_canvas_vtable  //
         &iconvg_private_cairo_canvas__path_cube_to,
         &iconvg_private_cairo_canvas__on_metadata_viewbox,
         &iconvg_private_cairo_canvas__on_metadata_suggested_palette,
+        &iconvg_private_cairo_canvas__end_drawing_instances,
 };
 
 iconvg_canvas  //
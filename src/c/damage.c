@@ -0,0 +1,327 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// The damage recording canvas records, for each drawing, what it looks like
+// (its paint snapshot and its dst-space path) and the path's pixel bounding
+// box. context_nonconst_ptr0 points to an iconvg_private_damage_recording.
+// Two recordings can then be compared drawing by drawing.
+
+typedef struct iconvg_private_damage_drawing_struct {
+  // data_begin and data_end bound this drawing's bytes in the recording's
+  // data buffer: its path records followed by its iconvg_paint_snapshot.
+  size_t data_begin;
+  size_t data_end;
+
+  // The bounding box of the path's points (including control points), rounded
+  // outwards to whole pixels.
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+} iconvg_private_damage_drawing;
+
+typedef struct iconvg_private_damage_recording_struct {
+  // drawings holds an array of iconvg_private_damage_drawing elements.
+  iconvg_growable_buffer drawings;
+  iconvg_growable_buffer data;
+
+  // clip_rect is the dst_rect passed to begin_decode.
+  iconvg_rectangle_f32 clip_rect;
+
+  // The current drawing's data_begin and (unrounded) bounding box.
+  size_t data_begin;
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+} iconvg_private_damage_recording;
+
+static const char*  //
+iconvg_private_damage_canvas__add_points(iconvg_canvas* c,
+                                         const float* xy,
+                                         size_t num_points,
+                                         uint8_t op) {
+  iconvg_private_damage_recording* r =
+      (iconvg_private_damage_recording*)(c->context_nonconst_ptr0);
+  for (size_t i = 0; i < num_points; i++) {
+    float x = xy[(2 * i) + 0];
+    float y = xy[(2 * i) + 1];
+    r->min_x = (r->min_x < x) ? r->min_x : x;
+    r->min_y = (r->min_y < y) ? r->min_y : y;
+    r->max_x = (r->max_x > x) ? r->max_x : x;
+    r->max_y = (r->max_y > y) ? r->max_y : y;
+  }
+  return iconvg_private_path_buffer__append(&r->data, op, xy, 2 * num_points);
+}
+
+static const char*  //
+iconvg_private_damage_canvas__begin_decode(iconvg_canvas* c,
+                                           iconvg_rectangle_f32 dst_rect) {
+  iconvg_private_damage_recording* r =
+      (iconvg_private_damage_recording*)(c->context_nonconst_ptr0);
+  r->clip_rect = dst_rect;
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_damage_canvas__end_decode(iconvg_canvas* c,
+                                         const char* err_msg,
+                                         size_t num_bytes_consumed,
+                                         size_t num_bytes_remaining) {
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_damage_canvas__begin_drawing(iconvg_canvas* c) {
+  iconvg_private_damage_recording* r =
+      (iconvg_private_damage_recording*)(c->context_nonconst_ptr0);
+  r->data_begin = r->data.len;
+  r->min_x = +INFINITY;
+  r->min_y = +INFINITY;
+  r->max_x = -INFINITY;
+  r->max_y = -INFINITY;
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_damage_canvas__end_drawing(iconvg_canvas* c,
+                                          const iconvg_paint* p) {
+  iconvg_private_damage_recording* r =
+      (iconvg_private_damage_recording*)(c->context_nonconst_ptr0);
+
+  iconvg_paint_snapshot snapshot;
+  size_t n = iconvg_paint__snapshot(p, &snapshot);
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(&r->data, n));
+  memcpy(r->data.ptr + r->data.len, &snapshot, n);
+  r->data.len += n;
+
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(
+      &r->drawings, sizeof(iconvg_private_damage_drawing)));
+  iconvg_private_damage_drawing* d =
+      (iconvg_private_damage_drawing*)(r->drawings.ptr + r->drawings.len);
+  r->drawings.len += sizeof(iconvg_private_damage_drawing);
+
+  d->data_begin = r->data_begin;
+  d->data_end = r->data.len;
+  // Anti-aliasing touches every pixel that the path's bounding box touches.
+  // This assumes that dst coordinate space units are pixels.
+  d->min_x = floorf(r->min_x);
+  d->min_y = floorf(r->min_y);
+  d->max_x = ceilf(r->max_x);
+  d->max_y = ceilf(r->max_y);
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_damage_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  float xy[2] = {x0, y0};
+  return iconvg_private_damage_canvas__add_points(
+      c, xy, 1, ICONVG_PRIVATE_PATH_OP__BEGIN_PATH);
+}
+
+static const char*  //
+iconvg_private_damage_canvas__end_path(iconvg_canvas* c) {
+  return iconvg_private_damage_canvas__add_points(
+      c, NULL, 0, ICONVG_PRIVATE_PATH_OP__END_PATH);
+}
+
+static const char*  //
+iconvg_private_damage_canvas__path_line_to(iconvg_canvas* c,
+                                           float x1,
+                                           float y1) {
+  float xy[2] = {x1, y1};
+  return iconvg_private_damage_canvas__add_points(
+      c, xy, 1, ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO);
+}
+
+static const char*  //
+iconvg_private_damage_canvas__path_quad_to(iconvg_canvas* c,
+                                           float x1,
+                                           float y1,
+                                           float x2,
+                                           float y2) {
+  float xy[4] = {x1, y1, x2, y2};
+  return iconvg_private_damage_canvas__add_points(
+      c, xy, 2, ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO);
+}
+
+static const char*  //
+iconvg_private_damage_canvas__path_cube_to(iconvg_canvas* c,
+                                           float x1,
+                                           float y1,
+                                           float x2,
+                                           float y2,
+                                           float x3,
+                                           float y3) {
+  float xy[6] = {x1, y1, x2, y2, x3, y3};
+  return iconvg_private_damage_canvas__add_points(
+      c, xy, 3, ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO);
+}
+
+static const char*  //
+iconvg_private_damage_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_damage_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  return NULL;
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_damage_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_damage_canvas__begin_decode,
+        &iconvg_private_damage_canvas__end_decode,
+        &iconvg_private_damage_canvas__begin_drawing,
+        &iconvg_private_damage_canvas__end_drawing,
+        &iconvg_private_damage_canvas__begin_path,
+        &iconvg_private_damage_canvas__end_path,
+        &iconvg_private_damage_canvas__path_line_to,
+        &iconvg_private_damage_canvas__path_quad_to,
+        &iconvg_private_damage_canvas__path_cube_to,
+        &iconvg_private_damage_canvas__on_metadata_viewbox,
+        &iconvg_private_damage_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// ----
+
+static const char*  //
+iconvg_private_damage_recording__record(iconvg_private_damage_recording* r,
+                                        iconvg_rectangle_f32 dst_rect,
+                                        const uint8_t* src_ptr,
+                                        size_t src_len,
+                                        const iconvg_decode_options* options) {
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_damage_canvas_vtable;
+  c.context_nonconst_ptr0 = r;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+  return iconvg_decode(&c, dst_rect, src_ptr, src_len, options);
+}
+
+static inline bool  //
+iconvg_private_damage_recording__same(const iconvg_private_damage_recording* a,
+                                      size_t i,
+                                      const iconvg_private_damage_recording* b,
+                                      size_t j) {
+  const iconvg_private_damage_drawing* da =
+      ((const iconvg_private_damage_drawing*)(a->drawings.ptr)) + i;
+  const iconvg_private_damage_drawing* db =
+      ((const iconvg_private_damage_drawing*)(b->drawings.ptr)) + j;
+  size_t n = da->data_end - da->data_begin;
+  return (n == (db->data_end - db->data_begin)) &&
+         !memcmp(a->data.ptr + da->data_begin, b->data.ptr + db->data_begin, n);
+}
+
+// iconvg_private_damage_recording__add_to sets *dst to its union with the
+// bounding boxes of r's drawings in the range [i, j).
+static void  //
+iconvg_private_damage_recording__add_to(
+    iconvg_rectangle_f32* dst,
+    const iconvg_private_damage_recording* r,
+    size_t i,
+    size_t j) {
+  const iconvg_private_damage_drawing* d =
+      (const iconvg_private_damage_drawing*)(r->drawings.ptr);
+  for (; i < j; i++) {
+    dst->min_x = (dst->min_x < d[i].min_x) ? dst->min_x : d[i].min_x;
+    dst->min_y = (dst->min_y < d[i].min_y) ? dst->min_y : d[i].min_y;
+    dst->max_x = (dst->max_x > d[i].max_x) ? dst->max_x : d[i].max_x;
+    dst->max_y = (dst->max_y > d[i].max_y) ? dst->max_y : d[i].max_y;
+  }
+}
+
+const char*  //
+iconvg_decode_damage(iconvg_rectangle_f32* dst_damage,
+                     iconvg_rectangle_f32 dst_rect,
+                     const uint8_t* old_src_ptr,
+                     size_t old_src_len,
+                     const uint8_t* new_src_ptr,
+                     size_t new_src_len,
+                     const iconvg_decode_options* options) {
+  if (!dst_damage) {
+    return iconvg_error_invalid_damage_argument;
+  }
+
+  iconvg_private_damage_recording r[2];
+  memset(&r[0], 0, sizeof(r));
+  for (int i = 0; i < 2; i++) {
+    r[i].drawings.grow = &iconvg_growable_buffer__realloc_grow;
+    r[i].data.grow = &iconvg_growable_buffer__realloc_grow;
+    r[i].clip_rect = dst_rect;
+  }
+
+  const char* err_msg = iconvg_private_damage_recording__record(
+      &r[0], dst_rect, old_src_ptr, old_src_len, options);
+  if (!err_msg) {
+    err_msg = iconvg_private_damage_recording__record(
+        &r[1], dst_rect, new_src_ptr, new_src_len, options);
+  }
+
+  if (err_msg) {
+    // Be conservative: everything is damaged.
+    *dst_damage = r[0].clip_rect;
+  } else {
+    size_t n0 = r[0].drawings.len / sizeof(iconvg_private_damage_drawing);
+    size_t n1 = r[1].drawings.len / sizeof(iconvg_private_damage_drawing);
+
+    // Skip the common prefix and the common suffix. Every pixel outside of
+    // the remaining drawings' bounding boxes is covered by the same sequence
+    // of drawings, old and new, so it is unchanged.
+    size_t prefix = 0;
+    while ((prefix < n0) && (prefix < n1) &&
+           iconvg_private_damage_recording__same(&r[0], prefix,  //
+                                                 &r[1], prefix)) {
+      prefix++;
+    }
+    size_t suffix = 0;
+    while (((prefix + suffix) < n0) && ((prefix + suffix) < n1) &&
+           iconvg_private_damage_recording__same(&r[0], n0 - suffix - 1,  //
+                                                 &r[1], n1 - suffix - 1)) {
+      suffix++;
+    }
+
+    iconvg_rectangle_f32 d = iconvg_make_rectangle_f32(
+        +INFINITY, +INFINITY, -INFINITY, -INFINITY);
+    iconvg_private_damage_recording__add_to(&d, &r[0], prefix, n0 - suffix);
+    iconvg_private_damage_recording__add_to(&d, &r[1], prefix, n1 - suffix);
+
+    // Intersect with the clip rectangle, which is the same for both.
+    const iconvg_rectangle_f32* k = &r[1].clip_rect;
+    d.min_x = (d.min_x > k->min_x) ? d.min_x : k->min_x;
+    d.min_y = (d.min_y > k->min_y) ? d.min_y : k->min_y;
+    d.max_x = (d.max_x < k->max_x) ? d.max_x : k->max_x;
+    d.max_y = (d.max_y < k->max_y) ? d.max_y : k->max_y;
+    if (iconvg_rectangle_f32__is_finite_and_not_empty(&d)) {
+      *dst_damage = d;
+    } else {
+      *dst_damage = iconvg_make_rectangle_f32(0, 0, 0, 0);
+    }
+  }
+
+  for (int i = 0; i < 2; i++) {
+    free(r[i].drawings.ptr);
+    free(r[i].data.ptr);
+  }
+  return err_msg;
+}
@@ -291,6 +291,9 @@ static const iconvg_canvas_vtable  //
         &iconvg_private_debug_canvas__path_cube_to,
         &iconvg_private_debug_canvas__on_metadata_viewbox,
         &iconvg_private_debug_canvas__on_metadata_suggested_palette,
+        // end_drawing_instances is NULL so that iconvg_decode_instances
+        // replays each instance as ordinary (logged) calls.
+        NULL,
 };
 
 iconvg_canvas  //
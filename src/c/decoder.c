@@ -279,13 +279,125 @@ iconvg_private_decoder__decode_metadata_suggested_palette(
   return true;
 }
 
+// iconvg_private_drawing_index_entry is one drawing's entry in a MID 2
+// (Drawing Index) metadata chunk: where the drawing's bytes are, relative to
+// the end of the previous drawing (or to the start of the bytecode), its
+// bounds in graphic (ViewBox) coordinates and the LOD0 and LOD1 registers'
+// values when it starts.
+typedef struct iconvg_private_drawing_index_entry_struct {
+  uint32_t gap;
+  uint32_t length;
+  iconvg_rectangle_f32 bounds;
+  float lod0;
+  float lod1;
+} iconvg_private_drawing_index_entry;
+
+static bool  //
+iconvg_private_decoder__decode_drawing_index_entry(
+    iconvg_private_decoder* self,
+    iconvg_private_drawing_index_entry* dst) {
+  return iconvg_private_decoder__decode_natural_number(self, &dst->gap) &&
+         iconvg_private_decoder__decode_natural_number(self, &dst->length) &&
+         iconvg_private_decoder__decode_coordinate_number(self,
+                                                          &dst->bounds.min_x) &&
+         iconvg_private_decoder__decode_coordinate_number(self,
+                                                          &dst->bounds.min_y) &&
+         iconvg_private_decoder__decode_coordinate_number(self,
+                                                          &dst->bounds.max_x) &&
+         iconvg_private_decoder__decode_coordinate_number(self,
+                                                          &dst->bounds.max_y) &&
+         iconvg_private_decoder__decode_real_number(self, &dst->lod0) &&
+         iconvg_private_decoder__decode_real_number(self, &dst->lod1);
+}
+
+// iconvg_private_decoder__decode_metadata_drawing_index checks that self
+// holds a well-formed drawing index: a number of entries and then exactly
+// that many entries. Whether those entries match the bytecode is checked as
+// the bytecode is executed.
+static bool  //
+iconvg_private_decoder__decode_metadata_drawing_index(
+    iconvg_private_decoder* self) {
+  uint32_t n;
+  if (!iconvg_private_decoder__decode_natural_number(self, &n)) {
+    return false;
+  }
+  for (; n > 0; n--) {
+    iconvg_private_drawing_index_entry e;
+    if (!iconvg_private_decoder__decode_drawing_index_entry(self, &e)) {
+      return false;
+    }
+  }
+  return self->len == 0;
+}
+
+// iconvg_private_check_index_bounds returns an error if index_bounds is
+// non-NULL and does not contain the point (x, y), given in graphic (ViewBox)
+// coordinates. A NaN point is never contained.
+static inline const char*  //
+iconvg_private_check_index_bounds(const iconvg_rectangle_f32* index_bounds,
+                                  double x,
+                                  double y) {
+  if (index_bounds &&
+      !((index_bounds->min_x <= x) && (x <= index_bounds->max_x) &&
+        (index_bounds->min_y <= y) && (y <= index_bounds->max_y))) {
+    return iconvg_error_bad_metadata_drawing_index;
+  }
+  return NULL;
+}
+
+// iconvg_private_check_index_arc_bounds is like
+// iconvg_private_check_index_bounds but for an arc, with the same arguments as
+// iconvg_private_path_arc_to.
+static const char*  //
+iconvg_private_check_index_arc_bounds(const iconvg_rectangle_f32* index_bounds,
+                                      float initial_x,
+                                      float initial_y,
+                                      float radius_x,
+                                      float radius_y,
+                                      float x_axis_rotation,
+                                      bool large_arc,
+                                      bool sweep,
+                                      float final_x,
+                                      float final_y) {
+  if (!index_bounds) {
+    return NULL;
+  }
+  double b[4];
+  if (iconvg_private_arc_bounds(&b[0], initial_x, initial_y, radius_x, radius_y,
+                                x_axis_rotation, large_arc, sweep, final_x,
+                                final_y)) {
+    ICONVG_PRIVATE_TRY(
+        iconvg_private_check_index_bounds(index_bounds, b[0], b[1]));
+    ICONVG_PRIVATE_TRY(
+        iconvg_private_check_index_bounds(index_bounds, b[2], b[3]));
+  }
+  return iconvg_private_check_index_bounds(index_bounds, final_x, final_y);
+}
+
 // ----
 
+// iconvg_private_one_byte_color_palette_mask returns the set of custom
+// palette indices that the one byte color u depends on, given the sets for
+// each CREG register. See iconvg_private_set_one_byte_color.
+static inline uint64_t  //
+iconvg_private_one_byte_color_palette_mask(const uint64_t* palette_masks,
+                                           uint8_t u) {
+  if (u < 0x80) {
+    return 0;
+  } else if (u < 0xC0) {
+    return ((uint64_t)1) << (u & 0x3F);
+  }
+  return palette_masks[u & 0x3F];
+}
+
 static const char*  //
 iconvg_private_execute_bytecode(iconvg_canvas* c_arg,
                                 iconvg_rectangle_f32 r,
                                 iconvg_private_decoder* d,
-                                iconvg_paint* state) {
+                                iconvg_paint* state,
+                                const uint8_t* src_ptr,
+                                iconvg_private_decoder drawing_index,
+                                const iconvg_rectangle_f32* cull_rect) {
   // adjustments are the ADJ values from the IconVG spec.
   static const uint32_t adjustments[8] = {0, 1, 2, 3, 4, 5, 6, 0};
 
@@ -304,6 +416,12 @@ iconvg_private_execute_bytecode(iconvg_canvas* c_arg,
   float y3 = +0.0f;
   uint32_t flags = 0;
 
+  // start_x and start_y are where the current path started. As in SVG,
+  // closing a path moves the current point back there, so that 'z; m' is
+  // relative to it.
+  float start_x = +0.0f;
+  float start_y = +0.0f;
+
   double scale_x = +1.0;
   double bias_x = +0.0;
   double scale_y = +1.0;
@@ -335,10 +453,49 @@ iconvg_private_execute_bytecode(iconvg_canvas* c_arg,
   lod[0] = 0.0;
   lod[1] = INFINITY;
 
+  // palette_masks[i] is the set of custom palette indices that CREG[i]'s
+  // value depends on. CREG starts as a copy of the custom palette.
+  uint64_t palette_masks[64];
+  for (int i = 0; i < 64; i++) {
+    palette_masks[i] = ((uint64_t)1) << i;
+  }
+
+  // drawing_begin is where the next drawing's styling opcodes start.
+  const uint8_t* drawing_begin = d->ptr;
+  state->source_position.drawing_index = 0;
+
+  // The drawing index (MID 2), if present, lets us skip painting drawings
+  // that lie outside of the cull rectangle. They are still decoded (onto the
+  // no-op canvas), and every entry is checked against the bytecode, so that
+  // an invalid index is always an error, regardless of the cull rectangle or
+  // of which drawings pass their Level of Detail thresholds.
+  //
+  // index_remaining counts the unused entries. index_end is where the
+  // current (or, in styling mode, previous) indexed drawing ends.
+  // index_bounds is NULL if there is no index, otherwise it points to the
+  // current drawing's bounds, which must contain all of its points.
+  uint32_t index_remaining = 0;
+  bool has_index = iconvg_private_decoder__decode_natural_number(
+      &drawing_index, &index_remaining);
+  const uint8_t* index_end = d->ptr;
+  iconvg_rectangle_f32 index_bounds_storage =
+      iconvg_make_rectangle_f32(0, 0, 0, 0);
+  const iconvg_rectangle_f32* index_bounds = NULL;
+
+  // cull holds the cull rectangle (if any) in graphic coordinates.
+  double cull[4] = {-INFINITY, -INFINITY, +INFINITY, +INFINITY};
+  if (cull_rect) {
+    cull[0] = (cull_rect->min_x * state->d2s_scale_x) + state->d2s_bias_x;
+    cull[1] = (cull_rect->min_y * state->d2s_scale_y) + state->d2s_bias_y;
+    cull[2] = (cull_rect->max_x * state->d2s_scale_x) + state->d2s_bias_x;
+    cull[3] = (cull_rect->max_y * state->d2s_scale_y) + state->d2s_bias_y;
+  }
+
 styling_mode:
   while (true) {
     if (d->len == 0) {
-      return NULL;
+      return (index_remaining > 0) ? iconvg_error_bad_metadata_drawing_index
+                                   : NULL;
     }
     uint8_t opcode = d->ptr[0];
     d->ptr += 1;
@@ -356,6 +513,8 @@ styling_mode:
       uint8_t* rgba = &state->creg.colors[creg_index].rgba[0];
       iconvg_private_set_one_byte_color(rgba, &state->custom_palette,
                                         &state->creg, d->ptr[0]);
+      palette_masks[creg_index] =
+          iconvg_private_one_byte_color_palette_mask(palette_masks, d->ptr[0]);
       d->ptr += 1;
       d->len -= 1;
       sel[0] += ((opcode & 0x07) == 0x07) ? 1 : 0;
@@ -371,6 +530,7 @@ styling_mode:
       rgba[1] = 0x11 * (d->ptr[0] & 0x0F);
       rgba[2] = 0x11 * (d->ptr[1] >> 4);
       rgba[3] = 0x11 * (d->ptr[1] & 0x0F);
+      palette_masks[creg_index] = 0;
       d->ptr += 2;
       d->len -= 2;
       sel[0] += ((opcode & 0x07) == 0x07) ? 1 : 0;
@@ -386,6 +546,7 @@ styling_mode:
       rgba[1] = d->ptr[1];
       rgba[2] = d->ptr[2];
       rgba[3] = 0xFF;
+      palette_masks[creg_index] = 0;
       d->ptr += 3;
       d->len -= 3;
       sel[0] += ((opcode & 0x07) == 0x07) ? 1 : 0;
@@ -401,6 +562,7 @@ styling_mode:
       rgba[1] = d->ptr[1];
       rgba[2] = d->ptr[2];
       rgba[3] = d->ptr[3];
+      palette_masks[creg_index] = 0;
       d->ptr += 4;
       d->len -= 4;
       sel[0] += ((opcode & 0x07) == 0x07) ? 1 : 0;
@@ -424,6 +586,9 @@ styling_mode:
       rgba[1] = (uint8_t)(((p_blend * p[1]) + (q_blend * q[1]) + 128) / 255);
       rgba[2] = (uint8_t)(((p_blend * p[2]) + (q_blend * q[2]) + 128) / 255);
       rgba[3] = (uint8_t)(((p_blend * p[3]) + (q_blend * q[3]) + 128) / 255);
+      palette_masks[creg_index] =
+          iconvg_private_one_byte_color_palette_mask(palette_masks, d->ptr[1]) |
+          iconvg_private_one_byte_color_palette_mask(palette_masks, d->ptr[2]);
       d->ptr += 3;
       d->len -= 3;
       sel[0] += ((opcode & 0x07) == 0x07) ? 1 : 0;
@@ -457,23 +622,59 @@ styling_mode:
       continue;
 
     } else if (opcode < 0xC7) {  // Switch to the drawing mode.
+      const uint8_t* drawing_ptr = d->ptr - 1;
       uint8_t creg_index = (sel[0] - adjustments[opcode & 0x07]) & 0x3F;
       memcpy(&state->paint_rgba, &state->creg.colors[creg_index],
              sizeof(state->paint_rgba));
       if (iconvg_paint__type(state) == ICONVG_PAINT_TYPE__INVALID) {
         return iconvg_error_invalid_paint_type;
       }
+      state->palette_dependencies = palette_masks[creg_index];
+      if (iconvg_paint__type(state) != ICONVG_PAINT_TYPE__FLAT_COLOR) {
+        uint32_t cbase = state->paint_rgba[1];
+        uint32_t n = iconvg_paint__gradient_number_of_stops(state);
+        for (uint32_t i = 0; i < n; i++) {
+          state->palette_dependencies |= palette_masks[0x3F & (cbase + i)];
+        }
+      }
       if (!iconvg_private_decoder__decode_coordinate_number(d, &curr_x) ||
           !iconvg_private_decoder__decode_coordinate_number(d, &curr_y)) {
         return iconvg_error_bad_coordinate;
       }
       double h = (double)state->height_in_pixels;
       c = ((lod[0] <= h) && (h < lod[1])) ? c_arg : &no_op_canvas;
+
+      if (has_index) {
+        // The entry must agree with the bytecode. Its LENGTH and bounds are
+        // checked as the drawing is decoded.
+        iconvg_private_drawing_index_entry e;
+        if ((index_remaining == 0) ||
+            !iconvg_private_decoder__decode_drawing_index_entry(&drawing_index,
+                                                                &e) ||
+            (((size_t)(drawing_ptr - index_end)) != e.gap) ||
+            (e.length > ((size_t)((d->ptr + d->len) - drawing_ptr))) ||
+            (((double)e.lod0) != lod[0]) || (((double)e.lod1) != lod[1])) {
+          return iconvg_error_bad_metadata_drawing_index;
+        }
+        index_remaining--;
+        index_end = drawing_ptr + e.length;
+        index_bounds_storage = e.bounds;
+        index_bounds = &index_bounds_storage;
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
+        if ((e.bounds.max_x < cull[0]) || (e.bounds.max_y < cull[1]) ||
+            (e.bounds.min_x > cull[2]) || (e.bounds.min_y > cull[3])) {
+          c = &no_op_canvas;
+        }
+      }
+
       ICONVG_PRIVATE_TRY((*c->vtable->begin_drawing)(c));
       ICONVG_PRIVATE_TRY(
           (*c->vtable->begin_path)(c,                            //
                                    (curr_x * scale_x) + bias_x,  //
                                    (curr_y * scale_y) + bias_y));
+      start_x = curr_x;
+      start_y = curr_y;
       x1 = curr_x;
       y1 = curr_y;
       goto drawing_mode;
@@ -510,6 +711,8 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &curr_y)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_line_to)(c,                            //
                                          (curr_x * scale_x) + bias_x,  //
@@ -529,6 +732,8 @@ drawing_mode:
           }
           curr_x += x1;
           curr_y += y1;
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_line_to)(c,                            //
                                          (curr_x * scale_x) + bias_x,  //
@@ -545,6 +750,10 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &y2)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_quad_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -567,6 +776,10 @@ drawing_mode:
           }
           x2 += curr_x;
           y2 += curr_y;
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_quad_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -589,6 +802,10 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &y2)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_quad_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -615,6 +832,10 @@ drawing_mode:
           y1 += curr_y;
           x2 += curr_x;
           y2 += curr_y;
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_quad_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -637,6 +858,12 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &y3)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x3, y3));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_cube_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -665,6 +892,12 @@ drawing_mode:
           y2 += curr_y;
           x3 += curr_x;
           y3 += curr_y;
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x3, y3));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_cube_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -691,6 +924,12 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &y3)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x3, y3));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_cube_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -723,6 +962,12 @@ drawing_mode:
           y2 += curr_y;
           x3 += curr_x;
           y3 += curr_y;
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x1, y1));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x2, y2));
+          ICONVG_PRIVATE_TRY(
+              iconvg_private_check_index_bounds(index_bounds, x3, y3));
           ICONVG_PRIVATE_TRY(
               (*c->vtable->path_cube_to)(c,                        //
                                          (x1 * scale_x) + bias_x,  //
@@ -751,6 +996,9 @@ drawing_mode:
               !iconvg_private_decoder__decode_coordinate_number(d, &curr_y)) {
             return iconvg_error_bad_coordinate;
           }
+          ICONVG_PRIVATE_TRY(iconvg_private_check_index_arc_bounds(
+              index_bounds, x0, y0, x1, y1, x2, flags & 0x01, flags & 0x02,
+              curr_x, curr_y));
           ICONVG_PRIVATE_TRY(iconvg_private_path_arc_to(
               c, scale_x, bias_x, scale_y, bias_y, x0, y0, x1, y1, x2,
               flags & 0x01, flags & 0x02, curr_x, curr_y));
@@ -774,6 +1022,9 @@ drawing_mode:
           }
           curr_x += x3;
           curr_y += y3;
+          ICONVG_PRIVATE_TRY(iconvg_private_check_index_arc_bounds(
+              index_bounds, x0, y0, x1, y1, x2, flags & 0x01, flags & 0x02,
+              curr_x, curr_y));
           ICONVG_PRIVATE_TRY(iconvg_private_path_arc_to(
               c, scale_x, bias_x, scale_y, bias_y, x0, y0, x1, y1, x2,
               flags & 0x01, flags & 0x02, curr_x, curr_y));
@@ -786,8 +1037,15 @@ drawing_mode:
 
     switch (opcode) {
       case 0xE1: {  // 'z' mnemonic: close_path.
+        if (index_bounds && (d->ptr != index_end)) {
+          return iconvg_error_bad_metadata_drawing_index;
+        }
         ICONVG_PRIVATE_TRY((*c->vtable->end_path)(c));
+        state->source_position.src_begin = (size_t)(drawing_begin - src_ptr);
+        state->source_position.src_end = (size_t)(d->ptr - src_ptr);
         ICONVG_PRIVATE_TRY((*c->vtable->end_drawing)(c, state));
+        state->source_position.drawing_index++;
+        drawing_begin = d->ptr;
         goto styling_mode;
       }
 
@@ -797,10 +1055,14 @@ drawing_mode:
             !iconvg_private_decoder__decode_coordinate_number(d, &curr_y)) {
           return iconvg_error_bad_coordinate;
         }
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->begin_path)(c,                            //
                                      (curr_x * scale_x) + bias_x,  //
                                      (curr_y * scale_y) + bias_y));
+        start_x = curr_x;
+        start_y = curr_y;
         x1 = curr_x;
         y1 = curr_y;
         continue;
@@ -812,12 +1074,16 @@ drawing_mode:
             !iconvg_private_decoder__decode_coordinate_number(d, &y1)) {
           return iconvg_error_bad_coordinate;
         }
-        curr_x += x1;
-        curr_y += y1;
+        curr_x = start_x + x1;
+        curr_y = start_y + y1;
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->begin_path)(c,                            //
                                      (curr_x * scale_x) + bias_x,  //
                                      (curr_y * scale_y) + bias_y));
+        start_x = curr_x;
+        start_y = curr_y;
         x1 = curr_x;
         y1 = curr_y;
         continue;
@@ -827,6 +1093,8 @@ drawing_mode:
         if (!iconvg_private_decoder__decode_coordinate_number(d, &curr_x)) {
           return iconvg_error_bad_coordinate;
         }
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->path_line_to)(c,                            //
                                        (curr_x * scale_x) + bias_x,  //
@@ -841,6 +1109,8 @@ drawing_mode:
           return iconvg_error_bad_coordinate;
         }
         curr_x += x1;
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->path_line_to)(c,                            //
                                        (curr_x * scale_x) + bias_x,  //
@@ -854,6 +1124,8 @@ drawing_mode:
         if (!iconvg_private_decoder__decode_coordinate_number(d, &curr_y)) {
           return iconvg_error_bad_coordinate;
         }
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->path_line_to)(c,                            //
                                        (curr_x * scale_x) + bias_x,  //
@@ -868,6 +1140,8 @@ drawing_mode:
           return iconvg_error_bad_coordinate;
         }
         curr_y += y1;
+        ICONVG_PRIVATE_TRY(
+            iconvg_private_check_index_bounds(index_bounds, curr_x, curr_y));
         ICONVG_PRIVATE_TRY(
             (*c->vtable->path_line_to)(c,                            //
                                        (curr_x * scale_x) + bias_x,  //
@@ -946,6 +1220,7 @@ iconvg_private_decode(iconvg_canvas* c,
                       iconvg_rectangle_f32 r,
                       iconvg_private_decoder* d,
                       const iconvg_decode_options* options) {
+  const uint8_t* src_ptr = d->ptr;
   iconvg_paint state;
   state.viewbox = iconvg_private_default_viewbox();
   if (options && options->height_in_pixels.has_value) {
@@ -962,6 +1237,8 @@ iconvg_private_decode(iconvg_canvas* c,
     }
   }
   memset(&state.paint_rgba, 0, sizeof(state.paint_rgba));
+  memset(&state.source_position, 0, sizeof(state.source_position));
+  state.palette_dependencies = 0;
   memcpy(&state.custom_palette, &iconvg_private_default_palette,
          sizeof(state.custom_palette));
 
@@ -973,6 +1250,10 @@ iconvg_private_decode(iconvg_canvas* c,
     return iconvg_error_bad_metadata;
   }
 
+  iconvg_private_decoder drawing_index;
+  drawing_index.ptr = NULL;
+  drawing_index.len = 0;
+
   int32_t previous_metadata_id = -1;
   for (; num_metadata_chunks > 0; num_metadata_chunks--) {
     uint32_t chunk_length;
@@ -1006,6 +1287,13 @@ iconvg_private_decode(iconvg_canvas* c,
         }
         break;
 
+      case 2:  // MID 2 (Drawing Index).
+        drawing_index = chunk;
+        if (!iconvg_private_decoder__decode_metadata_drawing_index(&chunk)) {
+          return iconvg_error_bad_metadata_drawing_index;
+        }
+        break;
+
       default:
         return iconvg_error_bad_metadata;
     }
@@ -1035,7 +1323,36 @@ iconvg_private_decode(iconvg_canvas* c,
   state.d2s_scale_y = +1.0;
   state.d2s_bias_y = +0.0;
 
-  return iconvg_private_execute_bytecode(c, r, d, &state);
+  const iconvg_matrix_2x3_f64* t =
+      iconvg_private_decode_options__dst_transform(options);
+  if (t) {
+    iconvg_matrix_2x3_f64 m = *t;
+    state.inverse_dst_transform = iconvg_matrix_2x3_f64__inverse(&m);
+  } else {
+    state.inverse_dst_transform = iconvg_private_identity_matrix_2x3_f64();
+  }
+
+  // Map the cull rectangle back through any dst_transform, to the bounding
+  // box of its pre-image. Culling is conservative: it only skips drawings
+  // that are certainly outside.
+  iconvg_rectangle_f32 cull_rect_storage;
+  const iconvg_rectangle_f32* cull_rect =
+      iconvg_private_decode_options__cull_rect(options);
+  if (cull_rect && t) {
+    cull_rect_storage = *cull_rect;
+    cull_rect = iconvg_private_transform_rectangle(&cull_rect_storage,
+                                                   &state.inverse_dst_transform)
+                    ? &cull_rect_storage
+                    : NULL;
+  }
+
+  if (t) {
+    iconvg_canvas tc = iconvg_private_make_transform_canvas(c, t);
+    return iconvg_private_execute_bytecode(&tc, r, d, &state, src_ptr,
+                                           drawing_index, cull_rect);
+  }
+  return iconvg_private_execute_bytecode(c, r, d, &state, src_ptr,
+                                         drawing_index, cull_rect);
 }
 
 const char*  //
@@ -1057,12 +1374,19 @@ iconvg_decode(iconvg_canvas* dst_canvas,
     return iconvg_error_unsupported_vtable;
   }
 
+  iconvg_rectangle_f32 clip_rect = dst_rect;
+  const iconvg_matrix_2x3_f64* t =
+      iconvg_private_decode_options__dst_transform(options);
+  if (t && !iconvg_private_transform_rectangle(&clip_rect, t)) {
+    return iconvg_error_invalid_dst_transform;
+  }
+
   iconvg_private_decoder d;
   d.ptr = src_ptr;
   d.len = src_len;
 
   const char* err_msg =
-      (*dst_canvas->vtable->begin_decode)(dst_canvas, dst_rect);
+      (*dst_canvas->vtable->begin_decode)(dst_canvas, clip_rect);
   if (!err_msg) {
     err_msg = iconvg_private_decode(dst_canvas, dst_rect, &d, options);
   }
@@ -0,0 +1,1014 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// The iconvg_encoder's private_mode field tracks where we are in the
+// "styling, drawing, styling, drawing, etc" sequence. A zero-valued
+// iconvg_encoder (one that hasn't been initialized) is in no valid mode.
+#define ICONVG_PRIVATE_ENCODER_MODE__STYLING 1
+#define ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH 2
+#define ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH 3
+#define ICONVG_PRIVATE_ENCODER_MODE__DRAWING_AFTER_PATH 4
+
+// iconvg_private_encoded_number is a number's encoding (1, 2 or 4 bytes) and
+// the value that the decoder will produce from those bytes. A zero len means
+// that there is no exact encoding.
+typedef struct iconvg_private_encoded_number_struct {
+  uint8_t bytes[4];
+  uint32_t len;
+  float value;
+} iconvg_private_encoded_number;
+
+static iconvg_private_encoded_number  //
+iconvg_private_encode_4_byte_number(float f) {
+  uint32_t u = iconvg_private_reinterpret_from_f32_to_u32(f);
+
+  // Round the fractional bits (the low 23 bits) to the nearest multiple of 4,
+  // being careful not to overflow into the upper bits. This matches the Go
+  // encoder.
+  uint32_t v = u & 0x007FFFFFu;
+  if (v < 0x007FFFFEu) {
+    v += 2;
+  }
+  u = (u & 0xFF800000u) | v;
+
+  // A 4 byte encoding has the low two bits set.
+  iconvg_private_encoded_number e;
+  iconvg_private_poke_u32le(&e.bytes[0], u | 0x03);
+  e.len = 4;
+  e.value = iconvg_private_reinterpret_from_u32_to_f32(u & 0xFFFFFFFCu);
+  return e;
+}
+
+static iconvg_private_encoded_number  //
+iconvg_private_encode_coordinate_number(float f) {
+  iconvg_private_encoded_number e;
+  if ((-64.0f <= f) && (f < +64.0f)) {
+    int32_t i = (int32_t)f;
+    if (((float)i) == f) {
+      e.bytes[0] = (uint8_t)((i + 64) << 1);
+      e.len = 1;
+      e.value = (float)i;
+      return e;
+    }
+  }
+  if ((-128.0f <= f) && (f < +128.0f)) {
+    float g = f * 64.0f;
+    int32_t i = (int32_t)g;
+    if (((float)i) == g) {
+      uint32_t u = (((uint32_t)(i + (128 * 64))) << 2) | 0x01;
+      e.bytes[0] = (uint8_t)(u >> 0);
+      e.bytes[1] = (uint8_t)(u >> 8);
+      e.len = 2;
+      e.value = ((float)i) / 64.0f;
+      return e;
+    }
+  }
+  return iconvg_private_encode_4_byte_number(f);
+}
+
+static iconvg_private_encoded_number  //
+iconvg_private_encode_natural_number(uint32_t u) {
+  iconvg_private_encoded_number e;
+  if (u < (1u << 7)) {
+    e.bytes[0] = (uint8_t)(u << 1);
+    e.len = 1;
+  } else if (u < (1u << 14)) {
+    u = (u << 2) | 0x01;
+    e.bytes[0] = (uint8_t)(u >> 0);
+    e.bytes[1] = (uint8_t)(u >> 8);
+    e.len = 2;
+  } else {
+    iconvg_private_poke_u32le(&e.bytes[0], (u << 2) | 0x03);
+    e.len = 4;
+  }
+  e.value = 0;
+  return e;
+}
+
+static iconvg_private_encoded_number  //
+iconvg_private_encode_real_number(float f) {
+  if ((0.0f <= f) && (f < 16384.0f)) {
+    uint32_t u = (uint32_t)f;
+    if (((float)u) == f) {
+      iconvg_private_encoded_number e = iconvg_private_encode_natural_number(u);
+      e.value = (float)u;
+      return e;
+    }
+  }
+  return iconvg_private_encode_4_byte_number(f);
+}
+
+static iconvg_private_encoded_number  //
+iconvg_private_encode_zero_to_one_number(float f) {
+  iconvg_private_encoded_number e;
+  if ((0.0f <= f) && (f < 2.0f)) {
+    // The decoder divides (in double precision) by 120 or 15120 before
+    // converting to float, so check that round-trip exactly.
+    uint32_t u = (uint32_t)((((double)f) * 120.0) + 0.5);
+    if ((u < (1u << 7)) && (((float)(((double)u) / 120.0)) == f)) {
+      e.bytes[0] = (uint8_t)(u << 1);
+      e.len = 1;
+      e.value = f;
+      return e;
+    }
+    u = (uint32_t)((((double)f) * 15120.0) + 0.5);
+    if ((u < (1u << 14)) && (((float)(((double)u) / 15120.0)) == f)) {
+      u = (u << 2) | 0x01;
+      e.bytes[0] = (uint8_t)(u >> 0);
+      e.bytes[1] = (uint8_t)(u >> 8);
+      e.len = 2;
+      e.value = f;
+      return e;
+    }
+  }
+  return iconvg_private_encode_4_byte_number(f);
+}
+
+// iconvg_private_encode_relative_coordinate_number returns the encoding of
+// (target - origin), if the decoder's (origin + decoded_difference) exactly
+// equals target. Its value field is that sum, an absolute coordinate.
+static iconvg_private_encoded_number  //
+iconvg_private_encode_relative_coordinate_number(float origin, float target) {
+  iconvg_private_encoded_number e =
+      iconvg_private_encode_coordinate_number(target - origin);
+  float sum = origin + e.value;
+  if (sum != target) {
+    e.len = 0;
+  }
+  e.value = sum;
+  return e;
+}
+
+// iconvg_private_encode_color returns the number of bytes (1, 2, 3 or 4)
+// written to dst and sets *opcode to the matching "Set CREG[etc]" opcode,
+// before adding its ADJ bits.
+static size_t  //
+iconvg_private_encode_color(uint8_t* dst,
+                            uint8_t* opcode,
+                            iconvg_premul_color c) {
+  const uint8_t* rgba = &c.rgba[0];
+  uint32_t u = iconvg_private_peek_u32le(rgba);
+  for (size_t i = 0; i < 0x80; i++) {
+    if (u ==
+        iconvg_private_peek_u32le(&iconvg_private_one_byte_colors[4 * i])) {
+      dst[0] = (uint8_t)i;
+      *opcode = 0x80;
+      return 1;
+    }
+  }
+  if (((rgba[0] % 0x11) == 0) && ((rgba[1] % 0x11) == 0) &&
+      ((rgba[2] % 0x11) == 0) && ((rgba[3] % 0x11) == 0)) {
+    dst[0] = (uint8_t)(((rgba[0] / 0x11) << 4) | (rgba[1] / 0x11));
+    dst[1] = (uint8_t)(((rgba[2] / 0x11) << 4) | (rgba[3] / 0x11));
+    *opcode = 0x88;
+    return 2;
+  } else if (rgba[3] == 0xFF) {
+    memcpy(dst, rgba, 3);
+    *opcode = 0x90;
+    return 3;
+  }
+  memcpy(dst, rgba, 4);
+  *opcode = 0x98;
+  return 4;
+}
+
+static inline size_t  //
+iconvg_private_append_encoded_number(uint8_t* dst,
+                                     iconvg_private_encoded_number e) {
+  memcpy(dst, &e.bytes[0], e.len);
+  return e.len;
+}
+
+// ----
+
+static inline bool  //
+iconvg_private_is_valid_premul_color(iconvg_premul_color c) {
+  return (c.rgba[0] <= c.rgba[3]) &&  //
+         (c.rgba[1] <= c.rgba[3]) &&  //
+         (c.rgba[2] <= c.rgba[3]);
+}
+
+// iconvg_private_encoder__check returns self's error, if it already has one,
+// or sets (and returns) iconvg_error_invalid_encoder_state if self is not in
+// the given mode.
+static const char*  //
+iconvg_private_encoder__check(iconvg_encoder* self, uint32_t mode) {
+  if (!self) {
+    return iconvg_error_invalid_encoder_state;
+  } else if (self->private_err_msg) {
+    return self->private_err_msg;
+  } else if (self->private_mode != mode) {
+    self->private_err_msg = iconvg_error_invalid_encoder_state;
+    return self->private_err_msg;
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_encoder__fail(iconvg_encoder* self, const char* err_msg) {
+  self->private_err_msg = err_msg;
+  return err_msg;
+}
+
+// iconvg_private_encoder__write appends src[0 .. n] to the dst buffer, or
+// appends nothing at all (on failure).
+static const char*  //
+iconvg_private_encoder__write(iconvg_encoder* self,
+                              const uint8_t* src,
+                              size_t n) {
+  iconvg_growable_buffer* b = self->private_dst;
+  const char* err_msg = iconvg_private_growable_buffer__reserve(b, n);
+  if (err_msg) {
+    return iconvg_private_encoder__fail(self, err_msg);
+  }
+  memcpy(b->ptr + b->len, src, n);
+  b->len += n;
+  return NULL;
+}
+
+// iconvg_private_encoder__can_extend_run returns whether the most recent
+// drawing opcode was opcode_base (such as 0x00 for 'L' or 0x60 for 'Q') with
+// a repeat count that can be incremented. Incrementing it, instead of writing
+// a fresh opcode byte, saves 1 byte per segment.
+static bool  //
+iconvg_private_encoder__can_extend_run(iconvg_encoder* self,
+                                       uint8_t opcode_base) {
+  if (self->private_run_index == 0) {
+    return false;
+  }
+  uint8_t opcode = self->private_dst->ptr[self->private_run_index];
+  uint8_t mask = (opcode_base < 0x40) ? 0x1F : 0x0F;
+  return ((opcode & ~mask) == opcode_base) && ((opcode & mask) < mask);
+}
+
+static size_t  //
+iconvg_private_encoder__segment_cost(iconvg_encoder* self,
+                                     uint8_t opcode_base,
+                                     const iconvg_private_encoded_number* args,
+                                     size_t num_args) {
+  size_t cost =
+      iconvg_private_encoder__can_extend_run(self, opcode_base) ? 0 : 1;
+  for (size_t i = 0; i < num_args; i++) {
+    if (args[i].len == 0) {
+      return SIZE_MAX;
+    }
+    cost += args[i].len;
+  }
+  return cost;
+}
+
+static const char*  //
+iconvg_private_encoder__write_segment(iconvg_encoder* self,
+                                      uint8_t opcode_base,
+                                      const iconvg_private_encoded_number* args,
+                                      size_t num_args) {
+  uint8_t buf[32];
+  size_t n = 0;
+  bool extend = iconvg_private_encoder__can_extend_run(self, opcode_base);
+  if (!extend) {
+    buf[n++] = opcode_base;
+  }
+  for (size_t i = 0; i < num_args; i++) {
+    n += iconvg_private_append_encoded_number(&buf[n], args[i]);
+  }
+
+  iconvg_growable_buffer* b = self->private_dst;
+  const char* err_msg = iconvg_private_growable_buffer__reserve(b, n);
+  if (err_msg) {
+    return iconvg_private_encoder__fail(self, err_msg);
+  } else if (extend) {
+    b->ptr[self->private_run_index]++;
+  } else {
+    self->private_run_index = b->len;
+  }
+  memcpy(b->ptr + b->len, &buf[0], n);
+  b->len += n;
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_encoder__write_single(iconvg_encoder* self,
+                                     uint8_t opcode,
+                                     const iconvg_private_encoded_number* args,
+                                     size_t num_args) {
+  uint8_t buf[16];
+  size_t n = 0;
+  buf[n++] = opcode;
+  for (size_t i = 0; i < num_args; i++) {
+    n += iconvg_private_append_encoded_number(&buf[n], args[i]);
+  }
+  self->private_run_index = 0;
+  return iconvg_private_encoder__write(self, &buf[0], n);
+}
+
+// ----
+
+const char*  //
+iconvg_encoder__initialize(iconvg_encoder* self,
+                           iconvg_growable_buffer* dst,
+                           const iconvg_rectangle_f32* viewbox,
+                           const iconvg_palette* suggested_palette) {
+  if (!self) {
+    return iconvg_error_invalid_encoder_argument;
+  }
+  memset(self, 0, sizeof(*self));
+  if (!dst) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+  self->private_dst = dst;
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__STYLING;
+
+  // The metadata is at most 4 + 1 + (1 + 1 + 16) + (2 + 1 + 1 + 256) bytes.
+  uint8_t buf[320];
+  size_t n = 0;
+  buf[n++] = 0x89;
+  buf[n++] = 0x49;
+  buf[n++] = 0x56;
+  buf[n++] = 0x47;
+
+  uint8_t viewbox_chunk[20];
+  size_t viewbox_chunk_len = 0;
+  if (viewbox) {
+    if (!(-INFINITY < viewbox->min_x) ||         //
+        !(viewbox->min_x <= viewbox->max_x) ||   //
+        !(viewbox->max_x < +INFINITY) ||         //
+        !(-INFINITY < viewbox->min_y) ||         //
+        !(viewbox->min_y <= viewbox->max_y) ||   //
+        !(viewbox->max_y < +INFINITY)) {
+      return iconvg_private_encoder__fail(
+          self, iconvg_error_invalid_encoder_argument);
+    }
+    iconvg_rectangle_f32 d = iconvg_private_default_viewbox();
+    if ((viewbox->min_x != d.min_x) || (viewbox->min_y != d.min_y) ||
+        (viewbox->max_x != d.max_x) || (viewbox->max_y != d.max_y)) {
+      uint8_t* p = &viewbox_chunk[0];
+      *p++ = 0x00;  // MID 0 (ViewBox).
+      p += iconvg_private_append_encoded_number(
+          p, iconvg_private_encode_coordinate_number(viewbox->min_x));
+      p += iconvg_private_append_encoded_number(
+          p, iconvg_private_encode_coordinate_number(viewbox->min_y));
+      p += iconvg_private_append_encoded_number(
+          p, iconvg_private_encode_coordinate_number(viewbox->max_x));
+      p += iconvg_private_append_encoded_number(
+          p, iconvg_private_encode_coordinate_number(viewbox->max_y));
+      viewbox_chunk_len = (size_t)(p - &viewbox_chunk[0]);
+    }
+  }
+
+  uint8_t palette_chunk[258];
+  size_t palette_chunk_len = 0;
+  int last = -1;
+  if (suggested_palette) {
+    last = iconvg_private_last_color_that_isnt_opaque_black(suggested_palette);
+  }
+  if (last >= 0) {
+    // Use the smallest per-color encoding that is exact for all of the colors,
+    // as the Go encoder's encodeSuggestedPalette does. This is not simply the
+    // longest of each color's own encoding: a 1-byte color (such as opaque
+    // 0x40 gray) isn't always 2-byte exact and a 1-byte or 2-byte color isn't
+    // always opaque. Only the first (last + 1) colors are written: the
+    // remainder default to opaque black.
+    bool all_1 = true;
+    bool all_2 = true;
+    bool all_3 = true;
+    for (int i = 0; i <= last; i++) {
+      iconvg_premul_color c = suggested_palette->colors[i];
+      uint8_t ignored_bytes[4];
+      uint8_t opcode = 0;
+      all_1 = all_1 &&
+              (iconvg_private_encode_color(&ignored_bytes[0], &opcode, c) == 1);
+      all_2 = all_2 && ((c.rgba[0] % 0x11) == 0) &&
+              ((c.rgba[1] % 0x11) == 0) && ((c.rgba[2] % 0x11) == 0) &&
+              ((c.rgba[3] % 0x11) == 0);
+      all_3 = all_3 && (c.rgba[3] == 0xFF);
+    }
+    size_t bytes_per_elem = 4;
+    if (all_1) {
+      bytes_per_elem = 1;
+    } else if (all_2) {
+      bytes_per_elem = 2;
+    } else if (all_3) {
+      bytes_per_elem = 3;
+    }
+
+    uint8_t* p = &palette_chunk[0];
+    *p++ = 0x02;  // MID 1 (Suggested Palette).
+    *p++ = (uint8_t)(((bytes_per_elem - 1) << 6) | ((size_t)last));
+    for (int i = 0; i <= last; i++) {
+      const uint8_t* rgba = &suggested_palette->colors[i].rgba[0];
+      switch (bytes_per_elem) {
+        case 1: {
+          uint8_t opcode = 0;
+          iconvg_private_encode_color(p, &opcode, suggested_palette->colors[i]);
+          p += 1;
+          break;
+        }
+        case 2:
+          *p++ = (uint8_t)(((rgba[0] / 0x11) << 4) | (rgba[1] / 0x11));
+          *p++ = (uint8_t)(((rgba[2] / 0x11) << 4) | (rgba[3] / 0x11));
+          break;
+        case 3:
+          memcpy(p, rgba, 3);
+          p += 3;
+          break;
+        default:
+          memcpy(p, rgba, 4);
+          p += 4;
+          break;
+      }
+    }
+    palette_chunk_len = (size_t)(p - &palette_chunk[0]);
+  }
+
+  n += iconvg_private_append_encoded_number(
+      &buf[n], iconvg_private_encode_natural_number(
+                   (viewbox_chunk_len ? 1 : 0) + (palette_chunk_len ? 1 : 0)));
+  if (viewbox_chunk_len) {
+    n += iconvg_private_append_encoded_number(
+        &buf[n],
+        iconvg_private_encode_natural_number((uint32_t)viewbox_chunk_len));
+    memcpy(&buf[n], &viewbox_chunk[0], viewbox_chunk_len);
+    n += viewbox_chunk_len;
+  }
+  if (palette_chunk_len) {
+    n += iconvg_private_append_encoded_number(
+        &buf[n],
+        iconvg_private_encode_natural_number((uint32_t)palette_chunk_len));
+    memcpy(&buf[n], &palette_chunk[0], palette_chunk_len);
+    n += palette_chunk_len;
+  }
+  return iconvg_private_encoder__write(self, &buf[0], n);
+}
+
+// ----
+
+static void  //
+iconvg_private_encoder__set_known_creg(iconvg_encoder* self,
+                                       uint32_t index,
+                                       iconvg_premul_color c) {
+  index &= 0x3F;
+  self->private_creg_known_bits |= ((uint64_t)1) << index;
+  self->private_creg[index] = c;
+}
+
+// iconvg_private_encoder__append_creg_incr appends a "Set CREG[CSEL-0]; then
+// increment CSEL" styling op to dst, returning the number of bytes appended
+// (at most 5).
+static size_t  //
+iconvg_private_encoder__append_creg_incr(iconvg_encoder* self,
+                                         uint8_t* dst,
+                                         iconvg_premul_color c) {
+  uint8_t opcode = 0;
+  size_t n = 1 + iconvg_private_encode_color(dst + 1, &opcode, c);
+  dst[0] = opcode | 0x07;
+  iconvg_private_encoder__set_known_creg(self, self->private_csel, c);
+  self->private_csel = (self->private_csel + 1) & 0x3F;
+  return n;
+}
+
+// iconvg_private_encoder__append_nreg_incr appends a "Set NREG[NSEL-0]; then
+// increment NSEL" styling op to dst, returning the number of bytes appended
+// (at most 5). It uses whichever of the real, coordinate or zero-to-one number
+// encodings is shortest.
+static size_t  //
+iconvg_private_encoder__append_nreg_incr(iconvg_encoder* self,
+                                         uint8_t* dst,
+                                         float f) {
+  iconvg_private_encoded_number e = iconvg_private_encode_real_number(f);
+  uint8_t opcode = 0xA8;
+  iconvg_private_encoded_number e1 = iconvg_private_encode_coordinate_number(f);
+  if (e.len > e1.len) {
+    e = e1;
+    opcode = 0xB0;
+  }
+  iconvg_private_encoded_number e2 =
+      iconvg_private_encode_zero_to_one_number(f);
+  if (e.len > e2.len) {
+    e = e2;
+    opcode = 0xB8;
+  }
+  dst[0] = opcode | 0x07;
+  self->private_nsel = (self->private_nsel + 1) & 0x3F;
+  return 1 + iconvg_private_append_encoded_number(dst + 1, e);
+}
+
+const char*  //
+iconvg_encoder__begin_drawing_flat_color(iconvg_encoder* self,
+                                         iconvg_premul_color color) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__STYLING));
+  if (!iconvg_private_is_valid_premul_color(color)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+
+  // Re-use a recently written color register if we can. The "Start path"
+  // opcode can refer to any of CREG[CSEL-0] .. CREG[CSEL-6].
+  uint32_t color_u32 = iconvg_private_peek_u32le(&color.rgba[0]);
+  for (uint32_t adj = 0; adj <= 6; adj++) {
+    uint32_t index = (self->private_csel - adj) & 0x3F;
+    if (((self->private_creg_known_bits >> index) & 1) &&
+        (color_u32 ==
+         iconvg_private_peek_u32le(&self->private_creg[index].rgba[0]))) {
+      self->private_start_path_adj = adj;
+      self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH;
+      return NULL;
+    }
+  }
+
+  // Otherwise, write the color to CREG[CSEL] and increment CSEL, so that the
+  // previous few colors remain available for re-use.
+  iconvg_growable_buffer* b = self->private_dst;
+  const char* err_msg = iconvg_private_growable_buffer__reserve(b, 5);
+  if (err_msg) {
+    return iconvg_private_encoder__fail(self, err_msg);
+  }
+  b->len += iconvg_private_encoder__append_creg_incr(self, b->ptr + b->len,
+                                                      color);
+  self->private_run_index = 0;
+  self->private_start_path_adj = 1;
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__begin_drawing_gradient(
+    iconvg_encoder* self,
+    bool radial,
+    iconvg_gradient_spread spread,
+    uint32_t num_stops,
+    const iconvg_premul_color* stop_colors,
+    const float* stop_offsets,
+    iconvg_matrix_2x3_f64 transformation_matrix) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__STYLING));
+
+  // The NREG registers hold the 6 matrix elements and then the N offsets.
+  // There are only 64 registers.
+  if ((num_stops > 58) || (((uint32_t)spread) > 3) ||
+      ((num_stops > 0) && (!stop_colors || !stop_offsets))) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+  float m[6];
+  for (int i = 0; i < 6; i++) {
+    m[i] = (float)(transformation_matrix.elems[i / 3][i % 3]);
+    if (!isfinite(m[i])) {
+      return iconvg_private_encoder__fail(
+          self, iconvg_error_invalid_encoder_argument);
+    }
+  }
+  for (uint32_t i = 0; i < num_stops; i++) {
+    if (!iconvg_private_is_valid_premul_color(stop_colors[i]) ||
+        !(0.0f <= stop_offsets[i]) || !(stop_offsets[i] <= 1.0f)) {
+      return iconvg_private_encoder__fail(
+          self, iconvg_error_invalid_encoder_argument);
+    }
+  }
+
+  // Reserve room for (num_stops + 1) color ops and (num_stops + 6) number
+  // ops, each at most 5 bytes, so that the rest of this function can't fail
+  // half-way through.
+  size_t max_n = 5 * ((2 * ((size_t)num_stops)) + 7);
+  iconvg_growable_buffer* b = self->private_dst;
+  const char* err_msg = iconvg_private_growable_buffer__reserve(b, max_n);
+  if (err_msg) {
+    return iconvg_private_encoder__fail(self, err_msg);
+  }
+  uint8_t* p = b->ptr + b->len;
+
+  // The stops' colors go in CREG[CBASE ..], followed by the gradient paint
+  // itself. The matrix goes in NREG[NBASE - 6 ..], followed by the offsets.
+  uint32_t cbase = self->private_csel;
+  for (uint32_t i = 0; i < num_stops; i++) {
+    p += iconvg_private_encoder__append_creg_incr(self, p, stop_colors[i]);
+  }
+  for (int i = 0; i < 6; i++) {
+    p += iconvg_private_encoder__append_nreg_incr(self, p, m[i]);
+  }
+  uint32_t nbase = self->private_nsel;
+  for (uint32_t i = 0; i < num_stops; i++) {
+    p += iconvg_private_encoder__append_nreg_incr(self, p, stop_offsets[i]);
+  }
+
+  iconvg_premul_color paint;
+  paint.rgba[0] = (uint8_t)num_stops;
+  paint.rgba[1] = (uint8_t)((((uint32_t)spread) << 6) | cbase);
+  paint.rgba[2] = (uint8_t)(0x80 | (radial ? 0x40 : 0x00) | nbase);
+  paint.rgba[3] = 0x00;
+  p += iconvg_private_encoder__append_creg_incr(self, p, paint);
+
+  b->len = (size_t)(p - b->ptr);
+  self->private_run_index = 0;
+  self->private_start_path_adj = 1;
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__end_drawing(iconvg_encoder* self) {
+  if (!self) {
+    return iconvg_error_invalid_encoder_state;
+  } else if (self->private_err_msg) {
+    return self->private_err_msg;
+  } else if (self->private_mode ==
+             ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH) {
+    // An empty drawing. There are no drawing opcodes to write. The styling
+    // opcodes, if any, are harmless.
+    self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__STYLING;
+    return NULL;
+  }
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_AFTER_PATH));
+  ICONVG_PRIVATE_TRY(
+      iconvg_private_encoder__write_single(self, 0xE1, NULL, 0));  // 'z'.
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__STYLING;
+  return NULL;
+}
+
+// ----
+
+const char*  //
+iconvg_encoder__begin_path(iconvg_encoder* self, float x0, float y0) {
+  if (!self) {
+    return iconvg_error_invalid_encoder_state;
+  } else if (self->private_err_msg) {
+    return self->private_err_msg;
+  } else if (!isfinite(x0) || !isfinite(y0)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+
+  iconvg_private_encoded_number args[2];
+  args[0] = iconvg_private_encode_coordinate_number(x0);
+  args[1] = iconvg_private_encode_coordinate_number(y0);
+
+  if (self->private_mode == ICONVG_PRIVATE_ENCODER_MODE__DRAWING_BEFORE_PATH) {
+    // "Start path" is always absolute.
+    ICONVG_PRIVATE_TRY(iconvg_private_encoder__write_single(
+        self, (uint8_t)(0xC0 | self->private_start_path_adj), args, 2));
+
+  } else {
+    ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+        self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_AFTER_PATH));
+    // As in SVG, closing a path moves the current point back to where the
+    // path started, so 'z; m' is relative to that.
+    iconvg_private_encoded_number relative[2];
+    relative[0] = iconvg_private_encode_relative_coordinate_number(
+        self->private_start_x, args[0].value);
+    relative[1] = iconvg_private_encode_relative_coordinate_number(
+        self->private_start_y, args[1].value);
+    if (relative[0].len && relative[1].len &&
+        ((relative[0].len + relative[1].len) < (args[0].len + args[1].len))) {
+      ICONVG_PRIVATE_TRY(iconvg_private_encoder__write_single(
+          self, 0xE3, relative, 2));  // 'z; m'.
+      args[0].value = relative[0].value;
+      args[1].value = relative[1].value;
+    } else {
+      ICONVG_PRIVATE_TRY(iconvg_private_encoder__write_single(
+          self, 0xE2, args, 2));  // 'z; M'.
+    }
+  }
+
+  self->private_curr_x = args[0].value;
+  self->private_curr_y = args[1].value;
+  self->private_start_x = args[0].value;
+  self->private_start_y = args[1].value;
+  self->private_refl_x = args[0].value;
+  self->private_refl_y = args[1].value;
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__end_path(iconvg_encoder* self) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH));
+  // Closing a path doesn't write anything yet. The next opcode ('z', 'z; M'
+  // or 'z; m') does that, depending on what comes next.
+  self->private_mode = ICONVG_PRIVATE_ENCODER_MODE__DRAWING_AFTER_PATH;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__path_line_to(iconvg_encoder* self, float x1, float y1) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH));
+  if (!isfinite(x1) || !isfinite(y1)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+  float curr_x = self->private_curr_x;
+  float curr_y = self->private_curr_y;
+
+  iconvg_private_encoded_number absolute[2];
+  absolute[0] = iconvg_private_encode_coordinate_number(x1);
+  absolute[1] = iconvg_private_encode_coordinate_number(y1);
+  iconvg_private_encoded_number relative[2];
+  relative[0] = iconvg_private_encode_relative_coordinate_number(curr_x,
+                                                            absolute[0].value);
+  relative[1] = iconvg_private_encode_relative_coordinate_number(curr_y,
+                                                            absolute[1].value);
+
+  // Pick the cheapest of 'L', 'l', 'H', 'h', 'V' and 'v'. Ties go to the
+  // earlier (in that list) mnemonic.
+  uint8_t opcode = 0x00;
+  const iconvg_private_encoded_number* args = absolute;
+  size_t num_args = 2;
+  size_t cost = iconvg_private_encoder__segment_cost(self, 0x00, absolute, 2);
+  size_t c = iconvg_private_encoder__segment_cost(self, 0x20, relative, 2);
+  if (c < cost) {
+    opcode = 0x20;
+    args = relative;
+    num_args = 2;
+    cost = c;
+  }
+  if (absolute[1].value == curr_y) {
+    if ((1 + absolute[0].len) < cost) {
+      opcode = 0xE6;
+      args = &absolute[0];
+      num_args = 1;
+      cost = 1 + absolute[0].len;
+    }
+    if (relative[0].len && ((1 + relative[0].len) < cost)) {
+      opcode = 0xE7;
+      args = &relative[0];
+      num_args = 1;
+      cost = 1 + relative[0].len;
+    }
+  }
+  if (absolute[0].value == curr_x) {
+    if ((1 + absolute[1].len) < cost) {
+      opcode = 0xE8;
+      args = &absolute[1];
+      num_args = 1;
+      cost = 1 + absolute[1].len;
+    }
+    if (relative[1].len && ((1 + relative[1].len) < cost)) {
+      opcode = 0xE9;
+      args = &relative[1];
+      num_args = 1;
+      cost = 1 + relative[1].len;
+    }
+  }
+
+  switch (opcode) {
+    case 0x00:
+    case 0x20:
+      ICONVG_PRIVATE_TRY(
+          iconvg_private_encoder__write_segment(self, opcode, args, num_args));
+      curr_x = args[0].value;
+      curr_y = args[1].value;
+      break;
+    case 0xE6:
+    case 0xE7:
+      ICONVG_PRIVATE_TRY(
+          iconvg_private_encoder__write_single(self, opcode, args, num_args));
+      curr_x = args[0].value;
+      break;
+    default:
+      ICONVG_PRIVATE_TRY(
+          iconvg_private_encoder__write_single(self, opcode, args, num_args));
+      curr_y = args[0].value;
+      break;
+  }
+
+  self->private_curr_x = curr_x;
+  self->private_curr_y = curr_y;
+  self->private_refl_x = curr_x;
+  self->private_refl_y = curr_y;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__path_quad_to(iconvg_encoder* self,
+                             float x1,
+                             float y1,
+                             float x2,
+                             float y2) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH));
+  if (!isfinite(x1) || !isfinite(y1) || !isfinite(x2) || !isfinite(y2)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+  float curr_x = self->private_curr_x;
+  float curr_y = self->private_curr_y;
+
+  iconvg_private_encoded_number absolute[4];
+  absolute[0] = iconvg_private_encode_coordinate_number(x1);
+  absolute[1] = iconvg_private_encode_coordinate_number(y1);
+  absolute[2] = iconvg_private_encode_coordinate_number(x2);
+  absolute[3] = iconvg_private_encode_coordinate_number(y2);
+  iconvg_private_encoded_number relative[4];
+  relative[0] = iconvg_private_encode_relative_coordinate_number(curr_x,
+                                                            absolute[0].value);
+  relative[1] = iconvg_private_encode_relative_coordinate_number(curr_y,
+                                                            absolute[1].value);
+  relative[2] = iconvg_private_encode_relative_coordinate_number(curr_x,
+                                                            absolute[2].value);
+  relative[3] = iconvg_private_encode_relative_coordinate_number(curr_y,
+                                                            absolute[3].value);
+
+  // Pick the cheapest of 'T', 't', 'Q' and 'q'. The smooth forms ('T' and
+  // 't') are only possible if the control point is the reflection of the
+  // previous one, as the decoder computes it.
+  bool smooth = (absolute[0].value == self->private_refl_x) &&
+                (absolute[1].value == self->private_refl_y);
+  uint8_t opcode = 0x60;
+  const iconvg_private_encoded_number* args = absolute;
+  size_t num_args = 4;
+  size_t cost = iconvg_private_encoder__segment_cost(self, 0x60, absolute, 4);
+  size_t c = iconvg_private_encoder__segment_cost(self, 0x70, relative, 4);
+  if (c < cost) {
+    opcode = 0x70;
+    args = relative;
+    num_args = 4;
+    cost = c;
+  }
+  if (smooth) {
+    c = iconvg_private_encoder__segment_cost(self, 0x40, &absolute[2], 2);
+    if (c < cost) {
+      opcode = 0x40;
+      args = &absolute[2];
+      num_args = 2;
+      cost = c;
+    }
+    c = iconvg_private_encoder__segment_cost(self, 0x50, &relative[2], 2);
+    if (c < cost) {
+      opcode = 0x50;
+      args = &relative[2];
+      num_args = 2;
+      cost = c;
+    }
+  }
+  ICONVG_PRIVATE_TRY(
+      iconvg_private_encoder__write_segment(self, opcode, args, num_args));
+
+  float ctrl_x = (num_args == 4) ? args[0].value : self->private_refl_x;
+  float ctrl_y = (num_args == 4) ? args[1].value : self->private_refl_y;
+  curr_x = args[num_args - 2].value;
+  curr_y = args[num_args - 1].value;
+  self->private_curr_x = curr_x;
+  self->private_curr_y = curr_y;
+  self->private_refl_x = (2 * curr_x) - ctrl_x;
+  self->private_refl_y = (2 * curr_y) - ctrl_y;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__path_cube_to(iconvg_encoder* self,
+                             float x1,
+                             float y1,
+                             float x2,
+                             float y2,
+                             float x3,
+                             float y3) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH));
+  if (!isfinite(x1) || !isfinite(y1) || !isfinite(x2) || !isfinite(y2) ||
+      !isfinite(x3) || !isfinite(y3)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+  float curr_x = self->private_curr_x;
+  float curr_y = self->private_curr_y;
+
+  iconvg_private_encoded_number absolute[6];
+  absolute[0] = iconvg_private_encode_coordinate_number(x1);
+  absolute[1] = iconvg_private_encode_coordinate_number(y1);
+  absolute[2] = iconvg_private_encode_coordinate_number(x2);
+  absolute[3] = iconvg_private_encode_coordinate_number(y2);
+  absolute[4] = iconvg_private_encode_coordinate_number(x3);
+  absolute[5] = iconvg_private_encode_coordinate_number(y3);
+  iconvg_private_encoded_number relative[6];
+  for (int i = 0; i < 6; i += 2) {
+    relative[i + 0] = iconvg_private_encode_relative_coordinate_number(
+        curr_x, absolute[i + 0].value);
+    relative[i + 1] = iconvg_private_encode_relative_coordinate_number(
+        curr_y, absolute[i + 1].value);
+  }
+
+  // Pick the cheapest of 'S', 's', 'C' and 'c'. The smooth forms ('S' and
+  // 's') are only possible if the first control point is the reflection of
+  // the previous one, as the decoder computes it.
+  bool smooth = (absolute[0].value == self->private_refl_x) &&
+                (absolute[1].value == self->private_refl_y);
+  uint8_t opcode = 0xA0;
+  const iconvg_private_encoded_number* args = absolute;
+  size_t num_args = 6;
+  size_t cost = iconvg_private_encoder__segment_cost(self, 0xA0, absolute, 6);
+  size_t c = iconvg_private_encoder__segment_cost(self, 0xB0, relative, 6);
+  if (c < cost) {
+    opcode = 0xB0;
+    args = relative;
+    num_args = 6;
+    cost = c;
+  }
+  if (smooth) {
+    c = iconvg_private_encoder__segment_cost(self, 0x80, &absolute[2], 4);
+    if (c < cost) {
+      opcode = 0x80;
+      args = &absolute[2];
+      num_args = 4;
+      cost = c;
+    }
+    c = iconvg_private_encoder__segment_cost(self, 0x90, &relative[2], 4);
+    if (c < cost) {
+      opcode = 0x90;
+      args = &relative[2];
+      num_args = 4;
+      cost = c;
+    }
+  }
+  ICONVG_PRIVATE_TRY(
+      iconvg_private_encoder__write_segment(self, opcode, args, num_args));
+
+  float ctrl_x = args[num_args - 4].value;
+  float ctrl_y = args[num_args - 3].value;
+  curr_x = args[num_args - 2].value;
+  curr_y = args[num_args - 1].value;
+  self->private_curr_x = curr_x;
+  self->private_curr_y = curr_y;
+  self->private_refl_x = (2 * curr_x) - ctrl_x;
+  self->private_refl_y = (2 * curr_y) - ctrl_y;
+  return NULL;
+}
+
+const char*  //
+iconvg_encoder__path_arc_to(iconvg_encoder* self,
+                            float radius_x,
+                            float radius_y,
+                            float x_axis_rotation,
+                            bool large_arc,
+                            bool sweep,
+                            float final_x,
+                            float final_y) {
+  ICONVG_PRIVATE_TRY(iconvg_private_encoder__check(
+      self, ICONVG_PRIVATE_ENCODER_MODE__DRAWING_IN_PATH));
+  if (!isfinite(radius_x) || !isfinite(radius_y) ||
+      !isfinite(x_axis_rotation) || !isfinite(final_x) || !isfinite(final_y)) {
+    return iconvg_private_encoder__fail(self,
+                                        iconvg_error_invalid_encoder_argument);
+  }
+
+  // Normalize the rotation to the range [0, 1).
+  double rotation = (double)x_axis_rotation;
+  rotation -= floor(rotation);
+  if (((float)rotation) >= 1.0f) {
+    rotation = 0;
+  }
+
+  iconvg_private_encoded_number args[6];
+  args[0] = iconvg_private_encode_coordinate_number(radius_x);
+  args[1] = iconvg_private_encode_coordinate_number(radius_y);
+  args[2] = iconvg_private_encode_zero_to_one_number((float)rotation);
+  args[3] = iconvg_private_encode_natural_number((large_arc ? 0x01 : 0x00) |
+                                                 (sweep ? 0x02 : 0x00));
+  args[4] = iconvg_private_encode_coordinate_number(final_x);
+  args[5] = iconvg_private_encode_coordinate_number(final_y);
+  iconvg_private_encoded_number relative[6];
+  memcpy(&relative[0], &args[0], 4 * sizeof(args[0]));
+  relative[4] = iconvg_private_encode_relative_coordinate_number(
+      self->private_curr_x, args[4].value);
+  relative[5] = iconvg_private_encode_relative_coordinate_number(
+      self->private_curr_y, args[5].value);
+
+  uint8_t opcode = 0xC0;
+  size_t cost = iconvg_private_encoder__segment_cost(self, 0xC0, args, 6);
+  size_t c = iconvg_private_encoder__segment_cost(self, 0xD0, relative, 6);
+  if (c < cost) {
+    opcode = 0xD0;
+    memcpy(&args[0], &relative[0], 6 * sizeof(args[0]));
+  }
+  ICONVG_PRIVATE_TRY(
+      iconvg_private_encoder__write_segment(self, opcode, args, 6));
+
+  self->private_curr_x = args[4].value;
+  self->private_curr_y = args[5].value;
+  self->private_refl_x = args[4].value;
+  self->private_refl_y = args[5].value;
+  return NULL;
+}
+
+// ----
+
+const char*  //
+iconvg_encoder__finish(iconvg_encoder* self) {
+  return iconvg_private_encoder__check(self,
+                                       ICONVG_PRIVATE_ENCODER_MODE__STYLING);
+}
@@ -24,6 +24,8 @@ const char iconvg_error_bad_magic_identifier[] =  //
     "iconvg: bad magic identifier";
 const char iconvg_error_bad_metadata[] =  //
     "iconvg: bad metadata";
+const char iconvg_error_bad_metadata_drawing_index[] =  //
+    "iconvg: bad metadata (drawing index)";
 const char iconvg_error_bad_metadata_id_order[] =  //
     "iconvg: bad metadata ID order";
 const char iconvg_error_bad_metadata_suggested_palette[] =  //
@@ -42,10 +44,32 @@ const char iconvg_error_system_failure_out_of_memory[] =  //
 
 const char iconvg_error_invalid_backend_not_enabled[] =  //
     "iconvg: invalid backend (not enabled)";
+const char iconvg_error_invalid_batch_argument[] =  //
+    "iconvg: invalid batch argument";
+const char iconvg_error_invalid_buffer_too_small[] =  //
+    "iconvg: invalid buffer (too small)";
 const char iconvg_error_invalid_constructor_argument[] =  //
     "iconvg: invalid constructor argument";
+const char iconvg_error_invalid_damage_argument[] =  //
+    "iconvg: invalid damage argument";
+const char iconvg_error_invalid_dst_transform[] =  //
+    "iconvg: invalid dst transform";
+const char iconvg_error_invalid_encoder_argument[] =  //
+    "iconvg: invalid encoder argument";
+const char iconvg_error_invalid_encoder_state[] =  //
+    "iconvg: invalid encoder state";
+const char iconvg_error_invalid_instances_argument[] =  //
+    "iconvg: invalid instances argument";
+const char iconvg_error_invalid_mipmap_argument[] =  //
+    "iconvg: invalid mipmap argument";
 const char iconvg_error_invalid_paint_type[] =  //
     "iconvg: invalid paint type";
+const char iconvg_error_invalid_pixel_argument[] =  //
+    "iconvg: invalid pixel argument";
+const char iconvg_error_invalid_raster_cache_argument[] =  //
+    "iconvg: invalid raster cache argument";
+const char iconvg_error_invalid_trace[] =  //
+    "iconvg: invalid trace";
 const char iconvg_error_unsupported_vtable[] =  //
     "iconvg: unsupported vtable";
 
@@ -61,6 +85,7 @@ iconvg_error_is_file_format_error(const char* err_msg) {
          (err_msg == iconvg_error_bad_drawing_opcode) ||
          (err_msg == iconvg_error_bad_magic_identifier) ||
          (err_msg == iconvg_error_bad_metadata) ||
+         (err_msg == iconvg_error_bad_metadata_drawing_index) ||
          (err_msg == iconvg_error_bad_metadata_id_order) ||
          (err_msg == iconvg_error_bad_metadata_suggested_palette) ||
          (err_msg == iconvg_error_bad_metadata_viewbox) ||
@@ -68,3 +93,46 @@ iconvg_error_is_file_format_error(const char* err_msg) {
          (err_msg == iconvg_error_bad_path_unfinished) ||
          (err_msg == iconvg_error_bad_styling_opcode);
 }
+
+const char*  //
+iconvg_private_error_from_string(const char* s) {
+  static const char* const errors[] = {
+      iconvg_error_bad_color,
+      iconvg_error_bad_coordinate,
+      iconvg_error_bad_drawing_opcode,
+      iconvg_error_bad_magic_identifier,
+      iconvg_error_bad_metadata,
+      iconvg_error_bad_metadata_drawing_index,
+      iconvg_error_bad_metadata_id_order,
+      iconvg_error_bad_metadata_suggested_palette,
+      iconvg_error_bad_metadata_viewbox,
+      iconvg_error_bad_number,
+      iconvg_error_bad_path_unfinished,
+      iconvg_error_bad_styling_opcode,
+      iconvg_error_system_failure_out_of_memory,
+      iconvg_error_invalid_backend_not_enabled,
+      iconvg_error_invalid_batch_argument,
+      iconvg_error_invalid_buffer_too_small,
+      iconvg_error_invalid_constructor_argument,
+      iconvg_error_invalid_damage_argument,
+      iconvg_error_invalid_dst_transform,
+      iconvg_error_invalid_encoder_argument,
+      iconvg_error_invalid_encoder_state,
+      iconvg_error_invalid_instances_argument,
+      iconvg_error_invalid_mipmap_argument,
+      iconvg_error_invalid_paint_type,
+      iconvg_error_invalid_pixel_argument,
+      iconvg_error_invalid_raster_cache_argument,
+      iconvg_error_invalid_trace,
+      iconvg_error_unsupported_vtable,
+      iconvg_private_internal_error_unreachable,
+  };
+  if (s) {
+    for (size_t i = 0; i < (sizeof(errors) / sizeof(errors[0])); i++) {
+      if (!strcmp(s, errors[i])) {
+        return errors[i];
+      }
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,278 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// The instances canvas sits between iconvg_decode and the wrapped canvas
+// passed to iconvg_decode_instances. context_nonconst_ptr0 points to an
+// iconvg_private_instances_state.
+//
+// If the wrapped canvas implements end_drawing_instances then every call is
+// forwarded as is, other than end_drawing. Otherwise, each drawing's path is
+// buffered and, at end_drawing, replayed once per instance.
+
+typedef struct iconvg_private_instances_state_struct {
+  iconvg_canvas* wrapped;
+  float min_dx;
+  float min_dy;
+  float max_dx;
+  float max_dy;
+  const float* offsets_xy;
+  size_t num_instances;
+  bool forward;
+  iconvg_growable_buffer path;
+} iconvg_private_instances_state;
+
+static const char*  //
+iconvg_private_instances_canvas__begin_decode(iconvg_canvas* c,
+                                              iconvg_rectangle_f32 dst_rect) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  iconvg_canvas* w = s->wrapped;
+  // dst_rect already accounts for any dst_transform. Grow it to cover every
+  // instance.
+  iconvg_rectangle_f32 union_rect = iconvg_make_rectangle_f32(
+      dst_rect.min_x + s->min_dx, dst_rect.min_y + s->min_dy,  //
+      dst_rect.max_x + s->max_dx, dst_rect.max_y + s->max_dy);
+  return (*w->vtable->begin_decode)(w, union_rect);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__end_decode(iconvg_canvas* c,
+                                            const char* err_msg,
+                                            size_t num_bytes_consumed,
+                                            size_t num_bytes_remaining) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  iconvg_canvas* w = s->wrapped;
+  return (*w->vtable->end_decode)(w, err_msg, num_bytes_consumed,
+                                  num_bytes_remaining);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__begin_drawing(iconvg_canvas* c) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->begin_drawing)(w);
+  }
+  s->path.len = 0;
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_instances_canvas__end_drawing(iconvg_canvas* c,
+                                             const iconvg_paint* p) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  iconvg_canvas* w = s->wrapped;
+  if (s->forward) {
+    return (*w->vtable->end_drawing_instances)(w, p, s->offsets_xy,
+                                               s->num_instances);
+  }
+
+  for (size_t i = 0; i < s->num_instances; i++) {
+    float dx = s->offsets_xy[(2 * i) + 0];
+    float dy = s->offsets_xy[(2 * i) + 1];
+    ICONVG_PRIVATE_TRY((*w->vtable->begin_drawing)(w));
+    ICONVG_PRIVATE_TRY(iconvg_private_path_buffer__replay(
+        s->path.ptr, s->path.len, w, dx, dy));
+
+    // Translate the paint too, so that gradients move with their paths. The
+    // offset applies after any dst_transform, so it is folded into the
+    // inverse_dst_transform (as a translation by -offset, applied first).
+    iconvg_paint q = *p;
+    iconvg_matrix_2x3_f64* m = &q.inverse_dst_transform;
+    m->elems[0][2] -= (m->elems[0][0] * dx) + (m->elems[0][1] * dy);
+    m->elems[1][2] -= (m->elems[1][0] * dx) + (m->elems[1][1] * dy);
+    ICONVG_PRIVATE_TRY((*w->vtable->end_drawing)(w, &q));
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_instances_canvas__begin_path(iconvg_canvas* c,
+                                            float x0,
+                                            float y0) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->begin_path)(w, x0, y0);
+  }
+  float args[2] = {x0, y0};
+  return iconvg_private_path_buffer__append(
+      &s->path, ICONVG_PRIVATE_PATH_OP__BEGIN_PATH, args, 2);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__end_path(iconvg_canvas* c) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->end_path)(w);
+  }
+  return iconvg_private_path_buffer__append(
+      &s->path, ICONVG_PRIVATE_PATH_OP__END_PATH, NULL, 0);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__path_line_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->path_line_to)(w, x1, y1);
+  }
+  float args[2] = {x1, y1};
+  return iconvg_private_path_buffer__append(
+      &s->path, ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO, args, 2);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__path_quad_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1,
+                                              float x2,
+                                              float y2) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->path_quad_to)(w, x1, y1, x2, y2);
+  }
+  float args[4] = {x1, y1, x2, y2};
+  return iconvg_private_path_buffer__append(
+      &s->path, ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO, args, 4);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__path_cube_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1,
+                                              float x2,
+                                              float y2,
+                                              float x3,
+                                              float y3) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  if (s->forward) {
+    iconvg_canvas* w = s->wrapped;
+    return (*w->vtable->path_cube_to)(w, x1, y1, x2, y2, x3, y3);
+  }
+  float args[6] = {x1, y1, x2, y2, x3, y3};
+  return iconvg_private_path_buffer__append(
+      &s->path, ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO, args, 6);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  iconvg_canvas* w = s->wrapped;
+  return (*w->vtable->on_metadata_viewbox)(w, viewbox);
+}
+
+static const char*  //
+iconvg_private_instances_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  iconvg_private_instances_state* s =
+      (iconvg_private_instances_state*)(c->context_nonconst_ptr0);
+  iconvg_canvas* w = s->wrapped;
+  return (*w->vtable->on_metadata_suggested_palette)(w, suggested_palette);
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_instances_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_instances_canvas__begin_decode,
+        &iconvg_private_instances_canvas__end_decode,
+        &iconvg_private_instances_canvas__begin_drawing,
+        &iconvg_private_instances_canvas__end_drawing,
+        &iconvg_private_instances_canvas__begin_path,
+        &iconvg_private_instances_canvas__end_path,
+        &iconvg_private_instances_canvas__path_line_to,
+        &iconvg_private_instances_canvas__path_quad_to,
+        &iconvg_private_instances_canvas__path_cube_to,
+        &iconvg_private_instances_canvas__on_metadata_viewbox,
+        &iconvg_private_instances_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// ----
+
+const char*  //
+iconvg_decode_instances(iconvg_canvas* dst_canvas,
+                        iconvg_rectangle_f32 dst_rect,
+                        const uint8_t* src_ptr,
+                        size_t src_len,
+                        const float* offsets_xy,
+                        size_t num_instances,
+                        const iconvg_decode_options* options) {
+  iconvg_canvas fallback_canvas = iconvg_make_broken_canvas(NULL);
+  if (!dst_canvas || !dst_canvas->vtable) {
+    dst_canvas = &fallback_canvas;
+  }
+  if (dst_canvas->vtable->sizeof__iconvg_canvas_vtable !=
+      sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  } else if (!offsets_xy && (num_instances > 0)) {
+    return iconvg_error_invalid_instances_argument;
+  }
+
+  iconvg_private_instances_state s;
+  s.wrapped = dst_canvas;
+  s.min_dx = 0.0f;
+  s.min_dy = 0.0f;
+  s.max_dx = 0.0f;
+  s.max_dy = 0.0f;
+  s.offsets_xy = offsets_xy;
+  s.num_instances = num_instances;
+  s.forward = dst_canvas->vtable->end_drawing_instances && (num_instances > 0);
+  s.path = iconvg_make_growable_buffer(NULL, 0);
+  s.path.grow = &iconvg_growable_buffer__realloc_grow;
+
+  if (num_instances > 0) {
+    s.min_dx = offsets_xy[0];
+    s.min_dy = offsets_xy[1];
+    s.max_dx = offsets_xy[0];
+    s.max_dy = offsets_xy[1];
+    for (size_t i = 1; i < num_instances; i++) {
+      float dx = offsets_xy[(2 * i) + 0];
+      float dy = offsets_xy[(2 * i) + 1];
+      s.min_dx = (s.min_dx < dx) ? s.min_dx : dx;
+      s.min_dy = (s.min_dy < dy) ? s.min_dy : dy;
+      s.max_dx = (s.max_dx > dx) ? s.max_dx : dx;
+      s.max_dy = (s.max_dy > dy) ? s.max_dy : dy;
+    }
+  }
+
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_instances_canvas_vtable;
+  c.context_nonconst_ptr0 = &s;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+
+  const char* err_msg = iconvg_decode(&c, dst_rect, src_ptr, src_len, options);
+  free(s.path.ptr);
+  return err_msg;
+}
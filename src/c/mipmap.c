@@ -0,0 +1,313 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// The hash canvas computes a 64-bit FNV-1a hash of its vtable calls and their
+// arguments. context_nonconst_ptr0 points to the uint64_t hash.
+
+static inline void  //
+iconvg_private_hash_canvas__update(iconvg_canvas* c,
+                                   const void* ptr,
+                                   size_t len) {
+  uint64_t* hash = (uint64_t*)(c->context_nonconst_ptr0);
+  uint64_t h = *hash;
+  const uint8_t* p = (const uint8_t*)ptr;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 0x00000100000001B3ull;
+  }
+  *hash = h;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__begin_decode(iconvg_canvas* c,
+                                         iconvg_rectangle_f32 dst_rect) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__end_decode(iconvg_canvas* c,
+                                       const char* err_msg,
+                                       size_t num_bytes_consumed,
+                                       size_t num_bytes_remaining) {
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__begin_drawing(iconvg_canvas* c) {
+  static const uint8_t op = 0x03;
+  iconvg_private_hash_canvas__update(c, &op, 1);
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__end_drawing(iconvg_canvas* c,
+                                        const iconvg_paint* p) {
+  static const uint8_t op = 0x04;
+  iconvg_private_hash_canvas__update(c, &op, 1);
+  iconvg_private_hash_canvas__update(c, &p->paint_rgba[0], 4);
+  switch (iconvg_paint__type(p)) {
+    case ICONVG_PAINT_TYPE__LINEAR_GRADIENT:
+    case ICONVG_PAINT_TYPE__RADIAL_GRADIENT: {
+      iconvg_matrix_2x3_f64 m = iconvg_paint__gradient_transformation_matrix(p);
+      iconvg_private_hash_canvas__update(c, &m, sizeof(m));
+      uint32_t nstops = iconvg_paint__gradient_number_of_stops(p);
+      for (uint32_t i = 0; i < nstops; i++) {
+        iconvg_premul_color k =
+            iconvg_paint__gradient_stop_color_as_premul_color(p, i);
+        float offset = iconvg_paint__gradient_stop_offset(p, i);
+        iconvg_private_hash_canvas__update(c, &k, sizeof(k));
+        iconvg_private_hash_canvas__update(c, &offset, sizeof(offset));
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  float args[3] = {5, x0, y0};
+  iconvg_private_hash_canvas__update(c, &args[0], sizeof(args));
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__end_path(iconvg_canvas* c) {
+  static const uint8_t op = 0x06;
+  iconvg_private_hash_canvas__update(c, &op, 1);
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__path_line_to(iconvg_canvas* c, float x1, float y1) {
+  float args[3] = {7, x1, y1};
+  iconvg_private_hash_canvas__update(c, &args[0], sizeof(args));
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__path_quad_to(iconvg_canvas* c,
+                                         float x1,
+                                         float y1,
+                                         float x2,
+                                         float y2) {
+  float args[5] = {8, x1, y1, x2, y2};
+  iconvg_private_hash_canvas__update(c, &args[0], sizeof(args));
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__path_cube_to(iconvg_canvas* c,
+                                         float x1,
+                                         float y1,
+                                         float x2,
+                                         float y2,
+                                         float x3,
+                                         float y3) {
+  float args[7] = {9, x1, y1, x2, y2, x3, y3};
+  iconvg_private_hash_canvas__update(c, &args[0], sizeof(args));
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__on_metadata_viewbox(iconvg_canvas* c,
+                                                iconvg_rectangle_f32 viewbox) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_hash_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  return NULL;
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_hash_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_hash_canvas__begin_decode,
+        &iconvg_private_hash_canvas__end_decode,
+        &iconvg_private_hash_canvas__begin_drawing,
+        &iconvg_private_hash_canvas__end_drawing,
+        &iconvg_private_hash_canvas__begin_path,
+        &iconvg_private_hash_canvas__end_path,
+        &iconvg_private_hash_canvas__path_line_to,
+        &iconvg_private_hash_canvas__path_quad_to,
+        &iconvg_private_hash_canvas__path_cube_to,
+        &iconvg_private_hash_canvas__on_metadata_viewbox,
+        &iconvg_private_hash_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// iconvg_private_mipmap_signature sets *dst_hash to a hash of what decoding
+// src would draw, with Level of Detail thresholds evaluated at the given
+// height (in pixels) but with geometry always mapped to the fixed dst_rect.
+// Two heights with equal signatures draw the same paths and paints.
+static const char*  //
+iconvg_private_mipmap_signature(uint64_t* dst_hash,
+                                iconvg_rectangle_f32 dst_rect,
+                                int64_t height_in_pixels,
+                                const uint8_t* src_ptr,
+                                size_t src_len,
+                                const iconvg_decode_options* options) {
+  iconvg_decode_options o = iconvg_make_decode_options_ffv1(NULL);
+  if (options) {
+    o.palette = options->palette;
+    o.height_in_pixels = options->height_in_pixels;
+  }
+  if (!o.height_in_pixels.has_value) {
+    o.height_in_pixels = iconvg_make_optional_i64_some(height_in_pixels);
+  }
+
+  *dst_hash = 0xCBF29CE484222325ull;  // The FNV-1a offset basis.
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_hash_canvas_vtable;
+  c.context_nonconst_ptr0 = dst_hash;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+  return iconvg_decode(&c, dst_rect, src_ptr, src_len, &o);
+}
+
+// ----
+
+// iconvg_private_mipmap_downsample sets dst to a 2x2 box filter of src. Both
+// hold 4 bytes (4 premultiplied-alpha channels, in any order) per pixel. When
+// a src dimension is 1, that single row or column is weighted double.
+//
+// Each uint32_t pixel is split into two 0x00FF00FF-masked halves, so that one
+// integer addition sums two channels at a time (SIMD within a register). The
+// per-channel sums are at most ((4 * 0xFF) + 2), which cannot overflow into
+// the neighboring 16-bit lane.
+static void  //
+iconvg_private_mipmap_downsample(iconvg_mipmap_level* dst,
+                                 const iconvg_mipmap_level* src) {
+  const uint32_t mask = 0x00FF00FF;
+  for (uint32_t y = 0; y < dst->height; y++) {
+    uint32_t sy0 = 2 * y;
+    uint32_t sy1 = ((sy0 + 1) < src->height) ? (sy0 + 1) : sy0;
+    const uint8_t* row0 = src->ptr + (sy0 * src->stride);
+    const uint8_t* row1 = src->ptr + (sy1 * src->stride);
+    uint8_t* d = dst->ptr + (y * dst->stride);
+    for (uint32_t x = 0; x < dst->width; x++) {
+      uint32_t sx0 = 2 * x;
+      uint32_t sx1 = ((sx0 + 1) < src->width) ? (sx0 + 1) : sx0;
+      uint32_t p = iconvg_private_peek_u32le(row0 + (4 * sx0));
+      uint32_t q = iconvg_private_peek_u32le(row0 + (4 * sx1));
+      uint32_t r = iconvg_private_peek_u32le(row1 + (4 * sx0));
+      uint32_t s = iconvg_private_peek_u32le(row1 + (4 * sx1));
+      uint32_t lo = (p & mask) + (q & mask) + (r & mask) + (s & mask) +
+                    0x00020002;
+      uint32_t hi = ((p >> 8) & mask) + ((q >> 8) & mask) +
+                    ((r >> 8) & mask) + ((s >> 8) & mask) + 0x00020002;
+      iconvg_private_poke_u32le(
+          d + (4 * x), ((lo >> 2) & mask) | (((hi >> 2) & mask) << 8));
+    }
+  }
+}
+
+// ----
+
+size_t  //
+iconvg_mipmap_chain_byte_length(uint32_t width, uint32_t height) {
+  if ((width == 0) || (height == 0)) {
+    return 0;
+  }
+  size_t n = 0;
+  while (true) {
+    size_t w = width;
+    size_t h = height;
+    if ((h > ((SIZE_MAX / 4) / w)) || ((4 * w * h) > (SIZE_MAX - n))) {
+      return 0;
+    }
+    n += 4 * w * h;
+    if ((width == 1) && (height == 1)) {
+      break;
+    }
+    width = (width > 1) ? (width / 2) : 1;
+    height = (height > 1) ? (height / 2) : 1;
+  }
+  return n;
+}
+
+const char*  //
+iconvg_decode_mipmap_chain(iconvg_mipmap_chain* dst_chain,
+                           uint8_t* dst_ptr,
+                           size_t dst_len,
+                           uint32_t width,
+                           uint32_t height,
+                           iconvg_mipmap_render_func render,
+                           void* render_context,
+                           const uint8_t* src_ptr,
+                           size_t src_len,
+                           const iconvg_decode_options* options) {
+  if (!dst_chain || !render || (width == 0) || (height == 0)) {
+    return iconvg_error_invalid_mipmap_argument;
+  }
+  size_t n = iconvg_mipmap_chain_byte_length(width, height);
+  if ((n == 0) || (n > dst_len) || !dst_ptr) {
+    return iconvg_error_invalid_buffer_too_small;
+  }
+
+  // Lay out the levels, largest first.
+  dst_chain->num_levels = 0;
+  {
+    uint8_t* ptr = dst_ptr;
+    uint32_t w = width;
+    uint32_t h = height;
+    while (true) {
+      iconvg_mipmap_level* level = &dst_chain->levels[dst_chain->num_levels++];
+      level->ptr = ptr;
+      level->stride = 4 * ((size_t)w);
+      level->width = w;
+      level->height = h;
+      level->rendered = false;
+      ptr += level->stride * h;
+      if ((w == 1) && (h == 1)) {
+        break;
+      }
+      w = (w > 1) ? (w / 2) : 1;
+      h = (h > 1) ? (h / 2) : 1;
+    }
+  }
+
+  // Level 0 is always rendered. Each subsequent level is downsampled from the
+  // previous level, unless the Level of Detail thresholds select a different
+  // set of paths at the smaller height, in which case it is rendered too.
+  iconvg_rectangle_f32 signature_rect =
+      iconvg_make_rectangle_f32(0, 0, (float)width, (float)height);
+  uint64_t prev_signature = 0;
+  for (uint32_t i = 0; i < dst_chain->num_levels; i++) {
+    iconvg_mipmap_level* level = &dst_chain->levels[i];
+    uint64_t signature = 0;
+    ICONVG_PRIVATE_TRY(iconvg_private_mipmap_signature(
+        &signature, signature_rect, (int64_t)(level->height), src_ptr, src_len,
+        options));
+
+    if ((i > 0) && (signature == prev_signature)) {
+      iconvg_private_mipmap_downsample(level, &dst_chain->levels[i - 1]);
+    } else {
+      memset(level->ptr, 0, level->stride * level->height);
+      level->rendered = true;
+      ICONVG_PRIVATE_TRY(
+          (*render)(render_context, level, src_ptr, src_len, options));
+    }
+    prev_signature = signature;
+  }
+  return NULL;
+}
@@ -165,5 +165,56 @@ iconvg_paint__gradient_transformation_matrix(const iconvg_paint* self) {
   double d11 = s11 * self->d2s_scale_y;
   double d12 = (s10 * self->d2s_bias_x) + (s11 * self->d2s_bias_y) + s12;
 
-  return iconvg_make_matrix_2x3_f64(d00, d01, d02, d10, d11, d12);
+  // Those dst coordinates are before any iconvg_decode_options dst_transform.
+  // Applying its inverse first gives the matrix for the transformed dst.
+  iconvg_matrix_2x3_f64 m =
+      iconvg_make_matrix_2x3_f64(d00, d01, d02, d10, d11, d12);
+  return iconvg_private_matrix_2x3_f64__mul(&m, &self->inverse_dst_transform);
+}
+
+size_t  //
+iconvg_paint__snapshot(const iconvg_paint* self, iconvg_paint_snapshot* dst) {
+  if (!self || !dst) {
+    return 0;
+  }
+  dst->type = iconvg_paint__type(self);
+  switch (dst->type) {
+    case ICONVG_PAINT_TYPE__LINEAR_GRADIENT:
+    case ICONVG_PAINT_TYPE__RADIAL_GRADIENT:
+      break;
+    default:
+      dst->flat_color = iconvg_paint__flat_color_as_premul_color(self);
+      dst->gradient_spread = ICONVG_GRADIENT_SPREAD__NONE;
+      dst->gradient_number_of_stops = 0;
+      return offsetof(iconvg_paint_snapshot, gradient_transformation_matrix);
+  }
+
+  uint32_t n = iconvg_paint__gradient_number_of_stops(self);
+  memset(&dst->flat_color, 0, sizeof(dst->flat_color));
+  dst->gradient_spread = iconvg_paint__gradient_spread(self);
+  dst->gradient_number_of_stops = n;
+  dst->gradient_transformation_matrix =
+      iconvg_paint__gradient_transformation_matrix(self);
+  for (uint32_t i = 0; i < n; i++) {
+    dst->gradient_stops[i].color =
+        iconvg_paint__gradient_stop_color_as_premul_color(self, i);
+    dst->gradient_stops[i].offset = iconvg_paint__gradient_stop_offset(self, i);
+  }
+  return offsetof(iconvg_paint_snapshot, gradient_stops) +
+         (n * sizeof(iconvg_paint_snapshot_stop));
+}
+
+iconvg_source_position  //
+iconvg_paint__source_position(const iconvg_paint* self) {
+  if (!self) {
+    iconvg_source_position z;
+    memset(&z, 0, sizeof(z));
+    return z;
+  }
+  return self->source_position;
+}
+
+uint64_t  //
+iconvg_paint__palette_dependencies(const iconvg_paint* self) {
+  return self ? self->palette_dependencies : 0;
 }
@@ -0,0 +1,138 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// The palette canvas ORs each drawing's palette dependencies into the uint64_t
+// pointed to by context_nonconst_ptr0. It paints nothing.
+
+static const char*  //
+iconvg_private_palette_canvas__begin_decode(iconvg_canvas* c,
+                                            iconvg_rectangle_f32 dst_rect) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__end_decode(iconvg_canvas* c,
+                                          const char* err_msg,
+                                          size_t num_bytes_consumed,
+                                          size_t num_bytes_remaining) {
+  return err_msg;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__begin_drawing(iconvg_canvas* c) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__end_drawing(iconvg_canvas* c,
+                                           const iconvg_paint* p) {
+  uint64_t* mask = (uint64_t*)(c->context_nonconst_ptr0);
+  *mask |= iconvg_paint__palette_dependencies(p);
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__begin_path(iconvg_canvas* c,
+                                          float x0,
+                                          float y0) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__end_path(iconvg_canvas* c) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__path_line_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__path_quad_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1,
+                                            float x2,
+                                            float y2) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__path_cube_to(iconvg_canvas* c,
+                                            float x1,
+                                            float y1,
+                                            float x2,
+                                            float y2,
+                                            float x3,
+                                            float y3) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_palette_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  return NULL;
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_palette_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_palette_canvas__begin_decode,
+        &iconvg_private_palette_canvas__end_decode,
+        &iconvg_private_palette_canvas__begin_drawing,
+        &iconvg_private_palette_canvas__end_drawing,
+        &iconvg_private_palette_canvas__begin_path,
+        &iconvg_private_palette_canvas__end_path,
+        &iconvg_private_palette_canvas__path_line_to,
+        &iconvg_private_palette_canvas__path_quad_to,
+        &iconvg_private_palette_canvas__path_cube_to,
+        &iconvg_private_palette_canvas__on_metadata_viewbox,
+        &iconvg_private_palette_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+// ----
+
+const char*  //
+iconvg_decode_palette_dependencies(uint64_t* dst_mask,
+                                   iconvg_rectangle_f32 dst_rect,
+                                   const uint8_t* src_ptr,
+                                   size_t src_len,
+                                   const iconvg_decode_options* options) {
+  uint64_t mask = 0;
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_palette_canvas_vtable;
+  c.context_nonconst_ptr0 = &mask;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+
+  const char* err_msg = iconvg_decode(&c, dst_rect, src_ptr, src_len, options);
+  if (dst_mask) {
+    *dst_mask = mask;
+  }
+  return err_msg;
+}
@@ -0,0 +1,310 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// The SIMD code paths are used when the compiler targets SSE2 (every x86_64
+// CPU) or NEON (every AArch64 CPU), unless ICONVG_CONFIG__DISABLE_SIMD is
+// defined. They only handle pixels that are fully opaque or fully
+// transparent, which are the majority in typical IconVG renderings, deferring
+// to the scalar code for the rest. There is no run-time CPU detection, so
+// wider instruction sets (such as AVX2) are not used.
+
+#if !defined(ICONVG_CONFIG__DISABLE_SIMD)
+#if defined(__SSE2__)
+#define ICONVG_PRIVATE_PIXEL_USE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ICONVG_PRIVATE_PIXEL_USE_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+#define ICONVG_PRIVATE_ALPHA_OP__NONE 0
+#define ICONVG_PRIVATE_ALPHA_OP__PREMULTIPLY 1
+#define ICONVG_PRIVATE_ALPHA_OP__UNPREMULTIPLY 2
+
+// iconvg_private_unpremul_reciprocals[a] is ceil((255 << 16) / a), so that
+// ((c * iconvg_private_unpremul_reciprocals[a]) >> 16) equals ((c * 255) / a)
+// for every 0 <= c <= a, replacing a division with a multiplication.
+static const uint32_t iconvg_private_unpremul_reciprocals[256] = {
+    0x00000000, 0x00FF0000, 0x007F8000, 0x00550000,  //
+    0x003FC000, 0x00330000, 0x002A8000, 0x00246DB7,  //
+    0x001FE000, 0x001C5556, 0x00198000, 0x00172E8C,  //
+    0x00154000, 0x00139D8A, 0x001236DC, 0x00110000,  //
+    0x000FF000, 0x000F0000, 0x000E2AAB, 0x000D6BCB,  //
+    0x000CC000, 0x000C2493, 0x000B9746, 0x000B1643,  //
+    0x000AA000, 0x000A3334, 0x0009CEC5, 0x000971C8,  //
+    0x00091B6E, 0x0008CB09, 0x00088000, 0x000839CF,  //
+    0x0007F800, 0x0007BA2F, 0x00078000, 0x00074925,  //
+    0x00071556, 0x0006E454, 0x0006B5E6, 0x000689D9,  //
+    0x00066000, 0x00063832, 0x0006124A, 0x0005EE24,  //
+    0x0005CBA3, 0x0005AAAB, 0x00058B22, 0x00056CF0,  //
+    0x00055000, 0x0005343F, 0x0005199A, 0x00050000,  //
+    0x0004E763, 0x0004CFB3, 0x0004B8E4, 0x0004A2E9,  //
+    0x00048DB7, 0x00047944, 0x00046585, 0x00045271,  //
+    0x00044000, 0x00042E2A, 0x00041CE8, 0x00040C31,  //
+    0x0003FC00, 0x0003EC4F, 0x0003DD18, 0x0003CE55,  //
+    0x0003C000, 0x0003B217, 0x0003A493, 0x00039770,  //
+    0x00038AAB, 0x00037E40, 0x0003722A, 0x00036667,  //
+    0x00035AF3, 0x00034FCB, 0x000344ED, 0x00033A55,  //
+    0x00033000, 0x000325EE, 0x00031C19, 0x00031282,  //
+    0x00030925, 0x00030000, 0x0002F712, 0x0002EE59,  //
+    0x0002E5D2, 0x0002DD7C, 0x0002D556, 0x0002CD5D,  //
+    0x0002C591, 0x0002BDF0, 0x0002B678, 0x0002AF29,  //
+    0x0002A800, 0x0002A0FE, 0x00029A20, 0x00029365,  //
+    0x00028CCD, 0x00028657, 0x00028000, 0x000279CA,  //
+    0x000273B2, 0x00026DB7, 0x000267DA, 0x00026218,  //
+    0x00025C72, 0x000256E7, 0x00025175, 0x00024C1C,  //
+    0x000246DC, 0x000241B3, 0x00023CA2, 0x000237A7,  //
+    0x000232C3, 0x00022DF3, 0x00022939, 0x00022493,  //
+    0x00022000, 0x00021B82, 0x00021715, 0x000212BC,  //
+    0x00020E74, 0x00020A3E, 0x00020619, 0x00020205,  //
+    0x0001FE00, 0x0001FA0C, 0x0001F628, 0x0001F253,  //
+    0x0001EE8C, 0x0001EAD4, 0x0001E72B, 0x0001E38F,  //
+    0x0001E000, 0x0001DC80, 0x0001D90C, 0x0001D5A4,  //
+    0x0001D24A, 0x0001CEFB, 0x0001CBB8, 0x0001C881,  //
+    0x0001C556, 0x0001C235, 0x0001BF20, 0x0001BC15,  //
+    0x0001B915, 0x0001B61F, 0x0001B334, 0x0001B052,  //
+    0x0001AD7A, 0x0001AAAB, 0x0001A7E6, 0x0001A52A,  //
+    0x0001A277, 0x00019FCC, 0x00019D2B, 0x00019A91,  //
+    0x00019800, 0x00019578, 0x000192F7, 0x0001907E,  //
+    0x00018E0D, 0x00018BA3, 0x00018941, 0x000186E6,  //
+    0x00018493, 0x00018246, 0x00018000, 0x00017DC2,  //
+    0x00017B89, 0x00017958, 0x0001772D, 0x00017508,  //
+    0x000172E9, 0x000170D1, 0x00016EBE, 0x00016CB2,  //
+    0x00016AAB, 0x000168AA, 0x000166AF, 0x000164B9,  //
+    0x000162C9, 0x000160DE, 0x00015EF8, 0x00015D18,  //
+    0x00015B3C, 0x00015966, 0x00015795, 0x000155C8,  //
+    0x00015400, 0x0001523E, 0x0001507F, 0x00014EC5,  //
+    0x00014D10, 0x00014B5F, 0x000149B3, 0x0001480B,  //
+    0x00014667, 0x000144C7, 0x0001432C, 0x00014194,  //
+    0x00014000, 0x00013E71, 0x00013CE5, 0x00013B5D,  //
+    0x000139D9, 0x00013859, 0x000136DC, 0x00013563,  //
+    0x000133ED, 0x0001327B, 0x0001310C, 0x00012FA1,  //
+    0x00012E39, 0x00012CD5, 0x00012B74, 0x00012A16,  //
+    0x000128BB, 0x00012763, 0x0001260E, 0x000124BD,  //
+    0x0001236E, 0x00012223, 0x000120DA, 0x00011F94,  //
+    0x00011E51, 0x00011D11, 0x00011BD4, 0x00011A99,  //
+    0x00011962, 0x0001182C, 0x000116FA, 0x000115CA,  //
+    0x0001149D, 0x00011372, 0x0001124A, 0x00011124,  //
+    0x00011000, 0x00010EE0, 0x00010DC1, 0x00010CA5,  //
+    0x00010B8B, 0x00010A73, 0x0001095E, 0x0001084B,  //
+    0x0001073A, 0x0001062C, 0x0001051F, 0x00010415,  //
+    0x0001030D, 0x00010207, 0x00010103, 0x00010000,  //
+};
+
+static bool  //
+iconvg_private_pixel_format__is_valid(iconvg_pixel_format f) {
+  return (ICONVG_PIXEL_FORMAT__BGRA_PREMUL <= f) &&
+         (f <= ICONVG_PIXEL_FORMAT__RGBA_NONPREMUL);
+}
+
+static bool  //
+iconvg_private_pixel_format__is_bgra(iconvg_pixel_format f) {
+  return (f == ICONVG_PIXEL_FORMAT__BGRA_PREMUL) ||
+         (f == ICONVG_PIXEL_FORMAT__BGRA_NONPREMUL);
+}
+
+static bool  //
+iconvg_private_pixel_format__is_premul(iconvg_pixel_format f) {
+  return (f == ICONVG_PIXEL_FORMAT__BGRA_PREMUL) ||
+         (f == ICONVG_PIXEL_FORMAT__RGBA_PREMUL);
+}
+
+// iconvg_private_convert_pixels__scalar converts n pixels. It reads each
+// pixel before writing it, so dst may equal src.
+static void  //
+iconvg_private_convert_pixels__scalar(uint8_t* dst,
+                                      const uint8_t* src,
+                                      size_t n,
+                                      bool swizzle,
+                                      int alpha_op) {
+  for (; n > 0; n--, dst += 4, src += 4) {
+    uint32_t c0 = src[0];
+    uint32_t c1 = src[1];
+    uint32_t c2 = src[2];
+    uint32_t a = src[3];
+    if (a == 0xFF) {
+      // No-op. Opaque pixels are unchanged by (un)premultiplication.
+    } else if (alpha_op == ICONVG_PRIVATE_ALPHA_OP__UNPREMULTIPLY) {
+      uint32_t r = iconvg_private_unpremul_reciprocals[a];
+      c0 = (c0 * r) >> 16;
+      c1 = (c1 * r) >> 16;
+      c2 = (c2 * r) >> 16;
+      // Invalid premultiplied colors (with c > a) saturate.
+      c0 = (c0 < 0xFF) ? c0 : 0xFF;
+      c1 = (c1 < 0xFF) ? c1 : 0xFF;
+      c2 = (c2 < 0xFF) ? c2 : 0xFF;
+    } else if (alpha_op == ICONVG_PRIVATE_ALPHA_OP__PREMULTIPLY) {
+      c0 = ((c0 * a) + 127) / 255;
+      c1 = ((c1 * a) + 127) / 255;
+      c2 = ((c2 * a) + 127) / 255;
+    }
+    dst[0] = (uint8_t)(swizzle ? c2 : c0);
+    dst[1] = (uint8_t)(c1);
+    dst[2] = (uint8_t)(swizzle ? c0 : c2);
+    dst[3] = (uint8_t)(a);
+  }
+}
+
+#if defined(ICONVG_PRIVATE_PIXEL_USE_SSE2)
+
+// iconvg_private_convert_pixels__sse2 converts 4 * n pixels, 4 at a time.
+static void  //
+iconvg_private_convert_pixels__sse2(uint8_t* dst,
+                                    const uint8_t* src,
+                                    size_t n,
+                                    bool swizzle,
+                                    int alpha_op) {
+  const __m128i ff = _mm_set1_epi32(0xFF);
+  const __m128i mask_ga = _mm_set1_epi32((int)0xFF00FF00);
+  const __m128i mask_c0 = _mm_set1_epi32(0x000000FF);
+  const __m128i mask_c2 = _mm_set1_epi32(0x00FF0000);
+  for (; n > 0; n--, dst += 16, src += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(const void*)src);
+    if (alpha_op != ICONVG_PRIVATE_ALPHA_OP__NONE) {
+      // Each 32-bit lane is one pixel, with alpha in the high byte.
+      __m128i a = _mm_srli_epi32(v, 24);
+      __m128i opaque = _mm_cmpeq_epi32(a, ff);
+      __m128i transparent = _mm_cmpeq_epi32(a, _mm_setzero_si128());
+      if (_mm_movemask_epi8(_mm_or_si128(opaque, transparent)) != 0xFFFF) {
+        iconvg_private_convert_pixels__scalar(dst, src, 4, swizzle, alpha_op);
+        continue;
+      }
+      // Opaque pixels are unchanged by (un)premultiplication. Transparent
+      // pixels become all zeroes.
+      v = _mm_and_si128(v, opaque);
+    }
+    if (swizzle) {
+      v = _mm_or_si128(
+          _mm_and_si128(v, mask_ga),
+          _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), mask_c0),
+                       _mm_and_si128(_mm_slli_epi32(v, 16), mask_c2)));
+    }
+    _mm_storeu_si128((__m128i*)(void*)dst, v);
+  }
+}
+
+#elif defined(ICONVG_PRIVATE_PIXEL_USE_NEON)
+
+// iconvg_private_convert_pixels__neon converts 16 * n pixels, 16 at a time.
+static void  //
+iconvg_private_convert_pixels__neon(uint8_t* dst,
+                                    const uint8_t* src,
+                                    size_t n,
+                                    bool swizzle,
+                                    int alpha_op) {
+  const uint8x16_t ff = vdupq_n_u8(0xFF);
+  const uint8x16_t zero = vdupq_n_u8(0x00);
+  for (; n > 0; n--, dst += 64, src += 64) {
+    // vld4q_u8 de-interleaves, so that v.val[3] holds 16 alpha values.
+    uint8x16x4_t v = vld4q_u8(src);
+    if (alpha_op != ICONVG_PRIVATE_ALPHA_OP__NONE) {
+      uint8x16_t opaque = vceqq_u8(v.val[3], ff);
+      uint8x16_t transparent = vceqq_u8(v.val[3], zero);
+      uint64x2_t ok = vreinterpretq_u64_u8(vorrq_u8(opaque, transparent));
+      if ((vgetq_lane_u64(ok, 0) & vgetq_lane_u64(ok, 1)) != ~0ull) {
+        iconvg_private_convert_pixels__scalar(dst, src, 16, swizzle,
+                                              alpha_op);
+        continue;
+      }
+      // Opaque pixels are unchanged by (un)premultiplication. Transparent
+      // pixels become all zeroes.
+      v.val[0] = vandq_u8(v.val[0], opaque);
+      v.val[1] = vandq_u8(v.val[1], opaque);
+      v.val[2] = vandq_u8(v.val[2], opaque);
+    }
+    if (swizzle) {
+      uint8x16_t t = v.val[0];
+      v.val[0] = v.val[2];
+      v.val[2] = t;
+    }
+    vst4q_u8(dst, v);
+  }
+}
+
+#endif
+
+const char*  //
+iconvg_convert_pixels(uint8_t* dst_ptr,
+                      size_t dst_len,
+                      size_t dst_stride,
+                      iconvg_pixel_format dst_format,
+                      const uint8_t* src_ptr,
+                      size_t src_len,
+                      size_t src_stride,
+                      iconvg_pixel_format src_format,
+                      uint32_t width,
+                      uint32_t height) {
+  if (!iconvg_private_pixel_format__is_valid(dst_format) ||
+      !iconvg_private_pixel_format__is_valid(src_format)) {
+    return iconvg_error_invalid_pixel_argument;
+  } else if ((width == 0) || (height == 0)) {
+    return NULL;
+  } else if (!dst_ptr || !src_ptr) {
+    return iconvg_error_invalid_pixel_argument;
+  }
+  // This multiplication can only overflow when size_t is 32 bits. Comparing
+  // width to (SIZE_MAX / 4) instead would be always false (and warned about by
+  // -Wtype-limits) when size_t is 64 bits.
+  size_t row_len = 4 * ((size_t)width);
+  if (((row_len / 4) != width) ||  //
+      (dst_stride < row_len) || (src_stride < row_len)) {
+    return iconvg_error_invalid_pixel_argument;
+  } else if ((dst_ptr == src_ptr) && (dst_stride != src_stride)) {
+    return iconvg_error_invalid_pixel_argument;
+  } else if ((dst_len < row_len) || (src_len < row_len) ||
+             (((dst_len - row_len) / dst_stride) < (height - 1)) ||
+             (((src_len - row_len) / src_stride) < (height - 1))) {
+    return iconvg_error_invalid_buffer_too_small;
+  }
+
+  bool swizzle = iconvg_private_pixel_format__is_bgra(dst_format) !=
+                 iconvg_private_pixel_format__is_bgra(src_format);
+  int alpha_op = ICONVG_PRIVATE_ALPHA_OP__NONE;
+  if (iconvg_private_pixel_format__is_premul(dst_format) !=
+      iconvg_private_pixel_format__is_premul(src_format)) {
+    alpha_op = iconvg_private_pixel_format__is_premul(src_format)
+                   ? ICONVG_PRIVATE_ALPHA_OP__UNPREMULTIPLY
+                   : ICONVG_PRIVATE_ALPHA_OP__PREMULTIPLY;
+  }
+
+  for (uint32_t y = 0; y < height; y++) {
+    uint8_t* d = dst_ptr + (y * dst_stride);
+    const uint8_t* s = src_ptr + (y * src_stride);
+    if (!swizzle && (alpha_op == ICONVG_PRIVATE_ALPHA_OP__NONE)) {
+      if (d != s) {
+        memcpy(d, s, row_len);
+      }
+      continue;
+    }
+    size_t n = width;
+#if defined(ICONVG_PRIVATE_PIXEL_USE_SSE2)
+    size_t m = n / 4;
+    iconvg_private_convert_pixels__sse2(d, s, m, swizzle, alpha_op);
+    d += 16 * m;
+    s += 16 * m;
+    n -= 4 * m;
+#elif defined(ICONVG_PRIVATE_PIXEL_USE_NEON)
+    size_t m = n / 16;
+    iconvg_private_convert_pixels__neon(d, s, m, swizzle, alpha_op);
+    d += 64 * m;
+    s += 64 * m;
+    n -= 16 * m;
+#endif
+    iconvg_private_convert_pixels__scalar(d, s, n, swizzle, alpha_op);
+  }
+  return NULL;
+}
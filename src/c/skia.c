@@ -183,9 +183,32 @@ iconvg_private_skia_canvas__begin_drawing(iconvg_canvas* c) {
   return NULL;
 }
 
+// iconvg_private_skia_draw_path draws path once, or once per instance if
+// offsets_xy is non-NULL, each under a translation. The paint's shader (if
+// any) is in local coordinates, so that gradients move with their paths.
+static void  //
+iconvg_private_skia_draw_path(sk_canvas_t* sc,
+                              const sk_path_t* path,
+                              const sk_paint_t* paint,
+                              const float* offsets_xy,
+                              size_t num_instances) {
+  if (!offsets_xy) {
+    sk_canvas_draw_path(sc, path, paint);
+    return;
+  }
+  for (size_t i = 0; i < num_instances; i++) {
+    sk_canvas_save(sc);
+    sk_canvas_translate(sc, offsets_xy[(2 * i) + 0], offsets_xy[(2 * i) + 1]);
+    sk_canvas_draw_path(sc, path, paint);
+    sk_canvas_restore(sc);
+  }
+}
+
 static const char*  //
-iconvg_private_skia_canvas__end_drawing(iconvg_canvas* c,
-                                        const iconvg_paint* p) {
+iconvg_private_skia_canvas__draw(iconvg_canvas* c,
+                                 const iconvg_paint* p,
+                                 const float* offsets_xy,
+                                 size_t num_instances) {
   sk_canvas_t* sc = (sk_canvas_t*)(c->context_nonconst_ptr0);
   sk_pathbuilder_t* spb = (sk_pathbuilder_t*)(c->context_nonconst_ptr1);
 
@@ -198,7 +221,8 @@ iconvg_private_skia_canvas__end_drawing(iconvg_canvas* c,
       sk_paint_set_antialias(paint, true);
       sk_paint_set_color(
           paint, sk_color_set_argb(k.rgba[3], k.rgba[0], k.rgba[1], k.rgba[2]));
-      sk_canvas_draw_path(sc, path, paint);
+      iconvg_private_skia_draw_path(sc, path, paint, offsets_xy,
+                                    num_instances);
       sk_paint_delete(paint);
       sk_path_delete(path);
       return NULL;
@@ -294,7 +318,7 @@ iconvg_private_skia_canvas__end_drawing(iconvg_canvas* c,
     sk_paint_set_antialias(paint, true);
     sk_paint_set_shader(paint, shader);
     sk_shader_unref(shader);
-    sk_canvas_draw_path(sc, path, paint);
+    iconvg_private_skia_draw_path(sc, path, paint, offsets_xy, num_instances);
     sk_paint_delete(paint);
     sk_path_delete(path);
   }
@@ -307,6 +331,20 @@ iconvg_private_skia_canvas__end_drawing(iconvg_canvas* c,
   return NULL;
 }
 
+static const char*  //
+iconvg_private_skia_canvas__end_drawing(iconvg_canvas* c,
+                                        const iconvg_paint* p) {
+  return iconvg_private_skia_canvas__draw(c, p, NULL, 0);
+}
+
+static const char*  //
+iconvg_private_skia_canvas__end_drawing_instances(iconvg_canvas* c,
+                                                  const iconvg_paint* p,
+                                                  const float* offsets_xy,
+                                                  size_t num_instances) {
+  return iconvg_private_skia_canvas__draw(c, p, offsets_xy, num_instances);
+}
+
 static const char*  //
 iconvg_private_skia_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
   sk_pathbuilder_t* spb = (sk_pathbuilder_t*)(c->context_nonconst_ptr1);
@@ -379,6 +417,7 @@ static const iconvg_canvas_vtable  //
         &iconvg_private_skia_canvas__path_cube_to,
         &iconvg_private_skia_canvas__on_metadata_viewbox,
         &iconvg_private_skia_canvas__on_metadata_suggested_palette,
+        &iconvg_private_skia_canvas__end_drawing_instances,
 };
 
 iconvg_canvas  //
@@ -0,0 +1,469 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// The paint sorting canvas buffers drawings (their paint, path and pixel
+// bounding box) between begin_decode and end_decode, then forwards them to
+// the wrapped canvas, context_nonconst_ptr0, in a possibly different order.
+// context_nonconst_ptr1 points to the iconvg_private_sort_state, allocated by
+// begin_decode and freed by end_decode.
+//
+// Drawings are only re-ordered within a window of up to
+// ICONVG_PRIVATE_SORT_WINDOW_SIZE consecutive drawings. Each full window is
+// forwarded as soon as its last drawing ends, which bounds both the memory
+// used and the (quadratic in the window size) sorting work per drawing.
+
+#define ICONVG_PRIVATE_SORT_WINDOW_SIZE 256
+
+typedef struct iconvg_private_sort_drawing_struct {
+  // The drawing's path records are data.ptr[data_begin .. path_end] and its
+  // iconvg_paint_snapshot prefix is data.ptr[path_end .. data_end].
+  size_t data_begin;
+  size_t path_end;
+  size_t data_end;
+
+  // The parts of the iconvg_paint that are not in its snapshot but that are
+  // needed to re-make an equivalent iconvg_paint: its RGBA value (which, for
+  // gradients, holds CBASE and NBASE), the NREG elements that form the
+  // gradient's matrix and the dst to src coordinate conversion.
+  uint8_t paint_rgba[4];
+  float nreg_matrix[6];
+  double d2s_scale_x;
+  double d2s_bias_x;
+  double d2s_scale_y;
+  double d2s_bias_y;
+  iconvg_matrix_2x3_f64 inverse_dst_transform;
+  iconvg_source_position source_position;
+  uint64_t palette_dependencies;
+
+  // The bounding box of the path's points (including control points), rounded
+  // outwards to whole pixels.
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+
+  // paint_class is the index of the first drawing (in the window) whose paint
+  // looks the same as this one's.
+  size_t paint_class;
+
+  // num_blockers is the number of earlier, overlapping and not yet forwarded
+  // drawings.
+  size_t num_blockers;
+  bool forwarded;
+} iconvg_private_sort_drawing;
+
+typedef struct iconvg_private_sort_state_struct {
+  // drawings holds an array of iconvg_private_sort_drawing elements.
+  iconvg_growable_buffer drawings;
+  iconvg_growable_buffer data;
+
+  // The current drawing's data_begin and (unrounded) bounding box.
+  size_t data_begin;
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+
+  // previous_snapshot is the snapshot prefix of the most recently forwarded
+  // drawing, if previous_snapshot_len is non-zero, so that the next window
+  // can continue with the same paint.
+  size_t previous_snapshot_len;
+  iconvg_paint_snapshot previous_snapshot;
+} iconvg_private_sort_state;
+
+static inline bool  //
+iconvg_private_sort_drawing__overlaps(const iconvg_private_sort_drawing* a,
+                                      const iconvg_private_sort_drawing* b) {
+  // Written so that NaNs overlap.
+  return !((a->max_x <= b->min_x) || (b->max_x <= a->min_x) ||
+           (a->max_y <= b->min_y) || (b->max_y <= a->min_y));
+}
+
+// iconvg_private_sort_drawing__looks_the_same returns whether the drawings'
+// paints look the same, comparing their snapshots.
+static inline bool  //
+iconvg_private_sort_drawing__looks_the_same(
+    const iconvg_private_sort_drawing* a,
+    const iconvg_private_sort_drawing* b,
+    const uint8_t* data) {
+  size_t n = a->data_end - a->path_end;
+  return (n == (b->data_end - b->path_end)) &&
+         !memcmp(data + a->path_end, data + b->path_end, n);
+}
+
+// iconvg_private_sort_drawing__make_paint re-makes the iconvg_paint that was
+// passed to end_drawing, or at least one that the public iconvg_paint__etc
+// functions cannot tell apart from it.
+static void  //
+iconvg_private_sort_drawing__make_paint(const iconvg_private_sort_drawing* d,
+                                        const uint8_t* data,
+                                        iconvg_paint* p) {
+  memset(p, 0, sizeof(*p));
+  memcpy(&p->paint_rgba[0], &d->paint_rgba[0], 4);
+  p->d2s_scale_x = d->d2s_scale_x;
+  p->d2s_bias_x = d->d2s_bias_x;
+  p->d2s_scale_y = d->d2s_scale_y;
+  p->d2s_bias_y = d->d2s_bias_y;
+  p->s2d_scale_x = 1.0 / p->d2s_scale_x;
+  p->s2d_bias_x = -p->d2s_bias_x * p->s2d_scale_x;
+  p->s2d_scale_y = 1.0 / p->d2s_scale_y;
+  p->s2d_bias_y = -p->d2s_bias_y * p->s2d_scale_y;
+  p->inverse_dst_transform = d->inverse_dst_transform;
+  p->source_position = d->source_position;
+  p->palette_dependencies = d->palette_dependencies;
+
+  iconvg_paint_snapshot snapshot;
+  memcpy(&snapshot, data + d->path_end, d->data_end - d->path_end);
+  uint32_t cbase = p->paint_rgba[1];
+  uint32_t nbase = p->paint_rgba[2];
+  // With more than 58 stops, the matrix and the stop offsets share NREG
+  // elements. Writing the matrix first, like the decoder's NREG writes that
+  // the matrix was read after, gives the same values.
+  for (uint32_t i = 0; i < 6; i++) {
+    p->nreg[0x3F & (nbase - 6 + i)] = d->nreg_matrix[i];
+  }
+  for (uint32_t i = 0; i < snapshot.gradient_number_of_stops; i++) {
+    p->creg.colors[0x3F & (cbase + i)] = snapshot.gradient_stops[i].color;
+    p->nreg[0x3F & (nbase + i)] = snapshot.gradient_stops[i].offset;
+  }
+}
+
+static const char*  //
+iconvg_private_sort_canvas__add_points(iconvg_canvas* c,
+                                       const float* xy,
+                                       size_t num_points,
+                                       uint8_t op) {
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  if (!s) {
+    return NULL;
+  }
+  for (size_t i = 0; i < num_points; i++) {
+    float x = xy[(2 * i) + 0];
+    float y = xy[(2 * i) + 1];
+    s->min_x = (s->min_x < x) ? s->min_x : x;
+    s->min_y = (s->min_y < y) ? s->min_y : y;
+    s->max_x = (s->max_x > x) ? s->max_x : x;
+    s->max_y = (s->max_y > y) ? s->max_y : y;
+  }
+  return iconvg_private_path_buffer__append(&s->data, op, xy, 2 * num_points);
+}
+
+// iconvg_private_sort_canvas__flush forwards the buffered drawings and then
+// clears the buffers. Among the drawings whose earlier overlapping drawings
+// have all been forwarded, it picks one that looks the same as the previously
+// forwarded drawing, if there is one, and otherwise the earliest.
+static const char*  //
+iconvg_private_sort_canvas__flush(iconvg_canvas* c) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  iconvg_private_sort_drawing* d =
+      (iconvg_private_sort_drawing*)(s->drawings.ptr);
+  size_t n = s->drawings.len / sizeof(iconvg_private_sort_drawing);
+  const uint8_t* data = s->data.ptr;
+  // Clear the buffers up front, so that no drawing is forwarded twice if
+  // this fails part way. Their contents stay valid until the next append.
+  s->drawings.len = 0;
+  s->data.len = 0;
+
+  size_t previous_paint_class = SIZE_MAX;
+  for (size_t i = 0; i < n; i++) {
+    d[i].paint_class = i;
+    d[i].num_blockers = 0;
+    d[i].forwarded = false;
+    for (size_t j = 0; j < i; j++) {
+      if ((d[j].paint_class == j) &&
+          iconvg_private_sort_drawing__looks_the_same(&d[i], &d[j], data)) {
+        d[i].paint_class = j;
+        break;
+      }
+    }
+    for (size_t j = 0; j < i; j++) {
+      if (iconvg_private_sort_drawing__overlaps(&d[i], &d[j])) {
+        d[i].num_blockers++;
+      }
+    }
+    if ((previous_paint_class == SIZE_MAX) && (d[i].paint_class == i) &&
+        (s->previous_snapshot_len == (d[i].data_end - d[i].path_end)) &&
+        !memcmp(&s->previous_snapshot, data + d[i].path_end,
+                s->previous_snapshot_len)) {
+      previous_paint_class = i;
+    }
+  }
+
+  for (size_t num_forwarded = 0; num_forwarded < n; num_forwarded++) {
+    size_t k = SIZE_MAX;
+    for (size_t i = 0; i < n; i++) {
+      if (d[i].forwarded || (d[i].num_blockers > 0)) {
+        continue;
+      } else if (k == SIZE_MAX) {
+        k = i;
+      }
+      if (d[i].paint_class == previous_paint_class) {
+        k = i;
+        break;
+      }
+    }
+    if (k == SIZE_MAX) {
+      return iconvg_private_internal_error_unreachable;
+    }
+
+    iconvg_paint p;
+    iconvg_private_sort_drawing__make_paint(&d[k], data, &p);
+    ICONVG_PRIVATE_TRY((*wrapped->vtable->begin_drawing)(wrapped));
+    ICONVG_PRIVATE_TRY(iconvg_private_path_buffer__replay(
+        data + d[k].data_begin, d[k].path_end - d[k].data_begin, wrapped,
+        0.0f, 0.0f));
+    ICONVG_PRIVATE_TRY((*wrapped->vtable->end_drawing)(wrapped, &p));
+
+    d[k].forwarded = true;
+    previous_paint_class = d[k].paint_class;
+    for (size_t i = k + 1; i < n; i++) {
+      if (!d[i].forwarded &&
+          iconvg_private_sort_drawing__overlaps(&d[i], &d[k])) {
+        d[i].num_blockers--;
+      }
+    }
+
+    if (num_forwarded + 1 == n) {
+      s->previous_snapshot_len = d[k].data_end - d[k].path_end;
+      memcpy(&s->previous_snapshot, data + d[k].path_end,
+             s->previous_snapshot_len);
+    }
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_sort_canvas__begin_decode(iconvg_canvas* c,
+                                         iconvg_rectangle_f32 dst_rect) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return NULL;
+  } else if (iconvg_private_canvas_sizeof_vtable(wrapped) <
+             sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  }
+
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  if (!s) {
+    s = (iconvg_private_sort_state*)calloc(1, sizeof(*s));
+    if (!s) {
+      return iconvg_error_system_failure_out_of_memory;
+    }
+    s->drawings.grow = &iconvg_growable_buffer__realloc_grow;
+    s->data.grow = &iconvg_growable_buffer__realloc_grow;
+    c->context_nonconst_ptr1 = s;
+  }
+  s->drawings.len = 0;
+  s->data.len = 0;
+  s->previous_snapshot_len = 0;
+  return (*wrapped->vtable->begin_decode)(wrapped, dst_rect);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__end_decode(iconvg_canvas* c,
+                                       const char* err_msg,
+                                       size_t num_bytes_consumed,
+                                       size_t num_bytes_remaining) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return err_msg;
+  } else if (iconvg_private_canvas_sizeof_vtable(wrapped) <
+             sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  }
+
+  // Like iconvg_decode, forward the drawings completed before any error.
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  if (s) {
+    const char* flush_err_msg = iconvg_private_sort_canvas__flush(c);
+    if (!err_msg) {
+      err_msg = flush_err_msg;
+    }
+    free(s->drawings.ptr);
+    free(s->data.ptr);
+    free(s);
+    c->context_nonconst_ptr1 = NULL;
+  }
+  return (*wrapped->vtable->end_decode)(wrapped, err_msg, num_bytes_consumed,
+                                        num_bytes_remaining);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__begin_drawing(iconvg_canvas* c) {
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  if (s) {
+    s->data_begin = s->data.len;
+    s->min_x = +INFINITY;
+    s->min_y = +INFINITY;
+    s->max_x = -INFINITY;
+    s->max_y = -INFINITY;
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_sort_canvas__end_drawing(iconvg_canvas* c,
+                                        const iconvg_paint* p) {
+  iconvg_private_sort_state* s =
+      (iconvg_private_sort_state*)(c->context_nonconst_ptr1);
+  if (!s) {
+    return NULL;
+  }
+  size_t path_end = s->data.len;
+  iconvg_paint_snapshot snapshot;
+  size_t n = iconvg_paint__snapshot(p, &snapshot);
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(&s->data, n));
+  memcpy(s->data.ptr + s->data.len, &snapshot, n);
+  s->data.len += n;
+
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(
+      &s->drawings, sizeof(iconvg_private_sort_drawing)));
+  iconvg_private_sort_drawing* d =
+      (iconvg_private_sort_drawing*)(s->drawings.ptr + s->drawings.len);
+  s->drawings.len += sizeof(iconvg_private_sort_drawing);
+
+  d->data_begin = s->data_begin;
+  d->path_end = path_end;
+  d->data_end = s->data.len;
+  memcpy(&d->paint_rgba[0], &p->paint_rgba[0], 4);
+  uint32_t nbase = p->paint_rgba[2];
+  for (uint32_t i = 0; i < 6; i++) {
+    d->nreg_matrix[i] = p->nreg[0x3F & (nbase - 6 + i)];
+  }
+  d->d2s_scale_x = p->d2s_scale_x;
+  d->d2s_bias_x = p->d2s_bias_x;
+  d->d2s_scale_y = p->d2s_scale_y;
+  d->d2s_bias_y = p->d2s_bias_y;
+  d->inverse_dst_transform = p->inverse_dst_transform;
+  d->source_position = p->source_position;
+  d->palette_dependencies = p->palette_dependencies;
+  // Anti-aliasing touches every pixel that the path's bounding box touches,
+  // so two drawings can only be re-ordered if they share no pixels. This
+  // assumes that dst coordinate space units are pixels.
+  d->min_x = floorf(s->min_x);
+  d->min_y = floorf(s->min_y);
+  d->max_x = ceilf(s->max_x);
+  d->max_y = ceilf(s->max_y);
+
+  if (s->drawings.len >=
+      (ICONVG_PRIVATE_SORT_WINDOW_SIZE * sizeof(iconvg_private_sort_drawing))) {
+    return iconvg_private_sort_canvas__flush(c);
+  }
+  return NULL;
+}
+
+static const char*  //
+iconvg_private_sort_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  float xy[2] = {x0, y0};
+  return iconvg_private_sort_canvas__add_points(
+      c, xy, 1, ICONVG_PRIVATE_PATH_OP__BEGIN_PATH);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__end_path(iconvg_canvas* c) {
+  return iconvg_private_sort_canvas__add_points(
+      c, NULL, 0, ICONVG_PRIVATE_PATH_OP__END_PATH);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__path_line_to(iconvg_canvas* c, float x1, float y1) {
+  float xy[2] = {x1, y1};
+  return iconvg_private_sort_canvas__add_points(
+      c, xy, 1, ICONVG_PRIVATE_PATH_OP__PATH_LINE_TO);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__path_quad_to(iconvg_canvas* c,
+                                         float x1,
+                                         float y1,
+                                         float x2,
+                                         float y2) {
+  float xy[4] = {x1, y1, x2, y2};
+  return iconvg_private_sort_canvas__add_points(
+      c, xy, 2, ICONVG_PRIVATE_PATH_OP__PATH_QUAD_TO);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__path_cube_to(iconvg_canvas* c,
+                                         float x1,
+                                         float y1,
+                                         float x2,
+                                         float y2,
+                                         float x3,
+                                         float y3) {
+  float xy[6] = {x1, y1, x2, y2, x3, y3};
+  return iconvg_private_sort_canvas__add_points(
+      c, xy, 3, ICONVG_PRIVATE_PATH_OP__PATH_CUBE_TO);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__on_metadata_viewbox(iconvg_canvas* c,
+                                                iconvg_rectangle_f32 viewbox) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return NULL;
+  }
+  return (*wrapped->vtable->on_metadata_viewbox)(wrapped, viewbox);
+}
+
+static const char*  //
+iconvg_private_sort_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (!wrapped) {
+    return NULL;
+  }
+  return (*wrapped->vtable->on_metadata_suggested_palette)(wrapped,
+                                                           suggested_palette);
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_sort_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_sort_canvas__begin_decode,
+        &iconvg_private_sort_canvas__end_decode,
+        &iconvg_private_sort_canvas__begin_drawing,
+        &iconvg_private_sort_canvas__end_drawing,
+        &iconvg_private_sort_canvas__begin_path,
+        &iconvg_private_sort_canvas__end_path,
+        &iconvg_private_sort_canvas__path_line_to,
+        &iconvg_private_sort_canvas__path_quad_to,
+        &iconvg_private_sort_canvas__path_cube_to,
+        &iconvg_private_sort_canvas__on_metadata_viewbox,
+        &iconvg_private_sort_canvas__on_metadata_suggested_palette,
+        NULL,
+};
+
+iconvg_canvas  //
+iconvg_make_paint_sorting_canvas(iconvg_canvas* wrapped) {
+  if (wrapped && !wrapped->vtable) {
+    wrapped = NULL;
+  }
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_sort_canvas_vtable;
+  c.context_nonconst_ptr0 = wrapped;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+  return c;
+}
@@ -0,0 +1,671 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// A trace is an 8 byte magic identifier followed by zero or more records. Each
+// record is a 1 byte opcode (the index of the iconvg_canvas_vtable function
+// pointer, counting sizeof__iconvg_canvas_vtable as index 0) followed by that
+// function's arguments. All numbers are little-endian:
+//
+//  - float arguments are 4 bytes and size_t arguments are 8 bytes.
+//  - iconvg_rectangle_f32 arguments are 4 floats.
+//  - iconvg_palette arguments are 64 RGBA colors, 4 bytes each.
+//  - const char* arguments are a 4 byte length n and then n bytes. A NULL
+//    pointer has n = 0. Otherwise, n includes the terminating NUL byte.
+//  - const iconvg_paint* arguments are the paint's 4 byte RGBA value. For
+//    gradients, this is followed by the 4 d2s_etc doubles (8 bytes each), the
+//    6 inverse_dst_transform doubles (row-major), the 6 NREG elements of the
+//    transformation matrix (4 bytes each) and then, for each stop, its 4 byte
+//    CREG color and its 4 byte NREG offset.
+//
+// The trace format is not stable across library versions. It is intended for
+// benchmarking, where traces are re-recorded when the library changes.
+
+static const uint8_t iconvg_private_trace_magic[8] = {
+    0x8A, 0x49, 0x56, 0x47, 0x54, 0x72, 0x63, 0x02,  // "\x8AIVGTrc\x02".
+};
+
+#define ICONVG_PRIVATE_TRACE_OP__BEGIN_DECODE 0x01
+#define ICONVG_PRIVATE_TRACE_OP__END_DECODE 0x02
+#define ICONVG_PRIVATE_TRACE_OP__BEGIN_DRAWING 0x03
+#define ICONVG_PRIVATE_TRACE_OP__END_DRAWING 0x04
+#define ICONVG_PRIVATE_TRACE_OP__BEGIN_PATH 0x05
+#define ICONVG_PRIVATE_TRACE_OP__END_PATH 0x06
+#define ICONVG_PRIVATE_TRACE_OP__PATH_LINE_TO 0x07
+#define ICONVG_PRIVATE_TRACE_OP__PATH_QUAD_TO 0x08
+#define ICONVG_PRIVATE_TRACE_OP__PATH_CUBE_TO 0x09
+#define ICONVG_PRIVATE_TRACE_OP__ON_METADATA_VIEWBOX 0x0A
+#define ICONVG_PRIVATE_TRACE_OP__ON_METADATA_SUGGESTED_PALETTE 0x0B
+
+// ICONVG_PRIVATE_TRACE_MAX_PAINT_SIZE is the largest encoded iconvg_paint
+// argument: 4 bytes RGBA, 10 doubles, 6 floats and 63 stops.
+#define ICONVG_PRIVATE_TRACE_MAX_PAINT_SIZE (4 + (10 * 8) + (6 * 4) + (63 * 8))
+
+static inline uint8_t*  //
+iconvg_private_trace_poke_f32(uint8_t* p, float f) {
+  iconvg_private_poke_u32le(p, iconvg_private_reinterpret_from_f32_to_u32(f));
+  return p + 4;
+}
+
+static inline uint8_t*  //
+iconvg_private_trace_poke_f64(uint8_t* p, double f) {
+  iconvg_private_poke_u64le(p, iconvg_private_reinterpret_from_f64_to_u64(f));
+  return p + 8;
+}
+
+static inline float  //
+iconvg_private_trace_peek_f32(const uint8_t* p) {
+  return iconvg_private_reinterpret_from_u32_to_f32(
+      iconvg_private_peek_u32le(p));
+}
+
+static inline double  //
+iconvg_private_trace_peek_f64(const uint8_t* p) {
+  return iconvg_private_reinterpret_from_u64_to_f64(
+      iconvg_private_peek_u64le(p));
+}
+
+// iconvg_private_trace_canvas__record appends ptr[0 .. len] to the trace. It
+// writes the magic identifier first, if the trace is empty.
+static const char*  //
+iconvg_private_trace_canvas__record(iconvg_canvas* c,
+                                    const uint8_t* ptr,
+                                    size_t len) {
+  iconvg_growable_buffer* b =
+      (iconvg_growable_buffer*)(c->context_nonconst_ptr1);
+  if (!b) {
+    return NULL;
+  }
+  size_t n = len;
+  if (b->len == 0) {
+    n += sizeof(iconvg_private_trace_magic);
+  }
+  ICONVG_PRIVATE_TRY(iconvg_private_growable_buffer__reserve(b, n));
+  if (b->len == 0) {
+    memcpy(b->ptr, iconvg_private_trace_magic,
+           sizeof(iconvg_private_trace_magic));
+    b->len = sizeof(iconvg_private_trace_magic);
+  }
+  memcpy(b->ptr + b->len, ptr, len);
+  b->len += len;
+  return NULL;
+}
+
+// iconvg_private_trace_canvas__wrapped returns the wrapped canvas, or NULL if
+// there is none. It sets *err_msg if the wrapped canvas is unusable.
+static inline iconvg_canvas*  //
+iconvg_private_trace_canvas__wrapped(iconvg_canvas* c, const char** err_msg) {
+  iconvg_canvas* wrapped = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  if (wrapped && (iconvg_private_canvas_sizeof_vtable(wrapped) <
+                  sizeof(iconvg_canvas_vtable))) {
+    *err_msg = iconvg_error_unsupported_vtable;
+    return NULL;
+  }
+  return wrapped;
+}
+
+static const char*  //
+iconvg_private_trace_canvas__begin_decode(iconvg_canvas* c,
+                                          iconvg_rectangle_f32 dst_rect) {
+  uint8_t buf[1 + 16];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__BEGIN_DECODE;
+  p = iconvg_private_trace_poke_f32(p, dst_rect.min_x);
+  p = iconvg_private_trace_poke_f32(p, dst_rect.min_y);
+  p = iconvg_private_trace_poke_f32(p, dst_rect.max_x);
+  p = iconvg_private_trace_poke_f32(p, dst_rect.max_y);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->begin_decode)(wrapped, dst_rect);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__end_decode(iconvg_canvas* c,
+                                        const char* err_msg,
+                                        size_t num_bytes_consumed,
+                                        size_t num_bytes_remaining) {
+  size_t n = err_msg ? (strlen(err_msg) + 1) : 0;
+  if (n > 0xFFFFFFFF) {
+    n = 0;
+  }
+  uint8_t buf0[1 + 4];
+  buf0[0] = ICONVG_PRIVATE_TRACE_OP__END_DECODE;
+  iconvg_private_poke_u32le(buf0 + 1, (uint32_t)n);
+  uint8_t buf1[16];
+  iconvg_private_poke_u64le(buf1 + 0, (uint64_t)num_bytes_consumed);
+  iconvg_private_poke_u64le(buf1 + 8, (uint64_t)num_bytes_remaining);
+  const char* record_err_msg =
+      iconvg_private_trace_canvas__record(c, buf0, sizeof(buf0));
+  if (!record_err_msg && (n > 0)) {
+    record_err_msg =
+        iconvg_private_trace_canvas__record(c, (const uint8_t*)err_msg, n);
+  }
+  if (!record_err_msg) {
+    record_err_msg = iconvg_private_trace_canvas__record(c, buf1, sizeof(buf1));
+  }
+  if (record_err_msg && !err_msg) {
+    err_msg = record_err_msg;
+  }
+
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->end_decode)(wrapped, err_msg, num_bytes_consumed,
+                                        num_bytes_remaining);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__begin_drawing(iconvg_canvas* c) {
+  uint8_t buf[1];
+  buf[0] = ICONVG_PRIVATE_TRACE_OP__BEGIN_DRAWING;
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->begin_drawing)(wrapped);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__end_drawing(iconvg_canvas* c,
+                                         const iconvg_paint* p) {
+  iconvg_paint_type paint_type = iconvg_paint__type(p);
+  if (paint_type == ICONVG_PAINT_TYPE__INVALID) {
+    return iconvg_error_invalid_paint_type;
+  }
+  uint8_t buf[1 + ICONVG_PRIVATE_TRACE_MAX_PAINT_SIZE];
+  uint8_t* q = buf;
+  *q++ = ICONVG_PRIVATE_TRACE_OP__END_DRAWING;
+  memcpy(q, &p->paint_rgba[0], 4);
+  q += 4;
+  switch (paint_type) {
+
+    case ICONVG_PAINT_TYPE__LINEAR_GRADIENT:
+    case ICONVG_PAINT_TYPE__RADIAL_GRADIENT: {
+      q = iconvg_private_trace_poke_f64(q, p->d2s_scale_x);
+      q = iconvg_private_trace_poke_f64(q, p->d2s_bias_x);
+      q = iconvg_private_trace_poke_f64(q, p->d2s_scale_y);
+      q = iconvg_private_trace_poke_f64(q, p->d2s_bias_y);
+      for (uint32_t i = 0; i < 6; i++) {
+        q = iconvg_private_trace_poke_f64(
+            q, p->inverse_dst_transform.elems[i / 3][i % 3]);
+      }
+      uint32_t cbase = p->paint_rgba[1];
+      uint32_t nbase = p->paint_rgba[2];
+      for (uint32_t i = 0; i < 6; i++) {
+        q = iconvg_private_trace_poke_f32(q, p->nreg[0x3F & (nbase - 6 + i)]);
+      }
+      uint32_t nstops = iconvg_paint__gradient_number_of_stops(p);
+      for (uint32_t i = 0; i < nstops; i++) {
+        memcpy(q, &p->creg.colors[0x3F & (cbase + i)].rgba[0], 4);
+        q = iconvg_private_trace_poke_f32(q + 4, p->nreg[0x3F & (nbase + i)]);
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+  ICONVG_PRIVATE_TRY(
+      iconvg_private_trace_canvas__record(c, buf, (size_t)(q - buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->end_drawing)(wrapped, p);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  uint8_t buf[1 + 8];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__BEGIN_PATH;
+  p = iconvg_private_trace_poke_f32(p, x0);
+  p = iconvg_private_trace_poke_f32(p, y0);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->begin_path)(wrapped, x0, y0);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__end_path(iconvg_canvas* c) {
+  uint8_t buf[1];
+  buf[0] = ICONVG_PRIVATE_TRACE_OP__END_PATH;
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->end_path)(wrapped);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__path_line_to(iconvg_canvas* c,
+                                          float x1,
+                                          float y1) {
+  uint8_t buf[1 + 8];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__PATH_LINE_TO;
+  p = iconvg_private_trace_poke_f32(p, x1);
+  p = iconvg_private_trace_poke_f32(p, y1);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->path_line_to)(wrapped, x1, y1);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__path_quad_to(iconvg_canvas* c,
+                                          float x1,
+                                          float y1,
+                                          float x2,
+                                          float y2) {
+  uint8_t buf[1 + 16];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__PATH_QUAD_TO;
+  p = iconvg_private_trace_poke_f32(p, x1);
+  p = iconvg_private_trace_poke_f32(p, y1);
+  p = iconvg_private_trace_poke_f32(p, x2);
+  p = iconvg_private_trace_poke_f32(p, y2);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->path_quad_to)(wrapped, x1, y1, x2, y2);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__path_cube_to(iconvg_canvas* c,
+                                          float x1,
+                                          float y1,
+                                          float x2,
+                                          float y2,
+                                          float x3,
+                                          float y3) {
+  uint8_t buf[1 + 24];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__PATH_CUBE_TO;
+  p = iconvg_private_trace_poke_f32(p, x1);
+  p = iconvg_private_trace_poke_f32(p, y1);
+  p = iconvg_private_trace_poke_f32(p, x2);
+  p = iconvg_private_trace_poke_f32(p, y2);
+  p = iconvg_private_trace_poke_f32(p, x3);
+  p = iconvg_private_trace_poke_f32(p, y3);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->path_cube_to)(wrapped, x1, y1, x2, y2, x3, y3);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__on_metadata_viewbox(iconvg_canvas* c,
+                                                 iconvg_rectangle_f32 viewbox) {
+  uint8_t buf[1 + 16];
+  uint8_t* p = buf;
+  *p++ = ICONVG_PRIVATE_TRACE_OP__ON_METADATA_VIEWBOX;
+  p = iconvg_private_trace_poke_f32(p, viewbox.min_x);
+  p = iconvg_private_trace_poke_f32(p, viewbox.min_y);
+  p = iconvg_private_trace_poke_f32(p, viewbox.max_x);
+  p = iconvg_private_trace_poke_f32(p, viewbox.max_y);
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->on_metadata_viewbox)(wrapped, viewbox);
+}
+
+static const char*  //
+iconvg_private_trace_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  uint8_t buf[1 + sizeof(iconvg_palette)];
+  buf[0] = ICONVG_PRIVATE_TRACE_OP__ON_METADATA_SUGGESTED_PALETTE;
+  memcpy(buf + 1, suggested_palette, sizeof(iconvg_palette));
+  ICONVG_PRIVATE_TRY(iconvg_private_trace_canvas__record(c, buf, sizeof(buf)));
+
+  const char* err_msg = NULL;
+  iconvg_canvas* wrapped = iconvg_private_trace_canvas__wrapped(c, &err_msg);
+  if (!wrapped) {
+    return err_msg;
+  }
+  return (*wrapped->vtable->on_metadata_suggested_palette)(wrapped,
+                                                           suggested_palette);
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_trace_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_trace_canvas__begin_decode,
+        &iconvg_private_trace_canvas__end_decode,
+        &iconvg_private_trace_canvas__begin_drawing,
+        &iconvg_private_trace_canvas__end_drawing,
+        &iconvg_private_trace_canvas__begin_path,
+        &iconvg_private_trace_canvas__end_path,
+        &iconvg_private_trace_canvas__path_line_to,
+        &iconvg_private_trace_canvas__path_quad_to,
+        &iconvg_private_trace_canvas__path_cube_to,
+        &iconvg_private_trace_canvas__on_metadata_viewbox,
+        &iconvg_private_trace_canvas__on_metadata_suggested_palette,
+        // end_drawing_instances is NULL so that iconvg_decode_instances
+        // replays each instance as ordinary (recorded) calls.
+        NULL,
+};
+
+iconvg_canvas  //
+iconvg_make_trace_canvas(iconvg_growable_buffer* dst, iconvg_canvas* wrapped) {
+  if (wrapped && !wrapped->vtable) {
+    wrapped = NULL;
+  }
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_trace_canvas_vtable;
+  c.context_nonconst_ptr0 = wrapped;
+  c.context_nonconst_ptr1 = dst;
+  c.context_const_ptr = NULL;
+  c.context_extra = 0;
+  return c;
+}
+
+// ----
+
+// iconvg_private_trace_replay_paint decodes a const iconvg_paint* argument.
+// It returns false if there were not enough source bytes.
+static bool  //
+iconvg_private_trace_replay_paint(iconvg_paint* p,
+                                  iconvg_private_decoder* d) {
+  memset(p, 0, sizeof(*p));
+  p->inverse_dst_transform = iconvg_private_identity_matrix_2x3_f64();
+  if (d->len < 4) {
+    return false;
+  }
+  memcpy(&p->paint_rgba[0], d->ptr, 4);
+  d->ptr += 4;
+  d->len -= 4;
+
+  switch (iconvg_paint__type(p)) {
+    case ICONVG_PAINT_TYPE__LINEAR_GRADIENT:
+    case ICONVG_PAINT_TYPE__RADIAL_GRADIENT:
+      break;
+    default:
+      return true;
+  }
+
+  uint32_t cbase = p->paint_rgba[1];
+  uint32_t nbase = p->paint_rgba[2];
+  uint32_t nstops = iconvg_paint__gradient_number_of_stops(p);
+  size_t n = (10 * 8) + (6 * 4) + (nstops * 8);
+  if (d->len < n) {
+    return false;
+  }
+  const uint8_t* q = d->ptr;
+  d->ptr += n;
+  d->len -= n;
+
+  p->d2s_scale_x = iconvg_private_trace_peek_f64(q + 0);
+  p->d2s_bias_x = iconvg_private_trace_peek_f64(q + 8);
+  p->d2s_scale_y = iconvg_private_trace_peek_f64(q + 16);
+  p->d2s_bias_y = iconvg_private_trace_peek_f64(q + 24);
+  q += 32;
+  for (uint32_t i = 0; i < 6; i++) {
+    p->inverse_dst_transform.elems[i / 3][i % 3] =
+        iconvg_private_trace_peek_f64(q);
+    q += 8;
+  }
+  p->s2d_scale_x = 1.0 / p->d2s_scale_x;
+  p->s2d_bias_x = -p->d2s_bias_x * p->s2d_scale_x;
+  p->s2d_scale_y = 1.0 / p->d2s_scale_y;
+  p->s2d_bias_y = -p->d2s_bias_y * p->s2d_scale_y;
+
+  // With more than 58 stops, the matrix and the stop offsets share NREG
+  // elements. Writing them in the same order as the recording (matrix first)
+  // reproduces the recorded values.
+  for (uint32_t i = 0; i < 6; i++) {
+    p->nreg[0x3F & (nbase - 6 + i)] = iconvg_private_trace_peek_f32(q);
+    q += 4;
+  }
+  for (uint32_t i = 0; i < nstops; i++) {
+    memcpy(&p->creg.colors[0x3F & (cbase + i)].rgba[0], q, 4);
+    p->nreg[0x3F & (nbase + i)] = iconvg_private_trace_peek_f32(q + 4);
+    q += 8;
+  }
+  return true;
+}
+
+// iconvg_private_trace_replay_f32s decodes n float arguments. It returns false
+// if there were not enough source bytes.
+static inline bool  //
+iconvg_private_trace_replay_f32s(float* dst,
+                                 size_t n,
+                                 iconvg_private_decoder* d) {
+  if (d->len < (4 * n)) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = iconvg_private_trace_peek_f32(d->ptr + (4 * i));
+  }
+  d->ptr += 4 * n;
+  d->len -= 4 * n;
+  return true;
+}
+
+const char*  //
+iconvg_replay_trace(iconvg_canvas* dst_canvas,
+                    const uint8_t* src_ptr,
+                    size_t src_len) {
+  iconvg_canvas fallback_canvas = iconvg_make_broken_canvas(NULL);
+  if (!dst_canvas || !dst_canvas->vtable) {
+    dst_canvas = &fallback_canvas;
+  }
+  iconvg_canvas* c = dst_canvas;
+
+  if (c->vtable->sizeof__iconvg_canvas_vtable != sizeof(iconvg_canvas_vtable)) {
+    return iconvg_error_unsupported_vtable;
+  } else if ((src_len < sizeof(iconvg_private_trace_magic)) ||
+             memcmp(src_ptr, iconvg_private_trace_magic,
+                    sizeof(iconvg_private_trace_magic))) {
+    return iconvg_error_invalid_trace;
+  }
+
+  iconvg_private_decoder d;
+  d.ptr = src_ptr + sizeof(iconvg_private_trace_magic);
+  d.len = src_len - sizeof(iconvg_private_trace_magic);
+  bool in_decode = false;
+  const char* err_msg = NULL;
+
+  while (d.len > 0) {
+    uint8_t opcode = *d.ptr++;
+    d.len--;
+    // Every record other than begin_decode must be within a decode.
+    if ((opcode == ICONVG_PRIVATE_TRACE_OP__BEGIN_DECODE) == in_decode) {
+      err_msg = iconvg_error_invalid_trace;
+      goto fail;
+    }
+
+    float f[6];
+    switch (opcode) {
+      case ICONVG_PRIVATE_TRACE_OP__BEGIN_DECODE: {
+        if (!iconvg_private_trace_replay_f32s(f, 4, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        in_decode = true;
+        err_msg = (*c->vtable->begin_decode)(
+            c, iconvg_make_rectangle_f32(f[0], f[1], f[2], f[3]));
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__END_DECODE: {
+        if (d.len < 4) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        uint32_t n = iconvg_private_peek_u32le(d.ptr);
+        d.ptr += 4;
+        d.len -= 4;
+        if ((d.len < n) || ((d.len - n) < 16) ||
+            ((n > 0) && (d.ptr[n - 1] != 0))) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        const char* recorded_err_msg = NULL;
+        if (n > 0) {
+          recorded_err_msg = (const char*)(d.ptr);
+          const char* e = iconvg_private_error_from_string(recorded_err_msg);
+          if (e) {
+            recorded_err_msg = e;
+          }
+        }
+        uint64_t num_bytes_consumed = iconvg_private_peek_u64le(d.ptr + n + 0);
+        uint64_t num_bytes_remaining = iconvg_private_peek_u64le(d.ptr + n + 8);
+        d.ptr += n + 16;
+        d.len -= n + 16;
+        in_decode = false;
+        ICONVG_PRIVATE_TRY((*c->vtable->end_decode)(
+            c, recorded_err_msg, (size_t)num_bytes_consumed,
+            (size_t)num_bytes_remaining));
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__BEGIN_DRAWING: {
+        err_msg = (*c->vtable->begin_drawing)(c);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__END_DRAWING: {
+        iconvg_paint p;
+        if (!iconvg_private_trace_replay_paint(&p, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg = (*c->vtable->end_drawing)(c, &p);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__BEGIN_PATH: {
+        if (!iconvg_private_trace_replay_f32s(f, 2, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg = (*c->vtable->begin_path)(c, f[0], f[1]);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__END_PATH: {
+        err_msg = (*c->vtable->end_path)(c);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__PATH_LINE_TO: {
+        if (!iconvg_private_trace_replay_f32s(f, 2, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg = (*c->vtable->path_line_to)(c, f[0], f[1]);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__PATH_QUAD_TO: {
+        if (!iconvg_private_trace_replay_f32s(f, 4, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg = (*c->vtable->path_quad_to)(c, f[0], f[1], f[2], f[3]);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__PATH_CUBE_TO: {
+        if (!iconvg_private_trace_replay_f32s(f, 6, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg =
+            (*c->vtable->path_cube_to)(c, f[0], f[1], f[2], f[3], f[4], f[5]);
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__ON_METADATA_VIEWBOX: {
+        if (!iconvg_private_trace_replay_f32s(f, 4, &d)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        err_msg = (*c->vtable->on_metadata_viewbox)(
+            c, iconvg_make_rectangle_f32(f[0], f[1], f[2], f[3]));
+        break;
+      }
+
+      case ICONVG_PRIVATE_TRACE_OP__ON_METADATA_SUGGESTED_PALETTE: {
+        iconvg_palette palette;
+        if (d.len < sizeof(palette)) {
+          err_msg = iconvg_error_invalid_trace;
+          goto fail;
+        }
+        memcpy(&palette, d.ptr, sizeof(palette));
+        d.ptr += sizeof(palette);
+        d.len -= sizeof(palette);
+        err_msg = (*c->vtable->on_metadata_suggested_palette)(c, &palette);
+        break;
+      }
+
+      default:
+        err_msg = iconvg_error_invalid_trace;
+        goto fail;
+    }
+
+    if (err_msg) {
+      goto fail;
+    }
+  }
+
+  if (!in_decode) {
+    return NULL;
+  }
+  err_msg = iconvg_error_invalid_trace;
+
+fail:
+  if (!in_decode) {
+    return err_msg;
+  }
+  return (*c->vtable->end_decode)(c, err_msg, src_len - d.len, d.len);
+}
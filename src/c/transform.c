@@ -0,0 +1,196 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "./aaa_private.h"
+
+// The transform canvas forwards every call to the iconvg_canvas pointed to by
+// context_nonconst_ptr0, after mapping path points through the
+// iconvg_matrix_2x3_f64 pointed to by context_const_ptr. Gradient paints are
+// handled separately, via the iconvg_paint's inverse_dst_transform.
+
+static inline void  //
+iconvg_private_transform_canvas__map(iconvg_canvas* c, float* x, float* y) {
+  const iconvg_matrix_2x3_f64* m =
+      (const iconvg_matrix_2x3_f64*)(c->context_const_ptr);
+  double x0 = *x;
+  double y0 = *y;
+  *x = (float)((m->elems[0][0] * x0) + (m->elems[0][1] * y0) + m->elems[0][2]);
+  *y = (float)((m->elems[1][0] * x0) + (m->elems[1][1] * y0) + m->elems[1][2]);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__begin_decode(iconvg_canvas* c,
+                                              iconvg_rectangle_f32 dst_rect) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->begin_decode)(w, dst_rect);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__end_decode(iconvg_canvas* c,
+                                            const char* err_msg,
+                                            size_t num_bytes_consumed,
+                                            size_t num_bytes_remaining) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->end_decode)(w, err_msg, num_bytes_consumed,
+                                  num_bytes_remaining);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__begin_drawing(iconvg_canvas* c) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->begin_drawing)(w);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__end_drawing(iconvg_canvas* c,
+                                             const iconvg_paint* p) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->end_drawing)(w, p);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__begin_path(iconvg_canvas* c,
+                                            float x0,
+                                            float y0) {
+  iconvg_private_transform_canvas__map(c, &x0, &y0);
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->begin_path)(w, x0, y0);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__end_path(iconvg_canvas* c) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->end_path)(w);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__path_line_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1) {
+  iconvg_private_transform_canvas__map(c, &x1, &y1);
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_line_to)(w, x1, y1);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__path_quad_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1,
+                                              float x2,
+                                              float y2) {
+  iconvg_private_transform_canvas__map(c, &x1, &y1);
+  iconvg_private_transform_canvas__map(c, &x2, &y2);
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_quad_to)(w, x1, y1, x2, y2);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__path_cube_to(iconvg_canvas* c,
+                                              float x1,
+                                              float y1,
+                                              float x2,
+                                              float y2,
+                                              float x3,
+                                              float y3) {
+  iconvg_private_transform_canvas__map(c, &x1, &y1);
+  iconvg_private_transform_canvas__map(c, &x2, &y2);
+  iconvg_private_transform_canvas__map(c, &x3, &y3);
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->path_cube_to)(w, x1, y1, x2, y2, x3, y3);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__on_metadata_viewbox(
+    iconvg_canvas* c,
+    iconvg_rectangle_f32 viewbox) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->on_metadata_viewbox)(w, viewbox);
+}
+
+static const char*  //
+iconvg_private_transform_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  iconvg_canvas* w = (iconvg_canvas*)(c->context_nonconst_ptr0);
+  return (*w->vtable->on_metadata_suggested_palette)(w, suggested_palette);
+}
+
+static const iconvg_canvas_vtable  //
+    iconvg_private_transform_canvas_vtable = {
+        sizeof(iconvg_canvas_vtable),
+        &iconvg_private_transform_canvas__begin_decode,
+        &iconvg_private_transform_canvas__end_decode,
+        &iconvg_private_transform_canvas__begin_drawing,
+        &iconvg_private_transform_canvas__end_drawing,
+        &iconvg_private_transform_canvas__begin_path,
+        &iconvg_private_transform_canvas__end_path,
+        &iconvg_private_transform_canvas__path_line_to,
+        &iconvg_private_transform_canvas__path_quad_to,
+        &iconvg_private_transform_canvas__path_cube_to,
+        &iconvg_private_transform_canvas__on_metadata_viewbox,
+        &iconvg_private_transform_canvas__on_metadata_suggested_palette,
+        // Instanced drawing would need each offset mapped by the matrix's
+        // linear part. Not forwarding it keeps this canvas simple, as callers
+        // fall back to end_drawing.
+        NULL,
+};
+
+iconvg_canvas  //
+iconvg_private_make_transform_canvas(iconvg_canvas* wrapped,
+                                     const iconvg_matrix_2x3_f64* m) {
+  iconvg_canvas c;
+  c.vtable = &iconvg_private_transform_canvas_vtable;
+  c.context_nonconst_ptr0 = wrapped;
+  c.context_nonconst_ptr1 = NULL;
+  c.context_const_ptr = m;
+  c.context_extra = 0;
+  return c;
+}
+
+bool  //
+iconvg_private_transform_rectangle(iconvg_rectangle_f32* r,
+                                   const iconvg_matrix_2x3_f64* m) {
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (!((-INFINITY < m->elems[i][j]) && (m->elems[i][j] < +INFINITY))) {
+        return false;
+      }
+    }
+  }
+  double det = (m->elems[0][0] * m->elems[1][1]) -
+               (m->elems[0][1] * m->elems[1][0]);
+  if (det == 0) {
+    return false;
+  }
+
+  double xs[2] = {r->min_x, r->max_x};
+  double ys[2] = {r->min_y, r->max_y};
+  double min_x = +INFINITY;
+  double min_y = +INFINITY;
+  double max_x = -INFINITY;
+  double max_y = -INFINITY;
+  for (int i = 0; i < 4; i++) {
+    double x = xs[i & 1];
+    double y = ys[i >> 1];
+    double tx = (m->elems[0][0] * x) + (m->elems[0][1] * y) + m->elems[0][2];
+    double ty = (m->elems[1][0] * x) + (m->elems[1][1] * y) + m->elems[1][2];
+    min_x = (min_x < tx) ? min_x : tx;
+    min_y = (min_y < ty) ? min_y : ty;
+    max_x = (max_x > tx) ? max_x : tx;
+    max_y = (max_y > ty) ? max_y : ty;
+  }
+  *r = iconvg_make_rectangle_f32((float)min_x, (float)min_y,  //
+                                 (float)max_x, (float)max_y);
+  return true;
+}
@@ -22,6 +22,7 @@ import (
 var midDescriptions = [...]string{
 	midViewBox:          "viewBox",
 	midSuggestedPalette: "suggested palette",
+	midDrawingIndex:     "drawing index",
 }
 
 // Destination handles the actions decoded from an IconVG graphic's byte code.
@@ -75,9 +76,13 @@ type DecodeOptions struct {
 
 // Decode decodes an IconVG graphic.
 //
+// If dst is also a BatchDestination then each path is delivered as a single
+// Path call. See the Decoder type for more details.
+//
 // opts may be nil, which means to use the default options.
 func Decode(dst Destination, src []byte, opts *DecodeOptions) error {
-	return decode(dst, nil, nil, false, src, opts)
+	d := Decoder{}
+	return d.Decode(dst, src, opts)
 }
 
 // DecodeMetadata decodes only the metadata in an IconVG graphic.
@@ -91,8 +96,36 @@ func DecodeMetadata(src []byte) (m Metadata, retErr error) {
 }
 
 func decode(dst Destination, p printer, m *Metadata, metadataOnly bool, src buffer, opts *DecodeOptions) error {
+	if m == nil {
+		m = &Metadata{}
+	}
+	src, err := decodeMetadata(p, m, src, opts, nil)
+	if err != nil {
+		return err
+	}
+	if metadataOnly {
+		return nil
+	}
+	if dst != nil {
+		dst.Reset(*m)
+	}
+
+	mf := modeFunc(decodeStyling)
+	for len(src) > 0 {
+		mf, src, err = mf(dst, p, src)
+		if err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// decodeMetadata decodes the magic identifier and metadata chunks, returning
+// the remaining (byte code) part of src. If index is non-nil, any drawing
+// index entries are appended to it.
+func decodeMetadata(p printer, m *Metadata, src buffer, opts *DecodeOptions, index *[]drawingIndexEntry) (src1 buffer, retErr error) {
 	if !bytes.HasPrefix(src, magicBytes) {
-		return errInvalidMagicIdentifier
+		return nil, errInvalidMagicIdentifier
 	}
 	if p != nil {
 		p(src[:len(magic)], "IconVG Magic identifier\n")
@@ -101,42 +134,24 @@ func decode(dst Destination, p printer, m *Metadata, metadataOnly bool, src buff
 
 	nMetadataChunks, n := src.decodeNatural()
 	if n == 0 {
-		return errInvalidNumberOfMetadataChunks
+		return nil, errInvalidNumberOfMetadataChunks
 	}
 	if p != nil {
 		p(src[:n], "Number of metadata chunks: %d\n", nMetadataChunks)
 	}
 	src = src[n:]
 
-	if m == nil {
-		m = &Metadata{}
-	}
 	for ; nMetadataChunks > 0; nMetadataChunks-- {
 		err := error(nil)
-		src, err = decodeMetadataChunk(p, m, src, opts)
-		if err != nil {
-			return err
-		}
-	}
-	if metadataOnly {
-		return nil
-	}
-	if dst != nil {
-		dst.Reset(*m)
-	}
-
-	mf := modeFunc(decodeStyling)
-	for len(src) > 0 {
-		err := error(nil)
-		mf, src, err = mf(dst, p, src)
+		src, err = decodeMetadataChunk(p, m, src, opts, index)
 		if err != nil {
-			return err
+			return nil, err
 		}
 	}
-	return nil
+	return src, nil
 }
 
-func decodeMetadataChunk(p printer, m *Metadata, src buffer, opts *DecodeOptions) (src1 buffer, retErr error) {
+func decodeMetadataChunk(p printer, m *Metadata, src buffer, opts *DecodeOptions, index *[]drawingIndexEntry) (src1 buffer, retErr error) {
 	length, n := src.decodeNatural()
 	if n == 0 {
 		return nil, errInvalidMetadataChunkLength
@@ -217,6 +232,13 @@ func decodeMetadataChunk(p printer, m *Metadata, src buffer, opts *DecodeOptions
 			}
 		}
 
+	case midDrawingIndex:
+		err := error(nil)
+		if src, err = decodeDrawingIndex(p, index, src); err != nil {
+			return nil, err
+		}
+		m.DrawingIndex = true
+
 	default:
 		return nil, errUnsupportedMetadataIdentifier
 	}
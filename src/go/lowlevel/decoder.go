@@ -0,0 +1,367 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package lowlevel
+
+// PathOp is a single drawing operation, part of a path delivered to a
+// BatchDestination.
+type PathOp struct {
+	// Op is the SVG-like path command: one of 'L', 'l', 'T', 't', 'Q', 'q',
+	// 'S', 's', 'C', 'c', 'A', 'a', 'H', 'h', 'V' or 'v'. It can also be 'M'
+	// or 'm', meaning a closePath followed by an absolute or relative moveTo
+	// (the ClosePathAbsMoveTo or ClosePathRelMoveTo Destination methods).
+	Op byte
+
+	// LargeArc and Sweep are the arc flags. They are only used when Op is
+	// 'A' or 'a'.
+	LargeArc bool
+	Sweep    bool
+
+	// Args holds the op's arguments, in the same order as the float32
+	// arguments of the corresponding Destination method. For example, 'Q'
+	// (AbsQuadTo) uses Args[0:4] to hold x1, y1, x, y and 'A' (AbsArcTo) uses
+	// Args[0:5] to hold rx, ry, xAxisRotation, x, y. Unused elements are zero.
+	Args [6]float32
+}
+
+// NumArgs returns the number of Args elements used by Op.
+func (o *PathOp) NumArgs() int {
+	switch o.Op {
+	case 'H', 'h', 'V', 'v':
+		return 1
+	case 'L', 'l', 'T', 't', 'M', 'm':
+		return 2
+	case 'Q', 'q', 'S', 's':
+		return 4
+	case 'A', 'a':
+		return 5
+	case 'C', 'c':
+		return 6
+	}
+	return 0
+}
+
+// Apply calls the dst method corresponding to o.
+func (o *PathOp) Apply(dst Destination) {
+	a := &o.Args
+	switch o.Op {
+	case 'L':
+		dst.AbsLineTo(a[0], a[1])
+	case 'l':
+		dst.RelLineTo(a[0], a[1])
+	case 'T':
+		dst.AbsSmoothQuadTo(a[0], a[1])
+	case 't':
+		dst.RelSmoothQuadTo(a[0], a[1])
+	case 'Q':
+		dst.AbsQuadTo(a[0], a[1], a[2], a[3])
+	case 'q':
+		dst.RelQuadTo(a[0], a[1], a[2], a[3])
+	case 'S':
+		dst.AbsSmoothCubeTo(a[0], a[1], a[2], a[3])
+	case 's':
+		dst.RelSmoothCubeTo(a[0], a[1], a[2], a[3])
+	case 'C':
+		dst.AbsCubeTo(a[0], a[1], a[2], a[3], a[4], a[5])
+	case 'c':
+		dst.RelCubeTo(a[0], a[1], a[2], a[3], a[4], a[5])
+	case 'A':
+		dst.AbsArcTo(a[0], a[1], a[2], o.LargeArc, o.Sweep, a[3], a[4])
+	case 'a':
+		dst.RelArcTo(a[0], a[1], a[2], o.LargeArc, o.Sweep, a[3], a[4])
+	case 'H':
+		dst.AbsHLineTo(a[0])
+	case 'h':
+		dst.RelHLineTo(a[0])
+	case 'V':
+		dst.AbsVLineTo(a[0])
+	case 'v':
+		dst.RelVLineTo(a[0])
+	case 'M':
+		dst.ClosePathAbsMoveTo(a[0], a[1])
+	case 'm':
+		dst.ClosePathRelMoveTo(a[0], a[1])
+	}
+}
+
+// BatchDestination is a Destination that can also accept a whole path in a
+// single call, instead of one method call per drawing operation.
+type BatchDestination interface {
+	Destination
+
+	// Path is called instead of the StartPath, drawing and ClosePathEndPath
+	// methods. The adj, x and y arguments are as for StartPath.
+	//
+	// The ops slice is only valid for the duration of the call. Its backing
+	// array is re-used for subsequent paths.
+	Path(adj uint8, x, y float32, ops []PathOp)
+}
+
+// Decoder decodes IconVG graphics. Its zero value is ready to use.
+//
+// Re-using a Decoder re-uses its internal buffers, so that, once warmed up,
+// decoding does not allocate memory (other than whatever the Destination
+// allocates).
+type Decoder struct {
+	ops []PathOp
+}
+
+// Decode decodes an IconVG graphic.
+//
+// If dst is also a BatchDestination then each path is delivered as a single
+// Path call, after that path's closing ClosePathEndPath opcode is decoded. A
+// path that is interrupted by a decoding error is not delivered. A path that
+// is still open at the end of src (which is not an error) is delivered by
+// the individual Destination methods, as if dst was not a BatchDestination.
+//
+// opts may be nil, which means to use the default options.
+func (d *Decoder) Decode(dst Destination, src []byte, opts *DecodeOptions) error {
+	m := Metadata{
+		ViewBox: DefaultViewBox,
+		Palette: DefaultPalette,
+	}
+	if opts != nil && opts.Palette != nil {
+		m.Palette = *opts.Palette
+	}
+	src, err := decodeMetadata(nil, &m, src, opts, nil)
+	if err != nil {
+		return err
+	}
+	if dst == nil {
+		dst = nopDestination{}
+	}
+	dst.Reset(m)
+	bdst, _ := dst.(BatchDestination)
+
+	for len(src) > 0 {
+		switch opcode := src[0]; {
+		case opcode < 0x40:
+			dst.SetCSel(opcode & 0x3f)
+			src = src[1:]
+
+		case opcode < 0x80:
+			dst.SetNSel(opcode & 0x3f)
+			src = src[1:]
+
+		case opcode < 0xa8:
+			adj := opcode & 0x07
+			incr := adj == 7
+			if incr {
+				adj = 0
+			}
+			c, n := Color{}, 0
+			switch (opcode - 0x80) >> 3 {
+			case 0:
+				c, n = buffer(src[1:]).decodeColor1()
+			case 1:
+				c, n = buffer(src[1:]).decodeColor2()
+			case 2:
+				c, n = buffer(src[1:]).decodeColor3Direct()
+			case 3:
+				c, n = buffer(src[1:]).decodeColor4()
+			case 4:
+				c, n = buffer(src[1:]).decodeColor3Indirect()
+			}
+			if n == 0 {
+				return errInvalidColor
+			}
+			dst.SetCReg(adj, incr, c)
+			src = src[1+n:]
+
+		case opcode < 0xc0:
+			adj := opcode & 0x07
+			incr := adj == 7
+			if incr {
+				adj = 0
+			}
+			f, n := float32(0), 0
+			switch (opcode - 0xa8) >> 3 {
+			case 0:
+				f, n = buffer(src[1:]).decodeReal()
+			case 1:
+				f, n = buffer(src[1:]).decodeCoordinate()
+			default:
+				f, n = buffer(src[1:]).decodeZeroToOne()
+			}
+			if n == 0 {
+				return errInvalidNumber
+			}
+			dst.SetNReg(adj, incr, f)
+			src = src[1+n:]
+
+		case opcode < 0xc7:
+			var xy [2]float32
+			if src, err = decodeFastCoordinates(xy[:], src[1:]); err != nil {
+				return err
+			}
+			if src, err = d.decodePath(dst, bdst, opcode&0x07, xy[0], xy[1], src); err != nil {
+				return err
+			}
+
+		case opcode == 0xc7:
+			var lod [2]float32
+			src = src[1:]
+			for i := range lod {
+				f, n := buffer(src).decodeReal()
+				if n == 0 {
+					return errInvalidNumber
+				}
+				lod[i], src = f, src[n:]
+			}
+			dst.SetLOD(lod[0], lod[1])
+
+		default:
+			return errUnsupportedStylingOpcode
+		}
+	}
+	return nil
+}
+
+// pathOps maps the high 4 bits of a (less than 0xe0) drawing opcode to the
+// PathOp.Op value.
+var pathOps = [14]byte{'L', 'L', 'l', 'l', 'T', 't', 'Q', 'q', 'S', 's', 'C', 'c', 'A', 'a'}
+
+// decodePath decodes the drawing opcodes of a path, up to and including its
+// closing ClosePathEndPath, returning the remaining part of src.
+func (d *Decoder) decodePath(dst Destination, bdst BatchDestination, adj uint8, x, y float32, src []byte) (src1 []byte, retErr error) {
+	if bdst == nil {
+		dst.StartPath(adj, x, y)
+	}
+	d.ops = d.ops[:0]
+
+	for len(src) > 0 {
+		opcode := src[0]
+		src = src[1:]
+		op, nReps := PathOp{}, 1
+		switch {
+		case opcode < 0xe0:
+			op.Op = pathOps[opcode>>4]
+			if opcode < 0x40 {
+				nReps = 1 + int(opcode&0x1f)
+			} else {
+				nReps = 1 + int(opcode&0x0f)
+			}
+		case opcode == 0xe1:
+			if bdst != nil {
+				bdst.Path(adj, x, y, d.ops)
+			} else {
+				dst.ClosePathEndPath()
+			}
+			return src, nil
+		case opcode == 0xe2:
+			op.Op = 'M'
+		case opcode == 0xe3:
+			op.Op = 'm'
+		case opcode == 0xe6:
+			op.Op = 'H'
+		case opcode == 0xe7:
+			op.Op = 'h'
+		case opcode == 0xe8:
+			op.Op = 'V'
+		case opcode == 0xe9:
+			op.Op = 'v'
+		default:
+			return nil, errUnsupportedDrawingOpcode
+		}
+
+		for ; nReps > 0; nReps-- {
+			err := error(nil)
+			if src, err = decodeFastPathOpArgs(&op, src); err != nil {
+				return nil, err
+			}
+			if bdst != nil {
+				d.ops = append(d.ops, op)
+			} else {
+				op.Apply(dst)
+			}
+		}
+	}
+
+	// src ended part-way through the path.
+	if bdst != nil {
+		dst.StartPath(adj, x, y)
+		for i := range d.ops {
+			d.ops[i].Apply(dst)
+		}
+	}
+	return src, nil
+}
+
+func decodeFastPathOpArgs(op *PathOp, src []byte) (src1 []byte, retErr error) {
+	if (op.Op != 'A') && (op.Op != 'a') {
+		return decodeFastCoordinates(op.Args[:op.NumArgs()], src)
+	}
+
+	err := error(nil)
+	if src, err = decodeFastCoordinates(op.Args[0:2], src); err != nil {
+		return nil, err
+	}
+	f, n := buffer(src).decodeZeroToOne()
+	if n == 0 {
+		return nil, errInvalidNumber
+	}
+	op.Args[2], src = f, src[n:]
+	u, n := buffer(src).decodeNatural()
+	if n == 0 {
+		return nil, errInvalidNumber
+	}
+	op.LargeArc, op.Sweep, src = (u>>0)&0x01 != 0, (u>>1)&0x01 != 0, src[n:]
+	return decodeFastCoordinates(op.Args[3:5], src)
+}
+
+func decodeFastCoordinates(coords []float32, src []byte) (src1 []byte, retErr error) {
+	for i := range coords {
+		f, n := buffer(src).decodeCoordinate()
+		if n == 0 {
+			return nil, errInvalidNumber
+		}
+		coords[i], src = f, src[n:]
+	}
+	return src, nil
+}
+
+// nopDestination is a Destination that does nothing, used when decoding
+// merely validates its input.
+type nopDestination struct{}
+
+func (nopDestination) Reset(m Metadata) {}
+
+func (nopDestination) SetCSel(cSel uint8)                      {}
+func (nopDestination) SetNSel(nSel uint8)                      {}
+func (nopDestination) SetCReg(adj uint8, incr bool, c Color)   {}
+func (nopDestination) SetNReg(adj uint8, incr bool, f float32) {}
+func (nopDestination) SetLOD(lod0, lod1 float32)               {}
+
+func (nopDestination) StartPath(adj uint8, x, y float32) {}
+func (nopDestination) ClosePathEndPath()                 {}
+func (nopDestination) ClosePathAbsMoveTo(x, y float32)   {}
+func (nopDestination) ClosePathRelMoveTo(x, y float32)   {}
+
+func (nopDestination) AbsHLineTo(x float32)                   {}
+func (nopDestination) RelHLineTo(x float32)                   {}
+func (nopDestination) AbsVLineTo(y float32)                   {}
+func (nopDestination) RelVLineTo(y float32)                   {}
+func (nopDestination) AbsLineTo(x, y float32)                 {}
+func (nopDestination) RelLineTo(x, y float32)                 {}
+func (nopDestination) AbsSmoothQuadTo(x, y float32)           {}
+func (nopDestination) RelSmoothQuadTo(x, y float32)           {}
+func (nopDestination) AbsQuadTo(x1, y1, x, y float32)         {}
+func (nopDestination) RelQuadTo(x1, y1, x, y float32)         {}
+func (nopDestination) AbsSmoothCubeTo(x2, y2, x, y float32)   {}
+func (nopDestination) RelSmoothCubeTo(x2, y2, x, y float32)   {}
+func (nopDestination) AbsCubeTo(x1, y1, x2, y2, x, y float32) {}
+func (nopDestination) RelCubeTo(x1, y1, x2, y2, x, y float32) {}
+
+func (nopDestination) AbsArcTo(rx, ry, xAxisRotation float32, largeArc, sweep bool, x, y float32) {}
+func (nopDestination) RelArcTo(rx, ry, xAxisRotation float32, largeArc, sweep bool, x, y float32) {}
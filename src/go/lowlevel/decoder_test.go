@@ -0,0 +1,85 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package lowlevel
+
+import (
+	"os"
+	"path/filepath"
+	"testing"
+)
+
+// nopBatchDestination is a BatchDestination that does nothing.
+type nopBatchDestination struct {
+	nopDestination
+}
+
+func (nopBatchDestination) Path(adj uint8, x, y float32, ops []PathOp) {}
+
+func readTestData(tb testing.TB) (names []string, srcs [][]byte) {
+	filenames, err := filepath.Glob(filepath.FromSlash("../../../test/data/*.ivg"))
+	if err != nil {
+		tb.Fatalf("Glob: %v", err)
+	}
+	if len(filenames) == 0 {
+		tb.Skip("no test/data/*.ivg files")
+	}
+	for _, filename := range filenames {
+		src, err := os.ReadFile(filename)
+		if err != nil {
+			tb.Fatalf("ReadFile: %v", err)
+		}
+		names = append(names, filepath.Base(filename))
+		srcs = append(srcs, src)
+	}
+	return names, srcs
+}
+
+func benchmarkDecode(b *testing.B, decode func(dst Destination, src []byte) error, dst Destination) {
+	names, srcs := readTestData(b)
+	for i, name := range names {
+		src := srcs[i]
+		b.Run(name, func(b *testing.B) {
+			if err := decode(dst, src); err != nil {
+				b.Fatalf("decode: %v", err)
+			}
+			b.SetBytes(int64(len(src)))
+			b.ReportAllocs()
+			b.ResetTimer()
+			for j := 0; j < b.N; j++ {
+				decode(dst, src)
+			}
+		})
+	}
+}
+
+func BenchmarkDecode(b *testing.B) {
+	benchmarkDecode(b, func(dst Destination, src []byte) error {
+		return Decode(dst, src, nil)
+	}, nopDestination{})
+}
+
+func BenchmarkDecoderDecode(b *testing.B) {
+	d := &Decoder{}
+	benchmarkDecode(b, func(dst Destination, src []byte) error {
+		return d.Decode(dst, src, nil)
+	}, nopDestination{})
+}
+
+func BenchmarkDecoderDecodeBatch(b *testing.B) {
+	d := &Decoder{}
+	benchmarkDecode(b, func(dst Destination, src []byte) error {
+		return d.Decode(dst, src, nil)
+	}, nopBatchDestination{})
+}
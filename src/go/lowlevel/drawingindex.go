@@ -0,0 +1,233 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package lowlevel
+
+import (
+	"math"
+)
+
+// drawingIndexEntry is one drawing's entry in a drawing index (MID 2)
+// metadata chunk.
+//
+// gap is the number of bytes between the end of the previous drawing (or the
+// start of the byte code, for the first drawing) and the start of this one.
+// length is the number of bytes from this drawing's first opcode through to
+// its closing ClosePathEndPath opcode. bounds contains the drawing's geometry,
+// in ViewBox coordinates. lod0 and lod1 are the LOD registers' values when
+// the drawing starts.
+type drawingIndexEntry struct {
+	gap    uint32
+	length uint32
+	bounds Rectangle
+	lod0   float32
+	lod1   float32
+}
+
+// VerifyDrawingIndex checks that src's drawing index, if it has one, matches
+// its byte code: that it has one entry per drawing, with the right byte
+// offsets and LOD ranges and with bounds that contain the drawing's
+// geometry. It returns nil if src is a valid IconVG graphic without a drawing
+// index.
+func VerifyDrawingIndex(src []byte) error {
+	m := Metadata{
+		ViewBox: DefaultViewBox,
+		Palette: DefaultPalette,
+	}
+	index := []drawingIndexEntry(nil)
+	bytecode, err := decodeMetadata(nil, &m, src, nil, &index)
+	if err != nil {
+		return err
+	}
+	want, err := scanDrawings(bytecode)
+	if err != nil {
+		return err
+	} else if !m.DrawingIndex {
+		return nil
+	} else if len(index) != len(want) {
+		return errInconsistentDrawingIndex
+	}
+	for i := range index {
+		a, b := &index[i], &want[i]
+		if (a.gap != b.gap) || (a.length != b.length) ||
+			!sameBits(a.lod0, b.lod0) || !sameBits(a.lod1, b.lod1) ||
+			!(a.bounds.Min[0] <= b.bounds.Min[0]) ||
+			!(a.bounds.Min[1] <= b.bounds.Min[1]) ||
+			!(a.bounds.Max[0] >= b.bounds.Max[0]) ||
+			!(a.bounds.Max[1] >= b.bounds.Max[1]) {
+			return errInconsistentDrawingIndex
+		}
+	}
+	return nil
+}
+
+// scanDrawings decodes the byte code (the part of an IconVG graphic after
+// the metadata) and returns a drawing index entry for each of its drawings. A
+// drawing that is still open at the end of the byte code has no entry.
+//
+// Each entry's bounds are as tight as encodeDrawingIndex can represent,
+// rounding outwards. Curves are bounded by their control points and arcs by
+// their radii, as per bounds.addOp.
+func scanDrawings(bytecode buffer) (entries []drawingIndexEntry, retErr error) {
+	p := &program{}
+	lod0, lod1 := float32(0), float32(math.Inf(+1))
+	prevEnd, start, opsStart := 0, 0, 0
+	drawing := false
+
+	mf := modeFunc(decodeStyling)
+	for src := bytecode; len(src) > 0; {
+		pos, opcode := len(bytecode)-len(src), src[0]
+		err := error(nil)
+		if mf, src, err = mf(p, nil, src); err != nil {
+			return nil, err
+		}
+
+		if !drawing {
+			if (0xc0 <= opcode) && (opcode < 0xc7) {
+				drawing, start, opsStart = true, pos, len(p.ops)-1
+			} else if opcode == 0xc7 {
+				op := &p.ops[len(p.ops)-1]
+				lod0, lod1 = op.f[0], op.f[1]
+			}
+			continue
+		} else if opcode != 0xe1 {
+			continue
+		}
+
+		drawing = false
+		b, pen := newBounds(), pen{}
+		for i := opsStart; i < len(p.ops); i++ {
+			b.addOp(&pen, &p.ops[i])
+			pen.apply(&p.ops[i])
+		}
+		entries = append(entries, drawingIndexEntry{
+			gap:    uint32(start - prevEnd),
+			length: uint32(pos + 1 - start),
+			bounds: Rectangle{
+				Min: [2]float32{roundCoordinate(b.minX, false), roundCoordinate(b.minY, false)},
+				Max: [2]float32{roundCoordinate(b.maxX, true), roundCoordinate(b.maxY, true)},
+			},
+			lod0: lod0,
+			lod1: lod1,
+		})
+		prevEnd = pos + 1
+		p.ops = p.ops[:0]
+	}
+	return entries, nil
+}
+
+// roundCoordinate returns the closest coordinate number to x, in the up or
+// down direction, that has an exact 1, 2 or 4 byte encoding. A NaN x rounds
+// to an infinity, so that the result is still a (trivially) valid bound.
+func roundCoordinate(x float64, up bool) float32 {
+	if math.IsNaN(x) {
+		x = math.Inf(-1)
+		if up {
+			x = math.Inf(+1)
+		}
+	}
+
+	// 2 byte coordinates are multiples of 1/64 in the range [-128, +128).
+	if (-128 <= x) && (x < +128) {
+		if up {
+			return float32(math.Ceil(x*64) / 64)
+		}
+		return float32(math.Floor(x*64) / 64)
+	}
+
+	// 4 byte coordinates are float32 values whose low two bits are zero.
+	dir := float32(math.Inf(-1))
+	if up {
+		dir = float32(math.Inf(+1))
+	}
+	f := float32(x)
+	if (up && (float64(f) < x)) || (!up && (float64(f) > x)) {
+		f = math.Nextafter32(f, dir)
+	}
+	for (math.Float32bits(f)&3 != 0) && !isNaNOrInfinity(f) {
+		f = math.Nextafter32(f, dir)
+	}
+	return f
+}
+
+// encodeDrawingIndex appends the MID-specific data of a drawing index (MID
+// 2) metadata chunk.
+func (b *buffer) encodeDrawingIndex(entries []drawingIndexEntry) {
+	b.encodeNatural(uint32(len(entries)))
+	for i := range entries {
+		e := &entries[i]
+		b.encodeNatural(e.gap)
+		b.encodeNatural(e.length)
+		b.encodeExactCoordinate(e.bounds.Min[0])
+		b.encodeExactCoordinate(e.bounds.Min[1])
+		b.encodeExactCoordinate(e.bounds.Max[0])
+		b.encodeExactCoordinate(e.bounds.Max[1])
+		b.encodeExactReal(e.lod0)
+		b.encodeExactReal(e.lod1)
+	}
+}
+
+// decodeDrawingIndex decodes the MID-specific data of a drawing index (MID 2)
+// metadata chunk, appending its entries to index (if non-nil).
+func decodeDrawingIndex(p printer, index *[]drawingIndexEntry, src buffer) (src1 buffer, retErr error) {
+	nDrawings, n := src.decodeNatural()
+	if n == 0 {
+		return nil, errInvalidDrawingIndex
+	}
+	if p != nil {
+		p(src[:n], "    %d drawings\n", nDrawings)
+	}
+	src = src[n:]
+
+	for i := uint32(0); i < nDrawings; i++ {
+		e := drawingIndexEntry{}
+		e.gap, n = src.decodeNatural()
+		if n == 0 {
+			return nil, errInvalidDrawingIndex
+		}
+		if p != nil {
+			p(src[:n], "    Drawing #%d starts %d bytes after the previous one\n", i, e.gap)
+		}
+		src = src[n:]
+
+		e.length, n = src.decodeNatural()
+		if n == 0 {
+			return nil, errInvalidDrawingIndex
+		}
+		if p != nil {
+			p(src[:n], "    Drawing #%d is %d bytes long\n", i, e.length)
+		}
+		src = src[n:]
+
+		coords := [4]float32{}
+		if src, retErr = decodeCoordinates(coords[:], p, src); retErr != nil {
+			return nil, errInvalidDrawingIndex
+		}
+		e.bounds.Min[0], e.bounds.Min[1] = coords[0], coords[1]
+		e.bounds.Max[0], e.bounds.Max[1] = coords[2], coords[3]
+
+		err := error(nil)
+		if e.lod0, src, err = decodeNumber(p, src, buffer.decodeReal); err != nil {
+			return nil, errInvalidDrawingIndex
+		}
+		if e.lod1, src, err = decodeNumber(p, src, buffer.decodeReal); err != nil {
+			return nil, errInvalidDrawingIndex
+		}
+
+		if index != nil {
+			*index = append(*index, e)
+		}
+	}
+	return src, nil
+}
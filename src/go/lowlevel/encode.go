@@ -0,0 +1,452 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package lowlevel
+
+import (
+	"image/color"
+	"math"
+)
+
+// encoderMode is whether an Encoder is expecting styling or drawing opcodes.
+type encoderMode uint8
+
+const (
+	encoderModeInitial encoderMode = iota
+	encoderModeStyling
+	encoderModeDrawing
+)
+
+// Encoder is a Destination that encodes the actions it receives as an IconVG
+// graphic. Decoding an IconVG graphic into an Encoder re-encodes it.
+//
+// Every number is written in its shortest form that decodes to exactly the
+// same value. A number that has no exact form, such as a coordinate whose low
+// two mantissa bits are non-zero, is rounded as per the 4 byte encoding.
+// Colors are similarly written in their shortest form.
+//
+// Consecutive drawing operations of the same kind (e.g. two absolute lineTo
+// operations) are merged into a single opcode with a repetition count.
+//
+// The zero value is ready to use. The first method called should be Reset.
+type Encoder struct {
+	buf  buffer
+	err  error
+	mode encoderMode
+
+	// drawingIndex is whether Bytes inserts a drawing index metadata chunk
+	// after the nMetadataChunks chunks written by Reset. metadataStart and
+	// bytecodeStart are the offsets in buf of the first of those chunks and of
+	// the byte code.
+	drawingIndex    bool
+	nMetadataChunks uint32
+	metadataStart   int
+	bytecodeStart   int
+
+	// runIndex is the index in buf of the opcode that the current drawing
+	// operation run started with, and runReps is that run's length so far.
+	// A runReps of zero means that the next drawing operation cannot extend
+	// the previous one.
+	runIndex int
+	runReps  int
+}
+
+// Bytes returns the encoded form, or the first error encountered.
+func (e *Encoder) Bytes() ([]byte, error) {
+	if e.err != nil {
+		return nil, e.err
+	}
+	if e.mode == encoderModeInitial {
+		return nil, errNotReset
+	} else if e.mode == encoderModeDrawing {
+		return nil, errUnfinishedPath
+	} else if !e.drawingIndex {
+		return e.buf, nil
+	}
+
+	// The drawing index's byte offsets are relative to the byte code, so
+	// inserting it before the byte code does not change them.
+	bytecode := e.buf[e.bytecodeStart:]
+	if len(bytecode) >= 1<<30 {
+		return nil, errUnsupportedDrawingIndexLength
+	}
+	entries, err := scanDrawings(bytecode)
+	if err != nil {
+		return nil, err
+	}
+	chunk := buffer(nil)
+	chunk.encodeNatural(midDrawingIndex)
+	chunk.encodeDrawingIndex(entries)
+	if len(chunk) >= 1<<30 {
+		return nil, errUnsupportedDrawingIndexLength
+	}
+
+	dst := append(buffer(nil), magic...)
+	dst.encodeNatural(e.nMetadataChunks + 1)
+	dst = append(dst, e.buf[e.metadataStart:e.bytecodeStart]...)
+	dst.encodeNatural(uint32(len(chunk)))
+	dst = append(dst, chunk...)
+	dst = append(dst, bytecode...)
+	return dst, nil
+}
+
+// Reset discards any previously encoded form and starts a new one, beginning
+// with the magic identifier and then metadata chunks for m's ViewBox and
+// Palette. Chunks are omitted if they would equal DefaultViewBox or
+// DefaultPalette. If m.DrawingIndex is set then Bytes also inserts a drawing
+// index chunk, computed from the byte code.
+func (e *Encoder) Reset(m Metadata) {
+	*e = Encoder{
+		buf:  append(buffer(nil), magic...),
+		mode: encoderModeStyling,
+	}
+
+	nMetadataChunks := uint32(0)
+	viewBox := buffer(nil)
+	if m.ViewBox != DefaultViewBox {
+		if m.ViewBox.Min[0] > m.ViewBox.Max[0] || m.ViewBox.Min[1] > m.ViewBox.Max[1] ||
+			isNaNOrInfinity(m.ViewBox.Min[0]) || isNaNOrInfinity(m.ViewBox.Min[1]) ||
+			isNaNOrInfinity(m.ViewBox.Max[0]) || isNaNOrInfinity(m.ViewBox.Max[1]) {
+			e.err = errInvalidViewBox
+			return
+		}
+		nMetadataChunks++
+		viewBox.encodeNatural(midViewBox)
+		viewBox.encodeExactCoordinate(m.ViewBox.Min[0])
+		viewBox.encodeExactCoordinate(m.ViewBox.Min[1])
+		viewBox.encodeExactCoordinate(m.ViewBox.Max[0])
+		viewBox.encodeExactCoordinate(m.ViewBox.Max[1])
+	}
+	palette := buffer(nil)
+	if m.Palette != DefaultPalette {
+		nMetadataChunks++
+		palette.encodeNatural(midSuggestedPalette)
+		palette.encodeSuggestedPalette(&m.Palette)
+	}
+
+	e.buf.encodeNatural(nMetadataChunks)
+	e.metadataStart = len(e.buf)
+	for _, chunk := range [2]buffer{viewBox, palette} {
+		if len(chunk) > 0 {
+			e.buf.encodeNatural(uint32(len(chunk)))
+			e.buf = append(e.buf, chunk...)
+		}
+	}
+	e.drawingIndex = m.DrawingIndex
+	e.nMetadataChunks = nMetadataChunks
+	e.bytecodeStart = len(e.buf)
+}
+
+// encodeSuggestedPalette encodes the palette's length and colors, excluding
+// any trailing opaque black colors, using the fewest bytes per color that
+// every remaining color allows.
+func (b *buffer) encodeSuggestedPalette(pal *Palette) {
+	length := len(pal)
+	for ; length > 1; length-- {
+		if pal[length-1] != (color.RGBA{0x00, 0x00, 0x00, 0xff}) {
+			break
+		}
+	}
+
+	// Each format has to be exact for every color. A 1-byte color (such as
+	// opaque 0x40 gray) isn't necessarily 2-byte exact, and neither 1-byte
+	// nor 2-byte colors are necessarily opaque.
+	all1, all2, all3 := true, true, true
+	for _, rgba := range pal[:length] {
+		c := RGBAColor(rgba)
+		_, ok1 := encodeColor1(c)
+		_, ok2 := encodeColor2(c)
+		_, ok3 := encodeColor3Direct(c)
+		all1, all2, all3 = all1 && ok1, all2 && ok2, all3 && ok3
+	}
+	format := uint8(3)
+	if all1 {
+		format = 0
+	} else if all2 {
+		format = 1
+	} else if all3 {
+		format = 2
+	}
+
+	*b = append(*b, uint8(length-1)|(format<<6))
+	for _, rgba := range pal[:length] {
+		switch c := RGBAColor(rgba); format {
+		case 0:
+			b.encodeColor1(c)
+		case 1:
+			b.encodeColor2(c)
+		case 2:
+			b.encodeColor3Direct(c)
+		default:
+			b.encodeColor4(c)
+		}
+	}
+}
+
+func (e *Encoder) styling() bool {
+	if e.err != nil {
+		return false
+	} else if e.mode == encoderModeInitial {
+		e.err = errNotReset
+		return false
+	} else if e.mode != encoderModeStyling {
+		e.err = errStylingOpcodeInDrawingMode
+		return false
+	}
+	return true
+}
+
+func (e *Encoder) drawing() bool {
+	if e.err != nil {
+		return false
+	} else if e.mode == encoderModeInitial {
+		e.err = errNotReset
+		return false
+	} else if e.mode != encoderModeDrawing {
+		e.err = errDrawingOpcodeInStylingMode
+		return false
+	}
+	return true
+}
+
+func (e *Encoder) SetCSel(cSel uint8) {
+	if e.styling() {
+		e.buf = append(e.buf, 0x00|(cSel&0x3f))
+	}
+}
+
+func (e *Encoder) SetNSel(nSel uint8) {
+	if e.styling() {
+		e.buf = append(e.buf, 0x40|(nSel&0x3f))
+	}
+}
+
+func (e *Encoder) SetCReg(adj uint8, incr bool, c Color) {
+	if !e.styling() {
+		return
+	}
+	adj = encodeAdj(adj, incr)
+	if x, ok := encodeColor1(c); ok {
+		e.buf = append(e.buf, 0x80|adj, x)
+	} else if x, ok := encodeColor2(c); ok {
+		e.buf = append(e.buf, 0x88|adj, x[0], x[1])
+	} else if x, ok := encodeColor3Direct(c); ok {
+		e.buf = append(e.buf, 0x90|adj, x[0], x[1], x[2])
+	} else if x, ok := encodeColor4(c); ok {
+		e.buf = append(e.buf, 0x98|adj, x[0], x[1], x[2], x[3])
+	} else if x, ok := encodeColor3Indirect(c); ok {
+		e.buf = append(e.buf, 0xa0|adj, x[0], x[1], x[2])
+	} else {
+		e.err = errInvalidColor
+	}
+}
+
+func (e *Encoder) SetNReg(adj uint8, incr bool, f float32) {
+	if !e.styling() {
+		return
+	}
+	opcode, x := encodeNRegNumber(f)
+	e.buf = append(e.buf, opcode|encodeAdj(adj, incr))
+	e.buf = append(e.buf, x.bytes()...)
+}
+
+// encodeNRegNumber returns the "Set NREG" opcode (without the ADJ bits) and
+// the shortest encoding, out of the real, coordinate and zero-to-one number
+// encodings, that decodes to exactly f.
+func encodeNRegNumber(f float32) (opcode byte, x encodedNumber) {
+	opcode, x = 0xb0, encodeExact(f, (*buffer).encodeCoordinate, buffer.decodeCoordinate)
+	if y := encodeExact(f, (*buffer).encodeReal, buffer.decodeReal); y.exact && (!x.exact || y.n < x.n) {
+		opcode, x = 0xa8, y
+	}
+	if y := encodeExact(f, (*buffer).encodeZeroToOne, buffer.decodeZeroToOne); y.exact && (!x.exact || y.n < x.n) {
+		opcode, x = 0xb8, y
+	}
+	return opcode, x
+}
+
+func encodeAdj(adj uint8, incr bool) uint8 {
+	if incr {
+		return 7
+	}
+	return adj & 0x07
+}
+
+func (e *Encoder) SetLOD(lod0, lod1 float32) {
+	if e.styling() {
+		e.buf = append(e.buf, 0xc7)
+		e.buf.encodeExactReal(lod0)
+		e.buf.encodeExactReal(lod1)
+	}
+}
+
+func (e *Encoder) StartPath(adj uint8, x, y float32) {
+	if !e.styling() {
+		return
+	} else if adj > 6 {
+		// An ADJ of 7 would be the "Set LOD" opcode.
+		e.err = errUnsupportedStylingOpcode
+		return
+	}
+	e.buf = append(e.buf, 0xc0|adj)
+	e.buf.encodeExactCoordinate(x)
+	e.buf.encodeExactCoordinate(y)
+	e.mode = encoderModeDrawing
+	e.runReps = 0
+}
+
+func (e *Encoder) ClosePathEndPath() {
+	if e.drawing() {
+		e.buf = append(e.buf, 0xe1)
+		e.mode = encoderModeStyling
+		e.runReps = 0
+	}
+}
+
+func (e *Encoder) ClosePathAbsMoveTo(x, y float32) { e.single(0xe2, x, y) }
+func (e *Encoder) ClosePathRelMoveTo(x, y float32) { e.single(0xe3, x, y) }
+
+func (e *Encoder) AbsHLineTo(x float32) { e.single(0xe6, x) }
+func (e *Encoder) RelHLineTo(x float32) { e.single(0xe7, x) }
+func (e *Encoder) AbsVLineTo(y float32) { e.single(0xe8, y) }
+func (e *Encoder) RelVLineTo(y float32) { e.single(0xe9, y) }
+
+func (e *Encoder) AbsLineTo(x, y float32) { e.repeatable(0x00, 32, x, y) }
+func (e *Encoder) RelLineTo(x, y float32) { e.repeatable(0x20, 32, x, y) }
+
+func (e *Encoder) AbsSmoothQuadTo(x, y float32) { e.repeatable(0x40, 16, x, y) }
+func (e *Encoder) RelSmoothQuadTo(x, y float32) { e.repeatable(0x50, 16, x, y) }
+
+func (e *Encoder) AbsQuadTo(x1, y1, x, y float32) { e.repeatable(0x60, 16, x1, y1, x, y) }
+func (e *Encoder) RelQuadTo(x1, y1, x, y float32) { e.repeatable(0x70, 16, x1, y1, x, y) }
+
+func (e *Encoder) AbsSmoothCubeTo(x2, y2, x, y float32) { e.repeatable(0x80, 16, x2, y2, x, y) }
+func (e *Encoder) RelSmoothCubeTo(x2, y2, x, y float32) { e.repeatable(0x90, 16, x2, y2, x, y) }
+
+func (e *Encoder) AbsCubeTo(x1, y1, x2, y2, x, y float32) {
+	e.repeatable(0xa0, 16, x1, y1, x2, y2, x, y)
+}
+
+func (e *Encoder) RelCubeTo(x1, y1, x2, y2, x, y float32) {
+	e.repeatable(0xb0, 16, x1, y1, x2, y2, x, y)
+}
+
+func (e *Encoder) AbsArcTo(rx, ry, xAxisRotation float32, largeArc, sweep bool, x, y float32) {
+	e.arcTo(0xc0, rx, ry, xAxisRotation, largeArc, sweep, x, y)
+}
+
+func (e *Encoder) RelArcTo(rx, ry, xAxisRotation float32, largeArc, sweep bool, x, y float32) {
+	e.arcTo(0xd0, rx, ry, xAxisRotation, largeArc, sweep, x, y)
+}
+
+func (e *Encoder) arcTo(opcode byte, rx, ry, xAxisRotation float32, largeArc, sweep bool, x, y float32) {
+	if !e.drawing() {
+		return
+	}
+	e.startOrExtendRun(opcode, 16)
+	e.buf.encodeExactCoordinate(rx)
+	e.buf.encodeExactCoordinate(ry)
+	e.buf = append(e.buf, encodeExact(xAxisRotation, (*buffer).encodeZeroToOne, buffer.decodeZeroToOne).bytes()...)
+	flags := uint32(0)
+	if largeArc {
+		flags |= 0x01
+	}
+	if sweep {
+		flags |= 0x02
+	}
+	e.buf.encodeNatural(flags)
+	e.buf.encodeExactCoordinate(x)
+	e.buf.encodeExactCoordinate(y)
+}
+
+// single encodes a drawing opcode that has no repetition count.
+func (e *Encoder) single(opcode byte, coords ...float32) {
+	if !e.drawing() {
+		return
+	}
+	e.buf = append(e.buf, opcode)
+	for _, f := range coords {
+		e.buf.encodeExactCoordinate(f)
+	}
+	e.runReps = 0
+}
+
+// repeatable encodes a drawing opcode that has a repetition count, extending
+// the previous opcode if possible.
+func (e *Encoder) repeatable(opcode byte, maxReps int, coords ...float32) {
+	if !e.drawing() {
+		return
+	}
+	e.startOrExtendRun(opcode, maxReps)
+	for _, f := range coords {
+		e.buf.encodeExactCoordinate(f)
+	}
+}
+
+func (e *Encoder) startOrExtendRun(opcode byte, maxReps int) {
+	if (e.runReps > 0) && (e.runReps < maxReps) && (e.buf[e.runIndex]-byte(e.runReps-1) == opcode) {
+		e.buf[e.runIndex]++
+		e.runReps++
+		return
+	}
+	e.runIndex = len(e.buf)
+	e.runReps = 1
+	e.buf = append(e.buf, opcode)
+}
+
+// encodedNumber is the encoded form of a real, coordinate or zero-to-one
+// number. exact is whether that form decodes to exactly the number that was
+// encoded.
+type encodedNumber struct {
+	b     [4]byte
+	n     int
+	exact bool
+}
+
+func (x encodedNumber) bytes() []byte { return x.b[:x.n] }
+
+type encodeNumberFunc func(*buffer, float32) int
+
+// encodeExact returns enc's encoding of f, or the 4 byte encoding if enc's
+// encoding was shorter but inexact (e.g. for negative zero).
+func encodeExact(f float32, enc encodeNumberFunc, dec decodeNumberFunc) encodedNumber {
+	x := encodeWith(f, enc, dec)
+	if !x.exact && (x.n < 4) {
+		if y := encodeWith(f, encode4ByteReal, dec); y.exact {
+			return y
+		}
+	}
+	return x
+}
+
+func encodeWith(f float32, enc encodeNumberFunc, dec decodeNumberFunc) (x encodedNumber) {
+	b := buffer(x.b[:0])
+	x.n = enc(&b, f)
+	copy(x.b[:], b)
+	g, _ := dec(b)
+	x.exact = math.Float32bits(f) == math.Float32bits(g)
+	return x
+}
+
+func encode4ByteReal(b *buffer, f float32) int {
+	b.encode4ByteReal(f)
+	return 4
+}
+
+func (b *buffer) encodeExactCoordinate(f float32) {
+	*b = append(*b, encodeExact(f, (*buffer).encodeCoordinate, buffer.decodeCoordinate).bytes()...)
+}
+
+func (b *buffer) encodeExactReal(f float32) {
+	*b = append(*b, encodeExact(f, (*buffer).encodeReal, buffer.decodeReal).bytes()...)
+}
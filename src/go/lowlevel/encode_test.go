@@ -0,0 +1,79 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package lowlevel
+
+import (
+	"image/color"
+	"testing"
+)
+
+func TestEncodeSuggestedPalette(t *testing.T) {
+	testCases := []struct {
+		name   string
+		colors []color.RGBA
+	}{{
+		// Opaque 0x40 gray is a 1-byte color but not 2-byte exact.
+		name: "opaque1And2",
+		colors: []color.RGBA{
+			{0x40, 0x40, 0x40, 0xff},
+			{0x11, 0x22, 0x33, 0xff},
+		},
+	}, {
+		// Translucent 0x80 gray is a 1-byte color but not opaque.
+		name: "translucent1And3",
+		colors: []color.RGBA{
+			{0x80, 0x80, 0x80, 0x80},
+			{0x12, 0x34, 0x56, 0xff},
+		},
+	}, {
+		name: "nibbleExact",
+		colors: []color.RGBA{
+			{0x00, 0x00, 0x00, 0x00},
+			{0x11, 0x22, 0x33, 0x44},
+			{0x00, 0x00, 0xcc, 0xcc},
+		},
+	}, {
+		name: "mixed",
+		colors: []color.RGBA{
+			{0x40, 0x40, 0x40, 0xff},
+			{0x80, 0x80, 0x80, 0x80},
+			{0x11, 0x22, 0x33, 0x44},
+			{0x12, 0x34, 0x56, 0xff},
+			{0x01, 0x02, 0x03, 0x04},
+		},
+	}}
+
+	for _, tc := range testCases {
+		m := Metadata{ViewBox: DefaultViewBox, Palette: DefaultPalette}
+		copy(m.Palette[:], tc.colors)
+		e := &Encoder{}
+		e.Reset(m)
+		src, err := e.Bytes()
+		if err != nil {
+			t.Errorf("%s: Bytes: %v", tc.name, err)
+			continue
+		}
+		got, err := DecodeMetadata(src)
+		if err != nil {
+			t.Errorf("%s: DecodeMetadata: %v", tc.name, err)
+			continue
+		}
+		for i := range got.Palette {
+			if g, w := got.Palette[i], m.Palette[i]; g != w {
+				t.Errorf("%s: color %d: got %v, want %v", tc.name, i, g, w)
+			}
+		}
+	}
+}
@@ -0,0 +1,443 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package lowlevel
+
+import (
+	"math"
+)
+
+// GenerateLODsOptions are the parameters to the GenerateLODs function.
+type GenerateLODsOptions struct {
+	// BandHeights are the boundaries, in pixels, between the Level of Detail
+	// bands. They must be positive and increasing. For example, {24, 48}
+	// produces three bands: heights in [0, 24), [24, 48) and [48, +∞).
+	//
+	// The last band holds the original geometry. Every other band holds a
+	// simplified copy, suitable for rendering at that band's height.
+	BandHeights []float32
+
+	// Tolerance is how far, in pixels, simplified geometry may deviate from
+	// the original. Zero means to use DefaultLODTolerance.
+	Tolerance float32
+}
+
+// DefaultLODTolerance is the default GenerateLODsOptions.Tolerance.
+const DefaultLODTolerance = 0.5
+
+// GenerateLODs returns a copy of the src IconVG graphic that holds multiple
+// Level of Detail (LOD) variants, one per band of pixel heights.
+//
+// For each band other than the last, each drawing is simplified as if
+// rendered at the band's largest height. Drawings smaller than one pixel are
+// dropped. Curves that are within the tolerance of a straight line become
+// lines and runs of lines are thinned with the Douglas–Peucker algorithm.
+// Styling operations are kept, so that later drawings see the same register
+// values. Each band starts by resetting the color and number registers (and
+// CSEL and NSEL) that src modifies, so that every band decodes as if it were
+// the first. Consecutive bands whose simplified geometry is the same are
+// merged.
+//
+// src must not already use LOD ranges.
+func GenerateLODs(src []byte, opts *GenerateLODsOptions) ([]byte, error) {
+	if (opts == nil) || (len(opts.BandHeights) == 0) {
+		return nil, errInvalidLODBandHeights
+	}
+	tolerance := float64(opts.Tolerance)
+	if tolerance <= 0 {
+		tolerance = DefaultLODTolerance
+	}
+	for i, h := range opts.BandHeights {
+		if !(h > 0) || isNaNOrInfinity(h) || ((i > 0) && !(h > opts.BandHeights[i-1])) {
+			return nil, errInvalidLODBandHeights
+		}
+	}
+
+	m, err := DecodeMetadata(src)
+	if err != nil {
+		return nil, err
+	}
+	p := &program{}
+	if err := Decode(p, src, nil); err != nil {
+		return nil, err
+	}
+	for i := range p.ops {
+		if p.ops[i].kind == programOpSetLOD {
+			return nil, errUnsupportedExistingLOD
+		}
+	}
+	viewBoxHeight := float64(m.ViewBox.Max[1]) - float64(m.ViewBox.Min[1])
+	if !(viewBoxHeight > 0) {
+		return nil, errInvalidViewBox
+	}
+
+	// Simplify each band, merging a band into its successor when they are
+	// the same. The final (unbounded) band holds the original program.
+	type band struct {
+		lod0 float32
+		ops  []programOp
+	}
+	bands := []band(nil)
+	lod0 := float32(0)
+	for _, h := range opts.BandHeights {
+		pixel := viewBoxHeight / float64(h)
+		bands = append(bands, band{lod0, simplifyProgram(p.ops, pixel, tolerance*pixel)})
+		lod0 = h
+	}
+	bands = append(bands, band{lod0, p.ops})
+	for i := 0; i+1 < len(bands); {
+		if (&program{ops: bands[i].ops}).equivalent(&program{ops: bands[i+1].ops}) {
+			bands[i+1].lod0 = bands[i].lod0
+			bands = append(bands[:i], bands[i+1:]...)
+		} else {
+			i++
+		}
+	}
+
+	out := &program{}
+	reset := registerResets(p.ops)
+	for i, b := range bands {
+		if len(bands) > 1 {
+			lod1 := float32(math.Inf(+1))
+			if i+1 < len(bands) {
+				lod1 = bands[i+1].lod0
+			}
+			out.ops = append(out.ops, programOp{kind: programOpSetLOD, f: [6]float32{b.lod0, lod1}})
+		}
+		if i > 0 {
+			out.ops = append(out.ops, reset...)
+		}
+		out.ops = append(out.ops, b.ops...)
+	}
+
+	e := &Encoder{}
+	out.encode(e, m)
+	return e.Bytes()
+}
+
+// registerResets returns the styling operations that restore the CREG and
+// NREG registers (and the CSEL and NSEL selectors) that ops modifies to their
+// initial values: the custom palette, zero and zero.
+func registerResets(ops []programOp) (resets []programOp) {
+	cSel, nSel := uint8(0), uint8(0)
+	cWritten, nWritten := uint64(0), uint64(0)
+	for i := range ops {
+		switch op := &ops[i]; op.kind {
+		case programOpSetCSel:
+			cSel = op.adj
+		case programOpSetNSel:
+			nSel = op.adj
+		case programOpSetCReg:
+			cWritten |= 1 << ((cSel - op.adj) & 0x3f)
+			if op.incr {
+				cSel++
+			}
+		case programOpSetNReg:
+			nWritten |= 1 << ((nSel - op.adj) & 0x3f)
+			if op.incr {
+				nSel++
+			}
+		}
+	}
+
+	for i := uint8(0); i < 64; i++ {
+		if cWritten&(1<<i) != 0 {
+			resets = append(resets,
+				programOp{kind: programOpSetCSel, adj: i},
+				programOp{kind: programOpSetCReg, c: PaletteIndexColor(i)},
+			)
+		}
+	}
+	for i := uint8(0); i < 64; i++ {
+		if nWritten&(1<<i) != 0 {
+			resets = append(resets,
+				programOp{kind: programOpSetNSel, adj: i},
+				programOp{kind: programOpSetNReg},
+			)
+		}
+	}
+	if cWritten != 0 {
+		resets = append(resets, programOp{kind: programOpSetCSel})
+	}
+	if nWritten != 0 {
+		resets = append(resets, programOp{kind: programOpSetNSel})
+	}
+	return resets
+}
+
+// simplifyProgram returns ops with every drawing simplified. pixel is the
+// size of one pixel and tolerance is the maximum deviation, both in viewBox
+// units.
+func simplifyProgram(ops []programOp, pixel float64, tolerance float64) (ret []programOp) {
+	for i := 0; i < len(ops); {
+		if ops[i].kind != programOpStartPath {
+			ret = append(ret, ops[i])
+			i++
+			continue
+		}
+		j := i + 1
+		for (j < len(ops)) && (ops[j].kind != programOpEndPath) {
+			j++
+		}
+		if j < len(ops) {
+			j++
+		}
+		ret = simplifyDrawing(ret, ops[i:j], pixel, tolerance)
+		i = j
+	}
+	return ret
+}
+
+// simplifyDrawing appends a simplified copy of the drawing (the ops from a
+// programOpStartPath to a programOpEndPath inclusive) to dst, or appends
+// nothing if the drawing is smaller than a pixel.
+func simplifyDrawing(dst []programOp, ops []programOp, pixel float64, tolerance float64) []programOp {
+	b := newBounds()
+	pn := pen{}
+	for i := range ops {
+		b.addOp(&pn, &ops[i])
+		pn.apply(&ops[i])
+	}
+	if ((b.maxX - b.minX) < pixel) && ((b.maxY - b.minY) < pixel) {
+		return dst
+	}
+
+	// Collect runs of segments that are (or can become) lines, and thin each
+	// run with the Douglas–Peucker algorithm.
+	run := []programOp(nil)
+	runStart := [2]float64{}
+	flush := func() {
+		dst = appendDouglasPeucker(dst, runStart, run, tolerance)
+		run = run[:0]
+	}
+	pn = pen{}
+	for i := range ops {
+		op := ops[i]
+		if op.kind < programOpLineTo {
+			flush()
+			dst = append(dst, op)
+		} else if flatEnough(&pn, &op, tolerance) {
+			if len(run) == 0 {
+				runStart = [2]float64{float64(pn.currX), float64(pn.currY)}
+			}
+			run = append(run, programOp{kind: programOpLineTo, f: [6]float32{endPoint(&op)[0], endPoint(&op)[1]}})
+		} else {
+			flush()
+			dst = append(dst, op)
+		}
+		pn.apply(&op)
+	}
+	flush()
+	return dst
+}
+
+// endPoint returns a path segment's final point.
+func endPoint(op *programOp) [2]float32 {
+	switch op.kind {
+	case programOpQuadTo:
+		return [2]float32{op.f[2], op.f[3]}
+	case programOpCubeTo, programOpArcTo:
+		return [2]float32{op.f[4], op.f[5]}
+	}
+	return [2]float32{op.f[0], op.f[1]}
+}
+
+// flatEnough returns whether the path segment, starting from pen, is within
+// tolerance of the straight line between its end points.
+func flatEnough(pen *pen, op *programOp, tolerance float64) bool {
+	x0, y0 := float64(pen.currX), float64(pen.currY)
+	e := endPoint(op)
+	x1, y1 := float64(e[0]), float64(e[1])
+	switch op.kind {
+	case programOpLineTo:
+		return true
+	case programOpQuadTo:
+		// The curve is within half of the control point's distance.
+		return distanceToSegment(float64(op.f[0]), float64(op.f[1]), x0, y0, x1, y1) <= 2*tolerance
+	case programOpCubeTo:
+		// The curve is within three quarters of the control points' distance.
+		d := math.Max(
+			distanceToSegment(float64(op.f[0]), float64(op.f[1]), x0, y0, x1, y1),
+			distanceToSegment(float64(op.f[2]), float64(op.f[3]), x0, y0, x1, y1))
+		return d <= (4.0/3.0)*tolerance
+	case programOpArcTo:
+		// The arc is within an ellipse that passes through both end points.
+		// If the radii are too small to reach, the ellipse is scaled up, but
+		// no further than the distance between those end points.
+		r := 2 * math.Max(math.Abs(float64(op.f[0])), math.Abs(float64(op.f[1])))
+		return math.Max(r, math.Hypot(x1-x0, y1-y0)) <= tolerance
+	}
+	return false
+}
+
+// appendDouglasPeucker appends the lineTo ops of run to dst, omitting those
+// whose points are within tolerance of the simplified polyline. start is the
+// point before run's first op.
+func appendDouglasPeucker(dst []programOp, start [2]float64, run []programOp, tolerance float64) []programOp {
+	if len(run) == 0 {
+		return dst
+	}
+	point := func(i int) (float64, float64) {
+		if i < 0 {
+			return start[0], start[1]
+		}
+		return float64(run[i].f[0]), float64(run[i].f[1])
+	}
+
+	keep := make([]bool, len(run))
+	keep[len(run)-1] = true
+	type span struct{ i, j int }
+	stack := []span{{-1, len(run) - 1}}
+	for len(stack) > 0 {
+		s := stack[len(stack)-1]
+		stack = stack[:len(stack)-1]
+		ax, ay := point(s.i)
+		bx, by := point(s.j)
+		farthest, farthestDistance := -1, tolerance
+		for k := s.i + 1; k < s.j; k++ {
+			px, py := point(k)
+			if d := distanceToSegment(px, py, ax, ay, bx, by); d > farthestDistance {
+				farthest, farthestDistance = k, d
+			}
+		}
+		if farthest >= 0 {
+			keep[farthest] = true
+			stack = append(stack, span{s.i, farthest}, span{farthest, s.j})
+		}
+	}
+
+	for i := range run {
+		if keep[i] {
+			dst = append(dst, run[i])
+		}
+	}
+	return dst
+}
+
+// distanceToSegment returns the distance from (px, py) to the line segment
+// from (ax, ay) to (bx, by).
+func distanceToSegment(px, py, ax, ay, bx, by float64) float64 {
+	dx, dy := bx-ax, by-ay
+	if ll := (dx * dx) + (dy * dy); ll > 0 {
+		t := (((px - ax) * dx) + ((py - ay) * dy)) / ll
+		if t > 1 {
+			ax, ay = bx, by
+		} else if t > 0 {
+			ax, ay = ax+(t*dx), ay+(t*dy)
+		}
+	}
+	return math.Hypot(px-ax, py-ay)
+}
+
+// bounds is an axis-aligned bounding box.
+type bounds struct {
+	minX, minY, maxX, maxY float64
+}
+
+func newBounds() bounds {
+	return bounds{
+		minX: math.Inf(+1),
+		minY: math.Inf(+1),
+		maxX: math.Inf(-1),
+		maxY: math.Inf(-1),
+	}
+}
+
+func (b *bounds) add(x, y float64) {
+	b.minX = math.Min(b.minX, x)
+	b.minY = math.Min(b.minY, y)
+	b.maxX = math.Max(b.maxX, x)
+	b.maxY = math.Max(b.maxY, y)
+}
+
+// addOp extends b to contain the drawing operation op, which starts from pen.
+// Curves are bounded by their control points. Arcs are bounded by a circle
+// around the ellipse's center, whose radius is the larger of the ellipse's
+// radii, after scaling them up (as per the SVG spec) if they are too small to
+// reach the end point.
+func (b *bounds) addOp(pen *pen, op *programOp) {
+	switch op.kind {
+	case programOpStartPath, programOpMoveTo, programOpLineTo:
+		b.add(float64(op.f[0]), float64(op.f[1]))
+	case programOpQuadTo:
+		b.add(float64(op.f[0]), float64(op.f[1]))
+		b.add(float64(op.f[2]), float64(op.f[3]))
+	case programOpCubeTo:
+		b.add(float64(op.f[0]), float64(op.f[1]))
+		b.add(float64(op.f[2]), float64(op.f[3]))
+		b.add(float64(op.f[4]), float64(op.f[5]))
+	case programOpArcTo:
+		if cx, cy, r, ok := arcCircle(pen, op); ok {
+			b.add(cx-r, cy-r)
+			b.add(cx+r, cy+r)
+		}
+		b.add(float64(op.f[4]), float64(op.f[5]))
+	}
+}
+
+// arcCircle returns a circle that contains the arc op, which starts from pen.
+// It follows the SVG spec's conversion from endpoint to center
+// parameterization, as the raster package's arcTo does. ok is false if the
+// arc is drawn as a straight line, because a radius is zero or the
+// conversion is not finite.
+//
+// The circle's radius has some slack, as renderers approximate the arc by
+// cubic Bézier curves that can stray slightly outside of the ellipse.
+func arcCircle(pen *pen, op *programOp) (cx float64, cy float64, r float64, ok bool) {
+	rx := math.Abs(float64(op.f[0]))
+	ry := math.Abs(float64(op.f[1]))
+	if !(rx > 0) || !(ry > 0) {
+		return 0, 0, 0, false
+	}
+	x1, y1 := float64(pen.currX), float64(pen.currY)
+	x2, y2 := float64(op.f[4]), float64(op.f[5])
+	phi := 2 * math.Pi * float64(op.f[2])
+
+	halfDx := (x1 - x2) / 2
+	halfDy := (y1 - y2) / 2
+	cosPhi := math.Cos(phi)
+	sinPhi := math.Sin(phi)
+	x1Prime := +(cosPhi * halfDx) + (sinPhi * halfDy)
+	y1Prime := -(sinPhi * halfDx) + (cosPhi * halfDy)
+
+	x1PrimeSq := x1Prime * x1Prime
+	y1PrimeSq := y1Prime * y1Prime
+	if radiiCheck := (x1PrimeSq / (rx * rx)) + (y1PrimeSq / (ry * ry)); radiiCheck > 1 {
+		s := math.Sqrt(radiiCheck)
+		rx *= s
+		ry *= s
+	}
+	rxSq := rx * rx
+	rySq := ry * ry
+
+	denom := (rxSq * y1PrimeSq) + (rySq * x1PrimeSq)
+	step2 := 0.0
+	if a := ((rxSq * rySq) / denom) - 1; a > 0 {
+		step2 = math.Sqrt(a)
+	}
+	if op.largeArc == op.sweep {
+		step2 = -step2
+	}
+	cxPrime := +(step2 * rx * y1Prime) / ry
+	cyPrime := -(step2 * ry * x1Prime) / rx
+
+	cx = +(cosPhi * cxPrime) - (sinPhi * cyPrime) + ((x1 + x2) / 2)
+	cy = +(sinPhi * cxPrime) + (cosPhi * cyPrime) + ((y1 + y2) / 2)
+	r = 1.01 * math.Max(rx, ry)
+	if math.IsNaN(cx) || math.IsInf(cx, 0) || math.IsNaN(cy) || math.IsInf(cy, 0) ||
+		math.IsNaN(r) || math.IsInf(r, 0) {
+		return 0, 0, 0, false
+	}
+	return cx, cy, r, true
+}
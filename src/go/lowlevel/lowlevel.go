@@ -27,8 +27,12 @@ import (
 )
 
 var (
+	errDrawingOpcodeInStylingMode      = errors.New("iconvg: drawing opcode in styling mode")
+	errInconsistentDrawingIndex        = errors.New("iconvg: inconsistent drawing index")
 	errInconsistentMetadataChunkLength = errors.New("iconvg: inconsistent metadata chunk length")
 	errInvalidColor                    = errors.New("iconvg: invalid color")
+	errInvalidDrawingIndex             = errors.New("iconvg: invalid drawing index")
+	errInvalidLODBandHeights           = errors.New("iconvg: invalid LOD band heights")
 	errInvalidMagicIdentifier          = errors.New("iconvg: invalid magic identifier")
 	errInvalidMetadataChunkLength      = errors.New("iconvg: invalid metadata chunk length")
 	errInvalidMetadataIdentifier       = errors.New("iconvg: invalid metadata identifier")
@@ -36,7 +40,13 @@ var (
 	errInvalidNumberOfMetadataChunks   = errors.New("iconvg: invalid number of metadata chunks")
 	errInvalidSuggestedPalette         = errors.New("iconvg: invalid suggested palette")
 	errInvalidViewBox                  = errors.New("iconvg: invalid view box")
+	errNotReset                        = errors.New("iconvg: Encoder.Reset was not called")
+	errOptimizedFormIsNotEquivalent    = errors.New("iconvg: internal error: optimized form is not equivalent")
+	errStylingOpcodeInDrawingMode      = errors.New("iconvg: styling opcode in drawing mode")
+	errUnfinishedPath                  = errors.New("iconvg: unfinished path")
+	errUnsupportedDrawingIndexLength   = errors.New("iconvg: unsupported drawing index length")
 	errUnsupportedDrawingOpcode        = errors.New("iconvg: unsupported drawing opcode")
+	errUnsupportedExistingLOD          = errors.New("iconvg: unsupported existing LOD ranges")
 	errUnsupportedMetadataIdentifier   = errors.New("iconvg: unsupported metadata identifier")
 	errUnsupportedStylingOpcode        = errors.New("iconvg: unsupported styling opcode")
 )
@@ -84,11 +94,19 @@ type Metadata struct {
 	// the optional palette passed to Decode, or if no optional palette was
 	// given, the suggested palette within the IconVG graphic.
 	Palette Palette
+
+	// DrawingIndex is whether the IconVG graphic has a drawing index: a
+	// metadata chunk that gives each drawing's byte offsets, bounds and LOD
+	// range, so that renderers can skip painting drawings that they do not
+	// need. When encoding, the Encoder computes the drawing index from the
+	// byte code.
+	DrawingIndex bool
 }
 
 const (
 	midViewBox          = 0
 	midSuggestedPalette = 1
+	midDrawingIndex     = 2
 )
 
 // DefaultViewBox is the default ViewBox. Its values should not be modified.
@@ -0,0 +1,712 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package lowlevel
+
+import (
+	"math"
+)
+
+// Optimize re-encodes an IconVG graphic in a form that is no larger and that
+// decodes equivalently: the same metadata, the same register values and the
+// same drawings, whose geometry is identical down to the bit.
+//
+// On top of the shortest number and color encodings that an Encoder always
+// picks, Optimize chooses, for each drawing operation, between the absolute
+// and relative forms, the smooth forms (whose first control point is
+// implicit) and the horizontal or vertical lineTo forms, minimizing the total
+// size including how consecutive operations share repetition counts. It also
+// replaces a blend of two direct colors by the blended color, when shorter.
+//
+// If src has a drawing index then it is re-computed for the re-encoded form.
+//
+// The result is verified by decoding it again. If src is already no larger
+// than the re-encoded form, or if the re-encoded form is not equivalent, a
+// copy of src is returned.
+func Optimize(src []byte) ([]byte, error) {
+	m, err := DecodeMetadata(src)
+	if err != nil {
+		return nil, err
+	}
+	p0 := &program{}
+	if err := Decode(p0, src, nil); err != nil {
+		return nil, err
+	}
+
+	e := &Encoder{}
+	p0.encode(e, m)
+	dst, err := e.Bytes()
+	if err != nil {
+		return nil, err
+	}
+
+	if m1, err := DecodeMetadata(dst); err != nil {
+		return nil, err
+	} else if m1 != m {
+		return nil, errOptimizedFormIsNotEquivalent
+	}
+	p1 := &program{}
+	if err := Decode(p1, dst, nil); err != nil {
+		return nil, err
+	} else if err := VerifyDrawingIndex(dst); err != nil {
+		return nil, err
+	}
+
+	if (len(dst) >= len(src)) || !p0.equivalent(p1) {
+		return append([]byte(nil), src...), nil
+	}
+	return dst, nil
+}
+
+// programOpKind is the kind of a programOp.
+type programOpKind uint8
+
+const (
+	programOpSetCSel programOpKind = iota
+	programOpSetNSel
+	programOpSetCReg
+	programOpSetNReg
+	programOpSetLOD
+	programOpStartPath
+	programOpMoveTo
+	programOpEndPath
+
+	// The remaining kinds are path segments.
+	programOpLineTo
+	programOpQuadTo
+	programOpCubeTo
+	programOpArcTo
+)
+
+// programOp is a decoded IconVG operation. Coordinates are absolute and
+// implicit control points are made explicit, so that the same geometry always
+// gives the same programOp, however it was encoded.
+//
+// For the styling operations, adj holds the ADJ, CSEL or NSEL value, c holds
+// the color and f[0] and f[1] hold the number or LOD bounds. For the drawing
+// operations, f holds the coordinates in the same order as the corresponding
+// Destination method (for arcs, f[3] is unused).
+//
+// For a moveTo or path segment that was decoded from bytes, orig is the form
+// that it was encoded in. Its maxReps is zero if there is no such form, such
+// as for a segment that GenerateLODs synthesized. orig is not part of the
+// geometry: equivalent ignores it.
+type programOp struct {
+	kind     programOpKind
+	adj      uint8
+	incr     bool
+	largeArc bool
+	sweep    bool
+	c        Color
+	f        [6]float32
+	orig     segmentForm
+}
+
+// pen is the current point, the reflection point (the implicit first control
+// point of a subsequent smooth quadTo or cubeTo) and the start point (what a
+// subsequent 'z; m' is relative to) of a path being decoded. They are updated
+// with the same float32 arithmetic as a decoder does.
+type pen struct {
+	currX, currY   float32
+	reflX, reflY   float32
+	startX, startY float32
+}
+
+func (p *pen) apply(op *programOp) {
+	switch op.kind {
+	case programOpStartPath, programOpMoveTo:
+		p.currX, p.currY = op.f[0], op.f[1]
+		p.reflX, p.reflY = p.currX, p.currY
+		p.startX, p.startY = p.currX, p.currY
+	case programOpLineTo:
+		p.currX, p.currY = op.f[0], op.f[1]
+		p.reflX, p.reflY = p.currX, p.currY
+	case programOpQuadTo:
+		p.currX, p.currY = op.f[2], op.f[3]
+		p.reflX, p.reflY = (2*p.currX)-op.f[0], (2*p.currY)-op.f[1]
+	case programOpCubeTo:
+		p.currX, p.currY = op.f[4], op.f[5]
+		p.reflX, p.reflY = (2*p.currX)-op.f[2], (2*p.currY)-op.f[3]
+	case programOpArcTo:
+		p.currX, p.currY = op.f[4], op.f[5]
+		p.reflX, p.reflY = p.currX, p.currY
+	}
+}
+
+// program is a Destination that records an IconVG graphic's operations, as
+// programOps.
+type program struct {
+	ops []programOp
+	pen pen
+}
+
+func (p *program) add(op programOp) {
+	p.pen.apply(&op)
+	p.ops = append(p.ops, op)
+}
+
+// addSegment is like add, for a moveTo or path segment, but it also records
+// the opcode and arguments that op was encoded with.
+func (p *program) addSegment(op programOp, opcode byte, maxReps int, args ...float32) {
+	op.orig = segmentForm{opcode: opcode, maxReps: maxReps}
+	copy(op.orig.args[:], args)
+	p.add(op)
+}
+
+func (p *program) Reset(m Metadata) {
+	p.ops = p.ops[:0]
+	p.pen = pen{}
+}
+
+func (p *program) SetCSel(cSel uint8) {
+	p.add(programOp{kind: programOpSetCSel, adj: cSel & 0x3f})
+}
+
+func (p *program) SetNSel(nSel uint8) {
+	p.add(programOp{kind: programOpSetNSel, adj: nSel & 0x3f})
+}
+
+func (p *program) SetCReg(adj uint8, incr bool, c Color) {
+	p.add(programOp{kind: programOpSetCReg, adj: adj, incr: incr, c: c})
+}
+
+func (p *program) SetNReg(adj uint8, incr bool, f float32) {
+	p.add(programOp{kind: programOpSetNReg, adj: adj, incr: incr, f: [6]float32{f}})
+}
+
+func (p *program) SetLOD(lod0, lod1 float32) {
+	p.add(programOp{kind: programOpSetLOD, f: [6]float32{lod0, lod1}})
+}
+
+func (p *program) StartPath(adj uint8, x, y float32) {
+	p.add(programOp{kind: programOpStartPath, adj: adj, f: [6]float32{x, y}})
+}
+
+func (p *program) ClosePathEndPath() {
+	p.add(programOp{kind: programOpEndPath})
+}
+
+func (p *program) ClosePathAbsMoveTo(x, y float32) {
+	p.addSegment(programOp{kind: programOpMoveTo, f: [6]float32{x, y}}, 0xe2, 1, x, y)
+}
+
+func (p *program) ClosePathRelMoveTo(x, y float32) {
+	sx, sy := p.pen.startX, p.pen.startY
+	p.addSegment(programOp{kind: programOpMoveTo, f: [6]float32{sx + x, sy + y}}, 0xe3, 1, x, y)
+}
+
+func (p *program) AbsHLineTo(x float32) {
+	p.addSegment(programOp{kind: programOpLineTo, f: [6]float32{x, p.pen.currY}}, 0xe6, 1, x)
+}
+
+func (p *program) RelHLineTo(x float32) {
+	cx, cy := p.pen.currX, p.pen.currY
+	p.addSegment(programOp{kind: programOpLineTo, f: [6]float32{cx + x, cy}}, 0xe7, 1, x)
+}
+
+func (p *program) AbsVLineTo(y float32) {
+	p.addSegment(programOp{kind: programOpLineTo, f: [6]float32{p.pen.currX, y}}, 0xe8, 1, y)
+}
+
+func (p *program) RelVLineTo(y float32) {
+	cx, cy := p.pen.currX, p.pen.currY
+	p.addSegment(programOp{kind: programOpLineTo, f: [6]float32{cx, cy + y}}, 0xe9, 1, y)
+}
+
+func (p *program) AbsLineTo(x, y float32) {
+	p.addSegment(programOp{kind: programOpLineTo, f: [6]float32{x, y}}, 0x00, 32, x, y)
+}
+
+func (p *program) RelLineTo(x, y float32) {
+	cx, cy := p.pen.currX, p.pen.currY
+	p.addSegment(programOp{kind: programOpLineTo, f: [6]float32{cx + x, cy + y}}, 0x20, 32, x, y)
+}
+
+func (p *program) AbsSmoothQuadTo(x, y float32) {
+	rx, ry := p.pen.reflX, p.pen.reflY
+	p.addSegment(programOp{kind: programOpQuadTo, f: [6]float32{rx, ry, x, y}}, 0x40, 16, x, y)
+}
+
+func (p *program) RelSmoothQuadTo(x, y float32) {
+	cx, cy, rx, ry := p.pen.currX, p.pen.currY, p.pen.reflX, p.pen.reflY
+	p.addSegment(programOp{kind: programOpQuadTo, f: [6]float32{rx, ry, cx + x, cy + y}}, 0x50, 16, x, y)
+}
+
+func (p *program) AbsQuadTo(x1, y1, x, y float32) {
+	p.addSegment(programOp{kind: programOpQuadTo, f: [6]float32{x1, y1, x, y}}, 0x60, 16, x1, y1, x, y)
+}
+
+func (p *program) RelQuadTo(x1, y1, x, y float32) {
+	cx, cy := p.pen.currX, p.pen.currY
+	p.addSegment(programOp{kind: programOpQuadTo, f: [6]float32{cx + x1, cy + y1, cx + x, cy + y}}, 0x70, 16, x1, y1, x, y)
+}
+
+func (p *program) AbsSmoothCubeTo(x2, y2, x, y float32) {
+	rx, ry := p.pen.reflX, p.pen.reflY
+	p.addSegment(programOp{kind: programOpCubeTo, f: [6]float32{rx, ry, x2, y2, x, y}}, 0x80, 16, x2, y2, x, y)
+}
+
+func (p *program) RelSmoothCubeTo(x2, y2, x, y float32) {
+	cx, cy, rx, ry := p.pen.currX, p.pen.currY, p.pen.reflX, p.pen.reflY
+	p.addSegment(programOp{kind: programOpCubeTo, f: [6]float32{rx, ry, cx + x2, cy + y2, cx + x, cy + y}}, 0x90, 16, x2, y2, x, y)
+}
+
+func (p *program) AbsCubeTo(x1, y1, x2, y2, x, y float32) {
+	p.addSegment(programOp{kind: programOpCubeTo, f: [6]float32{x1, y1, x2, y2, x, y}}, 0xa0, 16, x1, y1, x2, y2, x, y)
+}
+
+func (p *program) RelCubeTo(x1, y1, x2, y2, x, y float32) {
+	cx, cy := p.pen.currX, p.pen.currY
+	p.addSegment(programOp{kind: programOpCubeTo, f: [6]float32{cx + x1, cy + y1, cx + x2, cy + y2, cx + x, cy + y}}, 0xb0, 16, x1, y1, x2, y2, x, y)
+}
+
+func (p *program) AbsArcTo(rx, ry, xAxisRotation float32, largeArc, sweep bool, x, y float32) {
+	p.addSegment(programOp{
+		kind:     programOpArcTo,
+		largeArc: largeArc,
+		sweep:    sweep,
+		f:        [6]float32{rx, ry, xAxisRotation, 0, x, y},
+	}, 0xc0, 16, rx, ry, xAxisRotation, 0, x, y)
+}
+
+func (p *program) RelArcTo(rx, ry, xAxisRotation float32, largeArc, sweep bool, x, y float32) {
+	cx, cy := p.pen.currX, p.pen.currY
+	p.addSegment(programOp{
+		kind:     programOpArcTo,
+		largeArc: largeArc,
+		sweep:    sweep,
+		f:        [6]float32{rx, ry, xAxisRotation, 0, cx + x, cy + y},
+	}, 0xd0, 16, rx, ry, xAxisRotation, 0, x, y)
+}
+
+// equivalent returns whether p and q decode to the same register values and
+// the same geometry.
+func (p *program) equivalent(q *program) bool {
+	if len(p.ops) != len(q.ops) {
+		return false
+	}
+	for i := range p.ops {
+		a, b := &p.ops[i], &q.ops[i]
+		if (a.kind != b.kind) || (a.adj != b.adj) || (a.incr != b.incr) ||
+			(a.largeArc != b.largeArc) || (a.sweep != b.sweep) ||
+			(foldColor(a.c) != foldColor(b.c)) {
+			return false
+		}
+		for j := range a.f {
+			if !sameBits(a.f[j], b.f[j]) {
+				return false
+			}
+		}
+	}
+	return true
+}
+
+// sameBits is like x == y except that it distinguishes positive and negative
+// zero and treats a NaN as equal to itself.
+func sameBits(x, y float32) bool {
+	return math.Float32bits(x) == math.Float32bits(y)
+}
+
+// foldColor returns the direct Color that c resolves to, if c is a blend of
+// two direct Colors. Otherwise, it returns c.
+func foldColor(c Color) Color {
+	if c.typ != colorTypeBlend {
+		return c
+	}
+	_, c0, c1 := c.blend()
+	if (decodeColor1(c0).typ != colorTypeRGBA) || (decodeColor1(c1).typ != colorTypeRGBA) {
+		return c
+	}
+	return RGBAColor(c.Resolve(nil, nil))
+}
+
+// encodedColorLength returns the number of bytes in c's shortest encoding.
+func encodedColorLength(c Color) int {
+	if _, ok := encodeColor1(c); ok {
+		return 1
+	} else if _, ok := encodeColor2(c); ok {
+		return 2
+	} else if _, ok := encodeColor3Direct(c); ok {
+		return 3
+	} else if _, ok := encodeColor3Indirect(c); ok {
+		return 3
+	}
+	return 4
+}
+
+// encode encodes p to e, choosing the smallest form for each operation.
+func (p *program) encode(e *Encoder, m Metadata) {
+	e.Reset(m)
+	pen := pen{}
+	for i := 0; i < len(p.ops); {
+		op := &p.ops[i]
+		if op.kind >= programOpLineTo {
+			j := i + 1
+			for (j < len(p.ops)) && (p.ops[j].kind >= programOpLineTo) {
+				j++
+			}
+			encodeSegments(e, &pen, p.ops[i:j])
+			i = j
+			continue
+		}
+
+		switch op.kind {
+		case programOpSetCSel:
+			e.SetCSel(op.adj)
+		case programOpSetNSel:
+			e.SetNSel(op.adj)
+		case programOpSetCReg:
+			c := op.c
+			if f := foldColor(c); encodedColorLength(f) < encodedColorLength(c) {
+				c = f
+			}
+			e.SetCReg(op.adj, op.incr, c)
+		case programOpSetNReg:
+			e.SetNReg(op.adj, op.incr, op.f[0])
+		case programOpSetLOD:
+			e.SetLOD(op.f[0], op.f[1])
+		case programOpStartPath:
+			e.StartPath(op.adj, op.f[0], op.f[1])
+		case programOpMoveTo:
+			forms := segmentForms(nil, &pen, op)
+			best := 0
+			for k := range forms {
+				if forms[k].cost < forms[best].cost {
+					best = k
+				}
+			}
+			forms[best].encode(e, op)
+		case programOpEndPath:
+			e.ClosePathEndPath()
+		}
+		pen.apply(op)
+		i++
+	}
+}
+
+// segmentForm is one way to encode a path segment. opcode is the segment's
+// drawing opcode (excluding any repetition count), maxReps is the maximum
+// repetition count for that opcode (or 1 if it has none) and cost is the
+// number of bytes for the segment's arguments (excluding the opcode).
+type segmentForm struct {
+	opcode  byte
+	maxReps int
+	cost    int
+	args    [6]float32
+}
+
+func (f *segmentForm) encode(e Destination, op *programOp) {
+	a := &f.args
+	switch f.opcode {
+	case 0xe2:
+		e.ClosePathAbsMoveTo(a[0], a[1])
+	case 0xe3:
+		e.ClosePathRelMoveTo(a[0], a[1])
+	case 0x00:
+		e.AbsLineTo(a[0], a[1])
+	case 0x20:
+		e.RelLineTo(a[0], a[1])
+	case 0x40:
+		e.AbsSmoothQuadTo(a[0], a[1])
+	case 0x50:
+		e.RelSmoothQuadTo(a[0], a[1])
+	case 0x60:
+		e.AbsQuadTo(a[0], a[1], a[2], a[3])
+	case 0x70:
+		e.RelQuadTo(a[0], a[1], a[2], a[3])
+	case 0x80:
+		e.AbsSmoothCubeTo(a[0], a[1], a[2], a[3])
+	case 0x90:
+		e.RelSmoothCubeTo(a[0], a[1], a[2], a[3])
+	case 0xa0:
+		e.AbsCubeTo(a[0], a[1], a[2], a[3], a[4], a[5])
+	case 0xb0:
+		e.RelCubeTo(a[0], a[1], a[2], a[3], a[4], a[5])
+	case 0xc0:
+		e.AbsArcTo(a[0], a[1], a[2], op.largeArc, op.sweep, a[4], a[5])
+	case 0xd0:
+		e.RelArcTo(a[0], a[1], a[2], op.largeArc, op.sweep, a[4], a[5])
+	case 0xe6:
+		e.AbsHLineTo(a[0])
+	case 0xe7:
+		e.RelHLineTo(a[0])
+	case 0xe8:
+		e.AbsVLineTo(a[0])
+	case 0xe9:
+		e.RelVLineTo(a[0])
+	}
+}
+
+// reproduces returns whether f, starting from pen, decodes to exactly op.
+func (f *segmentForm) reproduces(pen *pen, op *programOp) bool {
+	q := &program{pen: *pen}
+	f.encode(q, op)
+	return (len(q.ops) == 1) && q.equivalent(&program{ops: []programOp{*op}})
+}
+
+// segmentForms returns the ways to encode the moveTo or path segment op,
+// starting from pen, that decode to exactly the same geometry.
+//
+// op's original form, if it has one, is always a candidate. It can be the
+// only exact form, as a relative coordinate re-computed from the absolute
+// one need not be encodable even when the original relative coordinate was.
+//
+// If no form is exact, such as for a segment that GenerateLODs synthesized,
+// the result is the absolute form, rounded to encodable coordinates.
+func segmentForms(forms []segmentForm, pen *pen, op *programOp) []segmentForm {
+	add := func(opcode byte, maxReps int, args ...float32) {
+		cost, ok := coordinatesCost(args)
+		if !ok {
+			return
+		}
+		f := segmentForm{opcode: opcode, maxReps: maxReps, cost: cost}
+		copy(f.args[:], args)
+		forms = append(forms, f)
+	}
+
+	n := len(forms)
+	a := &op.f
+	switch op.kind {
+	case programOpMoveTo:
+		add(0xe2, 1, a[0], a[1])
+		if dx, dy, relOK := relativeToStart(pen, a[0], a[1]); relOK {
+			add(0xe3, 1, dx, dy)
+		}
+
+	case programOpLineTo:
+		add(0x00, 32, a[0], a[1])
+		dx, dy, relOK := relativeTo(pen, a[0], a[1])
+		if relOK {
+			add(0x20, 32, dx, dy)
+		}
+		if sameBits(a[1], pen.currY) {
+			add(0xe6, 1, a[0])
+			if relOK {
+				add(0xe7, 1, dx)
+			}
+		}
+		if sameBits(a[0], pen.currX) {
+			add(0xe8, 1, a[1])
+			if relOK {
+				add(0xe9, 1, dy)
+			}
+		}
+
+	case programOpQuadTo:
+		add(0x60, 16, a[0], a[1], a[2], a[3])
+		dx1, dy1, rel1OK := relativeTo(pen, a[0], a[1])
+		dx, dy, relOK := relativeTo(pen, a[2], a[3])
+		if rel1OK && relOK {
+			add(0x70, 16, dx1, dy1, dx, dy)
+		}
+		if sameBits(a[0], pen.reflX) && sameBits(a[1], pen.reflY) {
+			add(0x40, 16, a[2], a[3])
+			if relOK {
+				add(0x50, 16, dx, dy)
+			}
+		}
+
+	case programOpCubeTo:
+		add(0xa0, 16, a[0], a[1], a[2], a[3], a[4], a[5])
+		dx1, dy1, rel1OK := relativeTo(pen, a[0], a[1])
+		dx2, dy2, rel2OK := relativeTo(pen, a[2], a[3])
+		dx, dy, relOK := relativeTo(pen, a[4], a[5])
+		if rel1OK && rel2OK && relOK {
+			add(0xb0, 16, dx1, dy1, dx2, dy2, dx, dy)
+		}
+		if sameBits(a[0], pen.reflX) && sameBits(a[1], pen.reflY) {
+			add(0x80, 16, a[2], a[3], a[4], a[5])
+			if rel2OK && relOK {
+				add(0x90, 16, dx2, dy2, dx, dy)
+			}
+		}
+
+	case programOpArcTo:
+		// The radii, rotation and flags are the same for both forms. Only the
+		// final point can be absolute or relative.
+		radii, radiiOK := coordinatesCost(a[:2])
+		rotation := encodeExact(a[2], (*buffer).encodeZeroToOne, buffer.decodeZeroToOne)
+		if !radiiOK || !rotation.exact {
+			break
+		}
+		const flagsCost = 1
+		prefix := radii + rotation.n + flagsCost
+		if cost, ok := coordinatesCost(a[4:6]); ok {
+			forms = append(forms, segmentForm{opcode: 0xc0, maxReps: 16, cost: prefix + cost, args: *a})
+		}
+		if dx, dy, relOK := relativeTo(pen, a[4], a[5]); relOK {
+			if cost, ok := coordinatesCost([]float32{dx, dy}); ok {
+				f := segmentForm{opcode: 0xd0, maxReps: 16, cost: prefix + cost, args: *a}
+				f.args[4], f.args[5] = dx, dy
+				forms = append(forms, f)
+			}
+		}
+	}
+
+	if o := op.orig; (o.maxReps != 0) && o.reproduces(pen, op) {
+		if cost, ok := o.argsCost(); ok {
+			o.cost = cost
+			forms = append(forms, o)
+		}
+	}
+	if len(forms) == n {
+		forms = append(forms, approximateForm(op))
+	}
+	return forms
+}
+
+// argsCost returns the number of bytes to encode f's arguments, and whether
+// they can all be encoded exactly.
+func (f *segmentForm) argsCost() (cost int, ok bool) {
+	a := f.args[:]
+	switch f.opcode & 0xf0 {
+	case 0x00, 0x20, 0x40, 0x50:
+		return coordinatesCost(a[:2])
+	case 0x60, 0x70, 0x80, 0x90:
+		return coordinatesCost(a[:4])
+	case 0xa0, 0xb0:
+		return coordinatesCost(a[:6])
+	case 0xc0, 0xd0:
+		radii, radiiOK := coordinatesCost(a[:2])
+		rotation := encodeExact(a[2], (*buffer).encodeZeroToOne, buffer.decodeZeroToOne)
+		point, pointOK := coordinatesCost(a[4:6])
+		const flagsCost = 1
+		return radii + rotation.n + flagsCost + point, radiiOK && rotation.exact && pointOK
+	}
+	switch f.opcode {
+	case 0xe2, 0xe3:
+		return coordinatesCost(a[:2])
+	}
+	return coordinatesCost(a[:1])
+}
+
+// approximateForm returns op's absolute form, whose coordinates the Encoder
+// rounds to the nearest encodable values.
+func approximateForm(op *programOp) segmentForm {
+	f := segmentForm{args: op.f}
+	switch op.kind {
+	case programOpMoveTo:
+		f.opcode, f.maxReps, f.cost = 0xe2, 1, 8
+	case programOpLineTo:
+		f.opcode, f.maxReps, f.cost = 0x00, 32, 8
+	case programOpQuadTo:
+		f.opcode, f.maxReps, f.cost = 0x60, 16, 16
+	case programOpCubeTo:
+		f.opcode, f.maxReps, f.cost = 0xa0, 16, 24
+	case programOpArcTo:
+		f.opcode, f.maxReps, f.cost = 0xc0, 16, 21
+	}
+	return f
+}
+
+// relativeTo returns the point (x, y) relative to the pen's current point, and
+// whether adding them back together gives exactly (x, y).
+func relativeTo(pen *pen, x, y float32) (dx, dy float32, ok bool) {
+	dx, dy = x-pen.currX, y-pen.currY
+	return dx, dy, sameBits(pen.currX+dx, x) && sameBits(pen.currY+dy, y)
+}
+
+// relativeToStart is like relativeTo, but relative to the pen's start point,
+// as a 'z; m' op is.
+func relativeToStart(pen *pen, x, y float32) (dx, dy float32, ok bool) {
+	dx, dy = x-pen.startX, y-pen.startY
+	return dx, dy, sameBits(pen.startX+dx, x) && sameBits(pen.startY+dy, y)
+}
+
+// coordinatesCost returns the number of bytes to encode the coordinates, and
+// whether they can all be encoded exactly.
+func coordinatesCost(coords []float32) (cost int, ok bool) {
+	for _, f := range coords {
+		x := encodeExact(f, (*buffer).encodeCoordinate, buffer.decodeCoordinate)
+		if !x.exact {
+			return 0, false
+		}
+		cost += x.n
+	}
+	return cost, true
+}
+
+// segmentState is a node in encodeSegments' dynamic programming search: the
+// cheapest way to encode the path segments so far, such that the last
+// segment uses the given form and is the reps'th segment of its opcode run.
+type segmentState struct {
+	cost   int
+	reps   int
+	form   int
+	parent int
+}
+
+// encodeSegments encodes a sequence of path segments, picking one
+// segmentForm per segment so that the total encoded size, including the
+// opcodes shared by repetition counts, is minimized.
+func encodeSegments(e *Encoder, pen *pen, ops []programOp) {
+	forms := make([][]segmentForm, len(ops))
+	states := make([][]segmentState, len(ops))
+	for i := range ops {
+		forms[i] = segmentForms(nil, pen, &ops[i])
+		for k := range forms[i] {
+			f := &forms[i][k]
+			if i == 0 {
+				states[i] = append(states[i], segmentState{
+					cost:   1 + f.cost,
+					reps:   1,
+					form:   k,
+					parent: -1,
+				})
+				continue
+			}
+			for j, s := range states[i-1] {
+				next := segmentState{form: k, parent: j}
+				if (f.maxReps > 1) && (forms[i-1][s.form].opcode == f.opcode) && (s.reps < f.maxReps) {
+					next.cost, next.reps = s.cost+f.cost, s.reps+1
+				} else {
+					next.cost, next.reps = s.cost+1+f.cost, 1
+				}
+				states[i] = addSegmentState(states[i], next)
+			}
+		}
+		pen.apply(&ops[i])
+	}
+
+	// Walk back from the cheapest final state.
+	best := 0
+	last := states[len(ops)-1]
+	for j := range last {
+		if last[j].cost < last[best].cost {
+			best = j
+		}
+	}
+	chosen := make([]int, len(ops))
+	for i := len(ops) - 1; i >= 0; i-- {
+		chosen[i] = states[i][best].form
+		best = states[i][best].parent
+	}
+	for i := range ops {
+		forms[i][chosen[i]].encode(e, &ops[i])
+	}
+}
+
+// addSegmentState adds s to states, unless there is already a state with the
+// same form and reps, in which case the cheaper of the two is kept.
+func addSegmentState(states []segmentState, s segmentState) []segmentState {
+	for i := range states {
+		if (states[i].form == s.form) && (states[i].reps == s.reps) {
+			if s.cost < states[i].cost {
+				states[i] = s
+			}
+			return states
+		}
+	}
+	return append(states, s)
+}
@@ -0,0 +1,161 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package raster
+
+import (
+	"math"
+)
+
+// arcTo approximates an elliptical arc, from the current point to (x, y), by
+// one or more cubic Bézier curves. It is a port of the C implementation
+// (src/c/arc.c), which has more commentary.
+func (z *Rasterizer) arcTo(radiusX, radiusY, xAxisRotation float32, largeArc, sweep bool, x, y float32) {
+	rx := math.Abs(float64(radiusX))
+	ry := math.Abs(float64(radiusY))
+	if !(rx > 0) || !(ry > 0) {
+		z.z.LineTo(z.tx(x), z.ty(y))
+		return
+	}
+
+	x1 := float64(z.currX)
+	y1 := float64(z.currY)
+	x2 := float64(x)
+	y2 := float64(y)
+	phi := 2 * math.Pi * float64(xAxisRotation)
+
+	// Step 1: Compute (x1′, y1′)
+
+	halfDx := (x1 - x2) / 2
+	halfDy := (y1 - y2) / 2
+	cosPhi := math.Cos(phi)
+	sinPhi := math.Sin(phi)
+	x1Prime := +(cosPhi * halfDx) + (sinPhi * halfDy)
+	y1Prime := -(sinPhi * halfDx) + (cosPhi * halfDy)
+
+	// Step 2: Compute (cx′, cy′)
+
+	rxSq := rx * rx
+	rySq := ry * ry
+	x1PrimeSq := x1Prime * x1Prime
+	y1PrimeSq := y1Prime * y1Prime
+
+	radiiCheck := (x1PrimeSq / rxSq) + (y1PrimeSq / rySq)
+	if radiiCheck > 1 {
+		s := math.Sqrt(radiiCheck)
+		rx *= s
+		ry *= s
+		rxSq = rx * rx
+		rySq = ry * ry
+	}
+
+	denom := (rxSq * y1PrimeSq) + (rySq * x1PrimeSq)
+	step2 := 0.0
+	if a := ((rxSq * rySq) / denom) - 1; a > 0 {
+		step2 = math.Sqrt(a)
+	}
+	if largeArc == sweep {
+		step2 = -step2
+	}
+	cxPrime := +(step2 * rx * y1Prime) / ry
+	cyPrime := -(step2 * ry * x1Prime) / rx
+
+	// Step 3: Compute (cx, cy) from (cx′, cy′)
+
+	cx := +(cosPhi * cxPrime) - (sinPhi * cyPrime) + ((x1 + x2) / 2)
+	cy := +(sinPhi * cxPrime) + (cosPhi * cyPrime) + ((y1 + y2) / 2)
+
+	// Step 4: Compute θ1 and Δθ
+
+	ax := (+x1Prime - cxPrime) / rx
+	ay := (+y1Prime - cyPrime) / ry
+	bx := (-x1Prime - cxPrime) / rx
+	by := (-y1Prime - cyPrime) / ry
+	theta1 := angle(1, 0, ax, ay)
+	deltaTheta := angle(ax, ay, bx, by)
+	if sweep {
+		if deltaTheta < 0 {
+			deltaTheta += 2 * math.Pi
+		}
+	} else {
+		if deltaTheta > 0 {
+			deltaTheta -= 2 * math.Pi
+		}
+	}
+
+	if !isFinite(cx) || !isFinite(cy) || !isFinite(theta1) || !isFinite(deltaTheta) {
+		z.z.LineTo(z.tx(x), z.ty(y))
+		return
+	}
+
+	n := int(math.Ceil(math.Abs(deltaTheta) / ((math.Pi / 2) + 0.001)))
+	invN := 1 / float64(n)
+	for i := 0; i < n; i++ {
+		z.arcSegmentTo(cx, cy,
+			theta1+(deltaTheta*float64(i+0)*invN),
+			theta1+(deltaTheta*float64(i+1)*invN),
+			rx, ry, cosPhi, sinPhi)
+	}
+}
+
+func (z *Rasterizer) arcSegmentTo(cx, cy, theta1, theta2, rx, ry, cosPhi, sinPhi float64) {
+	halfDeltaTheta := (theta2 - theta1) * 0.5
+	q := math.Sin(halfDeltaTheta * 0.5)
+	t := (8 * q * q) / (3 * math.Sin(halfDeltaTheta))
+	cos1 := math.Cos(theta1)
+	sin1 := math.Sin(theta1)
+	cos2 := math.Cos(theta2)
+	sin2 := math.Sin(theta2)
+	ix1 := rx * (+cos1 - (t * sin1))
+	iy1 := ry * (+sin1 + (t * cos1))
+	ix2 := rx * (+cos2 + (t * sin2))
+	iy2 := ry * (+sin2 - (t * cos2))
+	ix3 := rx * (+cos2)
+	iy3 := ry * (+sin2)
+	jx1 := cx + (cosPhi * ix1) - (sinPhi * iy1)
+	jy1 := cy + (sinPhi * ix1) + (cosPhi * iy1)
+	jx2 := cx + (cosPhi * ix2) - (sinPhi * iy2)
+	jy2 := cy + (sinPhi * ix2) + (cosPhi * iy2)
+	jx3 := cx + (cosPhi * ix3) - (sinPhi * iy3)
+	jy3 := cy + (sinPhi * ix3) + (cosPhi * iy3)
+	z.z.CubeTo(
+		z.tx(float32(jx1)), z.ty(float32(jy1)),
+		z.tx(float32(jx2)), z.ty(float32(jy2)),
+		z.tx(float32(jx3)), z.ty(float32(jy3)),
+	)
+}
+
+// angle returns the angle between two vectors u and v.
+func angle(ux, uy, vx, vy float64) float64 {
+	uNorm := math.Sqrt((ux * ux) + (uy * uy))
+	vNorm := math.Sqrt((vx * vx) + (vy * vy))
+	norm := uNorm * vNorm
+	cos := (ux*vx + uy*vy) / norm
+	ret := 0.0
+	if cos <= -1 {
+		ret = math.Pi
+	} else if cos >= +1 {
+		ret = 0
+	} else {
+		ret = math.Acos(cos)
+	}
+	if ux*vy < uy*vx {
+		return -ret
+	}
+	return +ret
+}
+
+func isFinite(f float64) bool {
+	return !math.IsInf(f, 0) && !math.IsNaN(f)
+}
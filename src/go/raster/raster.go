@@ -0,0 +1,392 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Package raster provides a pure Go renderer for the IconVG file format, built
+// on the golang.org/x/image/vector rasterizer.
+//
+// IconVG is specified at
+// https://github.com/google/iconvg/blob/main/spec/iconvg-spec.md
+package raster
+
+import (
+	"errors"
+	"image"
+	"image/color"
+	"image/draw"
+	"sync"
+
+	"github.com/google/iconvg/src/go/lowlevel"
+	"golang.org/x/image/vector"
+)
+
+var (
+	errInvalidPaintType = errors.New("iconvg: invalid paint type")
+	errNilDstImage      = errors.New("iconvg: nil dst image")
+)
+
+// Render decodes the src IconVG graphic and paints it onto the r rectangle of
+// dst, composited (with the Porter-Duff "over" operator) onto what is already
+// there.
+//
+// It is safe to call concurrently. Each call borrows a Rasterizer (and its
+// buffers) from a sync.Pool, so that, once warmed up, rendering allocates
+// little or no memory.
+//
+// opts may be nil, which means to use the default options.
+func Render(dst *image.RGBA, r image.Rectangle, src []byte, opts *lowlevel.DecodeOptions) error {
+	if dst == nil {
+		return errNilDstImage
+	}
+	p := pool.Get().(*pooled)
+	defer pool.Put(p)
+
+	p.z.SetDstImage(dst, r)
+	if err := p.d.Decode(&p.z, src, opts); err != nil {
+		return err
+	}
+	return p.z.Err()
+}
+
+// pooled is what is held in the pool: a Rasterizer and a Decoder, each of
+// which re-uses its buffers from one Render call to the next.
+type pooled struct {
+	z Rasterizer
+	d lowlevel.Decoder
+}
+
+var pool = sync.Pool{
+	New: func() interface{} { return &pooled{} },
+}
+
+// Rasterizer is a lowlevel.Destination that paints an IconVG graphic onto an
+// *image.RGBA. It also implements lowlevel.BatchDestination.
+//
+// Its zero value is usable, but paints nothing until SetDstImage is called. A
+// Rasterizer is not safe for concurrent use, but it can be re-used for
+// successive graphics.
+type Rasterizer struct {
+	z     vector.Rasterizer
+	mask  image.Alpha16
+	paint image.Uniform
+
+	dst *image.RGBA
+	r   image.Rectangle
+	err error
+
+	// scale and bias transform the metadata.ViewBox rectangle to the (0, 0) -
+	// (r.Dx(), r.Dy()) rectangle.
+	scaleX float32
+	biasX  float32
+	scaleY float32
+	biasY  float32
+
+	metadata lowlevel.Metadata
+
+	lod0 float32
+	lod1 float32
+	cSel uint8
+	nSel uint8
+
+	// disabled is whether the current path is not drawn, as it is outside of
+	// the Level of Detail range.
+	disabled bool
+
+	// pathCReg is the CREG value of the current path, which is either a flat
+	// color or a gradient.
+	pathCReg color.RGBA
+
+	// currX and currY are the current point, in ViewBox coordinates. reflX
+	// and reflY are the implicit first control point of a subsequent smooth
+	// quadTo or cubeTo, in vector.Rasterizer coordinates. Like the pen, the
+	// reflection is tracked in the latter coordinates, so that relative ops
+	// and smooth ops accumulate the same float32 rounding as the reference
+	// renderings in test/data.
+	currX float32
+	currY float32
+	reflX float32
+	reflY float32
+
+	cReg [64]color.RGBA
+	nReg [64]float32
+
+	gradient gradient
+}
+
+// SetDstImage sets the Rasterizer to paint onto the r rectangle of dst. The
+// rectangle's height (in pixels) selects which Level of Detail ranges are
+// drawn.
+func (z *Rasterizer) SetDstImage(dst *image.RGBA, r image.Rectangle) {
+	z.dst = dst
+	z.r = r
+	z.recalcTransform()
+}
+
+// Err returns the first error (such as an invalid paint type) encountered
+// since the last Reset, or nil if there were none.
+func (z *Rasterizer) Err() error {
+	return z.err
+}
+
+func (z *Rasterizer) recalcTransform() {
+	z.scaleX, z.biasX, z.scaleY, z.biasY = 1, 0, 1, 0
+	rw, rh := float32(z.r.Dx()), float32(z.r.Dy())
+	vw, vh := z.metadata.ViewBox.AspectRatio()
+	if (rw > 0) && (rh > 0) && (vw > 0) && (vh > 0) {
+		z.scaleX = rw / vw
+		z.scaleY = rh / vh
+		z.biasX = -z.metadata.ViewBox.Min[0] * z.scaleX
+		z.biasY = -z.metadata.ViewBox.Min[1] * z.scaleY
+	}
+}
+
+func (z *Rasterizer) Reset(m lowlevel.Metadata) {
+	z.err = nil
+	z.metadata = m
+	z.lod0 = 0
+	z.lod1 = positiveInfinity
+	z.cSel = 0
+	z.nSel = 0
+	z.disabled = false
+	z.currX, z.currY, z.reflX, z.reflY = 0, 0, 0, 0
+	z.cReg = m.Palette
+	z.nReg = [64]float32{}
+	z.recalcTransform()
+}
+
+func (z *Rasterizer) SetCSel(cSel uint8) { z.cSel = cSel & 0x3f }
+func (z *Rasterizer) SetNSel(nSel uint8) { z.nSel = nSel & 0x3f }
+
+func (z *Rasterizer) SetCReg(adj uint8, incr bool, c lowlevel.Color) {
+	z.cReg[(z.cSel-adj)&0x3f] = c.Resolve(&z.metadata.Palette, &z.cReg)
+	if incr {
+		z.cSel++
+	}
+}
+
+func (z *Rasterizer) SetNReg(adj uint8, incr bool, f float32) {
+	z.nReg[(z.nSel-adj)&0x3f] = f
+	if incr {
+		z.nSel++
+	}
+}
+
+func (z *Rasterizer) SetLOD(lod0, lod1 float32) {
+	z.lod0, z.lod1 = lod0, lod1
+}
+
+func (z *Rasterizer) StartPath(adj uint8, x, y float32) {
+	z.pathCReg = z.cReg[(z.cSel-adj)&0x3f]
+	if paintType(z.pathCReg) == paintTypeInvalid {
+		if z.err == nil {
+			z.err = errInvalidPaintType
+		}
+		z.disabled = true
+		return
+	}
+
+	h := float32(z.r.Dy())
+	z.disabled = (z.dst == nil) || !(z.lod0 <= h && h < z.lod1)
+	if z.disabled {
+		return
+	}
+
+	z.z.Reset(z.r.Dx(), z.r.Dy())
+	z.moveTo(z.tx(x), z.ty(y))
+}
+
+func (z *Rasterizer) ClosePathEndPath() {
+	if z.disabled {
+		return
+	}
+	z.z.ClosePath()
+	z.drawPath()
+}
+
+func (z *Rasterizer) ClosePathAbsMoveTo(x, y float32) {
+	if z.disabled {
+		return
+	}
+	z.z.ClosePath()
+	z.moveTo(z.tx(x), z.ty(y))
+}
+
+func (z *Rasterizer) ClosePathRelMoveTo(x, y float32) {
+	if z.disabled {
+		return
+	}
+	z.z.ClosePath()
+	// As in SVG, closing the path moves the pen back to the path's start.
+	px, py := z.z.Pen()
+	z.moveTo(px+z.rx(x), py+z.ry(y))
+}
+
+// moveTo, lineTo, quadTo and cubeTo take vector.Rasterizer coordinates.
+func (z *Rasterizer) moveTo(px, py float32) {
+	z.z.MoveTo(px, py)
+	z.currX, z.currY = z.untx(px), z.unty(py)
+	z.reflX, z.reflY = px, py
+}
+
+func (z *Rasterizer) lineTo(px, py float32) {
+	if z.disabled {
+		return
+	}
+	z.z.LineTo(px, py)
+	z.currX, z.currY = z.untx(px), z.unty(py)
+	z.reflX, z.reflY = px, py
+}
+
+func (z *Rasterizer) quadTo(px1, py1, px, py float32) {
+	if z.disabled {
+		return
+	}
+	z.z.QuadTo(px1, py1, px, py)
+	z.currX, z.currY = z.untx(px), z.unty(py)
+	z.reflX, z.reflY = (2*px)-px1, (2*py)-py1
+}
+
+func (z *Rasterizer) cubeTo(px1, py1, px2, py2, px, py float32) {
+	if z.disabled {
+		return
+	}
+	z.z.CubeTo(px1, py1, px2, py2, px, py)
+	z.currX, z.currY = z.untx(px), z.unty(py)
+	z.reflX, z.reflY = (2*px)-px2, (2*py)-py2
+}
+
+func (z *Rasterizer) AbsHLineTo(x float32) {
+	_, py := z.z.Pen()
+	z.lineTo(z.tx(x), py)
+}
+
+func (z *Rasterizer) RelHLineTo(x float32) {
+	px, py := z.z.Pen()
+	z.lineTo(px+z.rx(x), py)
+}
+
+func (z *Rasterizer) AbsVLineTo(y float32) {
+	px, _ := z.z.Pen()
+	z.lineTo(px, z.ty(y))
+}
+
+func (z *Rasterizer) RelVLineTo(y float32) {
+	px, py := z.z.Pen()
+	z.lineTo(px, py+z.ry(y))
+}
+
+func (z *Rasterizer) AbsLineTo(x, y float32) { z.lineTo(z.tx(x), z.ty(y)) }
+
+func (z *Rasterizer) RelLineTo(x, y float32) {
+	px, py := z.z.Pen()
+	z.lineTo(px+z.rx(x), py+z.ry(y))
+}
+
+func (z *Rasterizer) AbsSmoothQuadTo(x, y float32) {
+	z.quadTo(z.reflX, z.reflY, z.tx(x), z.ty(y))
+}
+
+func (z *Rasterizer) RelSmoothQuadTo(x, y float32) {
+	px, py := z.z.Pen()
+	z.quadTo(z.reflX, z.reflY, px+z.rx(x), py+z.ry(y))
+}
+
+func (z *Rasterizer) AbsQuadTo(x1, y1, x, y float32) {
+	z.quadTo(z.tx(x1), z.ty(y1), z.tx(x), z.ty(y))
+}
+
+func (z *Rasterizer) RelQuadTo(x1, y1, x, y float32) {
+	px, py := z.z.Pen()
+	z.quadTo(px+z.rx(x1), py+z.ry(y1), px+z.rx(x), py+z.ry(y))
+}
+
+func (z *Rasterizer) AbsSmoothCubeTo(x2, y2, x, y float32) {
+	z.cubeTo(z.reflX, z.reflY, z.tx(x2), z.ty(y2), z.tx(x), z.ty(y))
+}
+
+func (z *Rasterizer) RelSmoothCubeTo(x2, y2, x, y float32) {
+	px, py := z.z.Pen()
+	z.cubeTo(z.reflX, z.reflY, px+z.rx(x2), py+z.ry(y2), px+z.rx(x), py+z.ry(y))
+}
+
+func (z *Rasterizer) AbsCubeTo(x1, y1, x2, y2, x, y float32) {
+	z.cubeTo(z.tx(x1), z.ty(y1), z.tx(x2), z.ty(y2), z.tx(x), z.ty(y))
+}
+
+func (z *Rasterizer) RelCubeTo(x1, y1, x2, y2, x, y float32) {
+	px, py := z.z.Pen()
+	z.cubeTo(px+z.rx(x1), py+z.ry(y1), px+z.rx(x2), py+z.ry(y2), px+z.rx(x), py+z.ry(y))
+}
+
+func (z *Rasterizer) AbsArcTo(rx, ry, xAxisRotation float32, largeArc, sweep bool, x, y float32) {
+	if z.disabled {
+		return
+	}
+	z.arcTo(rx, ry, xAxisRotation, largeArc, sweep, x, y)
+	px, py := z.z.Pen()
+	z.currX, z.currY = z.untx(px), z.unty(py)
+	z.reflX, z.reflY = px, py
+}
+
+func (z *Rasterizer) RelArcTo(rx, ry, xAxisRotation float32, largeArc, sweep bool, x, y float32) {
+	z.AbsArcTo(rx, ry, xAxisRotation, largeArc, sweep, z.currX+x, z.currY+y)
+}
+
+// Path implements lowlevel.BatchDestination. Paths outside of the Level of
+// Detail range are skipped without visiting their ops.
+func (z *Rasterizer) Path(adj uint8, x, y float32, ops []lowlevel.PathOp) {
+	z.StartPath(adj, x, y)
+	if z.disabled {
+		return
+	}
+	for i := range ops {
+		ops[i].Apply(z)
+	}
+	z.ClosePathEndPath()
+}
+
+// tx and ty transform from ViewBox coordinates to vector.Rasterizer
+// coordinates. untx and unty are their inverses. rx and ry transform relative
+// (not absolute) coordinates.
+func (z *Rasterizer) tx(x float32) float32   { return (x * z.scaleX) + z.biasX }
+func (z *Rasterizer) ty(y float32) float32   { return (y * z.scaleY) + z.biasY }
+func (z *Rasterizer) untx(x float32) float32 { return (x - z.biasX) / z.scaleX }
+func (z *Rasterizer) unty(y float32) float32 { return (y - z.biasY) / z.scaleY }
+func (z *Rasterizer) rx(x float32) float32   { return x * z.scaleX }
+func (z *Rasterizer) ry(y float32) float32   { return y * z.scaleY }
+
+func (z *Rasterizer) drawPath() {
+	switch paintType(z.pathCReg) {
+	case paintTypeFlatColor:
+		z.paint.C = z.pathCReg
+		z.z.DrawOp = draw.Over
+		z.z.Draw(z.dst, z.r, &z.paint, image.Point{})
+
+	case paintTypeLinearGradient, paintTypeRadialGradient:
+		// Rasterize the path to a 16-bit alpha mask, then composite the
+		// gradient through that mask.
+		b := z.z.Bounds()
+		if n := 2 * b.Dx() * b.Dy(); cap(z.mask.Pix) < n {
+			z.mask.Pix = make([]uint8, n)
+		} else {
+			z.mask.Pix = z.mask.Pix[:n]
+		}
+		z.mask.Stride = 2 * b.Dx()
+		z.mask.Rect = b
+		z.paint.C = color.Opaque
+		z.z.DrawOp = draw.Src
+		z.z.Draw(&z.mask, b, &z.paint, image.Point{})
+		z.gradient.init(z)
+		z.gradient.composite(z.dst, z.r, &z.mask)
+	}
+}
@@ -0,0 +1,125 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package raster
+
+import (
+	"bytes"
+	"image"
+	"image/color"
+	"image/png"
+	"os"
+	"path/filepath"
+	"testing"
+
+	"github.com/google/iconvg/src/go/lowlevel"
+)
+
+// pinkPalette is the custom palette that favicon.pink.png was rendered with.
+var pinkPalette = func() *lowlevel.Palette {
+	p := lowlevel.DefaultPalette
+	p[0] = color.RGBA{0xfe, 0x76, 0xea, 0xff}
+	return &p
+}()
+
+// goldenTestCases lists the test/data/*.png renderings. Each renders
+// filename+".ivg" onto a transparent image the size of the
+// filename+variant+".png" golden.
+var goldenTestCases = []struct {
+	filename string
+	variant  string
+	opts     *lowlevel.DecodeOptions
+}{
+	{"action-info.hires", "", nil},
+	{"action-info.lores", "", nil},
+	{"arcs", "", nil},
+	{"blank", "", nil},
+	{"cowbell", "", nil},
+	{"elliptical", "", nil},
+	{"favicon", "", nil},
+	{"favicon", ".pink", &lowlevel.DecodeOptions{Palette: pinkPalette}},
+	{"gradient", "", nil},
+	{"lod-polygon", "", nil},
+	{"lod-polygon", ".64", nil},
+	{"video-005.primitive", "", nil},
+}
+
+func decodePNG(filename string) (image.Image, error) {
+	f, err := os.Open(filename)
+	if err != nil {
+		return nil, err
+	}
+	defer f.Close()
+	return png.Decode(f)
+}
+
+// roundTripPNG encodes and then decodes m. PNG holds non-premultiplied colors,
+// and the conversion from premultiplied colors is lossy, so a rendering has to
+// go through the same conversion as the goldens did to be compared exactly.
+func roundTripPNG(m image.Image) (image.Image, error) {
+	buf := &bytes.Buffer{}
+	if err := png.Encode(buf, m); err != nil {
+		return nil, err
+	}
+	return png.Decode(buf)
+}
+
+func nrgbaAt(m image.Image, x int, y int) color.NRGBA {
+	return color.NRGBAModel.Convert(m.At(x, y)).(color.NRGBA)
+}
+
+func TestRenderMatchesGoldens(t *testing.T) {
+	for _, tc := range goldenTestCases {
+		prefix := filepath.FromSlash("../../../test/data/" + tc.filename)
+		src, err := os.ReadFile(prefix + ".ivg")
+		if err != nil {
+			t.Errorf("%s: ReadFile: %v", tc.filename, err)
+			continue
+		}
+		want, err := decodePNG(prefix + tc.variant + ".png")
+		if err != nil {
+			t.Errorf("%s%s: decodePNG: %v", tc.filename, tc.variant, err)
+			continue
+		}
+
+		dst := image.NewRGBA(want.Bounds())
+		if err := Render(dst, dst.Bounds(), src, tc.opts); err != nil {
+			t.Errorf("%s%s: Render: %v", tc.filename, tc.variant, err)
+			continue
+		}
+		got, err := roundTripPNG(dst)
+		if err != nil {
+			t.Errorf("%s%s: roundTripPNG: %v", tc.filename, tc.variant, err)
+			continue
+		}
+
+		numMismatched, first := 0, image.Point{}
+		b := want.Bounds()
+		for y := b.Min.Y; y < b.Max.Y; y++ {
+			for x := b.Min.X; x < b.Max.X; x++ {
+				if nrgbaAt(got, x, y) != nrgbaAt(want, x, y) {
+					if numMismatched == 0 {
+						first = image.Point{x, y}
+					}
+					numMismatched++
+				}
+			}
+		}
+		if numMismatched > 0 {
+			t.Errorf("%s%s: %d mismatched pixels, the first at %v: got %v, want %v",
+				tc.filename, tc.variant, numMismatched, first,
+				nrgbaAt(got, first.X, first.Y), nrgbaAt(want, first.X, first.Y))
+		}
+	}
+}
@@ -0,0 +1,251 @@
+// Copyright 2021 The IconVG Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// ----------------
+
+// iconvg_test holds unit tests for the C implementation. Run it from the
+// IconVG root directory:
+//
+// gcc -Wall -std=c99 test/c/iconvg_test.c -lm && ./a.out
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ICONVG_IMPLEMENTATION
+#include "../../release/c/iconvg-unsupported-snapshot.c"
+
+// ----
+
+// palette_canvas is an iconvg_canvas that records the suggested palette
+// (which is the default palette if the graphic has none) and ignores
+// everything else.
+
+static const char*  //
+palette_canvas__begin_decode(iconvg_canvas* c, iconvg_rectangle_f32 dst_rect) {
+  return NULL;
+}
+
+static const char*  //
+palette_canvas__end_decode(iconvg_canvas* c,
+                           const char* err_msg,
+                           size_t num_bytes_consumed,
+                           size_t num_bytes_remaining) {
+  return err_msg;
+}
+
+static const char*  //
+palette_canvas__begin_drawing(iconvg_canvas* c) {
+  return NULL;
+}
+
+static const char*  //
+palette_canvas__end_drawing(iconvg_canvas* c, const iconvg_paint* p) {
+  return NULL;
+}
+
+static const char*  //
+palette_canvas__begin_path(iconvg_canvas* c, float x0, float y0) {
+  return NULL;
+}
+
+static const char*  //
+palette_canvas__end_path(iconvg_canvas* c) {
+  return NULL;
+}
+
+static const char*  //
+palette_canvas__path_line_to(iconvg_canvas* c, float x1, float y1) {
+  return NULL;
+}
+
+static const char*  //
+palette_canvas__path_quad_to(iconvg_canvas* c,
+                             float x1,
+                             float y1,
+                             float x2,
+                             float y2) {
+  return NULL;
+}
+
+static const char*  //
+palette_canvas__path_cube_to(iconvg_canvas* c,
+                             float x1,
+                             float y1,
+                             float x2,
+                             float y2,
+                             float x3,
+                             float y3) {
+  return NULL;
+}
+
+static const char*  //
+palette_canvas__on_metadata_viewbox(iconvg_canvas* c,
+                                    iconvg_rectangle_f32 viewbox) {
+  return NULL;
+}
+
+static const char*  //
+palette_canvas__on_metadata_suggested_palette(
+    iconvg_canvas* c,
+    const iconvg_palette* suggested_palette) {
+  *((iconvg_palette*)(c->context_nonconst_ptr0)) = *suggested_palette;
+  return NULL;
+}
+
+static const iconvg_canvas_vtable palette_canvas_vtable = {
+    sizeof(iconvg_canvas_vtable),
+    &palette_canvas__begin_decode,
+    &palette_canvas__end_decode,
+    &palette_canvas__begin_drawing,
+    &palette_canvas__end_drawing,
+    &palette_canvas__begin_path,
+    &palette_canvas__end_path,
+    &palette_canvas__path_line_to,
+    &palette_canvas__path_quad_to,
+    &palette_canvas__path_cube_to,
+    &palette_canvas__on_metadata_viewbox,
+    &palette_canvas__on_metadata_suggested_palette,
+    NULL,
+};
+
+// ----
+
+static iconvg_premul_color  //
+make_color(uint32_t rgba) {
+  iconvg_premul_color c;
+  c.rgba[0] = (uint8_t)(rgba >> 24);
+  c.rgba[1] = (uint8_t)(rgba >> 16);
+  c.rgba[2] = (uint8_t)(rgba >> 8);
+  c.rgba[3] = (uint8_t)(rgba >> 0);
+  return c;
+}
+
+// round_trip_palette encodes a graphic whose suggested palette starts with
+// colors[0 .. num_colors] (and is opaque black after that), decodes it and
+// checks that the decoded palette is the same.
+static const char*  //
+round_trip_palette(const uint32_t* colors, size_t num_colors) {
+  iconvg_palette want;
+  for (size_t i = 0; i < 64; i++) {
+    want.colors[i] = make_color((i < num_colors) ? colors[i] : 0x000000FF);
+  }
+
+  uint8_t buf[512];
+  iconvg_growable_buffer dst = iconvg_make_growable_buffer(buf, sizeof buf);
+  iconvg_encoder e;
+  ICONVG_PRIVATE_TRY(iconvg_encoder__initialize(&e, &dst, NULL, &want));
+  ICONVG_PRIVATE_TRY(iconvg_encoder__finish(&e));
+
+  iconvg_palette got;
+  memset(&got, 0, sizeof got);
+  iconvg_canvas c = {0};
+  c.vtable = &palette_canvas_vtable;
+  c.context_nonconst_ptr0 = &got;
+  ICONVG_PRIVATE_TRY(iconvg_decode(
+      &c, iconvg_make_rectangle_f32(0, 0, 64, 64), dst.ptr, dst.len, NULL));
+
+  for (size_t i = 0; i < 64; i++) {
+    if (memcmp(&got.colors[i], &want.colors[i], 4)) {
+      fprintf(stderr, "color %zu: got 0x%02X%02X%02X%02X, want 0x%08X\n", i,
+              got.colors[i].rgba[0], got.colors[i].rgba[1],
+              got.colors[i].rgba[2], got.colors[i].rgba[3],
+              (i < num_colors) ? colors[i] : 0x000000FFu);
+      return "round_trip_palette: colors differ";
+    }
+  }
+  return NULL;
+}
+
+static const char*  //
+test_encoder_suggested_palette(void) {
+  // Opaque 0x40 gray is a 1-byte color but not 2-byte exact, so a palette
+  // that also holds a 2-byte color needs 3 bytes per color.
+  static const uint32_t opaque_1_and_2[] = {
+      0x404040FF,
+      0x112233FF,
+      0x80C000FF,
+  };
+  ICONVG_PRIVATE_TRY(round_trip_palette(
+      opaque_1_and_2, sizeof(opaque_1_and_2) / sizeof(opaque_1_and_2[0])));
+
+  // Translucent 0x80 gray is a 1-byte color, so a palette that also holds a
+  // 3-byte color needs 4 bytes per color.
+  static const uint32_t translucent_1_and_3[] = {
+      0x80808080,
+      0x123456FF,
+  };
+  ICONVG_PRIVATE_TRY(round_trip_palette(
+      translucent_1_and_3,
+      sizeof(translucent_1_and_3) / sizeof(translucent_1_and_3[0])));
+
+  // All 2-byte exact, including translucent and 1-byte colors.
+  static const uint32_t nibble_exact[] = {
+      0x00000000,
+      0x11223344,
+      0xFFFFFFFF,
+      0x000000FF,
+      0x0000CCCC,
+  };
+  ICONVG_PRIVATE_TRY(round_trip_palette(
+      nibble_exact, sizeof(nibble_exact) / sizeof(nibble_exact[0])));
+
+  // A mixture of all of the above.
+  static const uint32_t mixed[] = {
+      0x404040FF, 0x80808080, 0x11223344, 0x123456FF,
+      0x01020304, 0x00000000, 0xC0C0C0C0, 0xFF0000FF,
+  };
+  ICONVG_PRIVATE_TRY(
+      round_trip_palette(mixed, sizeof(mixed) / sizeof(mixed[0])));
+
+  // Only 1-byte colors.
+  static const uint32_t one_byte[] = {
+      0x404040FF,
+      0xC0C0C0C0,
+      0xFF8000FF,
+  };
+  return round_trip_palette(one_byte, sizeof(one_byte) / sizeof(one_byte[0]));
+}
+
+// ----
+
+typedef const char* (*test_func)(void);
+
+static const struct {
+  const char* name;
+  test_func func;
+} g_tests[] = {
+    {"test_encoder_suggested_palette", &test_encoder_suggested_palette},
+};
+
+int  //
+main(int argc, char** argv) {
+  int num_failed = 0;
+  size_t num_tests = sizeof(g_tests) / sizeof(g_tests[0]);
+  for (size_t i = 0; i < num_tests; i++) {
+    const char* err_msg = (*g_tests[i].func)();
+    if (err_msg) {
+      fprintf(stderr, "FAIL %s: %s\n", g_tests[i].name, err_msg);
+      num_failed++;
+    }
+  }
+  if (num_failed) {
+    fprintf(stderr, "FAIL: %d of %zu tests failed\n", num_failed, num_tests);
+    return 1;
+  }
+  printf("PASS: %zu tests passed\n", num_tests);
+  return 0;
+}